@@ -0,0 +1,94 @@
+/**
+ * @file bench.h
+ * @brief Common helpers for the benchmark suites
+ *
+ * Every result is printed as one JSON object per line, prefixed with
+ * BENCH_JSON_PREFIX so it can be grepped out of a serial log:
+ *
+ *   BENCH {"suite":"decode","case":"batch_soa","target":"esp32s3",...}
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BENCH_JSON_PREFIX "BENCH "
+
+/** Minimum wall time per measured case */
+#define BENCH_MIN_TIME_US   500000
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} bench_suite_t;
+
+/**
+ * @brief Microseconds since boot
+ */
+int64_t bench_now_us(void);
+
+/**
+ * @brief Print one result line
+ *
+ * @param suite Suite name
+ * @param name Case name
+ * @param fields_fmt printf format of the remaining JSON members, without
+ *                   leading comma or braces, e.g. "\"records_per_s\":%.0f"
+ */
+void bench_report(const char *suite, const char *name, const char *fields_fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Small deterministic PRNG so runs are comparable
+ */
+uint32_t bench_rand(uint32_t *state);
+
+/**
+ * @brief Sort samples ascending, for bench_percentile()
+ */
+void bench_sort_u32(uint32_t *samples, size_t count);
+
+/**
+ * @brief Nearest-rank percentile of sorted samples
+ *
+ * @param pct 50 for the median, 100 for the largest
+ * @return The sample, 0 without samples
+ */
+uint32_t bench_percentile(const uint32_t *sorted, size_t count, unsigned pct);
+
+/**
+ * @brief Mount battery_fs on the spiflash backend
+ *
+ * @param image Image file on linux, recreated erased on every call; the
+ *              chip on hardware keeps its contents
+ * @param realtime On linux, let flash operations take their modeled time
+ */
+esp_err_t bench_mount_storage(const char *image, bool realtime);
+
+/**
+ * @brief bench_mount_storage() with a flash page cache of `cache_pages`
+ */
+esp_err_t bench_mount_storage_cached(const char *image, bool realtime, uint32_t cache_pages);
+
+// Suites
+void bench_decode_run(void);
+void bench_ingest_run(void);
+void bench_spiflash_run(void);
+void bench_evtrace_run(void);
+void bench_export_run(void);
+void bench_fault_run(void);
+void bench_poll_run(void);
+void bench_flags_run(void);
+void bench_tlm_run(void);
+void bench_cdc_run(void);
+
+#ifdef __cplusplus
+}
+#endif
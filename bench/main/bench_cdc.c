@@ -0,0 +1,268 @@
+/**
+ * @file bench_cdc.c
+ * @brief Append latency of battery_fs with change subscribers
+ *
+ * A few batteries are appended to in rounds, one append per poll period,
+ * the way acquisition stores downloads. Cases:
+ *  - append_alone:    no subscriber, the baseline
+ *  - subscribers:     a callback and a queue drained by its own task
+ *  - slow_subscriber: the same plus a callback sleeping on every change,
+ *                     far slower than the commits
+ *
+ * Reported per case: append latency p50/p99/max, then per subscriber the
+ * changes delivered and dropped, the largest lag in records, and changes
+ * received out of commit order (a sequence number below the one before).
+ * The callbacks read their own stats on every change, which must neither
+ * deadlock the dispatcher nor fail (callback_errors).
+ * The writer must not slow down with the slow subscriber; its changes
+ * are dropped instead.
+ *
+ * The filesystem is wiped first. On hardware this erases the battery logs
+ * on the chip, run it on a bench unit only.
+ */
+
+#include "bench.h"
+#include "batmon_fixtures.h"
+#include "battery_fs.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_CDC";
+
+#define CDC_IMAGE               "bench_cdc.img"
+#define CDC_BATTERIES           4
+#define CDC_APPEND_RECORDS      4       // New records per append
+#define CDC_ROUNDS              48      // Appends per battery and case
+#define CDC_QUEUE_LENGTH        8
+#define CDC_SLOW_MS             20      // Slow subscriber time per change
+#define CDC_DRAIN_TIMEOUT_MS    5000
+#define CDC_TASK_STACK          3072
+
+// Every case stores batteries of its own, below the 256-record ring
+_Static_assert(CDC_ROUNDS * CDC_APPEND_RECORDS <= 256, "appends would wrap the memory ring");
+
+typedef enum {
+    SUB_CALLBACK,
+    SUB_QUEUE,
+    SUB_SLOW,
+    SUB_KINDS
+} sub_kind_t;
+
+static const char *const s_sub_names[SUB_KINDS] = { "callback", "queue", "slow" };
+
+typedef struct {
+    const char *name;
+    bool subscribe[SUB_KINDS];
+} cdc_case_t;
+
+static const cdc_case_t s_cases[] = {
+    { "append_alone", { false, false, false } },
+    { "subscribers", { true, true, false } },
+    { "slow_subscriber", { true, true, true } },
+};
+
+typedef struct {
+    battery_fs_subscriber_t *handle;
+    uint32_t received;
+    uint32_t last_seq;
+    uint32_t out_of_order;
+    uint32_t callback_errors;       // battery_fs calls from its callback that failed
+} sub_t;
+
+typedef struct {
+    QueueHandle_t queue;
+    sub_t *sub;
+    volatile bool run;
+    volatile bool done;
+} drain_t;
+
+static BatmonMemory s_records[CDC_APPEND_RECORDS];
+static battery_log_t s_logs[CDC_APPEND_RECORDS];
+
+// ============================================================================
+// Subscribers
+// ============================================================================
+
+static void sub_receive(sub_t *sub, const battery_fs_change_t *change) {
+    sub->out_of_order += change->first_seq <= sub->last_seq;
+    sub->last_seq = change->first_seq + change->count - 1;
+    sub->received++;
+}
+
+static void sub_callback(sub_t *sub, const battery_fs_change_t *change) {
+    sub_receive(sub, change);
+    battery_fs_subscriber_stats_t st;
+    sub->callback_errors += sub->handle != NULL && battery_fs_subscriber_stats(sub->handle, &st) != ESP_OK;
+}
+
+static void on_change(const battery_fs_change_t *change, void *arg) {
+    sub_callback(arg, change);
+}
+
+static void on_change_slow(const battery_fs_change_t *change, void *arg) {
+    sub_callback(arg, change);
+    vTaskDelay(pdMS_TO_TICKS(CDC_SLOW_MS));
+}
+
+static void drain_task(void *arg) {
+    drain_t *d = arg;
+    battery_fs_change_t change;
+    while (d->run) {
+        if (xQueueReceive(d->queue, &change, 1) == pdTRUE) {
+            sub_receive(d->sub, &change);
+        }
+    }
+    d->done = true;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Wait until every change committed was handed over or dropped
+ */
+static void wait_drained(sub_t *subs, const cdc_case_t *c) {
+    int64_t start = bench_now_us();
+    for (int k = 0; k < SUB_KINDS; k++) {
+        battery_fs_subscriber_stats_t st;
+        while (c->subscribe[k] && battery_fs_subscriber_stats(subs[k].handle, &st) == ESP_OK && st.lag != 0 &&
+               bench_now_us() - start < CDC_DRAIN_TIMEOUT_MS * 1000LL) {
+            vTaskDelay(1);
+        }
+    }
+    // The queue subscriber's task may still hold the last few
+    vTaskDelay(pdMS_TO_TICKS(50));
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+static esp_err_t append(const char *serial, batmon_synth_t *synth, uint32_t first_index) {
+    batmon_synth_fill(synth, s_records, CDC_APPEND_RECORDS);
+    for (size_t i = 0; i < CDC_APPEND_RECORDS; i++) {
+        s_logs[i] = (battery_log_t){
+            .memory_index = first_index + i,
+            .data = (uint8_t *)&s_records[i],
+            .data_len = sizeof(BatmonMemory),
+        };
+    }
+    return battery_fs_write_data(serial, s_logs, CDC_APPEND_RECORDS);
+}
+
+static void report_case(const cdc_case_t *c, uint32_t *latency_us, size_t appends, uint32_t errors,
+                        sub_t *subs) {
+    bench_sort_u32(latency_us, appends);
+    bench_report("cdc", c->name,
+                 "\"appends\":%u,\"append_errors\":%lu,\"append_p50_us\":%lu,\"append_p99_us\":%lu,"
+                 "\"append_max_us\":%lu",
+                 (unsigned)appends, (unsigned long)errors,
+                 (unsigned long)bench_percentile(latency_us, appends, 50),
+                 (unsigned long)bench_percentile(latency_us, appends, 99),
+                 (unsigned long)bench_percentile(latency_us, appends, 100));
+
+    for (int k = 0; k < SUB_KINDS; k++) {
+        battery_fs_subscriber_stats_t st;
+        if (!c->subscribe[k] || battery_fs_subscriber_stats(subs[k].handle, &st) != ESP_OK) {
+            continue;
+        }
+        char name[48];
+        snprintf(name, sizeof(name), "%s/%s", c->name, s_sub_names[k]);
+        bench_report("cdc", name,
+                     "\"commits\":%u,\"delivered\":%lu,\"received\":%lu,\"dropped\":%lu,\"max_lag\":%lu,"
+                     "\"lag\":%lu,\"out_of_order\":%lu,\"callback_errors\":%lu",
+                     (unsigned)appends, (unsigned long)st.delivered, (unsigned long)subs[k].received,
+                     (unsigned long)st.dropped, (unsigned long)st.max_lag, (unsigned long)st.lag,
+                     (unsigned long)subs[k].out_of_order, (unsigned long)subs[k].callback_errors);
+    }
+}
+
+static void run_case(int case_index, const cdc_case_t *c) {
+    const size_t appends = CDC_BATTERIES * CDC_ROUNDS;
+    uint32_t *latency_us = malloc(appends * sizeof(uint32_t));
+    QueueHandle_t queue = xQueueCreate(CDC_QUEUE_LENGTH, sizeof(battery_fs_change_t));
+    if (latency_us == NULL || queue == NULL) {
+        ESP_LOGE(TAG, "%s: out of memory", c->name);
+        free(latency_us);
+        if (queue != NULL) {
+            vQueueDelete(queue);
+        }
+        return;
+    }
+
+    sub_t subs[SUB_KINDS] = {0};
+    drain_t drain = { .queue = queue, .sub = &subs[SUB_QUEUE], .run = true, .done = !c->subscribe[SUB_QUEUE] };
+    esp_err_t ret = ESP_OK;
+    if (c->subscribe[SUB_CALLBACK]) {
+        ret = battery_fs_subscribe(on_change, &subs[SUB_CALLBACK], &subs[SUB_CALLBACK].handle);
+    }
+    if (ret == ESP_OK && c->subscribe[SUB_SLOW]) {
+        ret = battery_fs_subscribe(on_change_slow, &subs[SUB_SLOW], &subs[SUB_SLOW].handle);
+    }
+    if (ret == ESP_OK && c->subscribe[SUB_QUEUE]) {
+        ret = battery_fs_subscribe_queue(queue, &subs[SUB_QUEUE].handle);
+        if (ret == ESP_OK && xTaskCreate(drain_task, "cdc_drain", CDC_TASK_STACK, &drain,
+                                         uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+            ret = ESP_ERR_NO_MEM;
+            drain.done = true;
+        }
+    }
+
+    batmon_synth_t synth[CDC_BATTERIES];
+    char serial[CDC_BATTERIES][16];
+    for (int i = 0; i < CDC_BATTERIES; i++) {
+        batmon_synth_init(&synth[i], NULL, case_index * CDC_BATTERIES + i);
+        snprintf(serial[i], sizeof(serial[i]), "CDC%u%03X", (unsigned)case_index, (unsigned)i);
+    }
+
+    uint32_t errors = ret != ESP_OK;
+    for (size_t n = 0; ret == ESP_OK && n < appends; n++) {
+        int b = n % CDC_BATTERIES;
+        int64_t t0 = bench_now_us();
+        errors += append(serial[b], &synth[b], (n / CDC_BATTERIES) * CDC_APPEND_RECORDS) != ESP_OK;
+        latency_us[n] = (uint32_t)(bench_now_us() - t0);
+        // One poll period between appends
+        vTaskDelay(1);
+    }
+
+    if (ret == ESP_OK) {
+        wait_drained(subs, c);
+        report_case(c, latency_us, appends, errors, subs);
+    } else {
+        ESP_LOGE(TAG, "%s: subscribing failed: %s", c->name, esp_err_to_name(ret));
+    }
+
+    for (int k = 0; k < SUB_KINDS; k++) {
+        if (subs[k].handle != NULL) {
+            battery_fs_unsubscribe(subs[k].handle);
+        }
+    }
+    drain.run = false;
+    while (!drain.done) {
+        vTaskDelay(1);
+    }
+    vQueueDelete(queue);
+    free(latency_us);
+}
+
+void bench_cdc_run(void) {
+    if (bench_mount_storage(CDC_IMAGE, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Storage not available, skipping");
+        return;
+    }
+
+    // Measure storage, not the console
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    battery_fs_delete_all();
+
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        run_case(i, &s_cases[i]);
+    }
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    battery_fs_deinit();
+}
@@ -0,0 +1,225 @@
+/**
+ * @file bench_decode.c
+ * @brief BatmonMemory decode throughput: bitfield access vs. batch decoder
+ *
+ * Cases:
+ *  - bitfield_aos:  field-by-field access through the Batmon_struct.h
+ *                   bitfields into one struct per record, as consumers do today
+ *  - batch_soa:     BATMON_decodeMemoryBatch() over a BatmonMemory array
+ *  - batch_soa_bin: same, with records interleaved with battery_fs record
+ *                   headers the way they sit in a .bin file
+ *  - *_summary:     decode followed by a per-pack style reduction (min SOC,
+ *                   max temperature, charge totals, alarm count), where the
+ *                   columns can be scanned contiguously
+ */
+
+#include "bench.h"
+#include "BATMON_decode.h"
+#include "batmon_fixtures.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_DECODE";
+
+#define DECODE_BATCH        256
+#define BIN_HEADER_SIZE     8   // battery_fs_record_header_t
+
+typedef struct {
+    uint8_t memory_index, min_soc, max_soc, soh;
+    float min_temp_c, max_temp_c, max_int_temp_c;
+    uint16_t max_current_a, cycle;
+    uint8_t new_cycle, logged_without_sleep;
+    uint8_t boot_min_cell, boot_max_cell, shut_min_cell, shut_max_cell;
+    uint16_t boot_min_mv, boot_max_mv, shut_min_mv, shut_max_mv, remain_mah;
+    uint32_t charged_mah, discharged_mah;
+    uint8_t cc_error, cc_time_error, cc_error_count, alarms;
+    uint32_t gps_start_s, gps_end_s;
+    uint8_t ir_min_mohm[INT_RES_PER_MEMORY], ir_max_mohm[INT_RES_PER_MEMORY];
+    uint8_t soc_from_voltage, storage_discharge, storage_mode;
+} decoded_row_t;
+
+static volatile uint32_t s_sink;
+
+static float temp_c(uint8_t raw) {
+    return (float)(raw - MEMORY_TEMP_OFFSET - KELVIN_CELCIUS);
+}
+
+static void decode_bitfields(const BatmonMemory *mem, size_t count, decoded_row_t *rows) {
+    for (size_t i = 0; i < count; i++) {
+        const __typeof__(mem->data) *d = &mem[i].data;
+        decoded_row_t *r = &rows[i];
+
+        r->memory_index = d->memoryIndex;
+        r->min_soc = d->minSOC;
+        r->max_soc = d->maxSOC;
+        r->soh = d->SOH;
+        r->min_temp_c = temp_c(d->minTempCycle);
+        r->max_temp_c = temp_c(d->maxTempCycle);
+        r->max_int_temp_c = temp_c(d->maxIntTempCycle);
+        r->max_current_a = d->maxDrainedCurrentCycle;
+        r->cycle = d->log.battCycle;
+        r->new_cycle = d->log.REC_NEW_CYCLE;
+        r->logged_without_sleep = d->log.LOGGED_WITHOUT_SLEEP;
+        r->boot_min_cell = d->bootupMinCellVIndex;
+        r->boot_max_cell = d->bootupMaxCellVIndex;
+        r->boot_min_mv = d->bootupMinCellV * MEM_VOLT_STORAGE_RESOLUTION;
+        r->boot_max_mv = d->bootupMaxCellV * MEM_VOLT_STORAGE_RESOLUTION;
+        r->shut_min_cell = d->shutdownMinCellVIndex;
+        r->shut_max_cell = d->shutdownMaxCellVIndex;
+        r->shut_min_mv = d->shutdownMinCellV * MEM_VOLT_STORAGE_RESOLUTION;
+        r->shut_max_mv = d->shutdownMaxCellV * MEM_VOLT_STORAGE_RESOLUTION;
+        r->remain_mah = d->shutdownRemainCap;
+        r->charged_mah = d->accumulatedCharged;
+        r->discharged_mah = d->accumulatedDischarged;
+        r->cc_error = d->bq_status.CC_ERROR;
+        r->cc_time_error = d->bq_status.CC_TIME_ERROR;
+        r->cc_error_count = d->bq_status.ccErrorCount;
+        r->alarms = d->triggeredAlarmCycle.alarm;
+        r->gps_start_s = d->gpsStartTimestamp.week * BATMON_GPS_SECONDS_PER_WEEK + d->gpsStartTimestamp.tow_s;
+        r->gps_end_s = d->gpsEndTimestamp.week * BATMON_GPS_SECONDS_PER_WEEK + d->gpsEndTimestamp.tow_s;
+        for (int s = 0; s < INT_RES_PER_MEMORY; s++) {
+            r->ir_min_mohm[s] = d->intRes[s].minIntRes;
+            r->ir_max_mohm[s] = d->intRes[s].maxIntRes;
+        }
+        r->soc_from_voltage = d->log2.bootFromVoltageSOC;
+        r->storage_discharge = d->log2.StorageModeDischargeStarted;
+        r->storage_mode = d->log2.StoragemodeStarted;
+    }
+}
+
+typedef struct {
+    uint8_t min_soc;
+    float max_temp_c;
+    uint32_t charged_mah;
+    uint32_t discharged_mah;
+    uint32_t alarm_records;
+} summary_t;
+
+static void summarize_rows(const decoded_row_t *rows, size_t count, summary_t *s) {
+    for (size_t i = 0; i < count; i++) {
+        s->min_soc = rows[i].min_soc < s->min_soc ? rows[i].min_soc : s->min_soc;
+        s->max_temp_c = rows[i].max_temp_c > s->max_temp_c ? rows[i].max_temp_c : s->max_temp_c;
+        s->charged_mah += rows[i].charged_mah;
+        s->discharged_mah += rows[i].discharged_mah;
+        s->alarm_records += rows[i].alarms != 0;
+    }
+}
+
+static void summarize_columns(const batmon_mem_columns_t *cols, size_t count, summary_t *s) {
+    uint8_t min_soc = s->min_soc;
+    float max_temp_c = s->max_temp_c;
+    uint32_t charged = s->charged_mah, discharged = s->discharged_mah, alarms = s->alarm_records;
+
+    // One loop per column, each a contiguous scan
+    for (size_t i = 0; i < count; i++) {
+        min_soc = cols->min_soc[i] < min_soc ? cols->min_soc[i] : min_soc;
+    }
+    for (size_t i = 0; i < count; i++) {
+        max_temp_c = cols->max_temp_c[i] > max_temp_c ? cols->max_temp_c[i] : max_temp_c;
+    }
+    for (size_t i = 0; i < count; i++) {
+        charged += cols->charged_mah[i];
+        discharged += cols->discharged_mah[i];
+    }
+    for (size_t i = 0; i < count; i++) {
+        alarms += cols->alarms[i] != 0;
+    }
+
+    s->min_soc = min_soc;
+    s->max_temp_c = max_temp_c;
+    s->charged_mah = charged;
+    s->discharged_mah = discharged;
+    s->alarm_records = alarms;
+}
+
+static void report(const char *name, uint64_t records, int64_t elapsed_us) {
+    double seconds = elapsed_us / 1e6;
+    bench_report("decode", name,
+                 "\"batch\":%d,\"records\":%llu,\"seconds\":%.3f,\"records_per_s\":%.0f,\"ns_per_record\":%.1f",
+                 DECODE_BATCH, (unsigned long long)records, seconds, records / seconds,
+                 elapsed_us * 1000.0 / records);
+}
+
+void bench_decode_run(void) {
+    BatmonMemory *mem = malloc(DECODE_BATCH * sizeof(BatmonMemory));
+    uint8_t *bin = malloc(DECODE_BATCH * (BIN_HEADER_SIZE + sizeof(BatmonMemory)));
+    decoded_row_t *rows = malloc(DECODE_BATCH * sizeof(decoded_row_t));
+    void *col_buf = malloc(BATMON_memColumnsSize(DECODE_BATCH));
+    if (mem == NULL || bin == NULL || rows == NULL || col_buf == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        free(mem);
+        free(bin);
+        free(rows);
+        free(col_buf);
+        return;
+    }
+
+    batmon_synth_t synth;
+    batmon_synth_init(&synth, &(batmon_synth_config_t){ .seed = 0x1234567 }, 0);
+    batmon_synth_fill(&synth, mem, DECODE_BATCH);
+    for (size_t i = 0; i < DECODE_BATCH; i++) {
+        uint8_t *rec = bin + i * (BIN_HEADER_SIZE + sizeof(BatmonMemory));
+        uint32_t header[2] = { mem[i].data.memoryIndex, sizeof(BatmonMemory) };
+        memcpy(rec, header, BIN_HEADER_SIZE);
+        memcpy(rec + BIN_HEADER_SIZE, &mem[i], sizeof(BatmonMemory));
+    }
+
+    batmon_mem_columns_t cols;
+    BATMON_memColumnsBind(&cols, col_buf, DECODE_BATCH);
+
+    uint64_t records = 0;
+    int64_t start = bench_now_us(), elapsed;
+    do {
+        decode_bitfields(mem, DECODE_BATCH, rows);
+        s_sink += rows[records % DECODE_BATCH].gps_end_s;
+        records += DECODE_BATCH;
+    } while ((elapsed = bench_now_us() - start) < BENCH_MIN_TIME_US);
+    report("bitfield_aos", records, elapsed);
+
+    records = 0;
+    start = bench_now_us();
+    do {
+        BATMON_decodeMemoryBatch(mem, sizeof(BatmonMemory), DECODE_BATCH, &cols, 0);
+        s_sink += cols.gps_end_s[records % DECODE_BATCH];
+        records += DECODE_BATCH;
+    } while ((elapsed = bench_now_us() - start) < BENCH_MIN_TIME_US);
+    report("batch_soa", records, elapsed);
+
+    records = 0;
+    start = bench_now_us();
+    do {
+        BATMON_decodeMemoryBatch(bin + BIN_HEADER_SIZE, BIN_HEADER_SIZE + sizeof(BatmonMemory),
+                                 DECODE_BATCH, &cols, 0);
+        s_sink += cols.gps_end_s[records % DECODE_BATCH];
+        records += DECODE_BATCH;
+    } while ((elapsed = bench_now_us() - start) < BENCH_MIN_TIME_US);
+    report("batch_soa_bin", records, elapsed);
+
+    summary_t summary = { .min_soc = UINT8_MAX, .max_temp_c = -1000.0f };
+    records = 0;
+    start = bench_now_us();
+    do {
+        decode_bitfields(mem, DECODE_BATCH, rows);
+        summarize_rows(rows, DECODE_BATCH, &summary);
+        records += DECODE_BATCH;
+    } while ((elapsed = bench_now_us() - start) < BENCH_MIN_TIME_US);
+    s_sink += summary.charged_mah;
+    report("bitfield_aos_summary", records, elapsed);
+
+    summary = (summary_t){ .min_soc = UINT8_MAX, .max_temp_c = -1000.0f };
+    records = 0;
+    start = bench_now_us();
+    do {
+        BATMON_decodeMemoryBatch(mem, sizeof(BatmonMemory), DECODE_BATCH, &cols, 0);
+        summarize_columns(&cols, DECODE_BATCH, &summary);
+        records += DECODE_BATCH;
+    } while ((elapsed = bench_now_us() - start) < BENCH_MIN_TIME_US);
+    s_sink += summary.charged_mah;
+    report("batch_soa_summary", records, elapsed);
+
+    free(mem);
+    free(bin);
+    free(rows);
+    free(col_buf);
+}
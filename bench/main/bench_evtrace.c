@@ -0,0 +1,90 @@
+/**
+ * @file bench_evtrace.c
+ * @brief Cost of one event tracer trace point
+ *
+ * Cases:
+ *  - stopped:         trace point with recording off, the cost every
+ *                     instrumented path pays in normal operation
+ *  - recording:       trace point with recording on, wrapping the ring
+ *  - recording_2core: same while a task on the other core records into its
+ *                     own ring (multi-core targets only)
+ */
+
+#include "bench.h"
+#include "evtrace.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "BENCH_EVTRACE";
+
+#define EVTRACE_BATCH   64      // Events per timing check
+
+#if CONFIG_EVTRACE_ENABLED
+
+static void run_case(const char *name) {
+    uint64_t events = 0;
+    int64_t start = bench_now_us(), elapsed;
+    do {
+        for (uint32_t i = 0; i < EVTRACE_BATCH / 2; i++) {
+            EVTRACE_BEGIN(EVTRACE_ID_SMBUS_POLL, i);
+            EVTRACE_END(EVTRACE_ID_SMBUS_POLL, i);
+        }
+        events += EVTRACE_BATCH;
+    } while ((elapsed = bench_now_us() - start) < BENCH_MIN_TIME_US);
+
+    uint32_t dropped;
+    evtrace_count(&dropped);
+    bench_report("evtrace", name,
+                 "\"events\":%llu,\"seconds\":%.3f,\"ns_per_event\":%.1f,\"overwritten\":%lu",
+                 (unsigned long long)events, elapsed / 1e6, elapsed * 1000.0 / events,
+                 (unsigned long)dropped);
+}
+
+#if !CONFIG_IDF_TARGET_LINUX && portNUM_PROCESSORS > 1
+static volatile bool s_other_core_run;
+static volatile bool s_other_core_done;
+
+static void other_core_task(void *arg) {
+    while (s_other_core_run) {
+        EVTRACE_INSTANT(EVTRACE_ID_SMBUS_POLL, 0);
+    }
+    s_other_core_done = true;
+    vTaskDelete(NULL);
+}
+#endif
+
+void bench_evtrace_run(void) {
+    evtrace_stop();
+    run_case("stopped");
+
+    evtrace_start();
+    run_case("recording");
+
+#if !CONFIG_IDF_TARGET_LINUX && portNUM_PROCESSORS > 1
+    s_other_core_run = true;
+    s_other_core_done = false;
+    if (xTaskCreatePinnedToCore(other_core_task, "evtrace_bench", 2048, NULL,
+                                uxTaskPriorityGet(NULL), NULL, 1 - xPortGetCoreID()) == pdPASS) {
+        evtrace_start();
+        run_case("recording_2core");
+        s_other_core_run = false;
+        while (!s_other_core_done) {
+            vTaskDelay(1);
+        }
+    } else {
+        ESP_LOGE(TAG, "No memory for the second core's task");
+    }
+#endif
+
+    evtrace_stop();
+}
+
+#else
+
+void bench_evtrace_run(void) {
+    ESP_LOGW(TAG, "Needs CONFIG_EVTRACE_ENABLED, skipping");
+}
+
+#endif // CONFIG_EVTRACE_ENABLED
@@ -0,0 +1,409 @@
+/**
+ * @file bench_export.c
+ * @brief Append latency of battery_fs while full-scan exports run
+ *
+ * A set of batteries is stored, then appended to in rounds of a few new
+ * records each, the way acquisition stores a download. Cases:
+ *  - append_alone:       appends only, the baseline
+ *  - append_export_low:  an exporter task below the appender's priority
+ *                        scans every battery with snapshot readers in a loop
+ *  - append_export_same: the same at the appender's priority
+ *
+ * Reported per case: append latency p50/p99/max, exports completed,
+ * records exported per second, and inconsistent snapshots: a scan that
+ * returned a different number of records than its snapshot count, a
+ * memory index out of order, or a record of the wrong size.
+ *
+ * Then a summary case: per battery, battery_fs_read_summary() against a
+ * full reader scan folding the same fields, p50 of each and the batteries
+ * whose stored summary differs from the scanned one.
+ *
+ * Last a sync case: rounds of appends to every battery, each followed by
+ * an incremental sync of a consumer cut off halfway. It acknowledges what
+ * it got, reads the rest, then reads once more and must get nothing.
+ * Reported: records appended and synced, sequence gaps or repeats, records
+ * not matching what was appended, p50 of a round's sync reads against a
+ * full export scan.
+ *
+ * The filesystem is wiped first. On hardware this erases the battery logs
+ * on the chip, run it on a bench unit only.
+ */
+
+#include "bench.h"
+#include "batmon_fixtures.h"
+#include "battery_fs.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_EXPORT";
+
+#define EXPORT_IMAGE            "bench_export.img"
+#define EXPORT_BATTERIES        8
+#define EXPORT_INITIAL_RECORDS  96      // Stored before the first case
+#define EXPORT_APPEND_RECORDS   4       // New records per append
+#define EXPORT_ROUNDS           12      // Appends per battery and case
+#define EXPORT_SYNC_ROUNDS      4       // Appends per battery in the sync case
+#define EXPORT_SYNC_CONSUMER    "bench"
+#define EXPORT_TASK_STACK       4096
+
+// Memory indexes stay below the 256-record ring of a pack
+_Static_assert(EXPORT_INITIAL_RECORDS + (3 * EXPORT_ROUNDS + EXPORT_SYNC_ROUNDS) * EXPORT_APPEND_RECORDS <= 256,
+               "appends would wrap the memory ring");
+
+typedef struct {
+    const char *name;
+    bool export;
+    int priority_offset;            // Exporter priority relative to the appender
+} export_case_t;
+
+static const export_case_t s_cases[] = {
+    { "append_alone", false, 0 },
+    { "append_export_low", true, -1 },
+    { "append_export_same", true, 0 },
+};
+
+typedef struct {
+    batmon_synth_t synth;
+    uint32_t next_index;            // Memory index of the next record
+    uint32_t synced_index;          // Of the next record the sync consumer is due
+    char serial[16];
+} battery_t;
+
+typedef struct {
+    volatile bool run;
+    volatile bool done;
+    uint32_t exports;               // Full scans completed
+    uint64_t records;               // Records read by completed scans
+    uint32_t inconsistent;
+    uint32_t errors;
+} exporter_t;
+
+static battery_t s_batteries[EXPORT_BATTERIES];
+static BatmonMemory s_records[EXPORT_INITIAL_RECORDS];
+static battery_log_t s_logs[EXPORT_INITIAL_RECORDS];
+
+/**
+ * @brief Store the next `count` records of a battery
+ */
+static esp_err_t append(battery_t *b, size_t count) {
+    batmon_synth_fill(&b->synth, s_records, count);
+    for (size_t i = 0; i < count; i++) {
+        s_logs[i] = (battery_log_t){
+            .memory_index = b->next_index + i,
+            .data = (uint8_t *)&s_records[i],
+            .data_len = sizeof(BatmonMemory),
+        };
+    }
+    esp_err_t ret = battery_fs_write_data(b->serial, s_logs, count);
+    if (ret == ESP_OK) {
+        b->next_index += count;
+    }
+    return ret;
+}
+
+// ============================================================================
+// Exporter
+// ============================================================================
+
+static bool export_battery(const char *serial_number, void *arg) {
+    exporter_t *ex = arg;
+    battery_fs_reader_t *reader;
+    if (battery_fs_reader_open(serial_number, &reader) != ESP_OK) {
+        ex->errors++;
+        return ex->run;
+    }
+
+    BatmonMemory record;
+    battery_fs_record_header_t hdr;
+    uint32_t records = 0;
+    bool ordered = true;
+    int64_t last_index = -1;
+    esp_err_t ret;
+    while ((ret = battery_fs_reader_next(reader, &hdr, (uint8_t *)&record, sizeof(record))) == ESP_OK) {
+        if ((int64_t)hdr.memory_index <= last_index || hdr.data_len != sizeof(BatmonMemory)) {
+            ordered = false;
+        }
+        last_index = hdr.memory_index;
+        records++;
+    }
+    if (ret != ESP_ERR_NOT_FOUND || records != battery_fs_reader_count(reader) || !ordered) {
+        ex->inconsistent++;
+    }
+    battery_fs_reader_close(reader);
+
+    ex->records += records;
+    return ex->run;
+}
+
+static void exporter_task(void *arg) {
+    exporter_t *ex = arg;
+    while (ex->run) {
+        if (battery_fs_foreach(export_battery, ex) != ESP_OK) {
+            ex->errors++;
+        }
+        if (ex->run) {
+            ex->exports++;
+        }
+    }
+    ex->done = true;
+    vTaskDelete(NULL);
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+static void run_case(const export_case_t *c) {
+    const size_t appends = EXPORT_BATTERIES * EXPORT_ROUNDS;
+    uint32_t *latency_us = malloc(appends * sizeof(uint32_t));
+    if (latency_us == NULL) {
+        ESP_LOGE(TAG, "%s: out of memory", c->name);
+        return;
+    }
+
+    exporter_t ex = { .run = true };
+    if (c->export) {
+        UBaseType_t prio = uxTaskPriorityGet(NULL) + c->priority_offset;
+        if (xTaskCreate(exporter_task, "exporter", EXPORT_TASK_STACK, &ex, prio, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "%s: no memory for the exporter", c->name);
+            free(latency_us);
+            return;
+        }
+        // Let the first scan get going
+        vTaskDelay(1);
+    }
+
+    uint32_t errors = 0;
+    int64_t start = bench_now_us();
+    for (size_t i = 0; i < appends; i++) {
+        battery_t *b = &s_batteries[i % EXPORT_BATTERIES];
+        int64_t t0 = bench_now_us();
+        if (append(b, EXPORT_APPEND_RECORDS) != ESP_OK) {
+            errors++;
+        }
+        latency_us[i] = (uint32_t)(bench_now_us() - t0);
+        // Give a same-priority exporter its turn, as between two polls
+        taskYIELD();
+    }
+    int64_t elapsed = bench_now_us() - start;
+
+    if (c->export) {
+        ex.run = false;
+        while (!ex.done) {
+            vTaskDelay(1);
+        }
+    }
+
+    bench_sort_u32(latency_us, appends);
+    bench_report("export", c->name,
+                 "\"appends\":%u,\"append_errors\":%lu,\"append_p50_us\":%lu,\"append_p99_us\":%lu,"
+                 "\"append_max_us\":%lu,\"exports\":%lu,\"export_records_per_s\":%.0f,"
+                 "\"inconsistent\":%lu,\"export_errors\":%lu",
+                 (unsigned)appends, (unsigned long)errors,
+                 (unsigned long)bench_percentile(latency_us, appends, 50),
+                 (unsigned long)bench_percentile(latency_us, appends, 99),
+                 (unsigned long)bench_percentile(latency_us, appends, 100), (unsigned long)ex.exports,
+                 elapsed > 0 ? ex.records * 1e6 / elapsed : 0.0,
+                 (unsigned long)ex.inconsistent, (unsigned long)ex.errors);
+    free(latency_us);
+}
+
+// ============================================================================
+// Summary
+// ============================================================================
+
+static void fold_field(battery_fs_summary_field_t *f, uint32_t value, bool first) {
+    f->min = first || value < f->min ? value : f->min;
+    f->max = first || value > f->max ? value : f->max;
+    f->sum += value;
+}
+
+/**
+ * @brief What a query without stored summaries costs: read every record
+ */
+static esp_err_t scan_summary(const char *serial_number, battery_fs_summary_t *sum) {
+    battery_fs_reader_t *reader;
+    esp_err_t ret = battery_fs_reader_open(serial_number, &reader);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    memset(sum, 0, sizeof(*sum));
+    BatmonMemory r;
+    battery_fs_record_header_t hdr;
+    while ((ret = battery_fs_reader_next(reader, &hdr, (uint8_t *)&r, sizeof(r))) == ESP_OK) {
+        bool first = sum->decoded++ == 0;
+        fold_field(&sum->fields[BATTERY_FS_SUMMARY_MIN_SOC], r.data.minSOC, first);
+        fold_field(&sum->fields[BATTERY_FS_SUMMARY_MAX_TEMP], r.data.maxTempCycle, first);
+        fold_field(&sum->fields[BATTERY_FS_SUMMARY_MAX_CURRENT], r.data.maxDrainedCurrentCycle, first);
+        fold_field(&sum->fields[BATTERY_FS_SUMMARY_DISCHARGED], r.data.accumulatedDischarged, first);
+        for (int b = 0; b < BATTERY_FS_SUMMARY_ALARMS; b++) {
+            sum->alarms[b] += (r.data.triggeredAlarmCycle.alarm >> b) & 1;
+        }
+        sum->latest_cycle = r.data.log.battCycle;
+    }
+    sum->records = sum->decoded;
+    battery_fs_reader_close(reader);
+    return ret == ESP_ERR_NOT_FOUND ? ESP_OK : ret;
+}
+
+static bool summary_equal(const battery_fs_summary_t *a, const battery_fs_summary_t *b) {
+    return a->records == b->records && a->decoded == b->decoded && a->latest_cycle == b->latest_cycle &&
+           memcmp(a->fields, b->fields, sizeof(a->fields)) == 0 &&
+           memcmp(a->alarms, b->alarms, sizeof(a->alarms)) == 0;
+}
+
+static void run_summary(void) {
+    uint32_t stored_us[EXPORT_BATTERIES], scan_us[EXPORT_BATTERIES];
+    uint32_t mismatches = 0, errors = 0, records = 0;
+
+    for (int i = 0; i < EXPORT_BATTERIES; i++) {
+        battery_fs_summary_t stored, scanned;
+        int64_t t0 = bench_now_us();
+        esp_err_t ret = battery_fs_read_summary(s_batteries[i].serial, &stored);
+        int64_t t1 = bench_now_us();
+        ret = ret == ESP_OK ? scan_summary(s_batteries[i].serial, &scanned) : ret;
+        int64_t t2 = bench_now_us();
+        stored_us[i] = (uint32_t)(t1 - t0);
+        scan_us[i] = (uint32_t)(t2 - t1);
+        if (ret != ESP_OK) {
+            errors++;
+            continue;
+        }
+        mismatches += !summary_equal(&stored, &scanned);
+        records += scanned.records;
+    }
+
+    bench_sort_u32(stored_us, EXPORT_BATTERIES);
+    bench_sort_u32(scan_us, EXPORT_BATTERIES);
+    bench_report("export", "summary",
+                 "\"batteries\":%d,\"records\":%lu,\"stored_p50_us\":%lu,\"scan_p50_us\":%lu,"
+                 "\"mismatches\":%lu,\"errors\":%lu",
+                 EXPORT_BATTERIES, (unsigned long)records,
+                 (unsigned long)bench_percentile(stored_us, EXPORT_BATTERIES, 50),
+                 (unsigned long)bench_percentile(scan_us, EXPORT_BATTERIES, 50), (unsigned long)mismatches,
+                 (unsigned long)errors);
+}
+
+// ============================================================================
+// Sync
+// ============================================================================
+
+typedef struct {
+    uint32_t next_seq;              // Due next
+    uint32_t records;
+    uint32_t gaps;                  // Sequence numbers skipped or repeated
+    uint32_t mismatches;
+} sync_check_t;
+
+static bool check_sync_record(const char *serial_number, uint32_t seq, const battery_fs_record_header_t *header,
+                              const uint8_t *data, void *arg) {
+    sync_check_t *sc = arg;
+    sc->gaps += seq != sc->next_seq;
+    sc->next_seq = seq + 1;
+    sc->records++;
+
+    battery_t *b = NULL;
+    for (int i = 0; i < EXPORT_BATTERIES && b == NULL; i++) {
+        b = strcmp(s_batteries[i].serial, serial_number) == 0 ? &s_batteries[i] : NULL;
+    }
+    if (b == NULL || header->memory_index != b->synced_index || header->data_len != sizeof(BatmonMemory)) {
+        sc->mismatches++;
+    } else {
+        b->synced_index++;
+    }
+    return true;
+}
+
+static bool count_battery(const char *serial_number, void *arg) {
+    exporter_t ex = { .run = true };
+    export_battery(serial_number, &ex);
+    *(uint64_t *)arg += ex.records;
+    return true;
+}
+
+static void run_sync(void) {
+    uint32_t sync_us[EXPORT_SYNC_ROUNDS], scan_us[EXPORT_SYNC_ROUNDS];
+    uint32_t appended = 0, redelivered = 0, errors = 0;
+    uint64_t scanned = 0;
+
+    // Only what this case appends is new to the consumer
+    uint32_t acked = battery_fs_sync_last_seq();
+    errors += battery_fs_sync_ack(EXPORT_SYNC_CONSUMER, acked) != ESP_OK;
+    sync_check_t sc = { .next_seq = acked + 1 };
+    for (int i = 0; i < EXPORT_BATTERIES; i++) {
+        s_batteries[i].synced_index = s_batteries[i].next_index;
+    }
+
+    for (int round = 0; round < EXPORT_SYNC_ROUNDS; round++) {
+        for (int i = 0; i < EXPORT_BATTERIES; i++) {
+            errors += append(&s_batteries[i], EXPORT_APPEND_RECORDS) != ESP_OK;
+            appended += EXPORT_APPEND_RECORDS;
+        }
+
+        // Cut off halfway, resume from the acknowledged mark
+        uint32_t last;
+        int64_t t0 = bench_now_us();
+        errors += battery_fs_sync_read(EXPORT_SYNC_CONSUMER, EXPORT_BATTERIES * EXPORT_APPEND_RECORDS / 2,
+                                       check_sync_record, &sc, &last) != ESP_OK;
+        errors += battery_fs_sync_ack(EXPORT_SYNC_CONSUMER, last) != ESP_OK;
+        errors += battery_fs_sync_read(EXPORT_SYNC_CONSUMER, 0, check_sync_record, &sc, &last) != ESP_OK;
+        errors += battery_fs_sync_ack(EXPORT_SYNC_CONSUMER, last) != ESP_OK;
+        int64_t t1 = bench_now_us();
+        battery_fs_foreach(count_battery, &scanned);
+        int64_t t2 = bench_now_us();
+        sync_us[round] = (uint32_t)(t1 - t0);
+        scan_us[round] = (uint32_t)(t2 - t1);
+
+        uint32_t before = sc.records;
+        errors += battery_fs_sync_read(EXPORT_SYNC_CONSUMER, 0, check_sync_record, &sc, &last) != ESP_OK;
+        redelivered += sc.records - before;
+    }
+
+    bench_sort_u32(sync_us, EXPORT_SYNC_ROUNDS);
+    bench_sort_u32(scan_us, EXPORT_SYNC_ROUNDS);
+    bench_report("export", "sync",
+                 "\"rounds\":%d,\"appended\":%lu,\"synced\":%lu,\"redelivered\":%lu,\"gaps\":%lu,"
+                 "\"mismatches\":%lu,\"sync_p50_us\":%lu,\"scan_p50_us\":%lu,\"scan_records\":%llu,"
+                 "\"errors\":%lu",
+                 EXPORT_SYNC_ROUNDS, (unsigned long)appended, (unsigned long)sc.records,
+                 (unsigned long)redelivered, (unsigned long)sc.gaps, (unsigned long)sc.mismatches,
+                 (unsigned long)bench_percentile(sync_us, EXPORT_SYNC_ROUNDS, 50),
+                 (unsigned long)bench_percentile(scan_us, EXPORT_SYNC_ROUNDS, 50),
+                 (unsigned long long)scanned, (unsigned long)errors);
+}
+
+void bench_export_run(void) {
+    if (bench_mount_storage(EXPORT_IMAGE, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Storage not available, skipping");
+        return;
+    }
+
+    // Measure storage, not the console
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    battery_fs_delete_all();
+
+    for (int i = 0; i < EXPORT_BATTERIES; i++) {
+        battery_t *b = &s_batteries[i];
+        batmon_synth_init(&b->synth, NULL, i);
+        b->next_index = 0;
+        snprintf(b->serial, sizeof(b->serial), "EXP%04X", b->synth.serial);
+        if (append(b, EXPORT_INITIAL_RECORDS) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to store %s", b->serial);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        run_case(&s_cases[i]);
+    }
+    run_summary();
+    run_sync();
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    battery_fs_deinit();
+}
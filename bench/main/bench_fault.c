@@ -0,0 +1,321 @@
+/**
+ * @file bench_fault.c
+ * @brief Fault handling latency while storage is busy
+ *
+ * A writer task appends batches of records the way acquisition stores a
+ * download, to a new battery whenever the memory ring of the current one
+ * would wrap. Faults are raised through system_state_request() at the
+ * moment battery_fs_flash_op() reports the wanted device operation, then
+ * cleared, and the writer retries the interrupted batch. Cases:
+ *  - fault_idle:    no storage call in progress (the writer is paused)
+ *  - fault_program: during a page program
+ *  - fault_erase:   during a block erase
+ *  - estop_erase:   the same with SYS_ESTOP
+ *
+ * Reported per case: injections, misses (the operation was not seen in
+ * time), response latency (raise to the state task running) and quiesce
+ * latency (raise to no storage call in progress) p50/p99/max, appends cut
+ * short by a fault. After the cases every battery is read back: a record
+ * count that differs from what the writer stored, or indexes out of
+ * sequence, count as inconsistent.
+ *
+ * On linux the flash takes its modeled time (see spiflash_config_t), so
+ * erases and programs last long enough to be caught. The filesystem is
+ * wiped first. On hardware this erases the battery logs on the chip, run
+ * it on a bench unit only.
+ */
+
+#include "bench.h"
+#include "batmon_fixtures.h"
+#include "battery_fs.h"
+#include "DataAcquisition.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_FAULT";
+
+#define FAULT_IMAGE             "bench_fault.img"
+#define FAULT_INJECTIONS        32      // Per case
+#define FAULT_BATCH             32      // Records per append
+#define FAULT_RING_RECORDS      224     // Start a new battery before index 256
+#define FAULT_MAX_BATTERIES     64
+#define FAULT_OP_WAIT_US        2000000 // Longest wait for the wanted operation
+#define FAULT_SETTLE_US         2000000 // Longest wait for the state task
+#define FAULT_TASK_STACK        4096
+
+_Static_assert(FAULT_RING_RECORDS % FAULT_BATCH == 0, "batches must fill a battery exactly");
+
+typedef struct {
+    const char *name;
+    battery_fs_flash_op_t op;       // Operation to catch, IDLE pauses the writer
+    system_state_t state;
+} fault_case_t;
+
+static const fault_case_t s_cases[] = {
+    { "fault_idle", BATTERY_FS_FLASH_IDLE, SYS_FAULT },
+    { "fault_program", BATTERY_FS_FLASH_PROGRAM, SYS_FAULT },
+    { "fault_erase", BATTERY_FS_FLASH_ERASE, SYS_FAULT },
+    { "estop_erase", BATTERY_FS_FLASH_ERASE, SYS_ESTOP },
+};
+
+typedef struct {
+    volatile bool run;
+    volatile bool pause;
+    volatile bool paused;
+    volatile bool done;
+    uint32_t batteries;             // Batteries started
+    uint32_t stored[FAULT_MAX_BATTERIES]; // Records stored per battery
+    uint32_t interrupted;           // Appends cut short by a suspension
+    uint32_t errors;
+    batmon_synth_t synth;
+    BatmonMemory records[FAULT_BATCH];
+    battery_log_t logs[FAULT_BATCH];
+} writer_t;
+
+static writer_t s_writer;
+
+static void battery_serial(uint32_t n, char *serial, size_t size) {
+    snprintf(serial, size, "FLT%04lX", (unsigned long)n);
+}
+
+// ============================================================================
+// Writer
+// ============================================================================
+
+static void writer_task(void *arg) {
+    writer_t *w = arg;
+    bool have_batch = false;
+    char serial[16];
+
+    // A batch cut short is finished before stopping, so every battery
+    // ends on a known count
+    while (w->run || have_batch) {
+        if (w->pause && !have_batch) {
+            w->paused = true;
+            vTaskDelay(1);
+            continue;
+        }
+        w->paused = false;
+
+        uint32_t b = w->batteries - 1;
+        if (!have_batch) {
+            if (w->stored[b] == FAULT_RING_RECORDS) {
+                if (w->batteries == FAULT_MAX_BATTERIES) {
+                    break;
+                }
+                b = w->batteries++;
+            }
+            batmon_synth_fill(&w->synth, w->records, FAULT_BATCH);
+            for (size_t i = 0; i < FAULT_BATCH; i++) {
+                w->logs[i] = (battery_log_t){
+                    .memory_index = w->stored[b] + i,
+                    .data = (uint8_t *)&w->records[i],
+                    .data_len = sizeof(BatmonMemory),
+                };
+            }
+            have_batch = true;
+        }
+
+        battery_serial(b, serial, sizeof(serial));
+        esp_err_t ret = battery_fs_write_data(serial, w->logs, FAULT_BATCH);
+        if (ret == ESP_OK) {
+            w->stored[b] += FAULT_BATCH;
+            have_batch = false;
+        } else if (ret == ESP_ERR_INVALID_STATE) {
+            // Retry the same logs once the fault is cleared
+            w->interrupted++;
+            while (battery_fs_is_suspended()) {
+                vTaskDelay(1);
+            }
+        } else {
+            w->errors++;
+            have_batch = false;
+        }
+    }
+
+    w->done = true;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Read every battery back and compare with what the writer stored
+ */
+static uint32_t check_batteries(const writer_t *w) {
+    uint32_t inconsistent = 0;
+    char serial[16];
+    BatmonMemory record;
+
+    for (uint32_t b = 0; b < w->batteries; b++) {
+        battery_serial(b, serial, sizeof(serial));
+        battery_fs_reader_t *reader;
+        if (battery_fs_reader_open(serial, &reader) != ESP_OK) {
+            inconsistent += w->stored[b] != 0;
+            continue;
+        }
+
+        battery_fs_record_header_t hdr;
+        uint32_t n = 0;
+        bool ordered = true;
+        while (battery_fs_reader_next(reader, &hdr, (uint8_t *)&record, sizeof(record)) == ESP_OK) {
+            ordered &= hdr.memory_index == n;
+            n++;
+        }
+        if (n != w->stored[b] || battery_fs_reader_count(reader) != w->stored[b] || !ordered) {
+            ESP_LOGE(TAG, "%s: %lu records read, %lu stored", serial, (unsigned long)n,
+                     (unsigned long)w->stored[b]);
+            inconsistent++;
+        }
+        battery_fs_reader_close(reader);
+    }
+    return inconsistent;
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+/**
+ * @brief Spin until the flash runs `op`, false on timeout
+ *
+ * Yields instead of sleeping: the writer runs at the same priority and the
+ * operations to catch last a few milliseconds at most.
+ */
+static bool wait_for_op(battery_fs_flash_op_t op) {
+    int64_t start = bench_now_us();
+    while (battery_fs_flash_op() != op) {
+        if (bench_now_us() - start > FAULT_OP_WAIT_US) {
+            return false;
+        }
+        taskYIELD();
+    }
+    return true;
+}
+
+/**
+ * @brief Wait for a new sample in `hist`, return it (sums are exact)
+ */
+static bool wait_sample(const acq_histogram_t *hist, uint32_t count, uint64_t sum, uint32_t *us) {
+    int64_t start = bench_now_us();
+    while (hist->count == count) {
+        if (bench_now_us() - start > FAULT_SETTLE_US) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    *us = (uint32_t)(hist->sum_us - sum);
+    return true;
+}
+
+static void report_case(const fault_case_t *c, uint32_t *response, uint32_t *quiesce, size_t n,
+                        uint32_t misses, uint32_t interrupted) {
+    if (n == 0) {
+        ESP_LOGE(TAG, "%s: no fault caught", c->name);
+        return;
+    }
+    bench_sort_u32(response, n);
+    bench_sort_u32(quiesce, n);
+    bench_report("fault", c->name,
+                 "\"injections\":%u,\"misses\":%lu,"
+                 "\"response_p50_us\":%lu,\"response_p99_us\":%lu,\"response_max_us\":%lu,"
+                 "\"quiesce_p50_us\":%lu,\"quiesce_p99_us\":%lu,\"quiesce_max_us\":%lu,"
+                 "\"appends_interrupted\":%lu",
+                 (unsigned)n, (unsigned long)misses,
+                 (unsigned long)bench_percentile(response, n, 50), (unsigned long)bench_percentile(response, n, 99),
+                 (unsigned long)bench_percentile(response, n, 100),
+                 (unsigned long)bench_percentile(quiesce, n, 50), (unsigned long)bench_percentile(quiesce, n, 99),
+                 (unsigned long)bench_percentile(quiesce, n, 100),
+                 (unsigned long)interrupted);
+}
+
+static void run_case(const fault_case_t *c) {
+    uint32_t response[FAULT_INJECTIONS], quiesce[FAULT_INJECTIONS];
+    uint32_t seed = 0xFA017000u;
+    uint32_t misses = 0, interrupted = s_writer.interrupted;
+    size_t n = 0;
+
+    for (int i = 0; i < FAULT_INJECTIONS && !s_writer.done; i++) {
+        if (c->op == BATTERY_FS_FLASH_IDLE) {
+            s_writer.pause = true;
+            while (!s_writer.paused && !s_writer.done) {
+                vTaskDelay(1);
+            }
+        } else {
+            // Land at a different point of the write stream every time
+            vTaskDelay(1 + bench_rand(&seed) % 3);
+            if (!wait_for_op(c->op)) {
+                misses++;
+                continue;
+            }
+        }
+
+        acq_histogram_t *rh = &acq_stats.fault_response, *qh = &acq_stats.fault_quiesce;
+        uint32_t rcount = rh->count, qcount = qh->count;
+        uint64_t rsum = rh->sum_us, qsum = qh->sum_us;
+        if (!system_state_request(c->state)) {
+            ESP_LOGE(TAG, "%s: %s refused in state %s", c->name, system_state_name(c->state),
+                     system_state_name(system_state_get()));
+            break;
+        }
+        bool ok = wait_sample(rh, rcount, rsum, &response[n]) && wait_sample(qh, qcount, qsum, &quiesce[n]);
+        system_state_request(SYS_IDLE);
+        s_writer.pause = false;
+        if (!ok) {
+            ESP_LOGE(TAG, "%s: storage did not quiesce", c->name);
+            misses++;
+            continue;
+        }
+        n++;
+    }
+
+    report_case(c, response, quiesce, n, misses, s_writer.interrupted - interrupted);
+}
+
+void bench_fault_run(void) {
+    if (bench_mount_storage(FAULT_IMAGE, true) != ESP_OK) {
+        ESP_LOGE(TAG, "Storage not available, skipping");
+        return;
+    }
+    if (system_state_start() != ESP_OK) {
+        battery_fs_deinit();
+        return;
+    }
+
+    // Measure storage, not the console; every fault is logged as an error
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    esp_log_level_set("DATA_ACQ", ESP_LOG_NONE);
+    battery_fs_delete_all();
+    acq_stats_reset();
+
+    memset(&s_writer, 0, sizeof(s_writer));
+    s_writer.run = true;
+    s_writer.batteries = 1;
+    batmon_synth_init(&s_writer.synth, NULL, 0);
+    if (xTaskCreate(writer_task, "fault_writer", FAULT_TASK_STACK, &s_writer,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        ESP_LOGE(TAG, "No memory for the writer");
+        esp_log_level_set("*", ESP_LOG_INFO);
+        battery_fs_deinit();
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        run_case(&s_cases[i]);
+    }
+
+    s_writer.run = false;
+    while (!s_writer.done) {
+        vTaskDelay(1);
+    }
+    uint32_t inconsistent = check_batteries(&s_writer);
+    bench_report("fault", "consistency",
+                 "\"batteries\":%lu,\"appends_interrupted\":%lu,\"append_errors\":%lu,\"inconsistent\":%lu",
+                 (unsigned long)s_writer.batteries, (unsigned long)s_writer.interrupted,
+                 (unsigned long)s_writer.errors, (unsigned long)inconsistent);
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    battery_fs_deinit();
+}
@@ -0,0 +1,344 @@
+/**
+ * @file bench_flags.c
+ * @brief Alarm and error flag queries: flag index against a full scan
+ *
+ * A fleet of packs is stored in appends of a few dozen records, the way
+ * acquisition stores downloads, with synthetic alarms and coulomb count
+ * errors. Cases:
+ *  - fleet_index: "which packs had flag X", battery_fs_flag_counts() per pack
+ *  - fleet_scan:  the same by reading every record of every pack
+ *  - pack_index:  "which records of pack P had flag X", battery_fs_flag_runs()
+ *  - pack_scan:   the same by reading every record of the pack
+ *  - topk_index:  "the packs ranking highest on metric M", battery_fs_topk()
+ *  - topk_scan:   the same from the summary and flag counts of every pack
+ *
+ * Reported per case: queries (one per flag, per flag and pack, or per
+ * metric), time per query p50/max, and mismatches: a pack (fleet), record
+ * set (pack) or ranked values (topk) the index answers differently from
+ * the scan.
+ *
+ * The FAT root directory holds 512 entries, two per pack, which bounds the
+ * fleet; per-pack costs add up linearly beyond that. The filesystem is
+ * wiped first. On hardware this erases the battery logs on the chip, run
+ * it on a bench unit only.
+ */
+
+#include "bench.h"
+#include "batmon_fixtures.h"
+#include "battery_fs.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_FLAGS";
+
+#define FLAGS_IMAGE         "bench_flags.img"
+#define FLAGS_PACKS         240     // Fits the root directory with room to spare
+#define FLAGS_RECORDS       192     // Per pack
+#define FLAGS_BATCH         32      // Records per append
+#define FLAGS_ALARM_PERMILLE 20     // Busier than the synthetic default
+
+_Static_assert(FLAGS_RECORDS % FLAGS_BATCH == 0, "appends must fill a pack exactly");
+
+typedef uint8_t record_bits_t[(FLAGS_RECORDS + 7) / 8];
+
+typedef struct {
+    battery_fs_flag_t flag;
+    uint32_t packs;
+    uint32_t errors;
+} fleet_query_t;
+
+static BatmonMemory s_records[FLAGS_BATCH];
+static battery_log_t s_logs[FLAGS_BATCH];
+
+static void pack_serial(int p, char *serial, size_t size) {
+    snprintf(serial, size, "FLG%04X", p);
+}
+
+/**
+ * @brief Flags of a record, decoded here rather than by battery_fs
+ */
+static uint8_t decode_flags(const BatmonMemory *r, uint8_t *cc_errors) {
+    uint8_t flags = r->data.triggeredAlarmCycle.alarm & 0x0F;
+    flags |= r->data.bq_status.CC_ERROR << BATTERY_FS_FLAG_CC_ERROR;
+    flags |= r->data.bq_status.CC_TIME_ERROR << BATTERY_FS_FLAG_CC_TIME_ERROR;
+    flags |= (r->data.bq_status.ccErrorCount != *cc_errors) << BATTERY_FS_FLAG_CC_ERROR_COUNT;
+    *cc_errors = r->data.bq_status.ccErrorCount;
+    return flags;
+}
+
+/**
+ * @brief Read every record of a pack, mark those with `flag` in `bits`
+ */
+static esp_err_t scan_pack(const char *serial, battery_fs_flag_t flag, record_bits_t bits, uint32_t *set) {
+    battery_fs_reader_t *reader;
+    esp_err_t ret = battery_fs_reader_open(serial, &reader);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    memset(bits, 0, sizeof(record_bits_t));
+    *set = 0;
+    BatmonMemory r;
+    battery_fs_record_header_t hdr;
+    uint8_t cc_errors = 0;
+    for (uint32_t n = 0; (ret = battery_fs_reader_next(reader, &hdr, (uint8_t *)&r, sizeof(r))) == ESP_OK; n++) {
+        if ((decode_flags(&r, &cc_errors) >> flag) & 1) {
+            (*set)++;
+            if (n < FLAGS_RECORDS) {
+                bits[n / 8] |= 1 << (n % 8);
+            }
+        }
+    }
+    battery_fs_reader_close(reader);
+    return ret == ESP_ERR_NOT_FOUND ? ESP_OK : ret;
+}
+
+// ============================================================================
+// Fleet queries
+// ============================================================================
+
+static bool count_index(const char *serial, void *arg) {
+    fleet_query_t *q = arg;
+    uint32_t set[BATTERY_FS_FLAGS];
+    if (battery_fs_flag_counts(serial, NULL, set) != ESP_OK) {
+        q->errors++;
+    } else {
+        q->packs += set[q->flag] > 0;
+    }
+    return true;
+}
+
+static bool count_scan(const char *serial, void *arg) {
+    fleet_query_t *q = arg;
+    record_bits_t bits;
+    uint32_t set;
+    if (scan_pack(serial, q->flag, bits, &set) != ESP_OK) {
+        q->errors++;
+    } else {
+        q->packs += set > 0;
+    }
+    return true;
+}
+
+static void report(const char *name, uint32_t *us, size_t n, uint32_t mismatches, uint32_t errors) {
+    bench_sort_u32(us, n);
+    bench_report("flags", name,
+                 "\"packs\":%d,\"records_per_pack\":%d,\"queries\":%u,\"query_p50_us\":%lu,"
+                 "\"query_max_us\":%lu,\"mismatches\":%lu,\"errors\":%lu",
+                 FLAGS_PACKS, FLAGS_RECORDS, (unsigned)n, (unsigned long)bench_percentile(us, n, 50),
+                 (unsigned long)bench_percentile(us, n, 100), (unsigned long)mismatches, (unsigned long)errors);
+}
+
+static void run_fleet(void) {
+    uint32_t index_us[BATTERY_FS_FLAGS], scan_us[BATTERY_FS_FLAGS];
+    uint32_t mismatches = 0, index_errors = 0, scan_errors = 0;
+
+    for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+        fleet_query_t qi = { .flag = f }, qs = { .flag = f };
+        int64_t t0 = bench_now_us();
+        index_errors += battery_fs_foreach(count_index, &qi) != ESP_OK;
+        int64_t t1 = bench_now_us();
+        scan_errors += battery_fs_foreach(count_scan, &qs) != ESP_OK;
+        int64_t t2 = bench_now_us();
+
+        index_us[f] = (uint32_t)(t1 - t0);
+        scan_us[f] = (uint32_t)(t2 - t1);
+        index_errors += qi.errors;
+        scan_errors += qs.errors;
+        mismatches += qi.packs != qs.packs;
+        ESP_LOGD(TAG, "flag %d: %lu packs", f, (unsigned long)qs.packs);
+    }
+
+    report("fleet_index", index_us, BATTERY_FS_FLAGS, mismatches, index_errors);
+    report("fleet_scan", scan_us, BATTERY_FS_FLAGS, mismatches, scan_errors);
+}
+
+// ============================================================================
+// Pack queries
+// ============================================================================
+
+static bool mark_run(uint32_t first, uint32_t count, void *arg) {
+    uint8_t *bits = arg;
+    for (uint32_t n = first; n < first + count && n < FLAGS_RECORDS; n++) {
+        bits[n / 8] |= 1 << (n % 8);
+    }
+    return true;
+}
+
+static void run_packs(void) {
+    const size_t queries = FLAGS_PACKS * BATTERY_FS_FLAGS;
+    uint32_t *index_us = malloc(queries * sizeof(uint32_t));
+    uint32_t *scan_us = malloc(queries * sizeof(uint32_t));
+    if (index_us == NULL || scan_us == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        free(index_us);
+        free(scan_us);
+        return;
+    }
+
+    uint32_t mismatches = 0, index_errors = 0, scan_errors = 0;
+    char serial[16];
+    for (size_t i = 0; i < queries; i++) {
+        battery_fs_flag_t flag = i % BATTERY_FS_FLAGS;
+        pack_serial(i / BATTERY_FS_FLAGS, serial, sizeof(serial));
+
+        record_bits_t indexed = {0}, scanned;
+        uint32_t set;
+        int64_t t0 = bench_now_us();
+        index_errors += battery_fs_flag_runs(serial, flag, mark_run, indexed) != ESP_OK;
+        int64_t t1 = bench_now_us();
+        scan_errors += scan_pack(serial, flag, scanned, &set) != ESP_OK;
+        int64_t t2 = bench_now_us();
+
+        index_us[i] = (uint32_t)(t1 - t0);
+        scan_us[i] = (uint32_t)(t2 - t1);
+        mismatches += memcmp(indexed, scanned, sizeof(record_bits_t)) != 0;
+    }
+
+    report("pack_index", index_us, queries, mismatches, index_errors);
+    report("pack_scan", scan_us, queries, mismatches, scan_errors);
+    free(index_us);
+    free(scan_us);
+}
+
+// ============================================================================
+// Fleet rankings
+// ============================================================================
+
+typedef struct {
+    battery_fs_topk_metric_t metric;
+    int32_t top[BATTERY_FS_TOPK];   // Highest first
+    size_t count;
+    uint32_t errors;
+} topk_scan_t;
+
+/**
+ * @brief A pack's metric value computed here rather than by battery_fs
+ */
+static bool metric_value(const battery_fs_summary_t *sum, const uint32_t set[BATTERY_FS_FLAGS],
+                         battery_fs_topk_metric_t metric, int32_t *value) {
+    switch (metric) {
+    case BATTERY_FS_TOPK_IR_GROWTH: {
+        uint64_t level = 0, baseline = 0;
+        for (int b = 0; b < BATTERY_FS_IR_BUCKETS; b++) {
+            const battery_fs_ir_bucket_t *bucket = &sum->ir[b];
+            if (bucket->samples >= BATTERY_FS_IR_SETTLED && bucket->baseline > 0) {
+                level += (uint64_t)bucket->level * bucket->samples;
+                baseline += (uint64_t)bucket->baseline * bucket->samples;
+            }
+        }
+        *value = baseline ? (int32_t)(((int64_t)level - (int64_t)baseline) * 1000 / (int64_t)baseline) : 0;
+        return baseline != 0;
+    }
+    case BATTERY_FS_TOPK_CC_ERRORS:
+        *value = (int32_t)set[BATTERY_FS_FLAG_CC_ERROR];
+        return true;
+    case BATTERY_FS_TOPK_ALARMS:
+        *value = 0;
+        for (int b = 0; b < BATTERY_FS_SUMMARY_ALARMS; b++) {
+            *value += (int32_t)sum->alarms[b];
+        }
+        return true;
+    default:
+        *value = (int32_t)sum->fields[BATTERY_FS_SUMMARY_MAX_TEMP].max;
+        return sum->decoded != 0;
+    }
+}
+
+static bool rank_scan(const char *serial, void *arg) {
+    topk_scan_t *q = arg;
+    battery_fs_summary_t sum;
+    uint32_t set[BATTERY_FS_FLAGS];
+    int32_t value;
+    if (battery_fs_read_summary(serial, &sum) != ESP_OK || battery_fs_flag_counts(serial, NULL, set) != ESP_OK) {
+        q->errors++;
+        return true;
+    }
+    if (!metric_value(&sum, set, q->metric, &value)) {
+        return true;
+    }
+
+    // Insertion into the sorted top values
+    size_t i = q->count < BATTERY_FS_TOPK ? q->count++ : BATTERY_FS_TOPK;
+    for (; i > 0 && q->top[i - 1] < value; i--) {
+        if (i < BATTERY_FS_TOPK) {
+            q->top[i] = q->top[i - 1];
+        }
+    }
+    if (i < BATTERY_FS_TOPK) {
+        q->top[i] = value;
+    }
+    return true;
+}
+
+static void run_topk(void) {
+    uint32_t index_us[BATTERY_FS_TOPK_METRICS], scan_us[BATTERY_FS_TOPK_METRICS];
+    uint32_t mismatches = 0, index_errors = 0, scan_errors = 0;
+
+    for (int m = 0; m < BATTERY_FS_TOPK_METRICS; m++) {
+        battery_fs_rank_t ranks[BATTERY_FS_TOPK];
+        size_t count = 0;
+        topk_scan_t qs = { .metric = m };
+        int64_t t0 = bench_now_us();
+        index_errors += battery_fs_topk(m, ranks, &count) != ESP_OK;
+        int64_t t1 = bench_now_us();
+        scan_errors += battery_fs_foreach(rank_scan, &qs) != ESP_OK;
+        int64_t t2 = bench_now_us();
+
+        index_us[m] = (uint32_t)(t1 - t0);
+        scan_us[m] = (uint32_t)(t2 - t1);
+        scan_errors += qs.errors;
+        bool same = count == qs.count;
+        for (size_t i = 0; same && i < count; i++) {
+            same = ranks[i].value == qs.top[i];
+        }
+        mismatches += !same;
+        ESP_LOGD(TAG, "metric %d: top %ld", m, count ? (long)ranks[0].value : 0L);
+    }
+
+    report("topk_index", index_us, BATTERY_FS_TOPK_METRICS, mismatches, index_errors);
+    report("topk_scan", scan_us, BATTERY_FS_TOPK_METRICS, mismatches, scan_errors);
+}
+
+void bench_flags_run(void) {
+    if (bench_mount_storage(FLAGS_IMAGE, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Storage not available, skipping");
+        return;
+    }
+
+    // Measure storage, not the console
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    battery_fs_delete_all();
+
+    batmon_synth_config_t cfg = { .alarm_permille = FLAGS_ALARM_PERMILLE };
+    char serial[16];
+    for (int p = 0; p < FLAGS_PACKS; p++) {
+        batmon_synth_t synth;
+        batmon_synth_init(&synth, &cfg, p);
+        pack_serial(p, serial, sizeof(serial));
+        for (uint32_t first = 0; first < FLAGS_RECORDS; first += FLAGS_BATCH) {
+            batmon_synth_fill(&synth, s_records, FLAGS_BATCH);
+            for (size_t i = 0; i < FLAGS_BATCH; i++) {
+                s_logs[i] = (battery_log_t){
+                    .memory_index = first + i,
+                    .data = (uint8_t *)&s_records[i],
+                    .data_len = sizeof(BatmonMemory),
+                };
+            }
+            if (battery_fs_write_data(serial, s_logs, FLAGS_BATCH) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to store %s", serial);
+                break;
+            }
+        }
+    }
+
+    run_fleet();
+    run_packs();
+    run_topk();
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    battery_fs_deinit();
+}
@@ -0,0 +1,401 @@
+/**
+ * @file bench_ingest.c
+ * @brief End-to-end ingest: simulated packs -> DataAcquisition -> battery_fs -> spiflash
+ *
+ * A replay harness drives SMBUS_poll() in virtual time. Every tick is one
+ * SMBUS_update period: the scenario's events are applied to the simulated
+ * slots (connects, disconnects, live telemetry) and one poll runs. Packs age
+ * while away from the charger, so each connection exposes the records
+ * logged since the previous one; the synthetic streams wrap the memory ring
+ * and reset, which exercises the new-record, ring-overwrite and
+ * nothing-new paths of battery_fs_write_data().
+ *
+ * Reported per scenario:
+ *  - records_per_s: records stored per second of measured poll time, and
+ *    with the modeled SMBus time added (records_per_s_bus)
+ *  - connect-to-persist latency p50/p99: wait for the next poll (virtual)
+ *    + poll time until the store completes (measured) + bus time (modeled)
+ *  - flash bytes programmed and FAT sectors written per stored record
+ *  - flash bytes read per stored record and the page cache hit rate
+ *  - heap high-water while the scenario runs
+ *
+ * Every scenario runs once per entry of s_cache_pages, from no page cache
+ * up; cached runs report as "<scenario>/cache<pages>".
+ *
+ * The filesystem is wiped before every scenario. On hardware this erases
+ * the battery logs on the chip, run it on a bench unit only.
+ */
+
+#include "bench.h"
+#include "DataAcquisition.h"
+#include "BATMON_sim.h"
+#include "batmon_fixtures.h"
+#include "battery_fs.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <sys/resource.h>
+#else
+#include "esp_heap_caps.h"
+#endif
+
+static const char *TAG = "BENCH_INGEST";
+
+#define POLL_PERIOD_US      1000000     // SMBUS_update period
+#define INGEST_IMAGE        "bench_ingest.img"
+
+#if CONFIG_IDF_TARGET_LINUX
+#define POOL_PACKS          32
+#define POOL_RING           BATMON_SIM_MAX_RECORDS
+#else
+#define POOL_PACKS          12
+#define POOL_RING           128         // Keeps the pack pool within internal RAM
+#endif
+
+// Page cache sizes to replay with, 0 = none
+static const uint32_t s_cache_pages[] = { 0, 16, 64 };
+
+typedef struct {
+    const char *name;
+    bool recorded;                  // Packs from batmon_fixtures instead of batmon_synth
+    uint32_t ticks;                 // Poll periods to replay
+    uint16_t connect_permille;      // Chance an empty slot gets a pack, per tick
+    uint16_t disconnect_permille;   // Chance a pack is pulled, per tick
+    uint16_t new_records_max;       // Records a pack logs while away, 1..max
+    uint32_t reset_interval;        // Synthetic memory resets, 0 = never
+} ingest_scenario_t;
+
+static const ingest_scenario_t s_scenarios[] = {
+    // Recorded packs plugged in and out; only the first download is new
+    { "recorded",       true,  300,  300, 100, 0,  0 },
+    // A charger shift: packs come back from flights with a few new records
+    { "synthetic",      false, 1800, 200, 20,  12, 2000 },
+    // Packs swapped every few seconds, long absences fill and wrap the ring
+    { "synthetic_churn", false, 600, 600, 300, 80, 1000 },
+};
+
+typedef struct {
+    uint16_t hash;
+    batmon_synth_t synth;
+    BatmonMemory *ring;             // Pack memory in memory slot order
+    const BatmonMemory *records;    // What the pack exposes (ring or fixture)
+    size_t record_count;
+    int slot;                       // -1 while on the shelf
+} pool_pack_t;
+
+typedef struct {
+    int pack;                       // -1 when empty
+    int64_t attach_wait_us;         // Virtual time from the attach to the next poll
+    bool pending;                   // Attached, not stored yet
+} slot_t;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static size_t heap_free_now(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    return 0;
+#else
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#endif
+}
+
+/**
+ * @brief Peak heap use since `free_at_start` was sampled
+ *
+ * On hardware this is the heap low-water mark (which covers the whole run
+ * so far). On linux the heap is the process', so peak RSS is reported.
+ */
+static size_t heap_peak_bytes(size_t free_at_start) {
+#if CONFIG_IDF_TARGET_LINUX
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (size_t)ru.ru_maxrss * 1024;
+#else
+    size_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    return free_at_start > min_free ? free_at_start - min_free : 0;
+#endif
+}
+
+// ============================================================================
+// Pack pool
+// ============================================================================
+
+static void pack_expose(pool_pack_t *p) {
+    p->records = p->ring;
+    p->record_count = p->synth.index < POOL_RING ? p->synth.index : POOL_RING;
+}
+
+/**
+ * @brief Log `count` records into the pack's memory ring
+ */
+static void pack_age(pool_pack_t *p, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        BatmonMemory rec;
+        batmon_synth_next(&p->synth, &rec);
+        p->ring[rec.data.memoryIndex] = rec;
+    }
+    pack_expose(p);
+}
+
+static size_t pool_init(pool_pack_t *pool, const ingest_scenario_t *sc, BatmonMemory **ring_buf) {
+    *ring_buf = NULL;
+    if (sc->recorded) {
+        size_t n = batmon_fixture_count < POOL_PACKS ? batmon_fixture_count : POOL_PACKS;
+        for (size_t i = 0; i < n; i++) {
+            const batmon_fixture_t *fx = &batmon_fixtures[i];
+            pool[i] = (pool_pack_t){
+                .hash = (uint16_t)strtoul(fx->name, NULL, 16),
+                .records = fx->records,
+                .record_count = fx->count < BATMON_SIM_MAX_RECORDS ? fx->count : BATMON_SIM_MAX_RECORDS,
+                .slot = -1,
+            };
+        }
+        return n;
+    }
+
+    *ring_buf = malloc((size_t)POOL_PACKS * POOL_RING * sizeof(BatmonMemory));
+    if (*ring_buf == NULL) {
+        return 0;
+    }
+
+    batmon_synth_config_t cfg = {
+        .seed = 0xC0FFEE,
+        .ring_size = POOL_RING,
+        .reset_interval = sc->reset_interval,
+    };
+    for (size_t i = 0; i < POOL_PACKS; i++) {
+        pool_pack_t *p = &pool[i];
+        memset(p, 0, sizeof(*p));
+        batmon_synth_init(&p->synth, &cfg, i);
+        p->hash = p->synth.serial;
+        p->ring = *ring_buf + i * POOL_RING;
+        p->slot = -1;
+        // Packs arrive with part of their history already logged
+        pack_age(p, 1 + p->synth.rng % (POOL_RING / 2));
+    }
+    return POOL_PACKS;
+}
+
+// ============================================================================
+// Replay
+// ============================================================================
+
+static void run_scenario(const ingest_scenario_t *sc, uint32_t cache_pages) {
+    static pool_pack_t pool[POOL_PACKS];
+    slot_t slots[NO_BATMON];
+    BatmonMemory *ring_buf;
+
+    size_t pack_count = pool_init(pool, sc, &ring_buf);
+    size_t max_events = (size_t)sc->ticks * NO_BATMON;
+    uint32_t *latency_us = malloc(max_events * sizeof(uint32_t));
+    uint32_t *persist_us = malloc(max_events * sizeof(uint32_t));
+    if (pack_count == 0 || latency_us == NULL || persist_us == NULL) {
+        ESP_LOGE(TAG, "%s: out of memory", sc->name);
+        free(ring_buf);
+        free(latency_us);
+        free(persist_us);
+        return;
+    }
+
+    // Fresh slots and storage
+    for (int i = 0; i < NO_BATMON; i++) {
+        BATMON_simDetach(BATMON_addresses[i]);
+        slots[i] = (slot_t){ .pack = -1 };
+    }
+    SMBUS_poll();
+    for (int i = 0; i < NO_BATMON; i++) {
+        memset(&battery_state[i], 0, sizeof(battery_state[i]));
+        battery_state[i].address = BATMON_addresses[i];
+    }
+    battery_fs_delete_all();
+    battery_fs_reset_stats();
+    BATMON_simResetStats();
+
+    size_t heap_start = heap_free_now();
+    uint32_t seed = 0x5EED0000 ^ sc->ticks;
+    size_t events = 0;
+    int64_t poll_time_us = 0;
+    // SMBUS_update polls every period, or back to back once a poll with
+    // downloads takes longer than that
+    int64_t poll_interval_us = POLL_PERIOD_US;
+
+    for (uint32_t tick = 0; tick < sc->ticks; tick++) {
+        // Events that happened since the previous poll
+        for (int i = 0; i < NO_BATMON; i++) {
+            slot_t *slot = &slots[i];
+            if (slot->pack >= 0) {
+                pool_pack_t *p = &pool[slot->pack];
+                if (bench_rand(&seed) % 1000 < sc->disconnect_permille) {
+                    BATMON_simDetach(BATMON_addresses[i]);
+                    p->slot = -1;
+                    slot->pack = -1;
+                    slot->pending = false;
+                    // Flies while away
+                    if (!sc->recorded) {
+                        pack_age(p, 1 + bench_rand(&seed) % sc->new_records_max);
+                    }
+                } else {
+                    BATMON_simSetTelemetry(BATMON_addresses[i], 20 + bench_rand(&seed) % 81,
+                                           (int16_t)(bench_rand(&seed) % 10000));
+                }
+                continue;
+            }
+
+            if (bench_rand(&seed) % 1000 >= sc->connect_permille) {
+                continue;
+            }
+            // Pick a pack from the shelf
+            size_t start = bench_rand(&seed) % pack_count;
+            for (size_t k = 0; k < pack_count; k++) {
+                pool_pack_t *p = &pool[(start + k) % pack_count];
+                if (p->slot >= 0) {
+                    continue;
+                }
+                batmon_sim_pack_t sim = {
+                    .hash = p->hash,
+                    .soc = 20 + bench_rand(&seed) % 81,
+                    .current_ma = 5000,
+                    .records = p->records,
+                    .record_count = p->record_count,
+                };
+                if (BATMON_simAttach(BATMON_addresses[i], &sim) == ESP_OK) {
+                    p->slot = i;
+                    slot->pack = (start + k) % pack_count;
+                    slot->pending = true;
+                    slot->attach_wait_us = poll_interval_us - bench_rand(&seed) % poll_interval_us;
+                }
+                break;
+            }
+        }
+
+        // Bus time per slot is only known after the poll
+        uint64_t bus_before[NO_BATMON];
+        for (int i = 0; i < NO_BATMON; i++) {
+            batmon_sim_stats_t st;
+            BATMON_simGetStats(BATMON_addresses[i], &st);
+            bus_before[i] = st.bus_us;
+        }
+
+        int64_t poll_start = bench_now_us();
+        SMBUS_poll();
+        int64_t poll_us = bench_now_us() - poll_start;
+        poll_time_us += poll_us;
+
+        // Slots are polled in order, so a store waits for the bus traffic of
+        // every slot before it
+        uint64_t bus_so_far = 0;
+        for (int i = 0; i < NO_BATMON; i++) {
+            batmon_sim_stats_t st;
+            BATMON_simGetStats(BATMON_addresses[i], &st);
+            bus_so_far += st.bus_us - bus_before[i];
+
+            slot_t *slot = &slots[i];
+            if (!slot->pending || !battery_state[i].is_connected) {
+                continue;
+            }
+            slot->pending = false;
+            if (battery_state[i].persisted_us == 0) {
+                continue;   // Nothing stored (empty memory or failure)
+            }
+
+            int64_t persist = battery_state[i].persisted_us - poll_start + bus_so_far;
+            persist_us[events] = (uint32_t)persist;
+            latency_us[events] = (uint32_t)(slot->attach_wait_us + persist);
+            events++;
+        }
+        poll_interval_us = poll_us + (int64_t)bus_so_far;
+        if (poll_interval_us < POLL_PERIOD_US) {
+            poll_interval_us = POLL_PERIOD_US;
+        }
+    }
+
+    size_t heap_peak = heap_peak_bytes(heap_start);
+
+    battery_fs_stats_t fs;
+    batmon_sim_stats_t bus;
+    battery_fs_get_stats(&fs);
+    BATMON_simGetStats(0, &bus);
+
+    uint32_t connects = 0, read_errors = 0, save_errors = 0;
+    for (int i = 0; i < NO_BATMON; i++) {
+        connects += battery_state[i].connects;
+        read_errors += battery_state[i].read_errors;
+        save_errors += battery_state[i].save_errors;
+    }
+
+    bench_sort_u32(latency_us, events);
+    bench_sort_u32(persist_us, events);
+
+    double records = fs.records_written;
+    double poll_s = poll_time_us / 1e6;
+    double bus_s = bus.bus_us / 1e6;
+    uint32_t lookups = fs.flash_cache_hits + fs.flash_cache_misses;
+    char name[48];
+    if (cache_pages) {
+        snprintf(name, sizeof(name), "%s/cache%lu", sc->name, (unsigned long)cache_pages);
+    } else {
+        snprintf(name, sizeof(name), "%s", sc->name);
+    }
+    bench_report("ingest", name,
+                 "\"ticks\":%lu,\"connects\":%lu,\"stored_connects\":%u,"
+                 "\"records_read\":%lu,\"records_stored\":%lu,"
+                 "\"read_errors\":%lu,\"save_errors\":%lu,"
+                 "\"poll_seconds\":%.3f,\"bus_seconds\":%.3f,"
+                 "\"records_per_s\":%.0f,\"records_per_s_bus\":%.0f,"
+                 "\"latency_p50_us\":%lu,\"latency_p99_us\":%lu,"
+                 "\"persist_p50_us\":%lu,\"persist_p99_us\":%lu,"
+                 "\"flash_bytes_per_record\":%.0f,\"fat_bytes_per_record\":%.0f,"
+                 "\"flash_blocks_erased\":%lu,\"flash_read_bytes_per_record\":%.0f,"
+                 "\"cache_pages\":%lu,\"cache_hit_rate\":%.3f,\"heap_peak_bytes\":%u",
+                 (unsigned long)sc->ticks, (unsigned long)connects, (unsigned)events,
+                 (unsigned long)bus.records_read, (unsigned long)fs.records_written,
+                 (unsigned long)read_errors, (unsigned long)save_errors,
+                 poll_s, bus_s,
+                 poll_s > 0 ? records / poll_s : 0, poll_s + bus_s > 0 ? records / (poll_s + bus_s) : 0,
+                 (unsigned long)bench_percentile(latency_us, events, 50),
+                 (unsigned long)bench_percentile(latency_us, events, 99),
+                 (unsigned long)bench_percentile(persist_us, events, 50),
+                 (unsigned long)bench_percentile(persist_us, events, 99),
+                 records ? fs.flash_bytes_programmed / records : 0,
+                 records ? (double)fs.sectors_written * fs.sector_size / records : 0,
+                 (unsigned long)fs.flash_blocks_erased, records ? fs.flash_bytes_read / records : 0,
+                 (unsigned long)cache_pages, lookups ? (double)fs.flash_cache_hits / lookups : 0,
+                 (unsigned)heap_peak);
+
+    for (int i = 0; i < NO_BATMON; i++) {
+        BATMON_simDetach(BATMON_addresses[i]);
+    }
+    for (size_t i = 0; i < pack_count; i++) {
+        pool[i].slot = -1;
+    }
+    free(ring_buf);
+    free(latency_us);
+    free(persist_us);
+}
+
+void bench_ingest_run(void) {
+    init_i2c_bus();
+    init_batmon_devices();
+
+    for (size_t c = 0; c < sizeof(s_cache_pages) / sizeof(s_cache_pages[0]); c++) {
+        if (bench_mount_storage_cached(INGEST_IMAGE, false, s_cache_pages[c]) != ESP_OK) {
+            ESP_LOGE(TAG, "Storage not available, skipping");
+            return;
+        }
+
+        // Measure storage, not the console
+        esp_log_level_set("*", ESP_LOG_ERROR);
+
+        for (size_t i = 0; i < sizeof(s_scenarios) / sizeof(s_scenarios[0]); i++) {
+            run_scenario(&s_scenarios[i], s_cache_pages[c]);
+        }
+
+        esp_log_level_set("*", ESP_LOG_INFO);
+        battery_fs_deinit();
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * @file bench_main.c
+ * @brief Benchmark app entry point
+ */
+
+#include "bench.h"
+#include "battery_fs.h"
+#include "spiflash.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <unistd.h>
+#else
+#include "driver/spi_common.h"
+#endif
+
+static const char *TAG = "BENCH";
+
+#define BENCH_FTL_BLOCKS    256         // Image size on linux
+
+static const bench_suite_t s_suites[] = {
+    { "decode", bench_decode_run },
+    { "ingest", bench_ingest_run },
+    { "spiflash", bench_spiflash_run },
+    { "evtrace", bench_evtrace_run },
+    { "export", bench_export_run },
+    { "fault", bench_fault_run },
+    { "poll", bench_poll_run },
+    { "flags", bench_flags_run },
+    { "tlm", bench_tlm_run },
+    { "cdc", bench_cdc_run },
+};
+
+int64_t bench_now_us(void) {
+    return esp_timer_get_time();
+}
+
+void bench_report(const char *suite, const char *name, const char *fields_fmt, ...) {
+    va_list ap;
+    va_start(ap, fields_fmt);
+    printf(BENCH_JSON_PREFIX "{\"suite\":\"%s\",\"case\":\"%s\",\"target\":\"%s\",",
+           suite, name, CONFIG_IDF_TARGET);
+    vprintf(fields_fmt, ap);
+    printf("}\n");
+    va_end(ap);
+    fflush(stdout);
+}
+
+uint32_t bench_rand(uint32_t *state) {
+    // xorshift32
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+esp_err_t bench_mount_storage(const char *image, bool realtime) {
+    return bench_mount_storage_cached(image, realtime, 0);
+}
+
+esp_err_t bench_mount_storage_cached(const char *image, bool realtime, uint32_t cache_pages) {
+    battery_fs_config_t config = {
+        .backend = BATTERY_FS_BACKEND_SPIFLASH,
+        .mount_point = "/nandflash",
+        .format_if_failed = true,
+        .page_cache_pages = cache_pages,
+#if CONFIG_IDF_TARGET_LINUX
+        .image_path = image,
+        .image_size = BENCH_FTL_BLOCKS * SPIFLASH_RAW_BLOCK_SIZE,
+        .ftl_blocks = BENCH_FTL_BLOCKS,
+        .flash_realtime = realtime,
+#else
+        // Same wiring as the firmware (main.c)
+        .spi_host = SPI2_HOST,
+        .pin_mosi = 5,
+        .pin_miso = 4,
+        .pin_sclk = 6,
+        .pin_cs = 17,
+        .pin_wp = 2,
+        .pin_hd = 4,
+        .clock_speed_hz = 40000000,
+#endif
+    };
+
+#if CONFIG_IDF_TARGET_LINUX
+    unlink(image);          // Every run starts from an erased chip
+#endif
+    return battery_fs_init(&config);
+}
+
+void app_main(void) {
+    ESP_LOGI(TAG, "Running %d suites", (int)(sizeof(s_suites) / sizeof(s_suites[0])));
+
+    for (size_t i = 0; i < sizeof(s_suites) / sizeof(s_suites[0]); i++) {
+        ESP_LOGI(TAG, "Suite: %s", s_suites[i].name);
+        s_suites[i].run();
+        // Let the idle task run between suites
+        vTaskDelay(1);
+    }
+
+    ESP_LOGI(TAG, "Done");
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
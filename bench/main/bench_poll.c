@@ -0,0 +1,273 @@
+/**
+ * @file bench_poll.c
+ * @brief SMBus polling: bus use and detection latency with mixed slot states
+ *
+ * A discrete-event replay in virtual time over the simulated slots. Every
+ * slot lives its own pack cycle: empty for a while, a pack is inserted, it
+ * charges through the CV transition to the end of charge, sits idle and is
+ * pulled. The last slots are spares that stay empty for long stretches.
+ * Cases:
+ *  - flat_1s:    SMBUS_poll() every second, the former SMBUS_update loop
+ *  - flat_100ms: the same every 100 ms, the CV latency adaptive aims for
+ *  - adaptive:   SMBUS_poll_due() with the default per-slot rates
+ *
+ * Reported per case: transactions per second and modeled bus utilization
+ * over the virtual time, and the delay from an event to the poll that
+ * notices it, p50/p99/max, for insertions and removals (presence) and for
+ * reaching CV and the end of charge (charge). An event superseded before
+ * it was noticed (a pack pulled right after insertion) counts as missed.
+ *
+ * Packs have empty memories, so storage stays out of the measurement.
+ */
+
+#include "bench.h"
+#include "DataAcquisition.h"
+#include "BATMON_sim.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_POLL";
+
+#define POLL_DURATION_US    (3600LL * 1000000)  // Virtual time per case
+#define POLL_SPARE_SLOTS    3                   // Last slots, rarely used
+#define POLL_MAX_EVENTS     4096                // Per event kind
+#define POLL_CHARGE_MA      3000
+#define POLL_SECOND_US      1000000LL
+
+typedef struct {
+    const char *name;
+    int64_t flat_period_us;         // 0 = SMBUS_poll_due()
+} poll_case_t;
+
+static const poll_case_t s_cases[] = {
+    { "flat_1s", 1000000 },
+    { "flat_100ms", 100000 },
+    { "adaptive", 0 },
+};
+
+typedef enum {
+    PACK_ABSENT,
+    PACK_CHARGING,                  // Below the CV transition
+    PACK_CHARGE_CV,
+    PACK_IDLE,
+} pack_phase_t;
+
+typedef enum {
+    EVENT_PRESENCE,                 // Inserted or pulled
+    EVENT_CHARGE,                   // Reached CV or finished charging
+    EVENT_KINDS
+} event_kind_t;
+
+typedef struct {
+    pack_phase_t phase;
+    int64_t next_us;                // Next phase change
+    uint16_t soc;
+    // The last change not noticed yet
+    bool pending;
+    event_kind_t kind;
+    int64_t at_us;
+    slot_class_t expect;
+} slot_sim_t;
+
+typedef struct {
+    uint32_t *delay_us;
+    size_t count;
+    uint32_t missed;
+} event_stats_t;
+
+// Anywhere between two polls, not on whole seconds
+static int64_t rand_us(uint32_t *seed, uint32_t min_s, uint32_t max_s) {
+    return min_s * POLL_SECOND_US + bench_rand(seed) % ((max_s - min_s) * POLL_SECOND_US + 1);
+}
+
+// ============================================================================
+// Slot model
+// ============================================================================
+
+static void expect_change(slot_sim_t *s, event_stats_t *stats, event_kind_t kind, int64_t now,
+                          slot_class_t expect) {
+    if (s->pending) {
+        stats[s->kind].missed++;
+    }
+    s->pending = true;
+    s->kind = kind;
+    s->at_us = now;
+    s->expect = expect;
+}
+
+/**
+ * @brief Move slot i to its next phase at `now`
+ */
+static void slot_step(int i, slot_sim_t *s, event_stats_t *stats, uint32_t *seed, int64_t now) {
+    uint8_t address = BATMON_addresses[i];
+    bool spare = i >= NO_BATMON - POLL_SPARE_SLOTS;
+
+    switch (s->phase) {
+    case PACK_ABSENT: {
+        // Some packs come back full from the shelf
+        bool full = bench_rand(seed) % 10 < 3;
+        s->soc = full ? 100 : 20 + bench_rand(seed) % 50;
+        batmon_sim_pack_t pack = {
+            .hash = (uint16_t)bench_rand(seed),
+            .soc = s->soc,
+            .current_ma = full ? 0 : POLL_CHARGE_MA,
+        };
+        BATMON_simAttach(address, &pack);
+        if (full) {
+            s->phase = PACK_IDLE;
+            s->next_us = now + rand_us(seed, 30, 300);
+            expect_change(s, stats, EVENT_PRESENCE, now, SLOT_IDLE);
+        } else {
+            // About 4 s per percent in constant current
+            s->phase = PACK_CHARGING;
+            s->next_us = now + (int64_t)(80 - s->soc) * 4 * POLL_SECOND_US;
+            expect_change(s, stats, EVENT_PRESENCE, now, SLOT_CHARGING);
+        }
+        break;
+    }
+    case PACK_CHARGING:
+        s->soc = 80;
+        BATMON_simSetTelemetry(address, s->soc, POLL_CHARGE_MA);
+        s->phase = PACK_CHARGE_CV;
+        s->next_us = now + rand_us(seed, 60, 180);
+        expect_change(s, stats, EVENT_CHARGE, now, SLOT_CHARGE_CV);
+        break;
+    case PACK_CHARGE_CV:
+        s->soc = 100;
+        BATMON_simSetTelemetry(address, s->soc, 0);
+        s->phase = PACK_IDLE;
+        s->next_us = now + rand_us(seed, 30, 300);
+        expect_change(s, stats, EVENT_CHARGE, now, SLOT_IDLE);
+        break;
+    case PACK_IDLE:
+        BATMON_simDetach(address);
+        s->phase = PACK_ABSENT;
+        s->next_us = now + (spare ? rand_us(seed, 300, 1200) : rand_us(seed, 5, 60));
+        expect_change(s, stats, EVENT_PRESENCE, now, SLOT_EMPTY);
+        break;
+    }
+}
+
+/**
+ * @brief Record the changes the last poll noticed
+ */
+static void check_noticed(slot_sim_t *slots, event_stats_t *stats, int64_t now) {
+    for (int i = 0; i < NO_BATMON; i++) {
+        slot_sim_t *s = &slots[i];
+        if (!s->pending || battery_state[i].poll_class != s->expect) {
+            continue;
+        }
+        event_stats_t *st = &stats[s->kind];
+        if (st->count < POLL_MAX_EVENTS) {
+            st->delay_us[st->count++] = (uint32_t)(now - s->at_us);
+        }
+        s->pending = false;
+    }
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+static void report_events(const poll_case_t *c, const char *kind, event_stats_t *st,
+                          const batmon_sim_stats_t *bus) {
+    bench_sort_u32(st->delay_us, st->count);
+    size_t n = st->count;
+    double seconds = POLL_DURATION_US / 1e6;
+    bench_report("poll", c->name,
+                 "\"events\":\"%s\",\"transactions_per_s\":%.1f,\"bus_util_pct\":%.3f,"
+                 "\"detected\":%u,\"missed\":%lu,"
+                 "\"delay_p50_ms\":%.1f,\"delay_p99_ms\":%.1f,\"delay_max_ms\":%.1f",
+                 kind, bus->transactions / seconds, bus->bus_us * 100.0 / POLL_DURATION_US,
+                 (unsigned)n, (unsigned long)st->missed,
+                 bench_percentile(st->delay_us, n, 50) / 1e3, bench_percentile(st->delay_us, n, 99) / 1e3,
+                 bench_percentile(st->delay_us, n, 100) / 1e3);
+}
+
+static void run_case(const poll_case_t *c, event_stats_t *stats) {
+    slot_sim_t slots[NO_BATMON];
+    uint32_t seed = 0x9011C0DE;
+
+    // Fresh slots: the first insertion of each comes after a random wait
+    for (int i = 0; i < NO_BATMON; i++) {
+        BATMON_simDetach(BATMON_addresses[i]);
+        memset(&battery_state[i], 0, sizeof(battery_state[i]));
+        battery_state[i].address = BATMON_addresses[i];
+        slots[i] = (slot_sim_t){ .phase = PACK_ABSENT, .next_us = rand_us(&seed, 0, 30) };
+    }
+    for (int k = 0; k < EVENT_KINDS; k++) {
+        stats[k].count = 0;
+        stats[k].missed = 0;
+    }
+    SMBUS_schedule_reset(0);
+    BATMON_simResetStats();
+
+    int64_t now = 0, next_poll = 0;
+    while (now < POLL_DURATION_US) {
+        int64_t next_event = INT64_MAX;
+        for (int i = 0; i < NO_BATMON; i++) {
+            if (slots[i].next_us < next_event) {
+                next_event = slots[i].next_us;
+            }
+        }
+
+        // Changes first when both fall on the same instant
+        if (next_event <= next_poll) {
+            now = next_event;
+            for (int i = 0; i < NO_BATMON; i++) {
+                if (slots[i].next_us <= now) {
+                    slot_step(i, &slots[i], stats, &seed, now);
+                }
+            }
+            continue;
+        }
+
+        now = next_poll;
+        if (c->flat_period_us) {
+            SMBUS_poll();
+            next_poll = now + c->flat_period_us;
+        } else {
+            next_poll = SMBUS_poll_due(now);
+        }
+        check_noticed(slots, stats, now);
+    }
+
+    batmon_sim_stats_t bus;
+    BATMON_simGetStats(0, &bus);
+    report_events(c, "presence", &stats[EVENT_PRESENCE], &bus);
+    report_events(c, "charge", &stats[EVENT_CHARGE], &bus);
+
+    for (int i = 0; i < NO_BATMON; i++) {
+        BATMON_simDetach(BATMON_addresses[i]);
+    }
+}
+
+void bench_poll_run(void) {
+    event_stats_t stats[EVENT_KINDS] = {0};
+    for (int k = 0; k < EVENT_KINDS; k++) {
+        stats[k].delay_us = malloc(POLL_MAX_EVENTS * sizeof(uint32_t));
+        if (stats[k].delay_us == NULL) {
+            ESP_LOGE(TAG, "Out of memory");
+            for (int j = 0; j < k; j++) {
+                free(stats[j].delay_us);
+            }
+            return;
+        }
+    }
+
+    init_i2c_bus();
+    init_batmon_devices();
+
+    // Every insertion and removal is logged
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        run_case(&s_cases[i], stats);
+    }
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    for (int k = 0; k < EVENT_KINDS; k++) {
+        free(stats[k].delay_us);
+    }
+}
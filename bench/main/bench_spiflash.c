@@ -0,0 +1,886 @@
+/**
+ * @file bench_spiflash.c
+ * @brief spiflash primitives: page reads, programs and block erases
+ *
+ * Every case runs at each SPI clock and mode in the sweep. Per operation
+ * the time is split into:
+ *  - spi_us:  SPI transactions that move commands and data
+ *  - busy_us: spiflash_wait_ready(), i.e. the chip's array time and the
+ *             status polls spent waiting for it
+ *  - sw_us:   everything else in the driver and the caller
+ *
+ * On hardware spi_us and busy_us are measured by the driver and sw_us is
+ * what is left of the wall time. On linux the image-backed driver models
+ * spi_us and busy_us from the clock and the chip's typical array times,
+ * and sw_us is the measured wall time.
+ *
+ * The contention cases share one handle between reader and writer tasks
+ * for a fixed time at the default clock. Writers erase and program their
+ * own blocks with self-checking pages, readers read random pages of all
+ * writers and check them. Every page read must be erased or intact; a
+ * torn page means two command sequences interleaved. Latency is per call,
+ * waiting for the handle included.
+ *
+ * The iosched cases run a foreground task persisting bursts of pages, an
+ * export task reading page runs and a compaction task erasing and copying
+ * blocks, first calling spiflash directly, then through a spiflash_sched
+ * with one class each. Reported per class: call latency, and for the
+ * scheduled run the queue wait, late and promoted operations and held
+ * back erases. On linux these cases hold the handle for the modeled time
+ * of each call (model_realtime), so waits are at device speed.
+ *
+ * The scan cases read the sequentially programmed blocks in order, the
+ * way an export does: without a page cache, with one, and with read-ahead
+ * into it. Reported against the raw bus rate of the clock (bus_fraction).
+ * Read-ahead only runs on chips with the 31h/3Fh cache read; on linux the
+ * cache_read cases model one, on hardware the chip decides. The borrow
+ * case parses the pages in place with spiflash_borrow_page() instead of
+ * copying them out; bytes copied are reported per page and per stored
+ * record (header and BatmonMemory image). Every scan case also checks
+ * that the page past the end of the chip is rejected (past_end_rejected)
+ * rather than returned as ESP_OK, borrowed in the borrow case.
+ *
+ * On hardware the cases erase and program BENCH_FLASH_BLOCKS blocks at
+ * the end of the chip, away from battery_fs, which only manages the first
+ * blocks. Their contents are lost.
+ */
+
+#include "bench.h"
+#include "spiflash.h"
+#include "spiflash_sched.h"
+#include "battery_fs_format.h"
+#include "Batmon_struct.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <string.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include <unistd.h>
+#else
+#include "driver/spi_common.h"
+#endif
+
+static const char *TAG = "BENCH_SPIFLASH";
+
+#define BENCH_FLASH_BLOCKS      32
+#define BENCH_SEQ_BLOCKS        4       // Blocks programmed and read back sequentially
+#define BENCH_READ_OPS          256
+
+#if CONFIG_IDF_TARGET_LINUX
+#define BENCH_FLASH_IMAGE       "bench_spiflash.img"
+#define BENCH_FLASH_FIRST_BLOCK 0
+static const int s_modes[] = { 0 };     // No bus, the mode changes nothing
+#else
+#define BENCH_FLASH_FIRST_BLOCK (SPIFLASH_TOTAL_BLOCKS - BENCH_FLASH_BLOCKS)
+static const int s_modes[] = { 0, 3 };
+#endif
+
+static const int s_clocks_hz[] = { 10000000, 20000000, 40000000 };
+
+#define CONTENTION_CLOCK_HZ         40000000
+#define CONTENTION_TIME_US          2000000
+#define CONTENTION_WRITER_BLOCKS    4       // Blocks each writer cycles through
+#define CONTENTION_SAMPLES          2048    // Latencies kept per task, the first ones
+#define CONTENTION_TASK_STACK       3072
+
+#define IOSCHED_TIME_US             2000000
+#define IOSCHED_FG_PERIOD_MS        20      // One persisted pack per period
+#define IOSCHED_FG_BURST            4       // Pages per pack: records, FAT, directory, metadata
+#define IOSCHED_EXPORT_RUN          16      // Pages per export read
+#define IOSCHED_BLOCKS_PER_TASK     2
+
+#define SCAN_CLOCK_HZ               40000000
+#define SCAN_CACHE_PAGES            64
+#define SCAN_READAHEAD_PAGES        16
+#define SCAN_RECORD_BYTES           (sizeof(battery_fs_record_header_t) + sizeof(BatmonMemory))
+
+typedef struct {
+    const char *name;
+    uint32_t cache_pages;
+    uint32_t readahead_pages;
+    bool cache_read;            // Modeled on linux only
+    bool borrow;                // Parse in place instead of copying
+} scan_case_t;
+
+static const scan_case_t s_scan_cases[] = {
+    { "scan", 0, 0, false, false },
+    { "scan_cached", SCAN_CACHE_PAGES, 0, false, false },
+    { "scan_readahead", SCAN_CACHE_PAGES, SCAN_READAHEAD_PAGES, false, false },
+#if CONFIG_IDF_TARGET_LINUX
+    { "scan_readahead_cache_read", SCAN_CACHE_PAGES, SCAN_READAHEAD_PAGES, true, false },
+#endif
+    { "scan_borrow", SCAN_CACHE_PAGES, SCAN_READAHEAD_PAGES, true, true },
+};
+
+typedef struct {
+    const char *name;
+    int readers;
+    int writers;
+} contention_case_t;
+
+static const contention_case_t s_contention_cases[] = {
+    { "contention_1r1w", 1, 1 },
+    { "contention_3r2w", 3, 2 },
+};
+
+typedef enum {
+    OP_READ,
+    OP_PROGRAM,
+    OP_ERASE,
+} op_kind_t;
+
+typedef struct {
+    spiflash_handle_t *flash;
+    uint8_t *page;
+    uint32_t *op_us;        // Per-operation totals, for the percentiles
+    uint32_t seed;
+} flash_ctx_t;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint32_t bench_page(uint32_t block, uint32_t page) {
+    return (BENCH_FLASH_FIRST_BLOCK + block) * SPIFLASH_PAGES_PER_BLOCK + page;
+}
+
+static spiflash_config_t flash_config(int clock_hz, int mode, bool realtime) {
+    return (spiflash_config_t){
+#if CONFIG_IDF_TARGET_LINUX
+        .image_path = BENCH_FLASH_IMAGE,
+        .image_blocks = BENCH_FLASH_BLOCKS,
+        .model_realtime = realtime,
+#else
+        // Same wiring as the firmware (main.c)
+        .host_id = SPI2_HOST,
+        .pin_mosi = 5,
+        .pin_miso = 4,
+        .pin_sclk = 6,
+        .pin_cs = 17,
+#endif
+        .clock_speed_hz = clock_hz,
+        .spi_mode = mode,
+    };
+}
+
+static esp_err_t flash_open(int clock_hz, int mode, bool realtime, spiflash_handle_t **flash) {
+    spiflash_config_t config = flash_config(clock_hz, mode, realtime);
+    return spiflash_init(&config, flash);
+}
+
+/**
+ * @brief Run one operation, return its time split like the report
+ */
+static esp_err_t run_op(flash_ctx_t *ctx, op_kind_t kind, uint32_t target,
+                        uint64_t *wall_us, uint64_t *spi_us, uint64_t *busy_us) {
+    spiflash_stats_t before, after;
+    spiflash_get_stats(ctx->flash, &before);
+
+    esp_err_t ret;
+    int64_t start = bench_now_us();
+    switch (kind) {
+    case OP_READ:
+        ret = spiflash_read_page(ctx->flash, target, ctx->page);
+        break;
+    case OP_PROGRAM:
+        ret = spiflash_write_page(ctx->flash, target, ctx->page);
+        break;
+    default:
+        ret = spiflash_erase_block(ctx->flash, target);
+        break;
+    }
+    *wall_us = bench_now_us() - start;
+
+    spiflash_get_stats(ctx->flash, &after);
+    *spi_us = after.spi_us - before.spi_us;
+    *busy_us = after.busy_us - before.busy_us;
+    return ret;
+}
+
+/**
+ * @brief Time `count` operations on `targets` and print one result
+ */
+static void run_case(flash_ctx_t *ctx, const char *name, op_kind_t kind,
+                     const uint32_t *targets, size_t count, int clock_hz, int mode) {
+    uint64_t spi_total = 0, busy_total = 0, sw_total = 0;
+    size_t bytes_per_op = kind == OP_ERASE ? SPIFLASH_BLOCK_SIZE : SPIFLASH_PAGE_SIZE;
+    spiflash_stats_t before, after;
+    spiflash_get_stats(ctx->flash, &before);
+
+    for (size_t i = 0; i < count; i++) {
+        if (kind == OP_PROGRAM) {
+            // Fresh data per page so nothing is served from a stale buffer
+            for (size_t j = 0; j < SPIFLASH_PAGE_SIZE; j += 4) {
+                uint32_t r = bench_rand(&ctx->seed);
+                memcpy(ctx->page + j, &r, 4);
+            }
+        }
+
+        uint64_t wall, spi, busy;
+        if (run_op(ctx, kind, targets[i], &wall, &spi, &busy) != ESP_OK) {
+            ESP_LOGE(TAG, "%s failed at %lu", name, (unsigned long)targets[i]);
+            return;
+        }
+
+#if CONFIG_IDF_TARGET_LINUX
+        uint64_t sw = wall;                 // Modeled time was not spent
+#else
+        uint64_t sw = wall > spi + busy ? wall - spi - busy : 0;
+#endif
+        spi_total += spi;
+        busy_total += busy;
+        sw_total += sw;
+        ctx->op_us[i] = (uint32_t)(spi + busy + sw);
+    }
+
+    spiflash_get_stats(ctx->flash, &after);
+    bench_sort_u32(ctx->op_us, count);
+
+    double total_us = (double)(spi_total + busy_total + sw_total);
+    bench_report("spiflash", name,
+                 "\"clock_hz\":%d,\"spi_mode\":%d,\"ops\":%u,"
+                 "\"op_us\":%.1f,\"spi_us\":%.1f,\"busy_us\":%.1f,\"sw_us\":%.1f,"
+                 "\"op_p50_us\":%lu,\"op_p99_us\":%lu,\"busy_polls_per_op\":%.1f,"
+                 "\"mb_per_s\":%.2f",
+                 clock_hz, mode, (unsigned)count,
+                 total_us / count, (double)spi_total / count,
+                 (double)busy_total / count, (double)sw_total / count,
+                 (unsigned long)bench_percentile(ctx->op_us, count, 50),
+                 (unsigned long)bench_percentile(ctx->op_us, count, 99),
+                 (double)(after.busy_polls - before.busy_polls) / count,
+                 total_us > 0 ? (double)bytes_per_op * count / total_us : 0);
+}
+
+// ============================================================================
+// Contention
+// ============================================================================
+
+typedef struct {
+    spiflash_handle_t *flash;
+    bool writer;
+    int index;                  // Among the tasks of its kind
+    int writers;                // Writers in the case, whose blocks readers pick from
+    volatile bool *stop;
+    SemaphoreHandle_t done;
+    uint32_t seed;
+    uint32_t ops, errors, torn;
+    uint32_t *lat_us;
+    size_t lat_count;
+} contender_t;
+
+/**
+ * @brief Fill a page that can be checked on its own: page number, seed,
+ * then PRNG output from that seed
+ */
+static void fill_check_page(uint8_t *page, uint32_t page_num, uint32_t seed) {
+    memcpy(page, &page_num, 4);
+    memcpy(page + 4, &seed, 4);
+    uint32_t state = seed | 1;
+    for (size_t j = 8; j < SPIFLASH_PAGE_SIZE; j += 4) {
+        uint32_t r = bench_rand(&state);
+        memcpy(page + j, &r, 4);
+    }
+}
+
+static bool page_intact(const uint8_t *page, uint32_t page_num, uint8_t *scratch) {
+    bool erased = true;
+    for (size_t j = 0; j < SPIFLASH_PAGE_SIZE && erased; j++) {
+        erased = page[j] == 0xFF;
+    }
+    if (erased) {
+        return true;
+    }
+
+    uint32_t seed;
+    memcpy(&seed, page + 4, 4);
+    fill_check_page(scratch, page_num, seed);
+    return memcmp(page, scratch, SPIFLASH_PAGE_SIZE) == 0;
+}
+
+static void contender_record(contender_t *c, int64_t start) {
+    if (c->lat_count < CONTENTION_SAMPLES) {
+        c->lat_us[c->lat_count++] = (uint32_t)(bench_now_us() - start);
+    }
+    c->ops++;
+}
+
+static void contender_task(void *arg) {
+    contender_t *c = arg;
+    uint8_t *page = malloc(SPIFLASH_PAGE_SIZE);
+    uint8_t *scratch = malloc(SPIFLASH_PAGE_SIZE);
+
+    if (page == NULL || scratch == NULL) {
+        c->errors++;
+    } else if (c->writer) {
+        uint32_t first_block = c->index * CONTENTION_WRITER_BLOCKS;
+        for (uint32_t n = 0; !*c->stop; n++) {
+            uint32_t block = first_block + n % CONTENTION_WRITER_BLOCKS;
+            int64_t start = bench_now_us();
+            if (spiflash_erase_block(c->flash, BENCH_FLASH_FIRST_BLOCK + block) != ESP_OK) {
+                c->errors++;
+                continue;
+            }
+            contender_record(c, start);
+
+            for (uint32_t p = 0; p < SPIFLASH_PAGES_PER_BLOCK && !*c->stop; p++) {
+                uint32_t page_num = bench_page(block, p);
+                fill_check_page(page, page_num, bench_rand(&c->seed));
+                start = bench_now_us();
+                if (spiflash_write_page(c->flash, page_num, page) != ESP_OK) {
+                    c->errors++;
+                    continue;
+                }
+                contender_record(c, start);
+            }
+        }
+    } else {
+        uint32_t pages = c->writers * CONTENTION_WRITER_BLOCKS * SPIFLASH_PAGES_PER_BLOCK;
+        while (!*c->stop) {
+            uint32_t page_num = bench_page(0, bench_rand(&c->seed) % pages);
+            int64_t start = bench_now_us();
+            if (spiflash_read_page(c->flash, page_num, page) != ESP_OK) {
+                c->errors++;
+                continue;
+            }
+            contender_record(c, start);
+            if (!page_intact(page, page_num, scratch)) {
+                c->torn++;
+            }
+        }
+    }
+
+    free(page);
+    free(scratch);
+    xSemaphoreGive(c->done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Merge the latencies of one kind of task and print the result
+ */
+static void report_contention(const contention_case_t *cc, const char *role, contender_t *tasks,
+                              int count, uint32_t *merged, int64_t elapsed_us,
+                              const spiflash_stats_t *stats) {
+    uint32_t ops = 0, errors = 0, torn = 0;
+    size_t n = 0;
+    for (int i = 0; i < count; i++) {
+        ops += tasks[i].ops;
+        errors += tasks[i].errors;
+        torn += tasks[i].torn;
+        memcpy(merged + n, tasks[i].lat_us, tasks[i].lat_count * sizeof(uint32_t));
+        n += tasks[i].lat_count;
+    }
+    if (n == 0) {
+        return;
+    }
+    bench_sort_u32(merged, n);
+
+    char name[48];
+    snprintf(name, sizeof(name), "%s_%s", cc->name, role);
+    bench_report("spiflash", name,
+                 "\"readers\":%d,\"writers\":%d,\"tasks\":%d,\"ops\":%lu,\"ops_per_s\":%.0f,"
+                 "\"op_p50_us\":%lu,\"op_p99_us\":%lu,\"op_max_us\":%lu,"
+                 "\"lock_waits\":%lu,\"lock_wait_us\":%llu,\"errors\":%lu,\"torn_pages\":%lu",
+                 cc->readers, cc->writers, count, (unsigned long)ops, ops * 1e6 / elapsed_us,
+                 (unsigned long)bench_percentile(merged, n, 50), (unsigned long)bench_percentile(merged, n, 99),
+                 (unsigned long)bench_percentile(merged, n, 100),
+                 (unsigned long)stats->lock_waits, (unsigned long long)stats->lock_wait_us,
+                 (unsigned long)errors, (unsigned long)torn);
+}
+
+static void run_contention(spiflash_handle_t *flash, const contention_case_t *cc) {
+    int total = cc->readers + cc->writers;
+    contender_t *tasks = calloc(total, sizeof(contender_t));
+    uint32_t *lat = malloc((size_t)total * CONTENTION_SAMPLES * sizeof(uint32_t));
+    uint32_t *merged = malloc((size_t)total * CONTENTION_SAMPLES * sizeof(uint32_t));
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(total, 0);
+    if (tasks == NULL || lat == NULL || merged == NULL || done == NULL) {
+        ESP_LOGE(TAG, "Out of memory for %s", cc->name);
+        free(tasks);
+        free(lat);
+        free(merged);
+        if (done) {
+            vSemaphoreDelete(done);
+        }
+        return;
+    }
+
+    volatile bool stop = false;
+    for (int i = 0; i < total; i++) {
+        contender_t *c = &tasks[i];
+        c->flash = flash;
+        c->writer = i < cc->writers;
+        c->index = c->writer ? i : i - cc->writers;
+        c->writers = cc->writers;
+        c->stop = &stop;
+        c->done = done;
+        c->seed = 0xC0FFEE00u + i;
+        c->lat_us = lat + (size_t)i * CONTENTION_SAMPLES;
+    }
+
+    // Start from erased blocks so readers only ever see whole pages
+    for (uint32_t b = 0; b < (uint32_t)cc->writers * CONTENTION_WRITER_BLOCKS; b++) {
+        spiflash_erase_block(flash, BENCH_FLASH_FIRST_BLOCK + b);
+    }
+    spiflash_reset_stats(flash);
+
+    // Same priority as the caller, so the tasks time-slice against each other
+    int started = 0;
+    int64_t start = bench_now_us();
+    for (int i = 0; i < total; i++) {
+        if (xTaskCreate(contender_task, tasks[i].writer ? "bench_wr" : "bench_rd", CONTENTION_TASK_STACK,
+                        &tasks[i], uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Could not start task %d of %s", i, cc->name);
+            break;
+        }
+        started++;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(CONTENTION_TIME_US / 1000));
+    stop = true;
+    for (int i = 0; i < started; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    int64_t elapsed = bench_now_us() - start;
+
+    spiflash_stats_t stats;
+    spiflash_get_stats(flash, &stats);
+    if (started == total) {
+        report_contention(cc, "writers", tasks, cc->writers, merged, elapsed, &stats);
+        report_contention(cc, "readers", tasks + cc->writers, cc->readers, merged, elapsed, &stats);
+    }
+
+    vSemaphoreDelete(done);
+    free(tasks);
+    free(lat);
+    free(merged);
+}
+
+// ============================================================================
+// I/O scheduling
+// ============================================================================
+
+typedef enum {
+    IOS_FOREGROUND,             // Bursts of page programs, erasing its blocks as they fill
+    IOS_EXPORT,                 // Runs of page reads
+    IOS_COMPACT,                // Erase a block, copy a block into it
+    IOS_ROLES
+} ios_role_t;
+
+static const char *const s_ios_roles[IOS_ROLES] = { "foreground", "export", "compact" };
+static const spiflash_io_class_t s_ios_class[IOS_ROLES] = {
+    SPIFLASH_IO_FOREGROUND, SPIFLASH_IO_NORMAL, SPIFLASH_IO_BACKGROUND,
+};
+
+typedef struct {
+    spiflash_handle_t *flash;
+    spiflash_sched_t *sched;    // NULL: call spiflash directly
+    ios_role_t role;
+    volatile bool *stop;
+    SemaphoreHandle_t done;
+    uint32_t seed;
+    uint32_t ops, errors;
+    uint32_t *lat_us;
+    size_t lat_count;
+} ios_task_t;
+
+// Blocks: foreground 0-1, the export and copy source 2-3, copy destination 4-5
+static uint32_t ios_block(ios_role_t owner, uint32_t n) {
+    return owner * IOSCHED_BLOCKS_PER_TASK + n % IOSCHED_BLOCKS_PER_TASK;
+}
+
+static esp_err_t ios_read(ios_task_t *t, uint32_t page_num, uint32_t count, uint8_t *buf) {
+    if (t->sched) {
+        return spiflash_sched_read_pages(t->sched, s_ios_class[t->role], page_num, count, buf);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        esp_err_t ret = spiflash_read_page(t->flash, page_num + i, buf + (size_t)i * SPIFLASH_PAGE_SIZE);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ios_program(ios_task_t *t, uint32_t page_num, const uint8_t *data) {
+    if (t->sched) {
+        return spiflash_sched_write_page_oob(t->sched, s_ios_class[t->role], page_num, data, NULL, 0);
+    }
+    return spiflash_write_page(t->flash, page_num, data);
+}
+
+static esp_err_t ios_erase(ios_task_t *t, uint32_t block) {
+    if (t->sched) {
+        return spiflash_sched_erase_block(t->sched, s_ios_class[t->role], BENCH_FLASH_FIRST_BLOCK + block);
+    }
+    return spiflash_erase_block(t->flash, BENCH_FLASH_FIRST_BLOCK + block);
+}
+
+static void ios_record(ios_task_t *t, esp_err_t ret, int64_t start) {
+    if (ret != ESP_OK) {
+        t->errors++;
+        return;
+    }
+    if (t->lat_count < CONTENTION_SAMPLES) {
+        t->lat_us[t->lat_count++] = (uint32_t)(bench_now_us() - start);
+    }
+    t->ops++;
+}
+
+static void ios_task(void *arg) {
+    ios_task_t *t = arg;
+    uint8_t *buf = malloc((size_t)IOSCHED_EXPORT_RUN * SPIFLASH_PAGE_SIZE);
+    int64_t start;
+    esp_err_t ret;
+
+    if (buf == NULL) {
+        t->errors++;
+    } else if (t->role == IOS_FOREGROUND) {
+        TickType_t wake = xTaskGetTickCount();
+        for (uint32_t n = 0; !*t->stop; n += IOSCHED_FG_BURST) {
+            uint32_t slot = n % (IOSCHED_BLOCKS_PER_TASK * SPIFLASH_PAGES_PER_BLOCK);
+            uint32_t block = ios_block(IOS_FOREGROUND, slot / SPIFLASH_PAGES_PER_BLOCK);
+            if (slot % SPIFLASH_PAGES_PER_BLOCK == 0) {
+                start = bench_now_us();
+                ios_record(t, ios_erase(t, block), start);
+            }
+            for (uint32_t p = 0; p < IOSCHED_FG_BURST; p++) {
+                uint32_t page_num = bench_page(block, slot % SPIFLASH_PAGES_PER_BLOCK + p);
+                fill_check_page(buf, page_num, bench_rand(&t->seed));
+                start = bench_now_us();
+                ios_record(t, ios_program(t, page_num, buf), start);
+            }
+            xTaskDelayUntil(&wake, pdMS_TO_TICKS(IOSCHED_FG_PERIOD_MS));
+        }
+    } else if (t->role == IOS_EXPORT) {
+        while (!*t->stop) {
+            uint32_t first = bench_rand(&t->seed) % (IOSCHED_BLOCKS_PER_TASK * SPIFLASH_PAGES_PER_BLOCK -
+                                                     IOSCHED_EXPORT_RUN);
+            start = bench_now_us();
+            ios_record(t, ios_read(t, bench_page(ios_block(IOS_EXPORT, 0), first), IOSCHED_EXPORT_RUN, buf), start);
+        }
+    } else {
+        for (uint32_t n = 0; !*t->stop; n++) {
+            uint32_t src = ios_block(IOS_EXPORT, n), dst = ios_block(IOS_COMPACT, n);
+            start = bench_now_us();
+            ios_record(t, ios_erase(t, dst), start);
+            for (uint32_t p = 0; p < SPIFLASH_PAGES_PER_BLOCK && !*t->stop; p++) {
+                start = bench_now_us();
+                ret = ios_read(t, bench_page(src, p), 1, buf);
+                if (ret == ESP_OK) {
+                    ret = ios_program(t, bench_page(dst, p), buf);
+                }
+                ios_record(t, ret, start);
+            }
+        }
+    }
+
+    free(buf);
+    xSemaphoreGive(t->done);
+    vTaskDelete(NULL);
+}
+
+static void report_iosched(bool scheduled, ios_task_t *t, const spiflash_sched_stats_t *ss,
+                           const spiflash_stats_t *fs, int64_t elapsed_us) {
+    char name[48];
+    snprintf(name, sizeof(name), "iosched_%s_%s", scheduled ? "sched" : "direct", s_ios_roles[t->role]);
+    if (t->lat_count == 0) {
+        ESP_LOGE(TAG, "%s: no operations", name);
+        return;
+    }
+    bench_sort_u32(t->lat_us, t->lat_count);
+    size_t n = t->lat_count;
+
+    // Direct calls have no queue of their own, the handle's wait count stands in
+    const spiflash_sched_class_stats_t *cs = &ss->cls[s_ios_class[t->role]];
+    bench_report("spiflash", name,
+                 "\"ops\":%lu,\"ops_per_s\":%.0f,\"errors\":%lu,"
+                 "\"op_p50_us\":%lu,\"op_p99_us\":%lu,\"op_max_us\":%lu,"
+                 "\"wait_p50_us\":%lu,\"wait_p99_us\":%lu,\"wait_max_us\":%lu,"
+                 "\"late\":%lu,\"promoted\":%lu,\"erase_holdoffs\":%lu,\"lock_waits\":%lu",
+                 (unsigned long)t->ops, t->ops * 1e6 / elapsed_us, (unsigned long)t->errors,
+                 (unsigned long)bench_percentile(t->lat_us, n, 50),
+                 (unsigned long)bench_percentile(t->lat_us, n, 99),
+                 (unsigned long)bench_percentile(t->lat_us, n, 100),
+                 (unsigned long)spiflash_sched_wait_percentile(cs, 50),
+                 (unsigned long)spiflash_sched_wait_percentile(cs, 99),
+                 (unsigned long)cs->max_wait_us, (unsigned long)cs->late,
+                 (unsigned long)cs->promoted, (unsigned long)cs->holdoffs,
+                 (unsigned long)fs->lock_waits);
+}
+
+static void run_iosched(spiflash_handle_t *flash, bool scheduled) {
+    ios_task_t tasks[IOS_ROLES] = {0};
+    uint32_t *lat = malloc((size_t)IOS_ROLES * CONTENTION_SAMPLES * sizeof(uint32_t));
+    uint8_t *page = malloc(SPIFLASH_PAGE_SIZE);
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(IOS_ROLES, 0);
+    spiflash_sched_t *sched = NULL;
+    if (lat == NULL || page == NULL || done == NULL ||
+        (scheduled && spiflash_sched_create(flash, NULL, &sched) != ESP_OK)) {
+        ESP_LOGE(TAG, "Out of memory for the iosched cases");
+        free(lat);
+        free(page);
+        if (done) {
+            vSemaphoreDelete(done);
+        }
+        return;
+    }
+
+    // Fresh blocks, and a source for the export and compaction tasks
+    for (uint32_t b = 0; b < IOS_ROLES * IOSCHED_BLOCKS_PER_TASK; b++) {
+        spiflash_erase_block(flash, BENCH_FLASH_FIRST_BLOCK + b);
+    }
+    for (uint32_t p = 0; p < IOSCHED_BLOCKS_PER_TASK * SPIFLASH_PAGES_PER_BLOCK; p++) {
+        uint32_t page_num = bench_page(ios_block(IOS_EXPORT, 0), p);
+        fill_check_page(page, page_num, p);
+        spiflash_write_page(flash, page_num, page);
+    }
+    spiflash_reset_stats(flash);
+
+    volatile bool stop = false;
+    int started = 0;
+    int64_t start = bench_now_us();
+    for (int r = 0; r < IOS_ROLES; r++) {
+        tasks[r] = (ios_task_t){
+            .flash = flash,
+            .sched = sched,
+            .role = r,
+            .stop = &stop,
+            .done = done,
+            .seed = 0x5C4ED000u + r,
+            .lat_us = lat + (size_t)r * CONTENTION_SAMPLES,
+        };
+        if (xTaskCreate(ios_task, s_ios_roles[r], CONTENTION_TASK_STACK, &tasks[r],
+                        uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Could not start the %s task", s_ios_roles[r]);
+            break;
+        }
+        started++;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(IOSCHED_TIME_US / 1000));
+    stop = true;
+    for (int i = 0; i < started; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    int64_t elapsed = bench_now_us() - start;
+
+    spiflash_sched_stats_t ss = {0};
+    spiflash_stats_t fs;
+    if (sched) {
+        spiflash_sched_get_stats(sched, &ss);
+    }
+    spiflash_get_stats(flash, &fs);
+    if (started == IOS_ROLES) {
+        for (int r = 0; r < IOS_ROLES; r++) {
+            report_iosched(scheduled, &tasks[r], &ss, &fs, elapsed);
+        }
+    }
+
+    spiflash_sched_delete(sched);
+    vSemaphoreDelete(done);
+    free(lat);
+    free(page);
+}
+
+// ============================================================================
+// Scan
+// ============================================================================
+
+/**
+ * @brief Read the sequential blocks in page order, like an export
+ */
+static void run_scan(flash_ctx_t *ctx, const scan_case_t *sc) {
+    spiflash_config_t config = flash_config(SCAN_CLOCK_HZ, 0, false);
+    config.cache_pages = sc->cache_pages;
+    config.readahead_pages = sc->readahead_pages;
+#if CONFIG_IDF_TARGET_LINUX
+    config.model_cache_read = sc->cache_read;
+#endif
+    spiflash_handle_t *flash;
+    if (spiflash_init(&config, &flash) != ESP_OK) {
+        ESP_LOGE(TAG, "%s: no flash", sc->name);
+        return;
+    }
+
+    const uint32_t pages = BENCH_SEQ_BLOCKS * SPIFLASH_PAGES_PER_BLOCK;
+    uint32_t sum = 0;
+    esp_err_t ret = ESP_OK;
+    spiflash_stats_t before, after;
+    spiflash_get_stats(flash, &before);
+    int64_t start = bench_now_us();
+    for (uint32_t n = 0; n < pages && ret == ESP_OK; n++) {
+        const uint8_t *page = ctx->page;
+        if (sc->borrow) {
+            ret = spiflash_borrow_page(flash, bench_page(0, n), &page);
+        } else {
+            ret = spiflash_read_page(flash, bench_page(0, n), ctx->page);
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+        // Touch the page like a record decoder would
+        for (size_t j = 0; j < SPIFLASH_PAGE_SIZE; j += 64) {
+            sum += page[j];
+        }
+        if (sc->borrow) {
+            spiflash_release_page(flash, page);
+        }
+    }
+    int64_t wall_us = bench_now_us() - start;
+    spiflash_get_stats(flash, &after);
+
+    const uint8_t *past_end = NULL;
+    esp_err_t past_end_ret = sc->borrow ? spiflash_borrow_page(flash, SPIFLASH_TOTAL_PAGES, &past_end)
+                                        : spiflash_read_page(flash, SPIFLASH_TOTAL_PAGES, ctx->page);
+    if (past_end_ret == ESP_OK) {
+        ESP_LOGE(TAG, "%s: page %d past the end was read", sc->name, SPIFLASH_TOTAL_PAGES);
+        if (past_end != NULL) {
+            spiflash_release_page(flash, past_end);
+        }
+    }
+    spiflash_deinit(flash);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s failed: %s", sc->name, esp_err_to_name(ret));
+        return;
+    }
+
+#if CONFIG_IDF_TARGET_LINUX
+    // Modeled device time plus the measured software time
+    double total_us = (double)(after.spi_us - before.spi_us) + (after.busy_us - before.busy_us) + wall_us;
+#else
+    double total_us = (double)wall_us;
+#endif
+    double mb_per_s = total_us > 0 ? (double)pages * SPIFLASH_PAGE_SIZE / total_us : 0;
+    double bus_mb_per_s = SCAN_CLOCK_HZ / 8 / 1e6;
+    double copied = (double)(after.bytes_copied - before.bytes_copied);
+    double records = (double)pages * SPIFLASH_PAGE_SIZE / SCAN_RECORD_BYTES;
+    bench_report("spiflash", sc->name,
+                 "\"clock_hz\":%d,\"pages\":%lu,\"page_us\":%.1f,\"mb_per_s\":%.2f,"
+                 "\"bus_mb_per_s\":%.2f,\"bus_fraction\":%.3f,\"chip_page_reads\":%lu,"
+                 "\"cache_hits\":%lu,\"readahead_pages\":%lu,\"readahead_used\":%lu,"
+                 "\"copied_bytes_per_page\":%.0f,\"copied_bytes_per_record\":%.1f,"
+                 "\"past_end_rejected\":%s,\"checksum\":%lu",
+                 SCAN_CLOCK_HZ, (unsigned long)pages, total_us / pages, mb_per_s, bus_mb_per_s,
+                 mb_per_s / bus_mb_per_s, (unsigned long)(after.pages_read - before.pages_read),
+                 (unsigned long)(after.cache_hits - before.cache_hits),
+                 (unsigned long)(after.readahead_pages - before.readahead_pages),
+                 (unsigned long)(after.readahead_used - before.readahead_used), copied / pages,
+                 copied / records, past_end_ret == ESP_ERR_INVALID_ARG ? "true" : "false", (unsigned long)sum);
+}
+
+// ============================================================================
+// Suite
+// ============================================================================
+
+static void run_sweep_point(flash_ctx_t *ctx, uint32_t *targets, int clock_hz, int mode) {
+    size_t n;
+
+    // Erase the whole area; everything after programs into it
+    for (n = 0; n < BENCH_FLASH_BLOCKS; n++) {
+        targets[n] = BENCH_FLASH_FIRST_BLOCK + n;
+    }
+    run_case(ctx, "block_erase", OP_ERASE, targets, n, clock_hz, mode);
+
+    // Streaming programs through whole blocks
+    for (n = 0; n < BENCH_SEQ_BLOCKS * SPIFLASH_PAGES_PER_BLOCK; n++) {
+        targets[n] = bench_page(0, n);
+    }
+    run_case(ctx, "program_seq", OP_PROGRAM, targets, n, clock_hz, mode);
+
+    // Isolated programs: the first page of every remaining block
+    for (n = 0; n < BENCH_FLASH_BLOCKS - BENCH_SEQ_BLOCKS; n++) {
+        targets[n] = bench_page(BENCH_SEQ_BLOCKS + n, 0);
+    }
+    run_case(ctx, "program_page", OP_PROGRAM, targets, n, clock_hz, mode);
+
+    // The same page over and over
+    for (n = 0; n < BENCH_READ_OPS; n++) {
+        targets[n] = bench_page(0, 0);
+    }
+    run_case(ctx, "read_page", OP_READ, targets, n, clock_hz, mode);
+
+    for (n = 0; n < BENCH_READ_OPS; n++) {
+        targets[n] = bench_page(0, n % (BENCH_SEQ_BLOCKS * SPIFLASH_PAGES_PER_BLOCK));
+    }
+    run_case(ctx, "read_seq", OP_READ, targets, n, clock_hz, mode);
+
+    for (n = 0; n < BENCH_READ_OPS; n++) {
+        targets[n] = bench_page(0, bench_rand(&ctx->seed) % (BENCH_SEQ_BLOCKS * SPIFLASH_PAGES_PER_BLOCK));
+    }
+    run_case(ctx, "read_random", OP_READ, targets, n, clock_hz, mode);
+}
+
+void bench_spiflash_run(void) {
+    size_t max_ops = BENCH_SEQ_BLOCKS * SPIFLASH_PAGES_PER_BLOCK;
+    if (max_ops < BENCH_READ_OPS) {
+        max_ops = BENCH_READ_OPS;
+    }
+
+    flash_ctx_t ctx = {
+        .page = malloc(SPIFLASH_PAGE_SIZE),
+        .op_us = malloc(max_ops * sizeof(uint32_t)),
+        .seed = 0xF1A5F1A5,
+    };
+    uint32_t *targets = malloc(max_ops * sizeof(uint32_t));
+    if (ctx.page == NULL || ctx.op_us == NULL || targets == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        free(ctx.page);
+        free(ctx.op_us);
+        free(targets);
+        return;
+    }
+
+#if CONFIG_IDF_TARGET_LINUX
+    unlink(BENCH_FLASH_IMAGE);
+#endif
+
+    // Erases and page writes log at INFO
+    esp_log_level_set("SPIFLASH", ESP_LOG_WARN);
+
+    for (size_t c = 0; c < sizeof(s_clocks_hz) / sizeof(s_clocks_hz[0]); c++) {
+        for (size_t m = 0; m < sizeof(s_modes) / sizeof(s_modes[0]); m++) {
+            if (flash_open(s_clocks_hz[c], s_modes[m], false, &ctx.flash) != ESP_OK) {
+                ESP_LOGE(TAG, "No flash at %d Hz mode %d, skipping", s_clocks_hz[c], s_modes[m]);
+                continue;
+            }
+            run_sweep_point(&ctx, targets, s_clocks_hz[c], s_modes[m]);
+            spiflash_deinit(ctx.flash);
+            ctx.flash = NULL;
+        }
+    }
+
+    // The sweep left the sequential blocks programmed
+    for (size_t i = 0; i < sizeof(s_scan_cases) / sizeof(s_scan_cases[0]); i++) {
+        run_scan(&ctx, &s_scan_cases[i]);
+    }
+
+    if (flash_open(CONTENTION_CLOCK_HZ, 0, false, &ctx.flash) == ESP_OK) {
+        for (size_t i = 0; i < sizeof(s_contention_cases) / sizeof(s_contention_cases[0]); i++) {
+            run_contention(ctx.flash, &s_contention_cases[i]);
+        }
+        spiflash_deinit(ctx.flash);
+        ctx.flash = NULL;
+    } else {
+        ESP_LOGE(TAG, "No flash for the contention cases");
+    }
+
+    if (flash_open(CONTENTION_CLOCK_HZ, 0, true, &ctx.flash) == ESP_OK) {
+        run_iosched(ctx.flash, false);
+        run_iosched(ctx.flash, true);
+        spiflash_deinit(ctx.flash);
+        ctx.flash = NULL;
+    } else {
+        ESP_LOGE(TAG, "No flash for the iosched cases");
+    }
+
+    esp_log_level_set("SPIFLASH", ESP_LOG_INFO);
+
+    free(ctx.page);
+    free(ctx.op_us);
+    free(targets);
+}
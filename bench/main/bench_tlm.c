@@ -0,0 +1,198 @@
+/**
+ * @file bench_tlm.c
+ * @brief Live telemetry rollups: append cost and range queries per resolution
+ *
+ * A few packs log one sample per second for more than a day, stored in
+ * batches the way acquisition does. Samples are a function of time, so
+ * every bucket a query returns can be checked against the samples it
+ * should cover. Cases:
+ *  - append:         battery_fs_tlm_append() of one batch
+ *  - query_raw:      the last 30 minutes at 1 s
+ *  - query_minute:   the last 6 hours at 1 min
+ *  - query_hour:     the whole history at 1 h
+ *  - query_fallback: the last day at 1 s, mostly aged out of the raw ring
+ *
+ * Reported per query case: queries, buckets per query, time per query
+ * p50/max and mismatches: a bucket whose samples, min, max or sum differ
+ * from what was logged in its period, or that overlaps the one before.
+ *
+ * The filesystem is wiped first. On hardware this erases the battery logs
+ * on the chip, run it on a bench unit only.
+ */
+
+#include "bench.h"
+#include "battery_fs.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BENCH_TLM";
+
+#define TLM_IMAGE           "bench_tlm.img"
+#define TLM_PACKS           2
+#define TLM_SECONDS         (26 * 3600)     // Past the minute ring, one day
+#define TLM_BATCH           16              // Samples per append, as acquisition
+#define TLM_START_S         1700000123u     // Not on a minute or hour boundary
+#define TLM_QUERIES         8               // Per case and pack
+
+typedef struct {
+    const char *name;
+    uint32_t span_s;                // Range ending at the last sample
+    uint32_t granularity_s;
+} tlm_case_t;
+
+static const tlm_case_t s_cases[] = {
+    { "query_raw", 1800, 1 },
+    { "query_minute", 6 * 3600, 60 },
+    { "query_hour", TLM_SECONDS, 3600 },
+    { "query_fallback", 24 * 3600, 1 },
+};
+
+typedef struct {
+    int pack;
+    uint32_t end_s;                 // Samples logged up to here, exclusive
+    int64_t last_end;               // End of the previous bucket
+    uint32_t buckets;
+    uint32_t mismatches;
+} tlm_check_t;
+
+static void pack_serial(int p, char *serial, size_t size) {
+    snprintf(serial, size, "TLM%04X", p);
+}
+
+/**
+ * @brief Sample of pack p at t: a slow SOC ramp and a noisy current
+ */
+static void sample_at(int p, uint32_t t, battery_fs_tlm_sample_t *s) {
+    uint32_t x = t * 2654435761u + p;
+    s->time_s = t;
+    s->value[BATTERY_FS_TLM_SOC] = (int16_t)((t / 36 + p * 17) % 101);
+    s->value[BATTERY_FS_TLM_CURRENT] = (int16_t)(1500 + (int32_t)(x >> 20) % 1000 - (p ? 3000 : 0));
+}
+
+// ============================================================================
+// Checks
+// ============================================================================
+
+static bool count_bucket(const battery_fs_tlm_bucket_t *b, uint32_t period_s, void *arg) {
+    (*(uint32_t *)arg)++;
+    return true;
+}
+
+static bool check_bucket(const battery_fs_tlm_bucket_t *b, uint32_t period_s, void *arg) {
+    tlm_check_t *c = arg;
+    c->buckets++;
+
+    battery_fs_tlm_bucket_t want = { .start_s = b->start_s };
+    uint32_t first = b->start_s > TLM_START_S ? b->start_s : TLM_START_S;
+    uint32_t last = b->start_s + period_s < c->end_s ? b->start_s + period_s : c->end_s;
+    for (uint32_t t = first; t < last; t++) {
+        battery_fs_tlm_sample_t s;
+        sample_at(c->pack, t, &s);
+        for (int ch = 0; ch < BATTERY_FS_TLM_CHANNELS; ch++) {
+            battery_fs_tlm_stat_t *st = &want.channel[ch];
+            int16_t v = s.value[ch];
+            st->min = want.samples == 0 || v < st->min ? v : st->min;
+            st->max = want.samples == 0 || v > st->max ? v : st->max;
+            st->sum += v;
+        }
+        want.samples++;
+    }
+
+    c->mismatches += (int64_t)b->start_s < c->last_end || b->samples != want.samples ||
+                     memcmp(b->channel, want.channel, sizeof(want.channel)) != 0;
+    c->last_end = (int64_t)b->start_s + period_s;
+    return true;
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+static void run_append(uint32_t *us, size_t n, uint32_t errors) {
+    bench_sort_u32(us, n);
+    bench_report("tlm", "append",
+                 "\"packs\":%d,\"samples\":%u,\"appends\":%u,\"append_p50_us\":%lu,"
+                 "\"append_p99_us\":%lu,\"append_max_us\":%lu,\"errors\":%lu",
+                 TLM_PACKS, (unsigned)(TLM_PACKS * TLM_SECONDS), (unsigned)n,
+                 (unsigned long)bench_percentile(us, n, 50), (unsigned long)bench_percentile(us, n, 99),
+                 (unsigned long)bench_percentile(us, n, 100), (unsigned long)errors);
+}
+
+static void run_query(const tlm_case_t *c) {
+    uint32_t us[TLM_PACKS * TLM_QUERIES];
+    uint32_t buckets = 0, mismatches = 0, errors = 0;
+    char serial[16];
+    size_t n = 0;
+
+    for (int p = 0; p < TLM_PACKS; p++) {
+        pack_serial(p, serial, sizeof(serial));
+        for (int q = 0; q < TLM_QUERIES; q++, n++) {
+            uint32_t to = TLM_START_S + TLM_SECONDS - 1, from = to - c->span_s + 1, got = 0;
+            int64_t t0 = bench_now_us();
+            errors += battery_fs_tlm_query(serial, from, to, c->granularity_s, count_bucket, &got) != ESP_OK;
+            us[n] = (uint32_t)(bench_now_us() - t0);
+            buckets += got;
+
+            // Checked in a second pass, outside the timing
+            tlm_check_t check = { .pack = p, .end_s = to + 1, .last_end = -1 };
+            errors += battery_fs_tlm_query(serial, from, to, c->granularity_s, check_bucket, &check) != ESP_OK;
+            mismatches += check.mismatches + (check.buckets != got);
+        }
+    }
+
+    bench_sort_u32(us, n);
+    bench_report("tlm", c->name,
+                 "\"span_s\":%lu,\"granularity_s\":%lu,\"queries\":%u,\"buckets_per_query\":%lu,"
+                 "\"query_p50_us\":%lu,\"query_max_us\":%lu,\"mismatches\":%lu,\"errors\":%lu",
+                 (unsigned long)c->span_s, (unsigned long)c->granularity_s, (unsigned)n,
+                 (unsigned long)(buckets / n), (unsigned long)bench_percentile(us, n, 50),
+                 (unsigned long)bench_percentile(us, n, 100),
+                 (unsigned long)mismatches, (unsigned long)errors);
+}
+
+void bench_tlm_run(void) {
+    const size_t appends = TLM_PACKS * (TLM_SECONDS / TLM_BATCH);
+    uint32_t *append_us = malloc(appends * sizeof(uint32_t));
+    if (append_us == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        return;
+    }
+    if (bench_mount_storage(TLM_IMAGE, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Storage not available, skipping");
+        free(append_us);
+        return;
+    }
+
+    // Measure storage, not the console
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    battery_fs_delete_all();
+
+    // Packs interleaved, as slots poll side by side
+    battery_fs_tlm_sample_t batch[TLM_BATCH];
+    uint32_t errors = 0;
+    char serial[16];
+    size_t n = 0;
+    for (uint32_t t = TLM_START_S; t + TLM_BATCH <= TLM_START_S + TLM_SECONDS; t += TLM_BATCH) {
+        for (int p = 0; p < TLM_PACKS; p++, n++) {
+            pack_serial(p, serial, sizeof(serial));
+            for (int i = 0; i < TLM_BATCH; i++) {
+                sample_at(p, t + i, &batch[i]);
+            }
+            int64_t t0 = bench_now_us();
+            errors += battery_fs_tlm_append(serial, batch, TLM_BATCH) != ESP_OK;
+            append_us[n] = (uint32_t)(bench_now_us() - t0);
+        }
+    }
+    run_append(append_us, n, errors);
+    free(append_us);
+
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        run_query(&s_cases[i]);
+    }
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+    battery_fs_deinit();
+}
@@ -0,0 +1,24 @@
+/**
+ * @file bench_util.c
+ * @brief Latency statistics shared by the benchmark suites
+ */
+
+#include "bench.h"
+#include <stdlib.h>
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_sort_u32(uint32_t *samples, size_t count) {
+    qsort(samples, count, sizeof(uint32_t), cmp_u32);
+}
+
+uint32_t bench_percentile(const uint32_t *sorted, size_t count, unsigned pct) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t rank = (count * pct + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
@@ -1,5 +1,6 @@
 #include "BATMON.h"
 #include "esp_log.h"
+#include "evtrace.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -454,7 +455,7 @@ esp_err_t BATMON_getMemoryInfo(batmon_handle_t *handle, BATMON_Mem_Info *mem_inf
     return ret;
 }
 
-bool BATMON_getMemory(batmon_handle_t *handle, BatmonMemory *batmem, const BATMON_Mem_Info *mem_info) {
+static bool read_memory(batmon_handle_t *handle, BatmonMemory *batmem, const BATMON_Mem_Info *mem_info) {
     if (handle == NULL || batmem == NULL || mem_info == NULL) return false;
     
     int m = 0;
@@ -523,3 +524,10 @@ bool BATMON_getMemory(batmon_handle_t *handle, BatmonMemory *batmem, const BATMO
     }
     return true;
 }
+
+bool BATMON_getMemory(batmon_handle_t *handle, BatmonMemory *batmem, const BATMON_Mem_Info *mem_info) {
+    EVTRACE_BEGIN(EVTRACE_ID_BATMON_GET_MEMORY, handle ? handle->address : 0);
+    bool ok = read_memory(handle, batmem, mem_info);
+    EVTRACE_END(EVTRACE_ID_BATMON_GET_MEMORY, ok);
+    return ok;
+}
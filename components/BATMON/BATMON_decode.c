@@ -0,0 +1,224 @@
+#include "BATMON_decode.h"
+#include <stdbool.h>
+
+_Static_assert(sizeof(BatmonMemory) == MEMORY_BLOCK_SIZE, "BatmonMemory must be packed to MEMORY_BLOCK_SIZE");
+
+// Byte offsets inside the packed BatmonMemory image
+#define OFF_MEMORY_INDEX    0
+#define OFF_MIN_SOC         1
+#define OFF_MAX_SOC         2
+#define OFF_SOH             3
+#define OFF_MIN_TEMP        4
+#define OFF_MAX_TEMP        5
+#define OFF_MAX_INT_TEMP    6
+#define OFF_MAX_CURRENT     7   // uint16
+#define OFF_LOG             9   // battCycle:14, REC_NEW_CYCLE:1, LOGGED_WITHOUT_SLEEP:1
+#define OFF_BOOT_INDICES    11  // min:4, max:4
+#define OFF_BOOT_MIN_V      12
+#define OFF_BOOT_MAX_V      13
+#define OFF_SHUT_INDICES    14
+#define OFF_SHUT_MIN_V      15
+#define OFF_SHUT_MAX_V      16
+#define OFF_REMAIN_CAP      17  // uint16
+#define OFF_ACCUMULATED     19  // charged:20, discharged:20
+#define OFF_BQ_STATUS       24  // CC_ERROR:1, CC_TIME_ERROR:1, ccErrorCount:6
+#define OFF_ALARM           25
+#define OFF_GPS_START       26  // week:12, tow_s:20
+#define OFF_GPS_END         30
+#define OFF_INT_RES         34  // INT_RES_PER_MEMORY x {tag, min, max, indices}
+#define OFF_LOG2            50
+
+#define INT_RES_SIZE        4
+
+// Stored temperatures are in °C with a MEMORY_TEMP_OFFSET K offset
+#define TEMP_OFFSET_C       ((float)(-MEMORY_TEMP_OFFSET - KELVIN_CELCIUS))
+
+#define COLUMN(field, type) { #field, type, offsetof(batmon_mem_columns_t, field) }
+#define IR_COLUMNS(n) \
+    { "ir" #n "_min_mohm", BATMON_COL_U8, offsetof(batmon_mem_columns_t, ir_min_mohm[n]) }, \
+    { "ir" #n "_max_mohm", BATMON_COL_U8, offsetof(batmon_mem_columns_t, ir_max_mohm[n]) }
+
+_Static_assert(INT_RES_PER_MEMORY == 4, "Update the IR_COLUMNS list below");
+
+const batmon_col_desc_t BATMON_memColumns[] = {
+    COLUMN(memory_index, BATMON_COL_U8),
+    COLUMN(min_soc, BATMON_COL_U8),
+    COLUMN(max_soc, BATMON_COL_U8),
+    COLUMN(soh, BATMON_COL_U8),
+    COLUMN(min_temp_c, BATMON_COL_F32),
+    COLUMN(max_temp_c, BATMON_COL_F32),
+    COLUMN(max_int_temp_c, BATMON_COL_F32),
+    COLUMN(max_current_a, BATMON_COL_U16),
+    COLUMN(cycle, BATMON_COL_U16),
+    COLUMN(new_cycle, BATMON_COL_U8),
+    COLUMN(logged_without_sleep, BATMON_COL_U8),
+    COLUMN(boot_min_cell, BATMON_COL_U8),
+    COLUMN(boot_max_cell, BATMON_COL_U8),
+    COLUMN(boot_min_mv, BATMON_COL_U16),
+    COLUMN(boot_max_mv, BATMON_COL_U16),
+    COLUMN(shut_min_cell, BATMON_COL_U8),
+    COLUMN(shut_max_cell, BATMON_COL_U8),
+    COLUMN(shut_min_mv, BATMON_COL_U16),
+    COLUMN(shut_max_mv, BATMON_COL_U16),
+    COLUMN(remain_mah, BATMON_COL_U16),
+    COLUMN(charged_mah, BATMON_COL_U32),
+    COLUMN(discharged_mah, BATMON_COL_U32),
+    COLUMN(cc_error, BATMON_COL_U8),
+    COLUMN(cc_time_error, BATMON_COL_U8),
+    COLUMN(cc_error_count, BATMON_COL_U8),
+    COLUMN(alarms, BATMON_COL_U8),
+    COLUMN(gps_start_s, BATMON_COL_U32),
+    COLUMN(gps_end_s, BATMON_COL_U32),
+    IR_COLUMNS(0),
+    IR_COLUMNS(1),
+    IR_COLUMNS(2),
+    IR_COLUMNS(3),
+    COLUMN(soc_from_voltage, BATMON_COL_U8),
+    COLUMN(storage_discharge, BATMON_COL_U8),
+    COLUMN(storage_mode, BATMON_COL_U8),
+};
+
+const size_t BATMON_memColumnCount = sizeof(BATMON_memColumns) / sizeof(BATMON_memColumns[0]);
+
+_Static_assert(sizeof(BATMON_memColumns) / sizeof(BATMON_memColumns[0]) ==
+               sizeof(batmon_mem_columns_t) / sizeof(void *), "Every column needs a descriptor");
+
+size_t BATMON_colTypeSize(batmon_col_type_t type) {
+    return type == BATMON_COL_U8 ? 1 : type == BATMON_COL_U16 ? 2 : 4;
+}
+
+/*
+ * Columns are padded to a whole cache line plus one more, so their starts
+ * are staggered across cache sets. With power-of-two capacities the columns
+ * would otherwise all map to the same sets and the decode loop, which writes
+ * every column in each iteration, thrashes the cache.
+ */
+#define COLUMN_ALIGN 64
+
+static inline size_t column_bytes(const batmon_col_desc_t *desc, size_t capacity) {
+    size_t bytes = BATMON_colTypeSize(desc->type) * capacity;
+    return ((bytes + COLUMN_ALIGN - 1) & ~(size_t)(COLUMN_ALIGN - 1)) + COLUMN_ALIGN;
+}
+
+size_t BATMON_memColumnsSize(size_t capacity) {
+    size_t size = 0;
+    for (size_t c = 0; c < BATMON_memColumnCount; c++) {
+        size += column_bytes(&BATMON_memColumns[c], capacity);
+    }
+    return size;
+}
+
+void BATMON_memColumnsBind(batmon_mem_columns_t *cols, void *buf, size_t capacity) {
+    uint8_t *p = buf;
+    for (size_t c = 0; c < BATMON_memColumnCount; c++) {
+        *(void **)((uint8_t *)cols + BATMON_memColumns[c].offset) = p;
+        p += column_bytes(&BATMON_memColumns[c], capacity);
+    }
+}
+
+static inline uint16_t ld16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t ld32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t gps_seconds(uint32_t packed) {
+    return (packed & 0xFFF) * BATMON_GPS_SECONDS_PER_WEEK + (packed >> 12);
+}
+
+void BATMON_decodeMemoryBatch(const void *records, size_t stride, size_t count,
+                              const batmon_mem_columns_t *cols, size_t row) {
+    // Local restrict copies tell the compiler the columns never alias
+    uint8_t  *restrict memory_index = cols->memory_index + row;
+    uint8_t  *restrict min_soc = cols->min_soc + row;
+    uint8_t  *restrict max_soc = cols->max_soc + row;
+    uint8_t  *restrict soh = cols->soh + row;
+    float    *restrict min_temp_c = cols->min_temp_c + row;
+    float    *restrict max_temp_c = cols->max_temp_c + row;
+    float    *restrict max_int_temp_c = cols->max_int_temp_c + row;
+    uint16_t *restrict max_current_a = cols->max_current_a + row;
+    uint16_t *restrict cycle = cols->cycle + row;
+    uint8_t  *restrict new_cycle = cols->new_cycle + row;
+    uint8_t  *restrict logged_without_sleep = cols->logged_without_sleep + row;
+    uint8_t  *restrict boot_min_cell = cols->boot_min_cell + row;
+    uint8_t  *restrict boot_max_cell = cols->boot_max_cell + row;
+    uint16_t *restrict boot_min_mv = cols->boot_min_mv + row;
+    uint16_t *restrict boot_max_mv = cols->boot_max_mv + row;
+    uint8_t  *restrict shut_min_cell = cols->shut_min_cell + row;
+    uint8_t  *restrict shut_max_cell = cols->shut_max_cell + row;
+    uint16_t *restrict shut_min_mv = cols->shut_min_mv + row;
+    uint16_t *restrict shut_max_mv = cols->shut_max_mv + row;
+    uint16_t *restrict remain_mah = cols->remain_mah + row;
+    uint32_t *restrict charged_mah = cols->charged_mah + row;
+    uint32_t *restrict discharged_mah = cols->discharged_mah + row;
+    uint8_t  *restrict cc_error = cols->cc_error + row;
+    uint8_t  *restrict cc_time_error = cols->cc_time_error + row;
+    uint8_t  *restrict cc_error_count = cols->cc_error_count + row;
+    uint8_t  *restrict alarms = cols->alarms + row;
+    uint32_t *restrict gps_start_s = cols->gps_start_s + row;
+    uint32_t *restrict gps_end_s = cols->gps_end_s + row;
+    uint8_t  *restrict soc_from_voltage = cols->soc_from_voltage + row;
+    uint8_t  *restrict storage_discharge = cols->storage_discharge + row;
+    uint8_t  *restrict storage_mode = cols->storage_mode + row;
+    const uint8_t *restrict in = records;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *m = in + i * stride;
+
+        memory_index[i] = m[OFF_MEMORY_INDEX];
+        min_soc[i] = m[OFF_MIN_SOC];
+        max_soc[i] = m[OFF_MAX_SOC];
+        soh[i] = m[OFF_SOH];
+        min_temp_c[i] = m[OFF_MIN_TEMP] + TEMP_OFFSET_C;
+        max_temp_c[i] = m[OFF_MAX_TEMP] + TEMP_OFFSET_C;
+        max_int_temp_c[i] = m[OFF_MAX_INT_TEMP] + TEMP_OFFSET_C;
+        max_current_a[i] = ld16(m + OFF_MAX_CURRENT);
+
+        uint16_t log = ld16(m + OFF_LOG);
+        cycle[i] = log & 0x3FFF;
+        new_cycle[i] = (log >> 14) & 1;
+        logged_without_sleep[i] = log >> 15;
+
+        boot_min_cell[i] = m[OFF_BOOT_INDICES] & 0x0F;
+        boot_max_cell[i] = m[OFF_BOOT_INDICES] >> 4;
+        boot_min_mv[i] = m[OFF_BOOT_MIN_V] * MEM_VOLT_STORAGE_RESOLUTION;
+        boot_max_mv[i] = m[OFF_BOOT_MAX_V] * MEM_VOLT_STORAGE_RESOLUTION;
+        shut_min_cell[i] = m[OFF_SHUT_INDICES] & 0x0F;
+        shut_max_cell[i] = m[OFF_SHUT_INDICES] >> 4;
+        shut_min_mv[i] = m[OFF_SHUT_MIN_V] * MEM_VOLT_STORAGE_RESOLUTION;
+        shut_max_mv[i] = m[OFF_SHUT_MAX_V] * MEM_VOLT_STORAGE_RESOLUTION;
+        remain_mah[i] = ld16(m + OFF_REMAIN_CAP);
+
+        // 40 bits: charged in bits 0-19, discharged in bits 20-39
+        charged_mah[i] = ld32(m + OFF_ACCUMULATED) & 0xFFFFF;
+        discharged_mah[i] = ld32(m + OFF_ACCUMULATED + 1) >> 12;
+
+        uint8_t bq = m[OFF_BQ_STATUS];
+        cc_error[i] = bq & 1;
+        cc_time_error[i] = (bq >> 1) & 1;
+        cc_error_count[i] = bq >> 2;
+        alarms[i] = m[OFF_ALARM];
+
+        gps_start_s[i] = gps_seconds(ld32(m + OFF_GPS_START));
+        gps_end_s[i] = gps_seconds(ld32(m + OFF_GPS_END));
+
+        uint8_t log2 = m[OFF_LOG2];
+        soc_from_voltage[i] = log2 & 1;
+        storage_discharge[i] = (log2 >> 1) & 1;
+        storage_mode[i] = (log2 >> 2) & 1;
+    }
+
+    // Internal resistance slots: same pattern per slot, kept out of the main
+    // loop so it does not need INT_RES_PER_MEMORY * 2 more live pointers
+    for (int s = 0; s < INT_RES_PER_MEMORY; s++) {
+        uint8_t *restrict ir_min = cols->ir_min_mohm[s] + row;
+        uint8_t *restrict ir_max = cols->ir_max_mohm[s] + row;
+        const uint8_t *restrict slot = in + OFF_INT_RES + s * INT_RES_SIZE;
+        for (size_t i = 0; i < count; i++) {
+            ir_min[i] = slot[i * stride + 1];
+            ir_max[i] = slot[i * stride + 2];
+        }
+    }
+}
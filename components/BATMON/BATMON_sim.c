@@ -0,0 +1,419 @@
+/**
+ * @file BATMON_sim.c
+ * @brief BATMON API served by simulated devices (CONFIG_BATMON_SIMULATED)
+ *
+ * Every call accounts the transaction the SMBus driver in BATMON.c would
+ * perform (command byte, read length) against the device at the handle's
+ * address, then answers from the attached pack.
+ */
+
+#include "BATMON.h"
+#include "BATMON_sim.h"
+#include "esp_log.h"
+#include "evtrace.h"
+#include <string.h>
+
+static const char *TAG = "BATMON_SIM";
+
+#ifndef CONFIG_BATMON_SIM_BUS_HZ
+#define CONFIG_BATMON_SIM_BUS_HZ    100000
+#endif
+
+#define SIM_DEFAULT_CELLS           6
+#define SIM_DEFAULT_CAPACITY_MAH    5000
+#define SIM_TEMP_DECIKELVIN         2981    // 25 °C
+
+// Record partitions reported by SMBUS_RESET_BATMEM, as on a 64-byte BATMON
+static const uint8_t s_partitions[NUM_MEMORY_BLOCK_PARTITION] = { 22, 21, 21 };
+
+typedef struct {
+    bool used;
+    bool present;
+    uint8_t address;
+    batmon_sim_pack_t pack;
+    uint8_t next_record;            // Advanced by SMBUS_BATMEM reads, reset by SMBUS_RESET_BATMEM
+    batmon_sim_stats_t stats;
+} sim_device_t;
+
+static sim_device_t s_devices[BATMON_SIM_MAX_DEVICES];
+static uint32_t s_bus_hz = CONFIG_BATMON_SIM_BUS_HZ;
+
+// ============================================================================
+// Device model
+// ============================================================================
+
+static sim_device_t *sim_find(uint8_t address, bool create) {
+    sim_device_t *free_slot = NULL;
+    for (int i = 0; i < BATMON_SIM_MAX_DEVICES; i++) {
+        if (s_devices[i].used && s_devices[i].address == address) {
+            return &s_devices[i];
+        }
+        if (!s_devices[i].used && free_slot == NULL) {
+            free_slot = &s_devices[i];
+        }
+    }
+    if (!create || free_slot == NULL) {
+        return NULL;
+    }
+
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->used = true;
+    free_slot->address = address;
+    return free_slot;
+}
+
+/**
+ * @brief Account one write-command / read-data transaction
+ *
+ * @return The device if a pack answered, NULL for a NACK
+ */
+static sim_device_t *sim_transfer(const batmon_handle_t *handle, size_t rx_len) {
+    sim_device_t *dev = sim_find(handle->address, false);
+    if (dev == NULL) {
+        return NULL;
+    }
+
+    // START, address+W, command, repeated START, address+R, data, STOP;
+    // a NACK ends the transaction after the first address byte
+    size_t bytes = dev->present ? 3 + rx_len : 1;
+    uint32_t bits = bytes * 9 + (dev->present ? 3 : 2);
+
+    dev->stats.transactions++;
+    dev->stats.bytes += bytes;
+    dev->stats.bus_us += ((uint64_t)bits * 1000000 + s_bus_hz - 1) / s_bus_hz;
+    if (!dev->present) {
+        dev->stats.nacks++;
+        return NULL;
+    }
+    return dev;
+}
+
+static uint8_t sim_cells(const sim_device_t *dev) {
+    return dev->pack.cells ? dev->pack.cells : SIM_DEFAULT_CELLS;
+}
+
+static uint16_t sim_capacity(const sim_device_t *dev) {
+    return dev->pack.capacity_mah ? dev->pack.capacity_mah : SIM_DEFAULT_CAPACITY_MAH;
+}
+
+// Resting cell voltage from SOC, 3.30 V empty to 4.20 V full
+static uint16_t sim_cell_mv(const sim_device_t *dev) {
+    return 3300 + dev->pack.soc * 9;
+}
+
+static uint8_t crc8_smbus(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// ============================================================================
+// Simulator control
+// ============================================================================
+
+esp_err_t BATMON_simAttach(uint8_t address, const batmon_sim_pack_t *pack) {
+    if (pack == NULL || pack->record_count > BATMON_SIM_MAX_RECORDS ||
+        (pack->records == NULL && pack->record_count > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sim_device_t *dev = sim_find(address, true);
+    if (dev == NULL) {
+        ESP_LOGE(TAG, "No free device for address 0x%02X", address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    dev->pack = *pack;
+    if (memcmp(dev->pack.sn, (const uint16_t[8]){0}, sizeof(dev->pack.sn)) == 0) {
+        for (int i = 0; i < 8; i++) {
+            dev->pack.sn[i] = pack->hash ^ (0x1111 * i);
+        }
+    }
+    dev->next_record = 0;
+    dev->present = true;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_simDetach(uint8_t address) {
+    sim_device_t *dev = sim_find(address, false);
+    if (dev == NULL || !dev->present) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    dev->present = false;
+    dev->pack.records = NULL;
+    dev->pack.record_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_simSetTelemetry(uint8_t address, uint16_t soc, int16_t current_ma) {
+    sim_device_t *dev = sim_find(address, false);
+    if (dev == NULL || !dev->present) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    dev->pack.soc = soc;
+    dev->pack.current_ma = current_ma;
+    return ESP_OK;
+}
+
+void BATMON_simSetBusClock(uint32_t hz) {
+    s_bus_hz = hz ? hz : CONFIG_BATMON_SIM_BUS_HZ;
+}
+
+esp_err_t BATMON_simGetStats(uint8_t address, batmon_sim_stats_t *stats) {
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (address != 0) {
+        sim_device_t *dev = sim_find(address, false);
+        if (dev == NULL) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        *stats = dev->stats;
+        return ESP_OK;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < BATMON_SIM_MAX_DEVICES; i++) {
+        const batmon_sim_stats_t *s = &s_devices[i].stats;
+        stats->transactions += s->transactions;
+        stats->nacks += s->nacks;
+        stats->bytes += s->bytes;
+        stats->bus_us += s->bus_us;
+        stats->records_read += s->records_read;
+    }
+    return ESP_OK;
+}
+
+void BATMON_simResetStats(void) {
+    for (int i = 0; i < BATMON_SIM_MAX_DEVICES; i++) {
+        memset(&s_devices[i].stats, 0, sizeof(s_devices[i].stats));
+    }
+}
+
+// ============================================================================
+// BATMON API
+// ============================================================================
+
+esp_err_t BATMON_init(i2c_master_bus_handle_t bus_handle, uint8_t address, uint8_t numTherms, batmon_handle_t *out_handle) {
+    if (out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Register the slot so it NACKs (and is accounted) until a pack is attached
+    if (sim_find(address, true) == NULL) {
+        ESP_LOGE(TAG, "No free device for address 0x%02X", address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    out_handle->i2c_handle = NULL;
+    out_handle->address = address;
+    out_handle->numTherms = numTherms;
+    return ESP_OK;
+}
+
+uint8_t BATMON_readCellVoltages(batmon_handle_t *handle, Batmon_cellVoltages *cv) {
+    if (handle == NULL || cv == NULL) return 2;
+
+    uint16_t cellCount = 0;
+    if (BATMON_getCellCount(handle, &cellCount) != ESP_OK) return 2;
+
+    for (int i = 0; i < cellCount; i++) {
+        sim_device_t *dev = sim_transfer(handle, 3);
+        if (dev == NULL) return 2;
+        cv->VCell[i].VCellWord = sim_cell_mv(dev);
+    }
+    cv->CRC = crc8_smbus((const uint8_t *)cv->VCell, cellCount * sizeof(cv->VCell[0]));
+    return 0;
+}
+
+uint8_t BATMON_readStatus(batmon_handle_t *handle, uint8_t *st) {
+    if (handle == NULL || st == NULL) return 2;
+    if (sim_transfer(handle, 2) == NULL) return 2;
+
+    *st = BATMON_READY;
+    return 0;
+}
+
+uint8_t BATMON_readTotalVoltage(batmon_handle_t *handle, Batmon_totalVoltage *tv) {
+    if (handle == NULL || tv == NULL) return 2;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return 2;
+
+    tv->TV.VTotWord = sim_cells(dev) * sim_cell_mv(dev);
+    tv->CRC = crc8_smbus((const uint8_t *)&tv->TV.VTotWord, 2);
+    return 0;
+}
+
+uint8_t BATMON_readTherms(batmon_handle_t *handle, Batmon_thermistors *ts, uint8_t num) {
+    if (handle == NULL || ts == NULL) return 2;
+    if (num > 2) return 3;
+    if (sim_transfer(handle, 2 * (num + 1) + 1) == NULL) return 2;
+
+    ts->T_int.TWord = SIM_TEMP_DECIKELVIN;
+    ts->T1.TWord = SIM_TEMP_DECIKELVIN;
+    ts->T2.TWord = SIM_TEMP_DECIKELVIN;
+    ts->CRC = 0;
+    return 0;
+}
+
+esp_err_t BATMON_getCur(batmon_handle_t *handle, int16_t *current) {
+    if (handle == NULL || current == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *current = dev->pack.current_ma;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getSOC(batmon_handle_t *handle, uint16_t *soc) {
+    if (handle == NULL || soc == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *soc = dev->pack.soc;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getCellCount(batmon_handle_t *handle, uint16_t *cellCount) {
+    if (handle == NULL || cellCount == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *cellCount = sim_cells(dev);
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getDeciCur(batmon_handle_t *handle, int *current) {
+    if (handle == NULL || current == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *current = dev->pack.current_ma / 100;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getTInt(batmon_handle_t *handle, int *temp) {
+    if (handle == NULL || temp == NULL) return ESP_ERR_INVALID_ARG;
+    if (sim_transfer(handle, 3) == NULL) return ESP_FAIL;
+
+    *temp = SIM_TEMP_DECIKELVIN - (int)(KELVIN_CELCIUS * 10.0);
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getTExt(batmon_handle_t *handle, uint8_t extThermNum, int *temp) {
+    if (handle == NULL || temp == NULL || extThermNum > 1) return ESP_ERR_INVALID_ARG;
+    if (sim_transfer(handle, 3) == NULL) return ESP_FAIL;
+
+    *temp = SIM_TEMP_DECIKELVIN - (int)(KELVIN_CELCIUS * 10.0);
+    return ESP_OK;
+}
+
+esp_err_t BATMON_read_mAh_discharged(batmon_handle_t *handle, int16_t *discharged) {
+    if (handle == NULL || discharged == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *discharged = (int16_t)((uint32_t)(100 - dev->pack.soc) * sim_capacity(dev) / 100);
+    return ESP_OK;
+}
+
+esp_err_t BATMON_readRemainCap(batmon_handle_t *handle, uint16_t *cap) {
+    if (handle == NULL || cap == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *cap = (uint32_t)dev->pack.soc * sim_capacity(dev) / 100;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getHash(batmon_handle_t *handle, uint16_t *hash) {
+    if (handle == NULL || hash == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, 3);
+    if (dev == NULL) return ESP_FAIL;
+
+    *hash = dev->pack.hash;
+    return ESP_OK;
+}
+
+bool BATMON_getSN(batmon_handle_t *handle, uint16_t sn[8]) {
+    if (handle == NULL || sn == NULL) return false;
+    sim_device_t *dev = sim_transfer(handle, 18);
+    if (dev == NULL) return false;
+
+    memcpy(sn, dev->pack.sn, sizeof(dev->pack.sn));
+    return true;
+}
+
+esp_err_t BATMON_getBattStatus(batmon_handle_t *handle, uint16_t *battStatus) {
+    if (handle == NULL || battStatus == NULL) return ESP_ERR_INVALID_ARG;
+    if (sim_transfer(handle, 3) == NULL) return ESP_FAIL;
+
+    *battStatus = 0;
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getMan(batmon_handle_t *handle, uint8_t *buf, size_t len) {
+    if (handle == NULL || buf == NULL) return ESP_ERR_INVALID_ARG;
+    if (len < 8) return ESP_ERR_INVALID_ARG;
+    if (sim_transfer(handle, 8) == NULL) return ESP_FAIL;
+
+    memcpy(buf, "\x06Rotoye", 8);
+    return ESP_OK;
+}
+
+esp_err_t BATMON_getMemoryInfo(batmon_handle_t *handle, BATMON_Mem_Info *mem_info) {
+    if (handle == NULL || mem_info == NULL) return ESP_ERR_INVALID_ARG;
+    sim_device_t *dev = sim_transfer(handle, sizeof(BATMON_Mem_Info));
+    if (dev == NULL) return ESP_FAIL;
+
+    // SMBUS_RESET_BATMEM rewinds the record reader
+    dev->next_record = 0;
+
+    mem_info->length = sizeof(mem_info->data);
+    mem_info->data.bytesPerRecord = MEMORY_BLOCK_SIZE;
+    mem_info->data.numPartitionsPerRecord = NUM_MEMORY_BLOCK_PARTITION;
+    mem_info->data.bytesinPartition1 = s_partitions[0];
+    mem_info->data.bytesinPartition2 = s_partitions[1];
+    mem_info->data.bytesinPartition3 = s_partitions[2];
+    mem_info->data.totalMemoryRecords = dev->pack.record_count;
+    mem_info->crc = crc8_smbus((const uint8_t *)&mem_info->data, sizeof(mem_info->data));
+    return ESP_OK;
+}
+
+static bool read_memory(batmon_handle_t *handle, BatmonMemory *batmem, const BATMON_Mem_Info *mem_info) {
+    if (handle == NULL || batmem == NULL || mem_info == NULL) return false;
+    if (mem_info->data.numPartitionsPerRecord > NUM_MEMORY_BLOCK_PARTITION) return false;
+
+    sim_device_t *dev = NULL;
+    int m = 0;
+    for (int p = 0; p < mem_info->data.numPartitionsPerRecord; p++) {
+        // Length byte, partition data, block tag and PEC
+        dev = sim_transfer(handle, s_partitions[p] + 4);
+        if (dev == NULL) return false;
+        m += s_partitions[p];
+    }
+
+    if (dev == NULL || dev->next_record >= dev->pack.record_count || m > MEMORY_BLOCK_SIZE) {
+        return false;
+    }
+
+    memcpy(batmem->bytedata, dev->pack.records[dev->next_record].bytedata, m);
+    dev->next_record++;
+    dev->stats.records_read++;
+    return true;
+}
+
+bool BATMON_getMemory(batmon_handle_t *handle, BatmonMemory *batmem, const BATMON_Mem_Info *mem_info) {
+    EVTRACE_BEGIN(EVTRACE_ID_BATMON_GET_MEMORY, handle ? handle->address : 0);
+    bool ok = read_memory(handle, batmem, mem_info);
+    EVTRACE_END(EVTRACE_ID_BATMON_GET_MEMORY, ok);
+    return ok;
+}
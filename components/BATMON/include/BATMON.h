@@ -1,6 +1,16 @@
 #pragma once
 
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "driver/i2c_master.h"
+#else
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+// No I2C driver on linux; the simulated devices never dereference these
+typedef struct i2c_master_bus_t *i2c_master_bus_handle_t;
+typedef struct i2c_master_dev_t *i2c_master_dev_handle_t;
+#endif
 #include "Batmon_struct.h"
 
 #ifdef __cplusplus
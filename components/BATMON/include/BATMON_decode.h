@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Batmon_struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATMON_GPS_SECONDS_PER_WEEK 604800u
+#define BATMON_GPS_EPOCH_UNIX       315964800   ///< 1980-01-06T00:00:00Z as a unix time
+
+/**
+ * @brief Decoded BatmonMemory records, one array per field (structure of arrays)
+ *
+ * Row i of every column belongs to the same record. Units are engineering
+ * units: mV, °C, mAh, A, mOhm and seconds since the GPS epoch.
+ */
+typedef struct {
+    uint8_t  *memory_index;
+    uint8_t  *min_soc;              ///< %
+    uint8_t  *max_soc;              ///< %
+    uint8_t  *soh;                  ///< %
+    float    *min_temp_c;
+    float    *max_temp_c;
+    float    *max_int_temp_c;       ///< BMS chip
+    uint16_t *max_current_a;
+    uint16_t *cycle;
+    uint8_t  *new_cycle;            ///< Cycle was incremented in this record
+    uint8_t  *logged_without_sleep;
+    uint8_t  *boot_min_cell;        ///< Cell index
+    uint8_t  *boot_max_cell;
+    uint16_t *boot_min_mv;
+    uint16_t *boot_max_mv;
+    uint8_t  *shut_min_cell;
+    uint8_t  *shut_max_cell;
+    uint16_t *shut_min_mv;
+    uint16_t *shut_max_mv;
+    uint16_t *remain_mah;
+    uint32_t *charged_mah;
+    uint32_t *discharged_mah;
+    uint8_t  *cc_error;
+    uint8_t  *cc_time_error;
+    uint8_t  *cc_error_count;
+    uint8_t  *alarms;               ///< triggeredAlarm bits
+    uint32_t *gps_start_s;
+    uint32_t *gps_end_s;
+    uint8_t  *ir_min_mohm[INT_RES_PER_MEMORY];
+    uint8_t  *ir_max_mohm[INT_RES_PER_MEMORY];
+    uint8_t  *soc_from_voltage;
+    uint8_t  *storage_discharge;
+    uint8_t  *storage_mode;
+} batmon_mem_columns_t;
+
+typedef enum {
+    BATMON_COL_U8,
+    BATMON_COL_U16,
+    BATMON_COL_U32,
+    BATMON_COL_F32,
+} batmon_col_type_t;
+
+/**
+ * @brief Describes one column of batmon_mem_columns_t, for generic output code
+ */
+typedef struct {
+    const char *name;
+    batmon_col_type_t type;
+    size_t offset;                  ///< Offset of the column pointer in batmon_mem_columns_t
+} batmon_col_desc_t;
+
+extern const batmon_col_desc_t BATMON_memColumns[];
+extern const size_t BATMON_memColumnCount;
+
+/**
+ * @brief Size in bytes of a single element of a column type
+ */
+size_t BATMON_colTypeSize(batmon_col_type_t type);
+
+/**
+ * @brief Pointer to the data of a column
+ */
+static inline void *BATMON_memColumn(const batmon_mem_columns_t *cols, const batmon_col_desc_t *desc) {
+    return *(void *const *)((const uint8_t *)cols + desc->offset);
+}
+
+/**
+ * @brief Buffer size needed by BATMON_memColumnsBind() for `capacity` rows
+ */
+size_t BATMON_memColumnsSize(size_t capacity);
+
+/**
+ * @brief Point every column into one caller-provided buffer
+ *
+ * Columns keep the alignment of the buffer. The decoder never allocates,
+ * so the buffer can come from any heap (or be static).
+ *
+ * @param cols Columns to set up
+ * @param buf Buffer of at least BATMON_memColumnsSize(capacity) bytes, 16-byte aligned
+ * @param capacity Number of rows
+ */
+void BATMON_memColumnsBind(batmon_mem_columns_t *cols, void *buf, size_t capacity);
+
+/**
+ * @brief Decode a batch of raw records into columns
+ *
+ * Bitfields are extracted with explicit shifts and masks from the packed
+ * little-endian image, one record per loop iteration with no branches, so
+ * the compiler can vectorize the loop.
+ *
+ * @param records First record
+ * @param stride Bytes from one record to the next (sizeof(BatmonMemory) for an array,
+ *               larger when records are interleaved with headers)
+ * @param count Number of records
+ * @param cols Output columns
+ * @param row First row of cols to write
+ */
+void BATMON_decodeMemoryBatch(const void *records, size_t stride, size_t count,
+                              const batmon_mem_columns_t *cols, size_t row);
+
+#ifdef __cplusplus
+}
+#endif
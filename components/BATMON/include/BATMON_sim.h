@@ -0,0 +1,101 @@
+/**
+ * @file BATMON_sim.h
+ * @brief Simulated BATMON devices (CONFIG_BATMON_SIMULATED)
+ *
+ * With CONFIG_BATMON_SIMULATED the BATMON API in BATMON.h is served by
+ * in-memory devices instead of the SMBus driver. A device answers at its
+ * address once a pack is attached and NACKs (ESP_FAIL) while the slot is
+ * empty, so connection detection works as on the bus.
+ *
+ * Transactions complete immediately. Each one is accounted with the bytes
+ * the real driver would move and the time that takes at the modeled bus
+ * clock, so harnesses can add bus time to measured software time.
+ *
+ * The simulator is not locked: attach, detach and the BATMON API must be
+ * called from one task (or from tasks that serialize among themselves).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "Batmon_struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATMON_SIM_MAX_DEVICES  16
+#define BATMON_SIM_MAX_RECORDS  255     ///< totalMemoryRecords is 8 bits
+
+/**
+ * @brief Pack plugged into a simulated slot
+ */
+typedef struct {
+    uint16_t hash;                  ///< SMBUS_SERIAL_NUM, names the battery_fs files
+    uint16_t sn[8];                 ///< 128-bit serial, all zero to derive it from hash
+    uint16_t soc;                   ///< %
+    int16_t current_ma;             ///< Positive while charging
+    uint8_t cells;                  ///< 0 for 6
+    uint16_t capacity_mah;          ///< 0 for 5000
+    const BatmonMemory *records;    ///< Pack memory in memory slot order; must stay valid while attached
+    size_t record_count;            ///< Up to BATMON_SIM_MAX_RECORDS
+} batmon_sim_pack_t;
+
+/**
+ * @brief Bus traffic counters
+ */
+typedef struct {
+    uint32_t transactions;
+    uint32_t nacks;                 ///< Transactions to an empty slot
+    uint64_t bytes;                 ///< Bytes on the wire, address and command bytes included
+    uint64_t bus_us;                ///< Modeled bus time
+    uint32_t records_read;          ///< Complete BatmonMemory records transferred
+} batmon_sim_stats_t;
+
+/**
+ * @brief Plug a pack into the slot at `address`
+ *
+ * @param address SMBus address of the slot
+ * @param pack Pack description, copied (the records are referenced)
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_NO_MEM if all device slots are used
+ */
+esp_err_t BATMON_simAttach(uint8_t address, const batmon_sim_pack_t *pack);
+
+/**
+ * @brief Unplug the pack at `address`
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if no pack is attached
+ */
+esp_err_t BATMON_simDetach(uint8_t address);
+
+/**
+ * @brief Update the live telemetry of an attached pack
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if no pack is attached
+ */
+esp_err_t BATMON_simSetTelemetry(uint8_t address, uint16_t soc, int16_t current_ma);
+
+/**
+ * @brief Change the modeled bus clock (CONFIG_BATMON_SIM_BUS_HZ by default)
+ */
+void BATMON_simSetBusClock(uint32_t hz);
+
+/**
+ * @brief Get the traffic counters
+ *
+ * @param address Device address, 0 for the sum over all devices
+ * @param stats Output: counters
+ * @return ESP_OK, ESP_ERR_NOT_FOUND for an unknown address
+ */
+esp_err_t BATMON_simGetStats(uint8_t address, batmon_sim_stats_t *stats);
+
+/**
+ * @brief Zero the traffic counters of every device
+ */
+void BATMON_simResetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,231 @@
+/**
+ * @file batmon_synth.c
+ * @brief Synthetic BatmonMemory record streams
+ *
+ * Each record is one usage session of a pack, alternating between a
+ * discharge (flight) and a charge back up, like the recorded fixtures.
+ * The generator keeps the counters a real BATMON keeps across records:
+ * memory index, cycle count, coulomb counter error count and the clock.
+ */
+
+#include "batmon_fixtures.h"
+#include <string.h>
+
+#define SYNTH_DEFAULT_RING          256
+#define SYNTH_DEFAULT_CAPACITY_MAH  5000
+#define SYNTH_DEFAULT_CELLS         6
+#define SYNTH_DEFAULT_START_GPS_S   1388102418u    // 2024-01-01T00:00:00Z
+#define SYNTH_DEFAULT_INTERVAL_S    3600
+#define SYNTH_DEFAULT_ALARM         5
+#define SYNTH_DEFAULT_CC_ERROR      2
+#define SYNTH_GPS_SECONDS_PER_WEEK  604800u
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint32_t synth_rand(batmon_synth_t *s) {
+    uint32_t x = s->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return s->rng = x;
+}
+
+// Uniform in [lo, hi]
+static uint32_t synth_range(batmon_synth_t *s, uint32_t lo, uint32_t hi) {
+    return lo + synth_rand(s) % (hi - lo + 1);
+}
+
+static bool synth_chance(batmon_synth_t *s, uint16_t permille) {
+    return synth_rand(s) % 1000 < permille;
+}
+
+static uint8_t temp_raw(int celsius) {
+    return (uint8_t)(celsius + KELVIN_CELCIUS + MEMORY_TEMP_OFFSET + 0.5);
+}
+
+// Resting cell voltage from SOC, 3.30 V empty to 4.20 V full
+static uint16_t cell_mv(uint8_t soc) {
+    return 3300 + soc * 9;
+}
+
+static void gps_time(GPSTime *t, uint32_t gps_s) {
+    t->week = gps_s / SYNTH_GPS_SECONDS_PER_WEEK;
+    t->tow_s = gps_s % SYNTH_GPS_SECONDS_PER_WEEK;
+}
+
+// Min and max cell of a pack at `soc`, with a few tens of mV of imbalance
+static void cell_spread(batmon_synth_t *s, uint8_t soc, uint8_t *min_idx, uint8_t *max_idx,
+                        uint8_t *min_v, uint8_t *max_v) {
+    uint16_t mv = cell_mv(soc);
+    uint16_t spread = synth_range(s, 0, 40);
+    *min_idx = synth_range(s, 0, s->cfg.cells - 1);
+    *max_idx = synth_range(s, 0, s->cfg.cells - 1);
+    *min_v = (mv - spread / 2) / MEM_VOLT_STORAGE_RESOLUTION;
+    *max_v = (mv + spread / 2) / MEM_VOLT_STORAGE_RESOLUTION;
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void batmon_synth_init(batmon_synth_t *synth, const batmon_synth_config_t *config, uint32_t pack) {
+    memset(synth, 0, sizeof(*synth));
+    if (config != NULL) {
+        synth->cfg = *config;
+    }
+
+    batmon_synth_config_t *cfg = &synth->cfg;
+    if (cfg->ring_size == 0 || cfg->ring_size > SYNTH_DEFAULT_RING) {
+        cfg->ring_size = SYNTH_DEFAULT_RING;
+    }
+    if (cfg->capacity_mah == 0) {
+        cfg->capacity_mah = SYNTH_DEFAULT_CAPACITY_MAH;
+    }
+    if (cfg->cells == 0 || cfg->cells > MAX_CELL_COUNT) {
+        cfg->cells = SYNTH_DEFAULT_CELLS;
+    }
+    if (cfg->start_gps_s == 0) {
+        cfg->start_gps_s = SYNTH_DEFAULT_START_GPS_S;
+    }
+    if (cfg->interval_s == 0) {
+        cfg->interval_s = SYNTH_DEFAULT_INTERVAL_S;
+    }
+    if (cfg->alarm_permille == 0) {
+        cfg->alarm_permille = SYNTH_DEFAULT_ALARM;
+    }
+    if (cfg->cc_error_permille == 0) {
+        cfg->cc_error_permille = SYNTH_DEFAULT_CC_ERROR;
+    }
+
+    // Never let the xorshift state be zero
+    synth->rng = (cfg->seed ^ (pack * 0x9E3779B9u)) | 1;
+    for (int i = 0; i < 8; i++) {
+        synth_rand(synth);
+    }
+
+    // Spread packs over serials, ages and clocks
+    synth->serial = (uint16_t)(synth_rand(synth) >> 16);
+    synth->cycle = cfg->start_cycle + synth_range(synth, 0, 50);
+    synth->soc = synth_range(synth, 60, 100);
+    synth->gps_s = cfg->start_gps_s + synth_range(synth, 0, cfg->interval_s);
+}
+
+void batmon_synth_next(batmon_synth_t *synth, BatmonMemory *out) {
+    batmon_synth_config_t *cfg = &synth->cfg;
+    bool reset = cfg->reset_interval != 0 && synth->records != 0 &&
+                 synth->records % cfg->reset_interval == 0;
+
+    if (reset) {
+        // A memory reset restarts the record ring and forgets the SOC
+        synth->index = 0;
+        synth->soc = synth_range(synth, 20, 100);
+    }
+
+    memset(out, 0, sizeof(*out));
+    __typeof__(out->data) *d = &out->data;
+
+    // Discharge after a charge and vice versa; a nearly empty pack always charges
+    bool discharge = synth->soc > 30 && (synth->records & 1) == 0;
+    uint8_t soc_start = synth->soc;
+    uint8_t soc_end;
+    if (discharge) {
+        soc_end = synth_range(synth, soc_start > 70 ? soc_start - 70 : 5, soc_start - 10);
+    } else {
+        soc_end = synth_range(synth, soc_start > 90 ? soc_start : 90, 100);
+    }
+    uint32_t swing_mah = (uint32_t)(soc_start > soc_end ? soc_start - soc_end : soc_end - soc_start) *
+                         cfg->capacity_mah / 100;
+
+    d->memoryIndex = (uint8_t)(synth->index % cfg->ring_size);
+    d->minSOC = soc_start < soc_end ? soc_start : soc_end;
+    d->maxSOC = soc_start < soc_end ? soc_end : soc_start;
+    d->SOH = 100 - (synth->cycle / 20 > 40 ? 40 : synth->cycle / 20);
+
+    // Ambient 15..30 °C, discharge current heats the pack
+    int ambient = synth_range(synth, 15, 30);
+    uint16_t current_a = discharge ? synth_range(synth, 10, 80) : 0;
+    int rise = discharge ? current_a / 4 : (int)synth_range(synth, 2, 8);
+    d->minTempCycle = temp_raw(ambient);
+    d->maxTempCycle = temp_raw(ambient + rise);
+    d->maxIntTempCycle = temp_raw(ambient + rise + synth_range(synth, 2, 10));
+    d->maxDrainedCurrentCycle = current_a;
+
+    // A cycle is counted for every capacity's worth of discharge
+    if (discharge) {
+        synth->discharged_mah += swing_mah;
+        if (synth->discharged_mah >= cfg->capacity_mah) {
+            synth->discharged_mah -= cfg->capacity_mah;
+            synth->cycle = (synth->cycle + 1) & 0x3FFF;
+            d->log.REC_NEW_CYCLE = 1;
+        }
+    }
+    d->log.battCycle = synth->cycle;
+    d->log.LOGGED_WITHOUT_SLEEP = synth_chance(synth, 50);
+
+    uint8_t min_idx, max_idx, min_v, max_v;
+    cell_spread(synth, soc_start, &min_idx, &max_idx, &min_v, &max_v);
+    d->bootupMinCellVIndex = min_idx;
+    d->bootupMaxCellVIndex = max_idx;
+    d->bootupMinCellV = min_v;
+    d->bootupMaxCellV = max_v;
+    cell_spread(synth, soc_end, &min_idx, &max_idx, &min_v, &max_v);
+    d->shutdownMinCellVIndex = min_idx;
+    d->shutdownMaxCellVIndex = max_idx;
+    d->shutdownMinCellV = min_v;
+    d->shutdownMaxCellV = max_v;
+    d->shutdownRemainCap = (uint32_t)soc_end * cfg->capacity_mah / 100;
+
+    d->accumulatedCharged = discharge ? 0 : swing_mah;
+    d->accumulatedDischarged = discharge ? swing_mah : synth_range(synth, 0, 20);
+
+    if (synth_chance(synth, cfg->cc_error_permille)) {
+        d->bq_status.CC_ERROR = synth_chance(synth, 500);
+        d->bq_status.CC_TIME_ERROR = !d->bq_status.CC_ERROR;
+        if (synth->cc_errors < 63) {
+            synth->cc_errors++;
+        }
+    }
+    d->bq_status.ccErrorCount = synth->cc_errors;
+
+    if (synth_chance(synth, cfg->alarm_permille)) {
+        d->triggeredAlarmCycle.alarm = 1 << synth_range(synth, 0, 3);
+    } else if (discharge && soc_end < 15) {
+        d->triggeredAlarmCycle.bits.REMAINING_CAPACITY_ALARM = 1;
+    }
+
+    // Sessions take up to half the interval, the pack rests in between
+    uint32_t duration = synth_range(synth, cfg->interval_s / 8, cfg->interval_s / 2);
+    gps_time(&d->gpsStartTimestamp, synth->gps_s);
+    gps_time(&d->gpsEndTimestamp, synth->gps_s + duration);
+    synth->gps_s += duration + synth_range(synth, cfg->interval_s / 2, cfg->interval_s);
+
+    // Internal resistance grows with age, a few mOhm per hundred cycles
+    uint32_t ir_base = 3 + synth->cycle / 100;
+    for (int i = 0; i < INT_RES_PER_MEMORY; i++) {
+        IntRes *ir = &d->intRes[i];
+        uint32_t lo = ir_base + synth_range(synth, 0, 2);
+        uint32_t hi = lo + synth_range(synth, 0, 4);
+        ir->intResTag.tag.current_interval = synth_range(synth, 0, 7);
+        ir->intResTag.tag.temperature_interval = synth_range(synth, 0, 7);
+        ir->intResTag.tag.SOC_interval = i;
+        ir->minIntRes = lo > UINT8_MAX ? UINT8_MAX : lo;
+        ir->maxIntRes = hi > UINT8_MAX ? UINT8_MAX : hi;
+        ir->IntResIndices.minIntResIndex = synth_range(synth, 0, cfg->cells - 1);
+        ir->IntResIndices.maxIntResIndex = synth_range(synth, 0, cfg->cells - 1);
+    }
+
+    d->log2.bootFromVoltageSOC = reset;
+    d->log2.StoragemodeStarted = !discharge && synth_chance(synth, 20);
+
+    synth->soc = soc_end;
+    synth->index++;
+    synth->records++;
+}
+
+void batmon_synth_fill(batmon_synth_t *synth, BatmonMemory *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        batmon_synth_next(synth, &out[i]);
+    }
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Convert the hex string tables of battery_mock_data.h into packed BatmonMemory
+arrays (a C source), so nothing has to parse hex at run time.
+
+    gen_fixtures.py <battery_mock_data.h> <output.c>
+
+Every `static const mock_battery_entry_t <name>[]` table becomes a
+`const BatmonMemory` array and an entry of batmon_fixtures[]. Byte values
+wider than 8 bits (the tables count memory indices up to 0x100) keep their
+low byte, which is what the 8-bit memoryIndex field holds on a real pack.
+"""
+
+import re
+import sys
+
+RECORD_SIZE = 64
+
+TABLE_RE = re.compile(r'static\s+const\s+mock_battery_entry_t\s+(\w+)\s*\[\s*\]\s*=\s*\{(.*?)\}\s*;', re.S)
+ENTRY_RE = re.compile(r'\{\s*(\d+)\s*,\s*"([^"]*)"\s*\}')
+
+
+def parse(path):
+    with open(path, encoding='utf-8') as f:
+        text = f.read()
+
+    tables = []
+    # The first table in the header closes with "}\n\n;", allow any whitespace
+    for name, body in TABLE_RE.findall(text.replace('}\n\n;', '};')):
+        entries = []
+        wrapped = 0
+        for log_number, hex_data in ENTRY_RE.findall(body):
+            values = [int(tok, 16) for tok in hex_data.split()]
+            if len(values) != RECORD_SIZE:
+                sys.exit(f'{path}: {name} entry {log_number}: {len(values)} bytes, expected {RECORD_SIZE}')
+            wrapped += sum(v > 0xFF for v in values)
+            entries.append((int(log_number), bytes(v & 0xFF for v in values)))
+        if not entries:
+            sys.exit(f'{path}: table {name} is empty')
+        if wrapped:
+            print(f'gen_fixtures: {name}: {wrapped} values wider than a byte truncated', file=sys.stderr)
+        tables.append((name, entries))
+
+    if not tables:
+        sys.exit(f'{path}: no mock_battery_entry_t tables found')
+    return tables
+
+
+def emit(tables, src, out):
+    lines = [
+        '// Generated by gen_fixtures.py from ' + src.replace('\\', '/').split('/')[-1] + ', do not edit',
+        '',
+        '#include "batmon_fixtures.h"',
+        '',
+    ]
+
+    for name, entries in tables:
+        lines.append(f'static const uint32_t {name}_logs[{len(entries)}] = {{')
+        for i in range(0, len(entries), 16):
+            lines.append('    ' + ', '.join(str(n) for n, _ in entries[i:i + 16]) + ',')
+        lines.append('};')
+        lines.append('')
+        lines.append(f'static const BatmonMemory {name}_records[{len(entries)}] = {{')
+        for _, data in entries:
+            lines.append('    {.bytedata = {' + ', '.join(f'0x{b:02X}' for b in data) + '}},')
+        lines.append('};')
+        lines.append('')
+
+    lines.append('const batmon_fixture_t batmon_fixtures[] = {')
+    for name, entries in tables:
+        # battery_01945_data -> "01945"
+        label = re.sub(r'^battery_|_data$', '', name)
+        lines.append(f'    {{"{label}", {name}_records, {name}_logs, {len(entries)}}},')
+    lines.append('};')
+    lines.append('')
+    lines.append('const size_t batmon_fixture_count = sizeof(batmon_fixtures) / sizeof(batmon_fixtures[0]);')
+    lines.append('')
+
+    with open(out, 'w', encoding='utf-8') as f:
+        f.write('\n'.join(lines))
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: gen_fixtures.py <battery_mock_data.h> <output.c>')
+    emit(parse(sys.argv[1]), sys.argv[1], sys.argv[2])
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,91 @@
+/**
+ * @file batmon_fixtures.h
+ * @brief Recorded and synthetic BatmonMemory record streams for benchmarks
+ *
+ * Recorded fixtures come from battery_mock_data.h, converted to packed
+ * BatmonMemory arrays at build time. The synthetic generator produces
+ * record streams for any number of packs with the behaviour seen in the
+ * field: memory index ring wrap, memory resets and cycle increments.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "Batmon_struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ============================================================================
+// Recorded fixtures
+// ============================================================================
+
+typedef struct {
+    const char *name;               ///< Battery label from the mock table, e.g. "01945"
+    const BatmonMemory *records;
+    const uint32_t *log_numbers;    ///< Log number of each record
+    size_t count;
+} batmon_fixture_t;
+
+extern const batmon_fixture_t batmon_fixtures[];
+extern const size_t batmon_fixture_count;
+
+// ============================================================================
+// Synthetic generator
+// ============================================================================
+
+/**
+ * @brief Generator parameters, zero fields take the default
+ */
+typedef struct {
+    uint32_t seed;
+    uint16_t ring_size;             ///< Memory slots before memoryIndex wraps, 1..256 (256)
+    uint16_t start_cycle;           ///< (0)
+    uint16_t capacity_mah;          ///< (5000)
+    uint8_t cells;                  ///< Series cells, 1..MAX_CELL_COUNT (6)
+    uint32_t reset_interval;        ///< Reset the pack memory every N records, 0 = never
+    uint32_t start_gps_s;           ///< First record time, GPS epoch seconds (2024-01-01)
+    uint32_t interval_s;            ///< Mean time between records (3600)
+    uint16_t alarm_permille;        ///< Chance of an alarm per record, 1/1000 (5)
+    uint16_t cc_error_permille;     ///< Chance of a coulomb counter error per record, 1/1000 (2)
+} batmon_synth_config_t;
+
+typedef struct {
+    batmon_synth_config_t cfg;
+    uint16_t serial;                ///< Pack serial hash, as used for battery_fs file names
+    uint32_t rng;
+    uint32_t records;               ///< Records generated so far
+    uint32_t index;                 ///< Records since the last memory reset
+    uint16_t cycle;
+    uint32_t discharged_mah;        ///< Discharge since the last cycle increment
+    uint8_t soc;
+    uint8_t cc_errors;
+    uint32_t gps_s;
+} batmon_synth_t;
+
+/**
+ * @brief Start a record stream
+ *
+ * @param synth Generator state
+ * @param config Parameters, NULL for all defaults
+ * @param pack Pack number; packs of the same config get distinct serials,
+ *             seeds, start cycles and clocks
+ */
+void batmon_synth_init(batmon_synth_t *synth, const batmon_synth_config_t *config, uint32_t pack);
+
+/**
+ * @brief Generate the next record of the stream
+ */
+void batmon_synth_next(batmon_synth_t *synth, BatmonMemory *out);
+
+/**
+ * @brief Generate `count` consecutive records
+ */
+void batmon_synth_fill(batmon_synth_t *synth, BatmonMemory *out, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,29 +4,196 @@
  */
 
 #include "battery_fs.h"
+#include "battery_fs_backend.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <dirent.h>
-#include <errno.h>
 #include <time.h>
 #include "esp_log.h"
-#include "esp_vfs_fat_nand.h"
-#include "spi_nand_flash.h"
-#include "nand_diag_api.h"
-#include "driver/spi_master.h"
 #include "esp_crc.h"
+#include "evtrace.h"
+#include "ff.h"
+#include "diskio_impl.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "Batmon_struct.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_vfs_fat.h"
+#endif
 
 static const char *TAG = "battery_fs";
 
+#define BATTERY_FS_MAX_FILES    20
+#define BATTERY_FS_LOCK_STRIPES 8       // Batteries share locks by serial number hash
+#define BATTERY_FS_DRAIN_POLL_MS 50     // Recheck period while waiting for readers
+#define BATTERY_FS_FLAG_READ_RUNS 16    // Flag runs per read in a query
+#define BATTERY_FS_TLM_READ_BUCKETS 8   // Telemetry buckets per read in a query
+#define BATTERY_FS_TLM_PENDING  16      // Closed buckets per level written at once
+#define BATTERY_FS_SYNC_READ_ENTRIES 8  // Sequence log entries per read in a sync read
+#define BATTERY_FS_SEQ_LOG      "SYNC.LOG"
+#define BATTERY_FS_SYNC_CURSORS "SYNC.CUR"
+#define BATTERY_FS_TOPK_STORE_MS 60000  // Longest time appends leave the rankings unstored
+#define BATTERY_FS_TOPK_STACK   4096    // Background rankings rebuild
+#define BATTERY_FS_TOPK_PRIORITY 1
+
+/**
+ * @brief Lock of the batteries hashing to one stripe
+ *
+ * FatFs (FF_FS_REENTRANT) serializes every call on the volume, which keeps
+ * sectors consistent but not the sequence of calls behind one append:
+ * metadata read, data append, metadata update. `writer` serializes appends
+ * and deletes of a battery.
+ *
+ * Readers do not take `writer`: they read the record count from the
+ * metadata once and stop there, and an append only updates the metadata
+ * after the records it counts are on the volume. Only a delete frees
+ * clusters an open reader may still be reading, so deletes wait for
+ * `readers` to drop to 0 and hold `guard` to keep new readers out.
+ */
+typedef struct {
+    SemaphoreHandle_t writer;
+    SemaphoreHandle_t guard;        // Protects readers
+    SemaphoreHandle_t drained;      // Given when readers drops to 0
+    uint32_t readers;
+} battery_lock_t;
+
+/**
+ * @brief Snapshot reader, see battery_fs_reader_open()
+ */
+struct battery_fs_reader {
+    FIL *file;
+    battery_lock_t *lock;
+    uint32_t count;                 // Records in the snapshot
+    uint32_t next;                  // Records returned so far
+};
+
+/**
+ * @brief Change subscription, see battery_fs_subscribe()
+ *
+ * Counters and marks are written by the dispatcher task only.
+ */
+struct battery_fs_subscriber {
+    bool active;
+    battery_fs_change_cb_t cb;      // NULL for a queue subscriber
+    void *arg;
+    QueueHandle_t queue;
+    uint32_t since_seq;             // First sequence number it gets
+    uint32_t handled_seq;           // Last one handed over or dropped
+    uint32_t delivered;
+    uint32_t dropped;               // Its own queue full
+    uint32_t max_lag;
+    uint32_t overflow_base;         // Dispatcher queue drops before it subscribed
+};
+
+/**
+ * @brief Head of a .met file, the flag runs follow
+ */
+typedef struct {
+    battery_metadata_t meta;
+    battery_fs_summary_t summary;
+    battery_fs_flag_header_t flags;
+} meta_file_t;
+
+_Static_assert(sizeof(meta_file_t) == sizeof(battery_metadata_t) + sizeof(battery_fs_summary_t) +
+                                      sizeof(battery_fs_flag_header_t),
+               "the summary and flag index head follow the metadata");
+_Static_assert(sizeof(meta_file_t) <= FF_MIN_SS, "the .met head is written as one sector");
+
+/**
+ * @brief Flag index being extended, rebuilt or scanned
+ *
+ * The open run of each flag is stored once the next run of that flag
+ * starts, or by flag_finish(): into the .met `file` when set, else to
+ * `emit` when set.
+ */
+typedef struct {
+    battery_fs_flag_header_t *hdr;
+    battery_fs_flag_run_t run[BATTERY_FS_FLAGS];    // Open run of each flag, count 0 = none
+    uint32_t entry[BATTERY_FS_FLAGS];               // Its entry number + 1, 0 = not stored yet
+    FIL *file;
+    void (*emit)(const battery_fs_flag_run_t *run, void *arg);
+    void *arg;
+    FRESULT res;                                    // First store error
+} flag_index_t;
+
+/**
+ * @brief Telemetry append in progress
+ *
+ * Closed buckets collect in `pending` and are written to their ring in
+ * one go; `hdr` commits them once written.
+ */
+typedef struct {
+    battery_fs_tlm_header_t hdr;
+    FIL *file;
+    battery_fs_tlm_bucket_t pending[BATTERY_FS_TLM_LEVELS][BATTERY_FS_TLM_PENDING];
+    uint32_t pending_count[BATTERY_FS_TLM_LEVELS];
+    FRESULT res;                    // First write error
+} tlm_append_t;
+
+_Static_assert(sizeof(battery_fs_tlm_header_t) <= BATTERY_FS_TLM_HEADER_SIZE,
+               "the telemetry header fits before the first ring");
+
+static const uint32_t s_tlm_period[BATTERY_FS_TLM_LEVELS] = { 1, 60, 3600 };
+static const uint32_t s_tlm_capacity[BATTERY_FS_TLM_LEVELS] = {
+    BATTERY_FS_TLM_RAW_BUCKETS, BATTERY_FS_TLM_MINUTE_BUCKETS, BATTERY_FS_TLM_HOUR_BUCKETS,
+};
+
+/**
+ * @brief Pending battery_fs_flag_runs() answer, touching runs are merged
+ */
+typedef struct {
+    battery_fs_flag_t flag;
+    battery_fs_flag_cb_t cb;
+    void *arg;
+    uint32_t first;                 // Run not reported yet
+    uint32_t count;
+    bool stop;
+} flag_query_t;
+
 // Internal state
 static struct {
     bool initialized;
-    spi_nand_flash_device_t *flash_handle;
-    spi_device_handle_t spi_handle;
+    const battery_fs_backend_ops_t *backend;
+    void *backend_ctx;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    BYTE pdrv;
+    FATFS *fatfs;
+    char drive[4];          // FatFs logical drive, e.g. "0:"
     char mount_point[32];
+    battery_fs_stats_t stats;
+    battery_lock_t locks[BATTERY_FS_LOCK_STRIPES];
+    volatile bool suspended;    // See battery_fs_suspend()
+    uint32_t active;            // Calls inside battery_fs, atomic
+    SemaphoreHandle_t idle;     // Given when active drops to 0 while suspended
+    battery_fs_topk_file_t topk;    // Fleet rankings, see battery_fs_topk()
+    SemaphoreHandle_t topk_lock;    // Taken after a battery's writer lock
+    battery_fs_topk_file_t *topk_building;  // Being rebuilt, NULL when no rebuild runs
+    bool topk_dirty;                // Changes not stored yet
+    TickType_t topk_stored;         // When last stored
+    SemaphoreHandle_t topk_done;    // Given by the rebuild task as it exits
+    bool topk_abort;                // Stops a rebuild and drops its result, atomic
+    uint32_t next_seq;              // Of the next record committed, 0 = log unreadable
+    uint32_t seq_entries;           // Entries in the sequence log
+    battery_fs_sync_file_t sync;    // Consumer marks, see battery_fs_sync_ack()
+    SemaphoreHandle_t seq_lock;     // Taken after a battery's writer lock
+    battery_fs_subscriber_t subs[BATTERY_FS_SUBSCRIBERS];
+    SemaphoreHandle_t sub_lock;     // Taken before seq_lock, never held across a callback
+    QueueHandle_t changes;          // To the dispatcher, NULL until the first subscription
+    SemaphoreHandle_t dispatch_done;
+    TaskHandle_t dispatcher;
+    battery_fs_subscriber_t *delivering;    // Its callback runs, under sub_lock
+    uint32_t changes_dropped;       // Dispatcher queue full, atomic
 } g_fs_state = {0};
 
+static void topk_load(void);
+static void topk_stop(void);
+static void sync_load(void);
+static FRESULT sync_search(FIL *f, uint32_t entries, uint32_t seq, uint32_t *index);
+static void change_publish(const battery_fs_seq_entry_t *e, uint32_t last_memory_index);
+static void dispatch_stop(void);
+
 // ============================================================================
 // Helper Functions
 // ============================================================================
@@ -35,14 +202,376 @@ static struct {
  * @brief Build data file path from serial number
  */
 static void build_data_path(const char *serial_number, char *path, size_t path_size) {
-    snprintf(path, path_size, "%s/%s.bin", g_fs_state.mount_point, serial_number);
+    snprintf(path, path_size, "%s/%s.bin", g_fs_state.drive, serial_number);
+}
+
+/**
+ * @brief Read `size` bytes at `offset`, short reads are errors
+ */
+static FRESULT read_at(FIL *f, FSIZE_t offset, void *data, UINT size) {
+    UINT read = 0;
+    FRESULT res = f_lseek(f, offset);
+    if (res == FR_OK) {
+        res = f_read(f, data, size, &read);
+    }
+    return res == FR_OK && read != size ? FR_INT_ERR : res;
+}
+
+/**
+ * @brief Write `size` bytes at `offset`, extending the file when needed
+ */
+static FRESULT write_at(FIL *f, FSIZE_t offset, const void *data, UINT size) {
+    UINT written = 0;
+    FRESULT res = f_lseek(f, offset);
+    if (res == FR_OK) {
+        res = f_write(f, data, size, &written);
+    }
+    return res == FR_OK && written != size ? FR_DENIED : res;
 }
 
 /**
  * @brief Build metadata file path from serial number
  */
 static void build_meta_path(const char *serial_number, char *path, size_t path_size) {
-    snprintf(path, path_size, "%s/%s.met", g_fs_state.mount_point, serial_number);
+    snprintf(path, path_size, "%s/%s.met", g_fs_state.drive, serial_number);
+}
+
+/**
+ * @brief Build telemetry file path from serial number
+ */
+static void build_tlm_path(const char *serial_number, char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s.tlm", g_fs_state.drive, serial_number);
+}
+
+/**
+ * @brief Build the fleet rankings path
+ */
+static void build_topk_path(char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/FLEET.TOP", g_fs_state.drive);
+}
+
+/**
+ * @brief Build the path of a volume file of the sync protocol
+ */
+static void build_sync_path(const char *name, char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s", g_fs_state.drive, name);
+}
+
+/**
+ * @brief Look up the backend selected in the configuration
+ */
+static const battery_fs_backend_ops_t *select_backend(battery_fs_backend_type_t type) {
+    switch (type) {
+    case BATTERY_FS_BACKEND_SPIFLASH:
+        return &battery_fs_backend_spiflash;
+#if !CONFIG_IDF_TARGET_LINUX
+    case BATTERY_FS_BACKEND_SPI_NAND:
+        return &battery_fs_backend_spi_nand;
+#else
+    case BATTERY_FS_BACKEND_FILE:
+        return &battery_fs_backend_file;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Open a file on the volume
+ *
+ * FIL embeds a full sector buffer, so it lives on the heap rather than on
+ * the (small) stack of the acquisition task.
+ */
+static FRESULT file_open(FIL **fp, const char *path, BYTE mode) {
+    *fp = malloc(sizeof(FIL));
+    if (*fp == NULL) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+
+    FRESULT res = f_open(*fp, path, mode);
+    if (res != FR_OK) {
+        free(*fp);
+        *fp = NULL;
+    }
+    return res;
+}
+
+/**
+ * @brief Close a file opened with file_open()
+ */
+static FRESULT file_close(FIL *fp) {
+    FRESULT res = f_close(fp);
+    free(fp);
+    return res;
+}
+
+// ============================================================================
+// Per-Battery Locks
+// ============================================================================
+
+static void locks_delete(void) {
+    for (int i = 0; i < BATTERY_FS_LOCK_STRIPES; i++) {
+        battery_lock_t *lock = &g_fs_state.locks[i];
+        if (lock->writer) vSemaphoreDelete(lock->writer);
+        if (lock->guard) vSemaphoreDelete(lock->guard);
+        if (lock->drained) vSemaphoreDelete(lock->drained);
+        memset(lock, 0, sizeof(*lock));
+    }
+    if (g_fs_state.idle) {
+        vSemaphoreDelete(g_fs_state.idle);
+        g_fs_state.idle = NULL;
+    }
+    if (g_fs_state.topk_lock) {
+        vSemaphoreDelete(g_fs_state.topk_lock);
+        g_fs_state.topk_lock = NULL;
+    }
+    if (g_fs_state.topk_done) {
+        vSemaphoreDelete(g_fs_state.topk_done);
+        g_fs_state.topk_done = NULL;
+    }
+    if (g_fs_state.seq_lock) {
+        vSemaphoreDelete(g_fs_state.seq_lock);
+        g_fs_state.seq_lock = NULL;
+    }
+    if (g_fs_state.sub_lock) {
+        vSemaphoreDelete(g_fs_state.sub_lock);
+        g_fs_state.sub_lock = NULL;
+    }
+}
+
+static esp_err_t locks_create(void) {
+    for (int i = 0; i < BATTERY_FS_LOCK_STRIPES; i++) {
+        battery_lock_t *lock = &g_fs_state.locks[i];
+        lock->writer = xSemaphoreCreateMutex();
+        lock->guard = xSemaphoreCreateMutex();
+        lock->drained = xSemaphoreCreateBinary();
+        lock->readers = 0;
+        if (lock->writer == NULL || lock->guard == NULL || lock->drained == NULL) {
+            locks_delete();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    g_fs_state.idle = xSemaphoreCreateBinary();
+    g_fs_state.topk_lock = xSemaphoreCreateMutex();
+    g_fs_state.topk_done = xSemaphoreCreateBinary();
+    g_fs_state.seq_lock = xSemaphoreCreateMutex();
+    g_fs_state.sub_lock = xSemaphoreCreateMutex();
+    if (g_fs_state.idle == NULL || g_fs_state.topk_lock == NULL || g_fs_state.topk_done == NULL ||
+        g_fs_state.seq_lock == NULL || g_fs_state.sub_lock == NULL) {
+        locks_delete();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static battery_lock_t *battery_lock(const char *serial_number) {
+    uint32_t hash = esp_crc32_le(0, (const uint8_t *)serial_number, strlen(serial_number));
+    return &g_fs_state.locks[hash % BATTERY_FS_LOCK_STRIPES];
+}
+
+static void reader_enter(battery_lock_t *lock) {
+    xSemaphoreTake(lock->guard, portMAX_DELAY);
+    lock->readers++;
+    xSemaphoreGive(lock->guard);
+}
+
+static void reader_leave(battery_lock_t *lock) {
+    xSemaphoreTake(lock->guard, portMAX_DELAY);
+    if (--lock->readers == 0) {
+        xSemaphoreGive(lock->drained);
+    }
+    xSemaphoreGive(lock->guard);
+}
+
+/**
+ * @brief Take a stripe for a delete: writer, and guard once no reader is open
+ *
+ * A stale `drained` give only costs one more loop, hence the poll period
+ * as a backstop rather than a timeout.
+ */
+static void exclusive_enter(battery_lock_t *lock) {
+    xSemaphoreTake(lock->writer, portMAX_DELAY);
+    while (true) {
+        xSemaphoreTake(lock->guard, portMAX_DELAY);
+        if (lock->readers == 0) {
+            return;
+        }
+        xSemaphoreGive(lock->guard);
+        xSemaphoreTake(lock->drained, pdMS_TO_TICKS(BATTERY_FS_DRAIN_POLL_MS));
+    }
+}
+
+static void exclusive_leave(battery_lock_t *lock) {
+    xSemaphoreGive(lock->guard);
+    xSemaphoreGive(lock->writer);
+}
+
+/**
+ * @brief Count a call out, see io_enter()
+ */
+static void io_leave(void) {
+    if (__atomic_sub_fetch(&g_fs_state.active, 1, __ATOMIC_SEQ_CST) == 0 && g_fs_state.suspended) {
+        xSemaphoreGive(g_fs_state.idle);
+    }
+}
+
+/**
+ * @brief Count a call in, unless storage is suspended
+ *
+ * Count first, then check: battery_fs_suspend() sets the flag before
+ * battery_fs_wait_idle() reads the count, so either the call sees the
+ * flag or the wait sees the call.
+ */
+static bool io_enter(void) {
+    __atomic_add_fetch(&g_fs_state.active, 1, __ATOMIC_SEQ_CST);
+    if (g_fs_state.suspended) {
+        io_leave();
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// FatFs Disk I/O
+// ============================================================================
+
+static DSTATUS diskio_init(BYTE pdrv) {
+    return 0;
+}
+
+static DSTATUS diskio_status(BYTE pdrv) {
+    return g_fs_state.backend ? 0 : STA_NOINIT;
+}
+
+static DRESULT diskio_read(BYTE pdrv, BYTE *buff, uint32_t sector, UINT count) {
+    esp_err_t ret = g_fs_state.backend->read(g_fs_state.backend_ctx, buff, sector, count);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Read of sector %lu failed: %s", (unsigned long)sector, esp_err_to_name(ret));
+        return RES_ERROR;
+    }
+    g_fs_state.stats.sectors_read += count;
+    return RES_OK;
+}
+
+static DRESULT diskio_write(BYTE pdrv, const BYTE *buff, uint32_t sector, UINT count) {
+    esp_err_t ret = g_fs_state.backend->write(g_fs_state.backend_ctx, buff, sector, count);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Write of sector %lu failed: %s", (unsigned long)sector, esp_err_to_name(ret));
+        return RES_ERROR;
+    }
+    g_fs_state.stats.sectors_written += count;
+    return RES_OK;
+}
+
+static DRESULT diskio_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    switch (cmd) {
+    case CTRL_SYNC:
+        return g_fs_state.backend->sync(g_fs_state.backend_ctx) == ESP_OK ? RES_OK : RES_ERROR;
+    case GET_SECTOR_COUNT:
+        *((DWORD *)buff) = g_fs_state.sector_count;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *((WORD *)buff) = g_fs_state.sector_size;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *((DWORD *)buff) = 1;  // Erase geometry is hidden by the backend
+        return RES_OK;
+    case CTRL_TRIM: {
+        LBA_t *range = buff;
+        esp_err_t ret = g_fs_state.backend->trim(g_fs_state.backend_ctx, range[0], range[1] - range[0] + 1);
+        return ret == ESP_OK ? RES_OK : RES_ERROR;
+    }
+    default:
+        return RES_PARERR;
+    }
+}
+
+static const ff_diskio_impl_t s_diskio_impl = {
+    .init = diskio_init,
+    .status = diskio_status,
+    .read = diskio_read,
+    .write = diskio_write,
+    .ioctl = diskio_ioctl,
+};
+
+/**
+ * @brief Register the backend with FatFs and mount (formatting if allowed)
+ */
+static esp_err_t mount_volume(const battery_fs_config_t *config) {
+    BYTE pdrv = 0xFF;
+    if (ff_diskio_get_drive(&pdrv) != ESP_OK || pdrv == 0xFF) {
+        ESP_LOGE(TAG, "No free FatFs drive");
+        return ESP_ERR_NO_MEM;
+    }
+    g_fs_state.pdrv = pdrv;
+    snprintf(g_fs_state.drive, sizeof(g_fs_state.drive), "%u:", pdrv);
+    ff_diskio_register(pdrv, &s_diskio_impl);
+
+#if !CONFIG_IDF_TARGET_LINUX
+    // Keep the volume reachable through stdio at the mount point
+    esp_vfs_fat_conf_t vfs_conf = {
+        .base_path = config->mount_point,
+        .fat_drive = g_fs_state.drive,
+        .max_files = BATTERY_FS_MAX_FILES,
+    };
+    esp_err_t ret = esp_vfs_fat_register_cfg(&vfs_conf, &g_fs_state.fatfs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register VFS: %s", esp_err_to_name(ret));
+        ff_diskio_register(pdrv, NULL);
+        return ret;
+    }
+#else
+    g_fs_state.fatfs = calloc(1, sizeof(FATFS));
+    if (g_fs_state.fatfs == NULL) {
+        ff_diskio_register(pdrv, NULL);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    FRESULT res = f_mount(g_fs_state.fatfs, g_fs_state.drive, 1);
+    if (res == FR_NO_FILESYSTEM && config->format_if_failed) {
+        ESP_LOGW(TAG, "No filesystem found, formatting...");
+        void *workbuf = malloc(FF_MAX_SS);
+        if (workbuf == NULL) {
+            res = FR_NOT_ENOUGH_CORE;
+        } else {
+            MKFS_PARM opt = {
+                .fmt = FM_ANY | FM_SFD,
+                .au_size = 16 * 1024,
+            };
+            res = f_mkfs(g_fs_state.drive, &opt, workbuf, FF_MAX_SS);
+            free(workbuf);
+            if (res == FR_OK) {
+                res = f_mount(g_fs_state.fatfs, g_fs_state.drive, 1);
+            }
+        }
+    }
+
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to mount filesystem (FatFs error %d)", res);
+        f_mount(NULL, g_fs_state.drive, 0);
+#if !CONFIG_IDF_TARGET_LINUX
+        esp_vfs_fat_unregister_path(config->mount_point);
+#else
+        free(g_fs_state.fatfs);
+#endif
+        g_fs_state.fatfs = NULL;
+        ff_diskio_register(pdrv, NULL);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static void unmount_volume(void) {
+    f_mount(NULL, g_fs_state.drive, 0);
+#if !CONFIG_IDF_TARGET_LINUX
+    esp_vfs_fat_unregister_path(g_fs_state.mount_point);
+#else
+    free(g_fs_state.fatfs);
+#endif
+    g_fs_state.fatfs = NULL;
+    ff_diskio_register(g_fs_state.pdrv, NULL);
 }
 
 // ============================================================================
@@ -60,76 +589,49 @@ esp_err_t battery_fs_init(const battery_fs_config_t *config) {
         return ESP_OK;
     }
 
-    ESP_LOGI(TAG, "Initializing battery filesystem");
-
-    // Store mount point
-    strncpy(g_fs_state.mount_point, config->mount_point, sizeof(g_fs_state.mount_point) - 1);
-
-    // Configure SPI bus
-    spi_bus_config_t bus_config = {
-        .mosi_io_num = config->pin_mosi,
-        .miso_io_num = config->pin_miso,
-        .sclk_io_num = config->pin_sclk,
-        .quadhd_io_num = config->pin_hd,
-        .quadwp_io_num = config->pin_wp,
-        .max_transfer_sz = 4096 * 2,
-    };
-
-    esp_err_t ret = spi_bus_initialize(config->spi_host, &bus_config, SPI_DMA_CH_AUTO);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize SPI bus: %s", esp_err_to_name(ret));
-        return ret;
+    const battery_fs_backend_ops_t *backend = select_backend(config->backend);
+    if (backend == NULL) {
+        ESP_LOGE(TAG, "Backend %d not available on this target", config->backend);
+        return ESP_ERR_NOT_SUPPORTED;
     }
 
-    // Configure SPI device
-    spi_device_interface_config_t devcfg = {
-        .clock_speed_hz = config->clock_speed_hz,
-        .mode = 0,
-        .spics_io_num = config->pin_cs,
-        .queue_size = 10,
-        .flags = SPI_DEVICE_HALFDUPLEX,
-    };
+    ESP_LOGI(TAG, "Initializing battery filesystem on %s backend", backend->name);
 
-    ret = spi_bus_add_device(config->spi_host, &devcfg, &g_fs_state.spi_handle);
+    esp_err_t ret = locks_create();
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to add SPI device: %s", esp_err_to_name(ret));
-        spi_bus_free(config->spi_host);
+        ESP_LOGE(TAG, "Failed to create locks");
         return ret;
     }
 
-    // Initialize NAND Flash
-    spi_nand_flash_config_t nand_config = {
-        .device_handle = g_fs_state.spi_handle,
-        .io_mode = SPI_NAND_IO_MODE_SIO,
-        .flags = SPI_DEVICE_HALFDUPLEX,
-    };
+    // Store mount point
+    strncpy(g_fs_state.mount_point, config->mount_point, sizeof(g_fs_state.mount_point) - 1);
 
-    ret = spi_nand_flash_init_device(&nand_config, &g_fs_state.flash_handle);
+    // Bring up the block device
+    ret = backend->init(config, &g_fs_state.backend_ctx,
+                        &g_fs_state.sector_size, &g_fs_state.sector_count);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize NAND Flash: %s", esp_err_to_name(ret));
-        spi_bus_remove_device(g_fs_state.spi_handle);
-        spi_bus_free(config->spi_host);
+        ESP_LOGE(TAG, "Failed to initialize %s backend: %s", backend->name, esp_err_to_name(ret));
+        locks_delete();
         return ret;
     }
+    g_fs_state.backend = backend;
+    memset(&g_fs_state.stats, 0, sizeof(g_fs_state.stats));
 
     // Mount FAT filesystem
-    esp_vfs_fat_mount_config_t mount_config = {
-        .max_files = 20,
-        .format_if_mount_failed = config->format_if_failed,
-        .allocation_unit_size = 16 * 1024,
-    };
-
-    ret = esp_vfs_fat_nand_mount(config->mount_point, g_fs_state.flash_handle, &mount_config);
+    ret = mount_volume(config);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to mount filesystem: %s", esp_err_to_name(ret));
-        spi_nand_flash_deinit_device(g_fs_state.flash_handle);
-        spi_bus_remove_device(g_fs_state.spi_handle);
-        spi_bus_free(config->spi_host);
+        backend->deinit(g_fs_state.backend_ctx);
+        g_fs_state.backend = NULL;
+        g_fs_state.backend_ctx = NULL;
+        locks_delete();
         return ret;
     }
 
     g_fs_state.initialized = true;
-    ESP_LOGI(TAG, "✓ Battery filesystem initialized at %s", config->mount_point);
+    sync_load();
+    topk_load();
+    ESP_LOGI(TAG, "✓ Battery filesystem initialized at %s (%lu x %lu byte sectors)", config->mount_point,
+             (unsigned long)g_fs_state.sector_count, (unsigned long)g_fs_state.sector_size);
 
     return ESP_OK;
 }
@@ -139,27 +641,55 @@ esp_err_t battery_fs_deinit(void) {
         return ESP_OK;
     }
 
+    // The rankings and subscribers get what happened so far
+    topk_stop();
+    dispatch_stop();
+
     // Unmount filesystem
-    esp_vfs_fat_nand_unmount(g_fs_state.mount_point, g_fs_state.flash_handle);
-    
-    // Cleanup NAND flash
-    if (g_fs_state.flash_handle) {
-        spi_nand_flash_deinit_device(g_fs_state.flash_handle);
-        g_fs_state.flash_handle = NULL;
-    }
-    
-    // Cleanup SPI
-    if (g_fs_state.spi_handle) {
-        spi_bus_remove_device(g_fs_state.spi_handle);
-        g_fs_state.spi_handle = NULL;
-    }
+    unmount_volume();
+
+    // Release the block device
+    g_fs_state.backend->deinit(g_fs_state.backend_ctx);
+    g_fs_state.backend = NULL;
+    g_fs_state.backend_ctx = NULL;
+    locks_delete();
 
+    g_fs_state.suspended = false;
     g_fs_state.initialized = false;
     ESP_LOGI(TAG, "✓ Battery filesystem deinitialized");
 
     return ESP_OK;
 }
 
+esp_err_t battery_fs_get_stats(battery_fs_stats_t *stats) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *stats = g_fs_state.stats;
+    stats->sector_size = g_fs_state.sector_size;
+    if (g_fs_state.backend->get_stats != NULL) {
+        return g_fs_state.backend->get_stats(g_fs_state.backend_ctx, stats);
+    }
+    return ESP_OK;
+}
+
+esp_err_t battery_fs_reset_stats(void) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memset(&g_fs_state.stats, 0, sizeof(g_fs_state.stats));
+    if (g_fs_state.backend->reset_stats != NULL) {
+        return g_fs_state.backend->reset_stats(g_fs_state.backend_ctx);
+    }
+    return ESP_OK;
+}
+
 // ============================================================================
 // Metadata Functions
 // ============================================================================
@@ -169,11 +699,11 @@ bool battery_fs_exists(const char *serial_number) {
         return false;
     }
 
-    char filepath[128];
+    char filepath[64];
     build_data_path(serial_number, filepath, sizeof(filepath));
 
-    struct stat st;
-    return (stat(filepath, &st) == 0);
+    FILINFO info;
+    return (f_stat(filepath, &info) == FR_OK);
 }
 
 esp_err_t battery_fs_read_metadata(const char *serial_number, battery_metadata_t *metadata) {
@@ -187,30 +717,55 @@ esp_err_t battery_fs_read_metadata(const char *serial_number, battery_metadata_t
         return ESP_ERR_INVALID_ARG;
     }
 
-    char metapath[128];
+    char metapath[64];
     build_meta_path(serial_number, metapath, sizeof(metapath));
 
-    FILE *f = fopen(metapath, "rb");
-    if (f == NULL) {
+    FIL *f;
+    if (file_open(&f, metapath, FA_READ) != FR_OK) {
         ESP_LOGD(TAG, "No metadata file for %s", serial_number);
         return ESP_ERR_NOT_FOUND;
     }
 
-    size_t read = fread(metadata, sizeof(battery_metadata_t), 1, f);
-    fclose(f);
+    UINT read = 0;
+    FRESULT res = f_read(f, metadata, sizeof(battery_metadata_t), &read);
+    file_close(f);
 
-    if (read != 1) {
+    if (res != FR_OK || read != sizeof(battery_metadata_t)) {
         ESP_LOGE(TAG, "Failed to read metadata");
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "Read metadata for %s: last_index=%lu, records=%lu", 
+    ESP_LOGD(TAG, "Read metadata for %s: last_index=%lu, records=%lu", 
              serial_number, (unsigned long)metadata->last_memory_index, 
              (unsigned long)metadata->record_count);
 
     return ESP_OK;
 }
 
+/**
+ * @brief Read the head of a .met file, parts it does not have are zeroed
+ */
+static esp_err_t read_meta_file(const char *serial_number, meta_file_t *mf) {
+    char metapath[64];
+    build_meta_path(serial_number, metapath, sizeof(metapath));
+
+    FIL *f;
+    if (file_open(&f, metapath, FA_READ) != FR_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    UINT read = 0;
+    FRESULT res = f_read(f, mf, sizeof(*mf), &read);
+    file_close(f);
+
+    if (res != FR_OK || read < sizeof(battery_metadata_t)) {
+        ESP_LOGE(TAG, "Failed to read metadata");
+        return ESP_FAIL;
+    }
+    memset((uint8_t *)mf + read, 0, sizeof(*mf) - read);
+    return ESP_OK;
+}
+
 esp_err_t battery_fs_write_metadata(const char *serial_number, const battery_metadata_t *metadata) {
     if (!g_fs_state.initialized) {
         ESP_LOGE(TAG, "Not initialized");
@@ -222,20 +777,24 @@ esp_err_t battery_fs_write_metadata(const char *serial_number, const battery_met
         return ESP_ERR_INVALID_ARG;
     }
 
-    char metapath[128];
+    char metapath[64];
     build_meta_path(serial_number, metapath, sizeof(metapath));
 
-    FILE *f = fopen(metapath, "wb");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to create metadata file %s (errno: %d - %s)", 
-                 metapath, errno, strerror(errno));
+    // In place, the summary and flag index stay until the next append
+    FIL *f;
+    FRESULT res = file_open(&f, metapath, FA_WRITE | FA_OPEN_ALWAYS);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to create metadata file %s (FatFs error %d)", metapath, res);
         return ESP_FAIL;
     }
 
-    size_t written = fwrite(metadata, sizeof(battery_metadata_t), 1, f);
-    fclose(f);
+    UINT written = 0;
+    res = f_write(f, metadata, sizeof(battery_metadata_t), &written);
+    if (file_close(f) != FR_OK) {
+        res = FR_DISK_ERR;
+    }
 
-    if (written != 1) {
+    if (res != FR_OK || written != sizeof(battery_metadata_t)) {
         ESP_LOGE(TAG, "Failed to write metadata");
         return ESP_FAIL;
     }
@@ -332,50 +891,1970 @@ esp_err_t battery_fs_identify_new_records(const battery_metadata_t *metadata,
 }
 
 // ============================================================================
-// Data Write Functions
+// Summary
 // ============================================================================
 
-esp_err_t battery_fs_write_data(const char *serial_number, const battery_log_t *logs, size_t log_count) {
-    if (!g_fs_state.initialized) {
-        ESP_LOGE(TAG, "Not initialized");
-        return ESP_ERR_INVALID_STATE;
+static void summary_init(battery_fs_summary_t *summary) {
+    memset(summary, 0, sizeof(*summary));
+    summary->magic = BATTERY_FS_SUMMARY_MAGIC;
+    summary->size = sizeof(*summary);
+    summary->soh = BATTERY_FS_SOH_UNKNOWN;
+}
+
+static bool summary_current(const battery_fs_summary_t *summary, const battery_metadata_t *metadata) {
+    return summary->magic == BATTERY_FS_SUMMARY_MAGIC && summary->size == sizeof(*summary) &&
+           summary->records == metadata->record_count;
+}
+
+static void summary_field_add(battery_fs_summary_field_t *field, uint32_t value, bool first) {
+    if (first || value < field->min) {
+        field->min = value;
+    }
+    if (first || value > field->max) {
+        field->max = value;
     }
+    field->sum += value;
+}
 
-    if (serial_number == NULL || logs == NULL || log_count == 0) {
-        ESP_LOGE(TAG, "Invalid arguments");
-        return ESP_ERR_INVALID_ARG;
+/**
+ * @brief Fold one internal resistance sample into its condition bucket
+ */
+static void summary_ir_add(battery_fs_ir_bucket_t *bucket, int32_t sample, uint16_t cycle) {
+    if (bucket->samples == 0) {
+        bucket->first_cycle = cycle;
     }
+    if (bucket->samples < BATTERY_FS_IR_BASELINE) {
+        // Running mean until the baseline is complete, the level follows it
+        bucket->baseline += (sample - bucket->baseline) / (bucket->samples + 1);
+        bucket->level = bucket->baseline;
+    } else {
+        bucket->level += (sample - bucket->level) / BATTERY_FS_IR_SMOOTHING;
+    }
+    if (bucket->samples < UINT16_MAX) {
+        bucket->samples++;
+    }
+    bucket->last_cycle = cycle;
+}
 
-    ESP_LOGI(TAG, "Writing battery data for %s (%u logs)", serial_number, log_count);
+/**
+ * @brief Level and baseline of the settled buckets, weighted by their samples
+ */
+static void summary_ir_totals(const battery_fs_summary_t *summary, uint64_t *level, uint64_t *baseline) {
+    *level = 0;
+    *baseline = 0;
+    for (int b = 0; b < BATTERY_FS_IR_BUCKETS; b++) {
+        const battery_fs_ir_bucket_t *bucket = &summary->ir[b];
+        if (bucket->samples >= BATTERY_FS_IR_SETTLED && bucket->baseline > 0) {
+            *level += (uint64_t)bucket->level * bucket->samples;
+            *baseline += (uint64_t)bucket->baseline * bucket->samples;
+        }
+    }
+}
 
-    // Step 1: Check if battery file exists
-    bool exists = battery_fs_exists(serial_number);
+/**
+ * @brief Resistance-based SOH over the settled buckets
+ */
+static uint8_t summary_soh(const battery_fs_summary_t *summary) {
+    uint64_t level, baseline;
+    summary_ir_totals(summary, &level, &baseline);
+    if (baseline == 0) {
+        return BATTERY_FS_SOH_UNKNOWN;
+    }
 
-    battery_log_t *logs_to_write = NULL;
-    size_t write_count = 0;
-    battery_metadata_t metadata = {0};
-    bool free_logs = false;
+    // 100 % at the baseline, 0 % at BATTERY_FS_SOH_EOL_PCT of it
+    int64_t soh = ((int64_t)baseline * BATTERY_FS_SOH_EOL_PCT - (int64_t)level * 100) * 100 /
+                  ((int64_t)baseline * (BATTERY_FS_SOH_EOL_PCT - 100));
+    return soh < 0 ? 0 : soh > 100 ? 100 : (uint8_t)soh;
+}
 
-    if (exists) {
-        ESP_LOGI(TAG, "Battery %s exists, checking for new records...", serial_number);
-        
-        // Step 2: Read existing metadata
-        esp_err_t ret = battery_fs_read_metadata(serial_number, &metadata);
-        if (ret != ESP_OK) {
-            ESP_LOGW(TAG, "Failed to read metadata, treating as new battery");
-            exists = false;
-        } else {
-            // Step 3: Identify new records
-            battery_log_t *new_logs = malloc(log_count * sizeof(battery_log_t));
-            if (new_logs == NULL) {
-                ESP_LOGE(TAG, "Failed to allocate memory for new logs");
-                return ESP_ERR_NO_MEM;
-            }
+/**
+ * @brief Fold one record into a summary
+ */
+static void summary_add(battery_fs_summary_t *summary, const uint8_t *data, size_t len) {
+    summary->records++;
+    if (len != sizeof(BatmonMemory)) {
+        return;
+    }
 
-            ret = battery_fs_identify_new_records(&metadata, logs, log_count, new_logs, &write_count);
-            if (ret != ESP_OK) {
-                free(new_logs);
-                return ret;
+    const BatmonMemory *rec = (const BatmonMemory *)data;
+    bool first = summary->decoded++ == 0;
+    summary_field_add(&summary->fields[BATTERY_FS_SUMMARY_MIN_SOC], rec->data.minSOC, first);
+    summary_field_add(&summary->fields[BATTERY_FS_SUMMARY_MAX_TEMP], rec->data.maxTempCycle, first);
+    summary_field_add(&summary->fields[BATTERY_FS_SUMMARY_MAX_CURRENT], rec->data.maxDrainedCurrentCycle, first);
+    summary_field_add(&summary->fields[BATTERY_FS_SUMMARY_DISCHARGED], rec->data.accumulatedDischarged, first);
+    for (int b = 0; b < BATTERY_FS_SUMMARY_ALARMS; b++) {
+        summary->alarms[b] += (rec->data.triggeredAlarmCycle.alarm >> b) & 1;
+    }
+    summary->latest_cycle = rec->data.log.battCycle;
+
+    // Unmeasured slots read 0, a saturated measurement 0xFF
+    for (int i = 0; i < INT_RES_PER_MEMORY; i++) {
+        const IntRes *ir = &rec->data.intRes[i];
+        if (ir->maxIntRes == 0 || ir->maxIntRes == UINT8_MAX) {
+            continue;
+        }
+        int b = ir->intResTag.tag.SOC_interval * BATTERY_FS_IR_TEMP_BUCKETS + ir->intResTag.tag.temperature_interval;
+        int32_t sample = (ir->minIntRes + ir->maxIntRes) * BATTERY_FS_IR_SCALE / 2;
+        summary_ir_add(&summary->ir[b], sample, rec->data.log.battCycle);
+    }
+    summary->soh = summary_soh(summary);
+}
+
+// ============================================================================
+// Flag Index
+// ============================================================================
+
+static FSIZE_t flag_run_offset(uint32_t entry) {
+    return sizeof(meta_file_t) + (FSIZE_t)entry * sizeof(battery_fs_flag_run_t);
+}
+
+static void flag_header_init(battery_fs_flag_header_t *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = BATTERY_FS_FLAG_MAGIC;
+    hdr->size = sizeof(*hdr);
+}
+
+static bool flag_header_current(const battery_fs_flag_header_t *hdr, const battery_metadata_t *metadata) {
+    return hdr->magic == BATTERY_FS_FLAG_MAGIC && hdr->size == sizeof(*hdr) &&
+           hdr->records == metadata->record_count;
+}
+
+/**
+ * @brief Flags of one record, `cc_errors` carries ccErrorCount from the previous one
+ */
+static uint8_t record_flags(const uint8_t *data, size_t len, uint8_t *cc_errors) {
+    if (len != sizeof(BatmonMemory)) {
+        return 0;
+    }
+
+    const BatmonMemory *rec = (const BatmonMemory *)data;
+    uint8_t flags = rec->data.triggeredAlarmCycle.alarm & ((1u << BATTERY_FS_SUMMARY_ALARMS) - 1);
+    flags |= rec->data.bq_status.CC_ERROR << BATTERY_FS_FLAG_CC_ERROR;
+    flags |= rec->data.bq_status.CC_TIME_ERROR << BATTERY_FS_FLAG_CC_TIME_ERROR;
+    flags |= (rec->data.bq_status.ccErrorCount != *cc_errors) << BATTERY_FS_FLAG_CC_ERROR_COUNT;
+    *cc_errors = rec->data.bq_status.ccErrorCount;
+    return flags;
+}
+
+static void flag_store(flag_index_t *ix, int flag) {
+    battery_fs_flag_run_t *run = &ix->run[flag];
+    if (run->count == 0) {
+        return;
+    }
+    if (ix->file == NULL) {
+        if (ix->emit) {
+            ix->emit(run, ix->arg);
+        }
+        return;
+    }
+
+    if (ix->entry[flag] == 0) {
+        ix->entry[flag] = ++ix->hdr->entries;
+    }
+    if (ix->res == FR_OK) {
+        ix->res = write_at(ix->file, flag_run_offset(ix->entry[flag] - 1), run, sizeof(*run));
+    }
+    ix->hdr->tail[flag] = ix->entry[flag];
+}
+
+/**
+ * @brief Index the next record
+ */
+static void flag_add(flag_index_t *ix, uint8_t flags) {
+    uint32_t n = ix->hdr->records++;
+    for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+        if (!(flags & (1u << f))) {
+            continue;
+        }
+        ix->hdr->set[f]++;
+
+        battery_fs_flag_run_t *run = &ix->run[f];
+        if (run->count > 0 && run->first + run->count == n && run->count < UINT16_MAX) {
+            run->count++;
+            continue;
+        }
+        flag_store(ix, f);
+        *run = (battery_fs_flag_run_t){ .first = n, .count = 1, .flag = f };
+        ix->entry[f] = 0;
+    }
+}
+
+static void flag_finish(flag_index_t *ix) {
+    for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+        flag_store(ix, f);
+    }
+}
+
+/**
+ * @brief Pick up the last run of every flag of a current index
+ *
+ * An append cut short may have grown a run past the committed records,
+ * that part is dropped.
+ */
+static bool flag_resume(flag_index_t *ix) {
+    for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+        uint32_t tail = ix->hdr->tail[f];
+        if (tail == 0) {
+            continue;
+        }
+        battery_fs_flag_run_t *run = &ix->run[f];
+        if (tail > ix->hdr->entries ||
+            read_at(ix->file, flag_run_offset(tail - 1), run, sizeof(*run)) != FR_OK ||
+            run->flag != f || run->first >= ix->hdr->records) {
+            return false;
+        }
+        if (run->first + run->count > ix->hdr->records) {
+            run->count = ix->hdr->records - run->first;
+        }
+        ix->entry[f] = tail;
+    }
+    return true;
+}
+
+static void query_run(flag_query_t *q, uint32_t first, uint32_t count) {
+    if (q->stop || count == 0) {
+        return;
+    }
+    if (q->count > 0 && q->first + q->count == first) {
+        q->count += count;
+        return;
+    }
+    if (q->count > 0) {
+        q->stop = !q->cb(q->first, q->count, q->arg);
+    }
+    q->first = first;
+    q->count = count;
+}
+
+static void query_emit(const battery_fs_flag_run_t *run, void *arg) {
+    flag_query_t *q = arg;
+    if (run->flag == q->flag) {
+        query_run(q, run->first, run->count);
+    }
+}
+
+static void query_finish(flag_query_t *q) {
+    if (!q->stop && q->count > 0) {
+        q->cb(q->first, q->count, q->arg);
+    }
+}
+
+/**
+ * @brief Answer a query from the runs of a current index
+ *
+ * Runs are in file order per flag; parts past the committed records
+ * belong to an append still in progress.
+ */
+static esp_err_t query_stored(const char *serial_number, const battery_fs_flag_header_t *hdr, flag_query_t *q) {
+    if (hdr->set[q->flag] == 0) {
+        return ESP_OK;
+    }
+
+    char metapath[64];
+    build_meta_path(serial_number, metapath, sizeof(metapath));
+    FIL *f;
+    if (file_open(&f, metapath, FA_READ) != FR_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    battery_fs_flag_run_t runs[BATTERY_FS_FLAG_READ_RUNS];
+    FRESULT res = FR_OK;
+    for (uint32_t e = 0; e < hdr->entries && !q->stop && res == FR_OK; e += BATTERY_FS_FLAG_READ_RUNS) {
+        uint32_t n = hdr->entries - e < BATTERY_FS_FLAG_READ_RUNS ? hdr->entries - e : BATTERY_FS_FLAG_READ_RUNS;
+        res = read_at(f, flag_run_offset(e), runs, n * sizeof(runs[0]));
+        for (uint32_t i = 0; i < n && res == FR_OK; i++) {
+            if (runs[i].flag != q->flag || runs[i].first >= hdr->records) {
+                continue;
+            }
+            uint32_t left = hdr->records - runs[i].first;
+            query_run(q, runs[i].first, runs[i].count < left ? runs[i].count : left);
+        }
+    }
+    file_close(f);
+
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to read the flag index of %s (FatFs error %d)", serial_number, res);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// ============================================================================
+// Fleet Rankings
+// ============================================================================
+
+/**
+ * @brief Fleet metrics of a battery from its .met head, false where not known
+ */
+static void topk_metrics(const meta_file_t *mf, int32_t value[BATTERY_FS_TOPK_METRICS],
+                         bool known[BATTERY_FS_TOPK_METRICS]) {
+    const battery_fs_summary_t *summary = &mf->summary;
+    uint64_t level, baseline;
+    summary_ir_totals(summary, &level, &baseline);
+    known[BATTERY_FS_TOPK_IR_GROWTH] = baseline != 0;
+    value[BATTERY_FS_TOPK_IR_GROWTH] = baseline != 0 ? (int32_t)(((int64_t)level - (int64_t)baseline) * 1000 /
+                                                                 (int64_t)baseline)
+                                                     : 0;
+
+    known[BATTERY_FS_TOPK_CC_ERRORS] = true;
+    value[BATTERY_FS_TOPK_CC_ERRORS] = (int32_t)mf->flags.set[BATTERY_FS_FLAG_CC_ERROR];
+
+    uint32_t alarms = 0;
+    for (int b = 0; b < BATTERY_FS_SUMMARY_ALARMS; b++) {
+        alarms += summary->alarms[b];
+    }
+    known[BATTERY_FS_TOPK_ALARMS] = true;
+    value[BATTERY_FS_TOPK_ALARMS] = (int32_t)alarms;
+
+    known[BATTERY_FS_TOPK_MAX_TEMP] = summary->decoded != 0;
+    value[BATTERY_FS_TOPK_MAX_TEMP] = (int32_t)summary->fields[BATTERY_FS_SUMMARY_MAX_TEMP].max;
+}
+
+static void topk_swap(battery_fs_topk_entry_t *a, battery_fs_topk_entry_t *b) {
+    battery_fs_topk_entry_t t = *a;
+    *a = *b;
+    *b = t;
+}
+
+/**
+ * @brief Restore the min-heap order around entry i
+ */
+static void topk_sift(battery_fs_topk_entry_t *heap, uint32_t n, uint32_t i) {
+    while (i > 0 && heap[i].value < heap[(i - 1) / 2].value) {
+        topk_swap(&heap[i], &heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    while (true) {
+        uint32_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && heap[l].value < heap[least].value) least = l;
+        if (r < n && heap[r].value < heap[least].value) least = r;
+        if (least == i) {
+            return;
+        }
+        topk_swap(&heap[i], &heap[least]);
+        i = least;
+    }
+}
+
+/**
+ * @brief Enter a battery's value in the candidates of a metric
+ *
+ * A value left out, or the one it pushes out, raises the bound of the
+ * batteries outside. A candidate keeps its place whatever its value.
+ *
+ * @return true if the rankings changed
+ */
+static bool topk_offer(battery_fs_topk_file_t *tk, int metric, const char *serial_number, int32_t value) {
+    battery_fs_topk_entry_t *heap = tk->entry[metric];
+    uint8_t *n = &tk->count[metric];
+
+    for (uint32_t i = 0; i < *n; i++) {
+        if (strncmp(heap[i].serial, serial_number, BATTERY_FS_TOPK_SERIAL) == 0) {
+            if (heap[i].value == value) {
+                return false;
+            }
+            heap[i].value = value;
+            topk_sift(heap, *n, i);
+            return true;
+        }
+    }
+
+    uint32_t i;
+    if (*n < BATTERY_FS_TOPK_CANDIDATES) {
+        i = (*n)++;
+    } else if (value > heap[0].value) {
+        i = 0;
+        if (heap[0].value > tk->bound[metric]) {
+            tk->bound[metric] = heap[0].value;
+        }
+    } else if (value > tk->bound[metric]) {
+        tk->bound[metric] = value;
+        return true;
+    } else {
+        return false;
+    }
+    strncpy(heap[i].serial, serial_number, BATTERY_FS_TOPK_SERIAL);
+    heap[i].value = value;
+    topk_sift(heap, *n, i);
+    return true;
+}
+
+/**
+ * @brief Empty rankings: INT32_MIN when no battery is left out, INT32_MAX
+ *        when every battery may be
+ */
+static void topk_reset(battery_fs_topk_file_t *tk, int32_t bound) {
+    memset(tk, 0, sizeof(*tk));
+    tk->magic = BATTERY_FS_TOPK_MAGIC;
+    tk->size = sizeof(*tk);
+    for (int m = 0; m < BATTERY_FS_TOPK_METRICS; m++) {
+        tk->bound[m] = bound;
+    }
+}
+
+/**
+ * @brief Enter the known metrics of a battery, with topk_lock held
+ *
+ * @return true if the rankings changed
+ */
+static bool topk_enter(battery_fs_topk_file_t *tk, const char *serial_number, const int32_t *value,
+                       const bool *known) {
+    bool changed = false;
+    for (int m = 0; m < BATTERY_FS_TOPK_METRICS; m++) {
+        if (known[m]) {
+            changed |= topk_offer(tk, m, serial_number, value[m]);
+        }
+    }
+    return changed;
+}
+
+/**
+ * @brief Write the rankings to FLEET.TOP, with topk_lock held
+ */
+static void topk_store(void) {
+    char path[32];
+    build_topk_path(path, sizeof(path));
+
+    // Appends enter their rankings before they take a sequence number
+    g_fs_state.topk.next_seq = __atomic_load_n(&g_fs_state.next_seq, __ATOMIC_RELAXED);
+
+    FIL *f;
+    FRESULT res = file_open(&f, path, FA_WRITE | FA_OPEN_ALWAYS);
+    if (res == FR_OK) {
+        res = write_at(f, 0, &g_fs_state.topk, sizeof(g_fs_state.topk));
+        if (file_close(f) != FR_OK) {
+            res = FR_DISK_ERR;
+        }
+    }
+    g_fs_state.topk_stored = xTaskGetTickCount();
+    if (res == FR_OK) {
+        g_fs_state.topk_dirty = false;
+    } else {
+        ESP_LOGW(TAG, "Failed to store the fleet rankings (FatFs error %d)", res);
+    }
+}
+
+/**
+ * @brief Enter a battery's values after an append
+ *
+ * Only batteries whose summary and flag index are current rank. The
+ * rankings are stored with the metadata of an append now and then, not
+ * on every one: the sequence log names the batteries appended since.
+ */
+static void topk_update(const char *serial_number, const meta_file_t *mf) {
+    if (strlen(serial_number) > BATTERY_FS_TOPK_SERIAL) {
+        return;
+    }
+
+    int32_t value[BATTERY_FS_TOPK_METRICS];
+    bool known[BATTERY_FS_TOPK_METRICS];
+    topk_metrics(mf, value, known);
+
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    g_fs_state.topk_dirty |= topk_enter(&g_fs_state.topk, serial_number, value, known);
+    if (g_fs_state.topk_building != NULL) {
+        topk_enter(g_fs_state.topk_building, serial_number, value, known);
+    }
+    if (g_fs_state.topk_dirty &&
+        xTaskGetTickCount() - g_fs_state.topk_stored >= pdMS_TO_TICKS(BATTERY_FS_TOPK_STORE_MS)) {
+        topk_store();
+    }
+    xSemaphoreGive(g_fs_state.topk_lock);
+}
+
+/**
+ * @brief Enter a battery's values from its .met head
+ *
+ * The writer lock orders this with the battery's appends, so the values
+ * of an older head never replace those of a newer one.
+ */
+static void topk_refresh(const char *serial_number, battery_fs_topk_file_t *tk) {
+    battery_lock_t *lock = battery_lock(serial_number);
+    meta_file_t mf;
+
+    xSemaphoreTake(lock->writer, portMAX_DELAY);
+    if (read_meta_file(serial_number, &mf) == ESP_OK && summary_current(&mf.summary, &mf.meta) &&
+        flag_header_current(&mf.flags, &mf.meta)) {
+        int32_t value[BATTERY_FS_TOPK_METRICS];
+        bool known[BATTERY_FS_TOPK_METRICS];
+        topk_metrics(&mf, value, known);
+        xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+        g_fs_state.topk_dirty |= topk_enter(tk, serial_number, value, known);
+        xSemaphoreGive(g_fs_state.topk_lock);
+    }
+    xSemaphoreGive(lock->writer);
+}
+
+static bool topk_visit(const char *serial_number, void *arg) {
+    if (__atomic_load_n(&g_fs_state.topk_abort, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if (strlen(serial_number) <= BATTERY_FS_TOPK_SERIAL) {
+        topk_refresh(serial_number, arg);
+    }
+    return true;
+}
+
+/**
+ * @brief Rank every battery from its .met head
+ *
+ * Runs in a task of its own, so neither queries nor appends wait for the
+ * scan: appends meanwhile enter their values in both rankings. An aborted
+ * or suspended scan leaves the previous rankings in place.
+ */
+static void topk_rebuild_task(void *arg) {
+    battery_fs_topk_file_t *tk = arg;
+
+    ESP_LOGI(TAG, "Rebuilding the fleet rankings");
+    esp_err_t ret = battery_fs_foreach(topk_visit, tk);
+
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    if (ret == ESP_OK && !__atomic_load_n(&g_fs_state.topk_abort, __ATOMIC_RELAXED)) {
+        g_fs_state.topk = *tk;
+        g_fs_state.topk_dirty = true;
+        if (!g_fs_state.suspended) {
+            topk_store();
+        }
+    }
+    g_fs_state.topk_building = NULL;
+    xSemaphoreGive(g_fs_state.topk_lock);
+
+    free(tk);
+    xSemaphoreGive(g_fs_state.topk_done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Start a rebuild in the background unless one runs, with topk_lock held
+ */
+static void topk_start(void) {
+    if (g_fs_state.topk_building != NULL || g_fs_state.suspended) {
+        return;
+    }
+
+    battery_fs_topk_file_t *tk = malloc(sizeof(*tk));
+    if (tk == NULL) {
+        ESP_LOGE(TAG, "No memory to rebuild the fleet rankings");
+        return;
+    }
+    topk_reset(tk, INT32_MIN);
+    __atomic_store_n(&g_fs_state.topk_abort, false, __ATOMIC_RELAXED);
+    // A give left by the previous rebuild
+    xSemaphoreTake(g_fs_state.topk_done, 0);
+    g_fs_state.topk_building = tk;
+    if (xTaskCreate(topk_rebuild_task, "fs_topk", BATTERY_FS_TOPK_STACK, tk, BATTERY_FS_TOPK_PRIORITY,
+                    NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the fleet rankings rebuild");
+        g_fs_state.topk_building = NULL;
+        free(tk);
+    }
+}
+
+/**
+ * @brief Stop a rebuild and store the rankings, at deinit
+ */
+static void topk_stop(void) {
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    bool running = g_fs_state.topk_building != NULL;
+    __atomic_store_n(&g_fs_state.topk_abort, true, __ATOMIC_RELAXED);
+    xSemaphoreGive(g_fs_state.topk_lock);
+    if (running) {
+        xSemaphoreTake(g_fs_state.topk_done, portMAX_DELAY);
+    }
+
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    if (g_fs_state.topk_dirty) {
+        topk_store();
+    }
+    xSemaphoreGive(g_fs_state.topk_lock);
+}
+
+/**
+ * @brief Enter again the batteries appended to from sequence number `from` on
+ */
+static FRESULT topk_replay(uint32_t from) {
+    xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+    uint32_t entries = g_fs_state.seq_entries;
+    xSemaphoreGive(g_fs_state.seq_lock);
+    if (entries == 0) {
+        return FR_OK;
+    }
+
+    char path[32];
+    build_sync_path(BATTERY_FS_SEQ_LOG, path, sizeof(path));
+    FIL *f;
+    FRESULT res = file_open(&f, path, FA_READ);
+    if (res != FR_OK) {
+        return res;
+    }
+
+    uint32_t index = 0;
+    res = sync_search(f, entries, from, &index);
+    battery_fs_seq_entry_t batch[BATTERY_FS_SYNC_READ_ENTRIES];
+    while (res == FR_OK && index < entries) {
+        uint32_t n = entries - index < BATTERY_FS_SYNC_READ_ENTRIES ? entries - index : BATTERY_FS_SYNC_READ_ENTRIES;
+        res = read_at(f, (FSIZE_t)index * sizeof(batch[0]), batch, n * sizeof(batch[0]));
+        for (uint32_t i = 0; res == FR_OK && i < n; i++) {
+            if (batch[i].first_seq + batch[i].count <= from) {
+                continue;
+            }
+            char serial[BATTERY_FS_SEQ_SERIAL + 1];
+            memcpy(serial, batch[i].serial, BATTERY_FS_SEQ_SERIAL);
+            serial[BATTERY_FS_SEQ_SERIAL] = '\0';
+            topk_refresh(serial, &g_fs_state.topk);
+        }
+        index += n;
+    }
+    file_close(f);
+    return res;
+}
+
+/**
+ * @brief Load the stored rankings at mount and enter the appends they lack
+ *
+ * Without stored rankings, or a sequence log to tell what they lack,
+ * every rank is unknown until a rebuild in the background.
+ */
+static void topk_load(void) {
+    char path[32];
+    build_topk_path(path, sizeof(path));
+
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    FIL *f;
+    bool loaded = false;
+    if (file_open(&f, path, FA_READ) == FR_OK) {
+        loaded = read_at(f, 0, &g_fs_state.topk, sizeof(g_fs_state.topk)) == FR_OK &&
+                 g_fs_state.topk.magic == BATTERY_FS_TOPK_MAGIC &&
+                 g_fs_state.topk.size == sizeof(g_fs_state.topk);
+        file_close(f);
+    }
+    for (int m = 0; loaded && m < BATTERY_FS_TOPK_METRICS; m++) {
+        loaded = g_fs_state.topk.count[m] <= BATTERY_FS_TOPK_CANDIDATES;
+    }
+    uint32_t from = g_fs_state.topk.next_seq;
+    uint32_t next_seq = g_fs_state.next_seq;
+    loaded = loaded && from != 0 && next_seq != 0 && from <= next_seq;
+    g_fs_state.topk_dirty = false;
+    g_fs_state.topk_stored = xTaskGetTickCount();
+    xSemaphoreGive(g_fs_state.topk_lock);
+
+    FRESULT res = FR_OK;
+    if (loaded && from < next_seq) {
+        res = topk_replay(from);
+    }
+
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    if (!loaded || res != FR_OK) {
+        topk_reset(&g_fs_state.topk, INT32_MAX);
+        topk_start();
+    }
+    xSemaphoreGive(g_fs_state.topk_lock);
+}
+
+/**
+ * @brief Drop a deleted battery from the rankings, with topk_lock held
+ *
+ * The candidate after it takes its place.
+ *
+ * @return true if it was ranked
+ */
+static bool topk_remove(battery_fs_topk_file_t *tk, const char *serial_number) {
+    bool removed = false;
+    for (int m = 0; m < BATTERY_FS_TOPK_METRICS; m++) {
+        battery_fs_topk_entry_t *heap = tk->entry[m];
+        uint8_t *n = &tk->count[m];
+        for (uint32_t i = 0; i < *n; i++) {
+            if (strncmp(heap[i].serial, serial_number, BATTERY_FS_TOPK_SERIAL) == 0) {
+                heap[i] = heap[--(*n)];
+                if (i < *n) {
+                    topk_sift(heap, *n, i);
+                }
+                removed = true;
+                break;
+            }
+        }
+    }
+    return removed;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    int32_t x = ((const battery_fs_topk_entry_t *)a)->value, y = ((const battery_fs_topk_entry_t *)b)->value;
+    return (x < y) - (x > y);
+}
+
+esp_err_t battery_fs_topk(battery_fs_topk_metric_t metric, battery_fs_rank_t ranks[BATTERY_FS_TOPK], size_t *count) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (metric >= BATTERY_FS_TOPK_METRICS || ranks == NULL || count == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    battery_fs_topk_entry_t cand[BATTERY_FS_TOPK_CANDIDATES];
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    size_t n = g_fs_state.topk.count[metric];
+    int32_t bound = g_fs_state.topk.bound[metric];
+    memcpy(cand, g_fs_state.topk.entry[metric], n * sizeof(cand[0]));
+    xSemaphoreGive(g_fs_state.topk_lock);
+
+    // Candidates below the bound may rank under a battery left out
+    qsort(cand, n, sizeof(cand[0]), cmp_entry);
+    *count = 0;
+    while (*count < n && *count < BATTERY_FS_TOPK && cand[*count].value >= bound) {
+        battery_fs_rank_t *r = &ranks[*count];
+        memcpy(r->serial_number, cand[*count].serial, BATTERY_FS_TOPK_SERIAL);
+        r->serial_number[BATTERY_FS_TOPK_SERIAL] = '\0';
+        r->value = cand[*count].value;
+        (*count)++;
+    }
+
+    if (*count < BATTERY_FS_TOPK && bound != INT32_MIN) {
+        xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+        topk_start();
+        xSemaphoreGive(g_fs_state.topk_lock);
+    }
+    return ESP_OK;
+}
+
+// ============================================================================
+// Index Maintenance
+// ============================================================================
+
+/**
+ * @brief Fold one record into the summary and flag index
+ */
+static void index_add(battery_fs_summary_t *summary, flag_index_t *ix, const uint8_t *data, size_t len) {
+    if (summary != NULL) {
+        summary_add(summary, data, len);
+    }
+    if (ix != NULL) {
+        flag_add(ix, record_flags(data, len, &ix->hdr->cc_errors));
+    }
+}
+
+/**
+ * @brief Build a summary and/or flag index from the stored records of a battery
+ *
+ * Either may be NULL; the flag index header must be initialized.
+ */
+static esp_err_t index_scan(const char *serial_number, battery_fs_summary_t *summary, flag_index_t *ix) {
+    battery_fs_reader_t *reader;
+    esp_err_t ret = battery_fs_reader_open(serial_number, &reader);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (summary != NULL) {
+        summary_init(summary);
+    }
+    uint8_t record[sizeof(BatmonMemory)];
+    battery_fs_record_header_t header;
+    while ((ret = battery_fs_reader_next(reader, &header, record, sizeof(record))) == ESP_OK ||
+           ret == ESP_ERR_INVALID_SIZE) {
+        index_add(summary, ix, record, header.data_len);
+    }
+    battery_fs_reader_close(reader);
+    return ret == ESP_ERR_NOT_FOUND ? ESP_OK : ret;
+}
+
+/**
+ * @brief Fold appended records in and write the .met file, writer lock held
+ *
+ * `mf` carries the updated metadata with the summary and flag index head
+ * as they were before the append. New runs go first and the head last, in
+ * one write within a sector, so a reader sees the metadata, summary and
+ * index of either side of the append. A summary or index that is not
+ * current (written before they existed, or metadata rewritten since) is
+ * rebuilt from the stored records first; when that fails only the
+ * metadata is written and the next append tries again.
+ */
+static esp_err_t write_meta_index(const char *serial_number, meta_file_t *mf, bool current,
+                                  const battery_log_t *logs, size_t count) {
+    char metapath[64];
+    build_meta_path(serial_number, metapath, sizeof(metapath));
+
+    FIL *f;
+    FRESULT res = file_open(&f, metapath, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to create metadata file %s (FatFs error %d)", metapath, res);
+        return ESP_FAIL;
+    }
+
+    flag_index_t ix = { .hdr = &mf->flags, .file = f };
+    if (current && !flag_resume(&ix)) {
+        current = false;
+    }
+    if (!current) {
+        ESP_LOGI(TAG, "Rebuilding the summary and flag index of %s", serial_number);
+        flag_header_init(&mf->flags);
+        memset(ix.run, 0, sizeof(ix.run));
+        memset(ix.entry, 0, sizeof(ix.entry));
+        current = index_scan(serial_number, &mf->summary, &ix) == ESP_OK;
+        if (!current) {
+            ESP_LOGW(TAG, "Failed to rebuild the summary and flag index of %s", serial_number);
+        }
+    }
+
+    size_t size = sizeof(mf->meta);
+    if (current) {
+        for (size_t i = 0; i < count; i++) {
+            index_add(&mf->summary, &ix, logs[i].data, logs[i].data_len);
+        }
+        flag_finish(&ix);
+        if (ix.res == FR_OK) {
+            size = sizeof(*mf);
+        } else {
+            ESP_LOGW(TAG, "Failed to store the flag index of %s (FatFs error %d)", serial_number, ix.res);
+        }
+    }
+
+    res = write_at(f, 0, mf, size);
+    if (file_close(f) != FR_OK) {
+        res = FR_DISK_ERR;
+    }
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to write metadata");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "✓ Wrote metadata for %s: last_index=%lu, records=%lu%s",
+             serial_number, (unsigned long)mf->meta.last_memory_index,
+             (unsigned long)mf->meta.record_count, size == sizeof(*mf) ? "" : " (no index)");
+    if (size == sizeof(*mf)) {
+        topk_update(serial_number, mf);
+    }
+    return ESP_OK;
+}
+
+// ============================================================================
+// Index Queries
+// ============================================================================
+
+esp_err_t battery_fs_read_summary(const char *serial_number, battery_fs_summary_t *summary) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (serial_number == NULL || summary == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    meta_file_t mf;
+    esp_err_t ret = read_meta_file(serial_number, &mf);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (summary_current(&mf.summary, &mf.meta)) {
+        *summary = mf.summary;
+        return ESP_OK;
+    }
+
+    ESP_LOGD(TAG, "No current summary for %s, scanning its records", serial_number);
+    return index_scan(serial_number, summary, NULL);
+}
+
+/**
+ * @brief Flag counts, and the runs of one flag when `q` is set
+ *
+ * Holds a reader count so a delete cannot free the runs mid-read.
+ */
+static esp_err_t flag_lookup(const char *serial_number, battery_fs_flag_header_t *hdr, flag_query_t *q) {
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    battery_lock_t *lock = battery_lock(serial_number);
+    reader_enter(lock);
+
+    meta_file_t mf;
+    esp_err_t ret = read_meta_file(serial_number, &mf);
+    if (ret == ESP_OK && flag_header_current(&mf.flags, &mf.meta)) {
+        *hdr = mf.flags;
+        ret = q != NULL ? query_stored(serial_number, hdr, q) : ESP_OK;
+    } else if (ret == ESP_OK) {
+        ESP_LOGD(TAG, "No current flag index for %s, scanning its records", serial_number);
+        flag_header_init(hdr);
+        flag_index_t ix = { .hdr = hdr, .emit = q != NULL ? query_emit : NULL, .arg = q };
+        ret = index_scan(serial_number, NULL, &ix);
+        if (ret == ESP_OK) {
+            flag_finish(&ix);
+        }
+    }
+
+    reader_leave(lock);
+    io_leave();
+    if (ret == ESP_OK && q != NULL) {
+        query_finish(q);
+    }
+    return ret;
+}
+
+esp_err_t battery_fs_flag_counts(const char *serial_number, uint32_t *records, uint32_t set[BATTERY_FS_FLAGS]) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (serial_number == NULL || set == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    battery_fs_flag_header_t hdr;
+    esp_err_t ret = flag_lookup(serial_number, &hdr, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (records != NULL) {
+        *records = hdr.records;
+    }
+    memcpy(set, hdr.set, sizeof(hdr.set));
+    return ESP_OK;
+}
+
+esp_err_t battery_fs_flag_runs(const char *serial_number, battery_fs_flag_t flag,
+                               battery_fs_flag_cb_t cb, void *arg) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (serial_number == NULL || flag >= BATTERY_FS_FLAGS || cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    battery_fs_flag_header_t hdr;
+    flag_query_t q = { .flag = flag, .cb = cb, .arg = arg };
+    return flag_lookup(serial_number, &hdr, &q);
+}
+
+// ============================================================================
+// Telemetry Rollups
+// ============================================================================
+
+static FSIZE_t tlm_ring_offset(int level, uint32_t entry) {
+    FSIZE_t offset = BATTERY_FS_TLM_HEADER_SIZE;
+    for (int l = 0; l < level; l++) {
+        offset += (FSIZE_t)s_tlm_capacity[l] * sizeof(battery_fs_tlm_bucket_t);
+    }
+    return offset + (FSIZE_t)entry * sizeof(battery_fs_tlm_bucket_t);
+}
+
+static void tlm_header_init(battery_fs_tlm_header_t *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = BATTERY_FS_TLM_MAGIC;
+    hdr->size = sizeof(*hdr);
+}
+
+/**
+ * @brief Read the header of an open .tlm file, false if it has none
+ */
+static bool tlm_header_read(FIL *f, battery_fs_tlm_header_t *hdr) {
+    return read_at(f, 0, hdr, sizeof(*hdr)) == FR_OK && hdr->magic == BATTERY_FS_TLM_MAGIC &&
+           hdr->size == sizeof(*hdr);
+}
+
+static void tlm_bucket_add(battery_fs_tlm_bucket_t *dst, const battery_fs_tlm_bucket_t *src) {
+    uint32_t samples = (uint32_t)dst->samples + src->samples;
+    dst->samples = samples > UINT16_MAX ? UINT16_MAX : samples;
+    for (int c = 0; c < BATTERY_FS_TLM_CHANNELS; c++) {
+        battery_fs_tlm_stat_t *d = &dst->channel[c];
+        const battery_fs_tlm_stat_t *s = &src->channel[c];
+        d->min = s->min < d->min ? s->min : d->min;
+        d->max = s->max > d->max ? s->max : d->max;
+        d->sum += s->sum;
+    }
+}
+
+/**
+ * @brief Write the pending buckets of a level to its ring, wrapping once at most
+ */
+static void tlm_flush(tlm_append_t *ap, int level) {
+    uint32_t n = ap->pending_count[level];
+    ap->pending_count[level] = 0;
+    if (n == 0 || ap->res != FR_OK) {
+        return;
+    }
+
+    uint32_t cap = s_tlm_capacity[level];
+    uint32_t head = ap->hdr.head[level];
+    uint32_t first = n < cap - head ? n : cap - head;
+    ap->res = write_at(ap->file, tlm_ring_offset(level, head), ap->pending[level],
+                       first * sizeof(battery_fs_tlm_bucket_t));
+    if (ap->res == FR_OK && first < n) {
+        ap->res = write_at(ap->file, tlm_ring_offset(level, 0), &ap->pending[level][first],
+                           (n - first) * sizeof(battery_fs_tlm_bucket_t));
+    }
+    ap->hdr.head[level] = (head + n) % cap;
+    ap->hdr.count[level] = ap->hdr.count[level] + n < cap ? ap->hdr.count[level] + n : cap;
+}
+
+/**
+ * @brief Fold a bucket into the open bucket of `level`
+ *
+ * A bucket of a later period closes the open one: it goes to the ring and
+ * is folded into the next level the same way.
+ */
+static void tlm_merge(tlm_append_t *ap, int level, const battery_fs_tlm_bucket_t *bucket) {
+    battery_fs_tlm_bucket_t carry = *bucket;
+    for (; level < BATTERY_FS_TLM_LEVELS; level++) {
+        battery_fs_tlm_bucket_t *open = &ap->hdr.open[level];
+        uint32_t start = carry.start_s - carry.start_s % s_tlm_period[level];
+        if (open->samples != 0 && open->start_s == start) {
+            tlm_bucket_add(open, &carry);
+            return;
+        }
+
+        battery_fs_tlm_bucket_t closed = *open;
+        *open = carry;
+        open->start_s = start;
+        if (closed.samples == 0) {
+            return;
+        }
+        ap->pending[level][ap->pending_count[level]++] = closed;
+        if (ap->pending_count[level] == BATTERY_FS_TLM_PENDING) {
+            tlm_flush(ap, level);
+        }
+        carry = closed;
+    }
+}
+
+/**
+ * @brief Fold samples into the .tlm file of a battery, with its writer lock held
+ */
+static esp_err_t tlm_append(const char *serial_number, const battery_fs_tlm_sample_t *samples, size_t count) {
+    char tlmpath[64];
+    build_tlm_path(serial_number, tlmpath, sizeof(tlmpath));
+
+    // Pending buckets make this too large for the acquisition task stack
+    tlm_append_t *ap = calloc(1, sizeof(tlm_append_t));
+    if (ap == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    FRESULT res = file_open(&ap->file, tlmpath, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to open telemetry file %s (FatFs error %d)", tlmpath, res);
+        free(ap);
+        return ESP_FAIL;
+    }
+
+    if (!tlm_header_read(ap->file, &ap->hdr)) {
+        if (f_size(ap->file) != 0) {
+            ESP_LOGW(TAG, "Telemetry of %s unreadable, starting over", serial_number);
+        }
+        tlm_header_init(&ap->hdr);
+    }
+
+    size_t dropped = 0;
+    for (size_t i = 0; i < count; i++) {
+        const battery_fs_tlm_sample_t *s = &samples[i];
+        const battery_fs_tlm_bucket_t *raw = &ap->hdr.open[BATTERY_FS_TLM_RAW];
+        if (raw->samples != 0 && s->time_s < raw->start_s) {
+            dropped++;
+            continue;
+        }
+
+        battery_fs_tlm_bucket_t bucket = { .start_s = s->time_s, .samples = 1 };
+        for (int c = 0; c < BATTERY_FS_TLM_CHANNELS; c++) {
+            bucket.channel[c] = (battery_fs_tlm_stat_t){ s->value[c], s->value[c], s->value[c] };
+        }
+        tlm_merge(ap, BATTERY_FS_TLM_RAW, &bucket);
+    }
+
+    // Ring entries first, the header commits them
+    for (int level = 0; level < BATTERY_FS_TLM_LEVELS; level++) {
+        tlm_flush(ap, level);
+    }
+    res = ap->res;
+    if (res == FR_OK) {
+        res = write_at(ap->file, 0, &ap->hdr, sizeof(ap->hdr));
+    }
+    if (file_close(ap->file) != FR_OK && res == FR_OK) {
+        res = FR_DISK_ERR;
+    }
+    free(ap);
+
+    if (dropped != 0) {
+        ESP_LOGW(TAG, "Dropped %u telemetry samples of %s older than the last stored", dropped, serial_number);
+    }
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to write telemetry of %s (FatFs error %d)", serial_number, res);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t battery_fs_tlm_append(const char *serial_number, const battery_fs_tlm_sample_t *samples, size_t count) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (serial_number == NULL || samples == NULL || count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    battery_lock_t *lock = battery_lock(serial_number);
+    xSemaphoreTake(lock->writer, portMAX_DELAY);
+    esp_err_t ret = g_fs_state.suspended ? ESP_ERR_INVALID_STATE : tlm_append(serial_number, samples, count);
+    xSemaphoreGive(lock->writer);
+    io_leave();
+    return ret;
+}
+
+/**
+ * @brief Telemetry query in progress, see battery_fs_tlm_query()
+ */
+typedef struct {
+    FIL *file;
+    const battery_fs_tlm_header_t *hdr;
+    battery_fs_tlm_cb_t cb;
+    void *arg;
+    bool stop;
+} tlm_query_t;
+
+/**
+ * @brief Ring entry of the n-th oldest bucket of a level
+ */
+static uint32_t tlm_entry(const battery_fs_tlm_header_t *hdr, int level, uint32_t n) {
+    uint32_t cap = s_tlm_capacity[level];
+    return (hdr->head[level] + cap - hdr->count[level] + n) % cap;
+}
+
+/**
+ * @brief Read `count` buckets from the n-th oldest, not past the end of the ring
+ */
+static FRESULT tlm_read_entries(tlm_query_t *q, int level, uint32_t n, battery_fs_tlm_bucket_t *buckets,
+                                uint32_t count) {
+    return read_at(q->file, tlm_ring_offset(level, tlm_entry(q->hdr, level, n)), buckets,
+                   count * sizeof(battery_fs_tlm_bucket_t));
+}
+
+/**
+ * @brief What a level holds past its ring: its open bucket, then the open
+ *        buckets of the finer levels not folded in yet, merged per period
+ *
+ * Open buckets hold disjoint samples, coarser ones the older, so this is
+ * the level as if every open bucket were closed now.
+ *
+ * @return Buckets in `tail`, BATTERY_FS_TLM_LEVELS at most
+ */
+static uint32_t tlm_tail(const battery_fs_tlm_header_t *hdr, int level, battery_fs_tlm_bucket_t *tail) {
+    uint32_t n = 0;
+    for (int l = level; l >= 0; l--) {
+        const battery_fs_tlm_bucket_t *open = &hdr->open[l];
+        if (open->samples == 0) {
+            continue;
+        }
+        uint32_t start = open->start_s - open->start_s % s_tlm_period[level];
+        if (n != 0 && tail[n - 1].start_s == start) {
+            tlm_bucket_add(&tail[n - 1], open);
+        } else {
+            tail[n] = *open;
+            tail[n++].start_s = start;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Start of the oldest bucket a level holds, UINT32_MAX when empty
+ */
+static uint32_t tlm_oldest(tlm_query_t *q, int level) {
+    battery_fs_tlm_bucket_t buckets[BATTERY_FS_TLM_LEVELS];
+    if (q->hdr->count[level] != 0 && tlm_read_entries(q, level, 0, buckets, 1) == FR_OK) {
+        return buckets[0].start_s;
+    }
+    return tlm_tail(q->hdr, level, buckets) != 0 ? buckets[0].start_s : UINT32_MAX;
+}
+
+/**
+ * @brief Report the buckets of a level that overlap [from, end)
+ *
+ * `whole` keeps to buckets that end by `end`. The first one is found by a
+ * binary search over the ring, the tail (tlm_tail()) follows the ring. A
+ * bucket not later than the one before it, left by a reset between ring
+ * and header writes, is skipped.
+ */
+static FRESULT tlm_emit_level(tlm_query_t *q, int level, uint64_t from, uint64_t end, bool whole) {
+    _Static_assert(BATTERY_FS_TLM_LEVELS <= BATTERY_FS_TLM_READ_BUCKETS, "the tail fits one read");
+    uint32_t period = s_tlm_period[level];
+    uint32_t count = q->hdr->count[level];
+    uint32_t lo = 0, hi = count;
+    battery_fs_tlm_bucket_t buckets[BATTERY_FS_TLM_READ_BUCKETS];
+    FRESULT res;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((res = tlm_read_entries(q, level, mid, buckets, 1)) != FR_OK) {
+            return res;
+        }
+        if ((uint64_t)buckets[0].start_s + period > from) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    int64_t last = -1;
+    for (uint32_t n = lo; n <= count && !q->stop;) {
+        uint32_t got;
+        if (n == count) {
+            got = tlm_tail(q->hdr, level, buckets);
+            n++;
+        } else {
+            got = count - n < BATTERY_FS_TLM_READ_BUCKETS ? count - n : BATTERY_FS_TLM_READ_BUCKETS;
+            // Stop at the end of the ring, the next read starts at entry 0
+            uint32_t entry = tlm_entry(q->hdr, level, n);
+            got = got < s_tlm_capacity[level] - entry ? got : s_tlm_capacity[level] - entry;
+            if ((res = tlm_read_entries(q, level, n, buckets, got)) != FR_OK) {
+                return res;
+            }
+            n += got;
+        }
+
+        for (uint32_t i = 0; i < got && !q->stop; i++) {
+            const battery_fs_tlm_bucket_t *b = &buckets[i];
+            uint64_t b_end = (uint64_t)b->start_s + period;
+            if (b->start_s >= end || (whole && b_end > end)) {
+                return FR_OK;
+            }
+            if ((int64_t)b->start_s <= last || b_end <= from) {
+                continue;
+            }
+            last = b->start_s;
+            q->stop = !q->cb(b, period, q->arg);
+        }
+    }
+    return FR_OK;
+}
+
+esp_err_t battery_fs_tlm_query(const char *serial_number, uint32_t from_s, uint32_t to_s,
+                               uint32_t granularity_s, battery_fs_tlm_cb_t cb, void *arg) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (serial_number == NULL || cb == NULL || from_s > to_s) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char tlmpath[64];
+    build_tlm_path(serial_number, tlmpath, sizeof(tlmpath));
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    battery_lock_t *lock = battery_lock(serial_number);
+    reader_enter(lock);
+
+    battery_fs_tlm_header_t hdr;
+    tlm_query_t q = { .hdr = &hdr, .cb = cb, .arg = arg };
+    esp_err_t ret = ESP_OK;
+    if (file_open(&q.file, tlmpath, FA_READ) != FR_OK) {
+        ret = ESP_ERR_NOT_FOUND;
+    } else if (!tlm_header_read(q.file, &hdr)) {
+        ret = ESP_ERR_NOT_FOUND;
+    }
+
+    if (ret == ESP_OK) {
+        int fine = BATTERY_FS_TLM_RAW;
+        while (fine + 1 < BATTERY_FS_TLM_LEVELS && s_tlm_period[fine + 1] <= granularity_s) {
+            fine++;
+        }
+
+        // Each coarser level fills in before the oldest bucket of the finer ones
+        uint64_t end[BATTERY_FS_TLM_LEVELS];
+        int coarse = fine;
+        end[fine] = (uint64_t)to_s + 1;
+        for (uint64_t cut = end[fine]; coarse + 1 < BATTERY_FS_TLM_LEVELS; coarse++) {
+            uint32_t oldest = tlm_oldest(&q, coarse);
+            cut = oldest < cut ? oldest : cut;
+            if (cut <= from_s) {
+                break;
+            }
+            end[coarse + 1] = cut;
+        }
+
+        FRESULT res = FR_OK;
+        for (int level = coarse; level >= fine && res == FR_OK && !q.stop; level--) {
+            res = tlm_emit_level(&q, level, from_s, end[level], level != fine);
+        }
+        if (res != FR_OK) {
+            ESP_LOGE(TAG, "Failed to read telemetry of %s (FatFs error %d)", serial_number, res);
+            ret = ESP_FAIL;
+        }
+    }
+    if (q.file != NULL) {
+        file_close(q.file);
+    }
+
+    reader_leave(lock);
+    io_leave();
+    return ret;
+}
+
+// ============================================================================
+// Incremental Sync
+// ============================================================================
+
+/**
+ * @brief Load the sequence log position and consumer marks at mount
+ */
+static void sync_load(void) {
+    char path[32];
+    FIL *f;
+
+    g_fs_state.next_seq = 1;
+    g_fs_state.seq_entries = 0;
+    build_sync_path(BATTERY_FS_SEQ_LOG, path, sizeof(path));
+    if (file_open(&f, path, FA_READ) == FR_OK) {
+        // A torn entry at the end is overwritten by the next append
+        uint32_t entries = f_size(f) / sizeof(battery_fs_seq_entry_t);
+        battery_fs_seq_entry_t e;
+        if (entries != 0) {
+            if (read_at(f, (FSIZE_t)(entries - 1) * sizeof(e), &e, sizeof(e)) == FR_OK) {
+                g_fs_state.seq_entries = entries;
+                g_fs_state.next_seq = e.first_seq + e.count;
+            } else {
+                // Numbering again from 1 would hand consumers old numbers
+                ESP_LOGE(TAG, "Sequence log unreadable, appends are not sequenced");
+                g_fs_state.next_seq = 0;
+            }
+        }
+        file_close(f);
+    }
+
+    build_sync_path(BATTERY_FS_SYNC_CURSORS, path, sizeof(path));
+    bool loaded = false;
+    if (file_open(&f, path, FA_READ) == FR_OK) {
+        loaded = read_at(f, 0, &g_fs_state.sync, sizeof(g_fs_state.sync)) == FR_OK &&
+                 g_fs_state.sync.magic == BATTERY_FS_SYNC_MAGIC && g_fs_state.sync.size == sizeof(g_fs_state.sync);
+        file_close(f);
+    }
+    if (!loaded) {
+        memset(&g_fs_state.sync, 0, sizeof(g_fs_state.sync));
+        g_fs_state.sync.magic = BATTERY_FS_SYNC_MAGIC;
+        g_fs_state.sync.size = sizeof(g_fs_state.sync);
+    }
+}
+
+/**
+ * @brief Give the records of a committed append their sequence numbers
+ *
+ * Called with the battery's writer lock held, after the .met head, and
+ * publishes the append to subscribers. When the entry cannot be written
+ * the append goes without: the records stay readable, sync consumers and
+ * subscribers do not get them.
+ */
+static void seq_log_append(const char *serial_number, uint32_t first_record, FSIZE_t offset, uint32_t crc,
+                           uint32_t count, uint32_t last_memory_index) {
+    battery_fs_seq_entry_t e = {
+        .first_record = first_record,
+        .offset = (uint32_t)offset,
+        .crc = crc,
+        .count = count,
+    };
+    strncpy(e.serial, serial_number, BATTERY_FS_SEQ_SERIAL);
+
+    char path[32];
+    build_sync_path(BATTERY_FS_SEQ_LOG, path, sizeof(path));
+
+    xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+    if (g_fs_state.next_seq == 0 || strlen(serial_number) > BATTERY_FS_SEQ_SERIAL) {
+        xSemaphoreGive(g_fs_state.seq_lock);
+        return;
+    }
+    e.first_seq = g_fs_state.next_seq;
+
+    FIL *f;
+    FRESULT res = file_open(&f, path, FA_WRITE | FA_OPEN_ALWAYS);
+    if (res == FR_OK) {
+        res = write_at(f, (FSIZE_t)g_fs_state.seq_entries * sizeof(e), &e, sizeof(e));
+        if (file_close(f) != FR_OK) {
+            res = FR_DISK_ERR;
+        }
+    }
+    if (res == FR_OK) {
+        g_fs_state.seq_entries++;
+        __atomic_store_n(&g_fs_state.next_seq, g_fs_state.next_seq + count, __ATOMIC_RELAXED);
+        change_publish(&e, last_memory_index);
+    } else {
+        ESP_LOGW(TAG, "Failed to sequence %lu records of %s (FatFs error %d)", (unsigned long)count,
+                 serial_number, res);
+    }
+    xSemaphoreGive(g_fs_state.seq_lock);
+}
+
+/**
+ * @brief Slot of a consumer, -1 if never acknowledged; seq_lock held
+ */
+static int sync_find(const char *consumer) {
+    for (int i = 0; i < BATTERY_FS_SYNC_CONSUMERS; i++) {
+        const char *name = g_fs_state.sync.cursor[i].name;
+        if (name[0] != '\0' && strncmp(name, consumer, BATTERY_FS_SYNC_NAME) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool sync_name_valid(const char *consumer) {
+    size_t len = consumer != NULL ? strlen(consumer) : 0;
+    return len != 0 && len <= BATTERY_FS_SYNC_NAME;
+}
+
+typedef struct {
+    battery_fs_sync_cb_t cb;
+    void *arg;
+    uint32_t max;                   // 0 = no limit
+    uint32_t sent;
+    uint32_t last;                  // Sequence number the consumer is served up to
+    bool stop;
+    uint8_t *buf;                   // Record data
+    size_t buf_size;
+} sync_read_t;
+
+/**
+ * @brief Hand over the records of one sequence log entry from `from` on
+ *
+ * The battery's reader lock keeps it from being deleted meanwhile. Records
+ * of a battery deleted since, or stored again under the same name, do not
+ * match the entry and are skipped as a whole.
+ */
+static esp_err_t sync_entry(sync_read_t *sr, const battery_fs_seq_entry_t *e, uint32_t from) {
+    char serial[BATTERY_FS_SEQ_SERIAL + 1];
+    memcpy(serial, e->serial, BATTERY_FS_SEQ_SERIAL);
+    serial[BATTERY_FS_SEQ_SERIAL] = '\0';
+
+    battery_lock_t *lock = battery_lock(serial);
+    reader_enter(lock);
+
+    battery_metadata_t metadata;
+    bool valid = battery_fs_read_metadata(serial, &metadata) == ESP_OK &&
+                 (uint64_t)e->first_record + e->count <= metadata.record_count;
+
+    FIL *f = NULL;
+    FRESULT res = FR_OK;
+    if (valid) {
+        char filepath[64];
+        build_data_path(serial, filepath, sizeof(filepath));
+        valid = file_open(&f, filepath, FA_READ) == FR_OK;
+    }
+    if (valid) {
+        res = f_lseek(f, e->offset);
+    }
+
+    esp_err_t ret = ESP_OK;
+    for (uint32_t k = 0; valid && res == FR_OK && k < e->count && !sr->stop; k++) {
+        battery_fs_record_header_t header;
+        UINT read;
+        res = f_read(f, &header, sizeof(header), &read);
+        if (res != FR_OK || read != sizeof(header) || header.data_len > f_size(f) - f_tell(f)) {
+            valid = false;
+            break;
+        }
+        if (header.data_len > sr->buf_size) {
+            uint8_t *buf = realloc(sr->buf, header.data_len);
+            if (buf == NULL) {
+                ret = ESP_ERR_NO_MEM;
+                break;
+            }
+            sr->buf = buf;
+            sr->buf_size = header.data_len;
+        }
+        res = f_read(f, sr->buf, header.data_len, &read);
+        if (res != FR_OK || read != header.data_len ||
+            (k == 0 && calculate_data_hash(sr->buf, header.data_len) != e->crc)) {
+            valid = false;
+            break;
+        }
+
+        uint32_t seq = e->first_seq + k;
+        if (seq < from) {
+            continue;
+        }
+        sr->last = seq;
+        sr->sent++;
+        if (!sr->cb(serial, seq, &header, sr->buf, sr->arg) || sr->sent == sr->max) {
+            sr->stop = true;
+        }
+    }
+
+    if (f != NULL) {
+        file_close(f);
+    }
+    reader_leave(lock);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to read %s for sync (FatFs error %d)", serial, res);
+        return ESP_FAIL;
+    }
+    if (!valid) {
+        ESP_LOGW(TAG, "Records %lu-%lu of %s are gone, skipped", (unsigned long)e->first_seq,
+                 (unsigned long)(e->first_seq + e->count - 1), serial);
+        sr->last = e->first_seq + e->count - 1;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Index of the log entry holding sequence number `seq`
+ */
+static FRESULT sync_search(FIL *f, uint32_t entries, uint32_t seq, uint32_t *index) {
+    uint32_t lo = 0, hi = entries - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        battery_fs_seq_entry_t e;
+        FRESULT res = read_at(f, (FSIZE_t)mid * sizeof(e), &e, sizeof(e));
+        if (res != FR_OK) {
+            return res;
+        }
+        if (e.first_seq <= seq) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    *index = lo;
+    return FR_OK;
+}
+
+uint32_t battery_fs_sync_last_seq(void) {
+    if (!g_fs_state.initialized) {
+        return 0;
+    }
+    xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+    uint32_t last = g_fs_state.next_seq != 0 ? g_fs_state.next_seq - 1 : 0;
+    xSemaphoreGive(g_fs_state.seq_lock);
+    return last;
+}
+
+esp_err_t battery_fs_sync_read(const char *consumer, uint32_t max_records, battery_fs_sync_cb_t cb, void *arg,
+                               uint32_t *last_seq) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!sync_name_valid(consumer) || cb == NULL || last_seq == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Entries appended from here on wait for the next read
+    xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+    int slot = sync_find(consumer);
+    uint32_t acked = slot >= 0 ? g_fs_state.sync.cursor[slot].acked : 0;
+    uint32_t entries = g_fs_state.seq_entries;
+    uint32_t next_seq = g_fs_state.next_seq;
+    xSemaphoreGive(g_fs_state.seq_lock);
+
+    sync_read_t sr = { .cb = cb, .arg = arg, .max = max_records, .last = acked };
+    *last_seq = acked;
+    if (entries == 0 || acked + 1 >= next_seq) {
+        io_leave();
+        return ESP_OK;
+    }
+
+    char path[32];
+    build_sync_path(BATTERY_FS_SEQ_LOG, path, sizeof(path));
+    FIL *f;
+    FRESULT res = file_open(&f, path, FA_READ);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to open the sequence log (FatFs error %d)", res);
+        io_leave();
+        return ESP_FAIL;
+    }
+
+    uint32_t index = 0;
+    res = sync_search(f, entries, acked + 1, &index);
+
+    esp_err_t ret = ESP_OK;
+    battery_fs_seq_entry_t batch[BATTERY_FS_SYNC_READ_ENTRIES];
+    while (res == FR_OK && ret == ESP_OK && index < entries && !sr.stop) {
+        uint32_t n = entries - index < BATTERY_FS_SYNC_READ_ENTRIES ? entries - index : BATTERY_FS_SYNC_READ_ENTRIES;
+        res = read_at(f, (FSIZE_t)index * sizeof(batch[0]), batch, n * sizeof(batch[0]));
+        for (uint32_t i = 0; res == FR_OK && ret == ESP_OK && i < n && !sr.stop; i++) {
+            const battery_fs_seq_entry_t *e = &batch[i];
+            if (e->first_seq + e->count <= acked + 1) {
+                continue;
+            }
+            // Between appends, so a suspension does not wait for the consumer
+            if (g_fs_state.suspended) {
+                ret = ESP_ERR_INVALID_STATE;
+                break;
+            }
+            ret = sync_entry(&sr, e, sr.last + 1);
+        }
+        index += n;
+    }
+    file_close(f);
+    free(sr.buf);
+    io_leave();
+
+    *last_seq = sr.last;
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to read the sequence log (FatFs error %d)", res);
+        return ESP_FAIL;
+    }
+    return ret;
+}
+
+esp_err_t battery_fs_sync_ack(const char *consumer, uint32_t seq) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!sync_name_valid(consumer)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+    if (g_fs_state.next_seq != 0 && seq >= g_fs_state.next_seq) {
+        xSemaphoreGive(g_fs_state.seq_lock);
+        io_leave();
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int slot = sync_find(consumer);
+    for (int i = 0; slot < 0 && i < BATTERY_FS_SYNC_CONSUMERS; i++) {
+        if (g_fs_state.sync.cursor[i].name[0] == '\0') {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        xSemaphoreGive(g_fs_state.seq_lock);
+        io_leave();
+        return ESP_ERR_NO_MEM;
+    }
+
+    battery_fs_sync_cursor_t *cursor = &g_fs_state.sync.cursor[slot];
+    battery_fs_sync_cursor_t previous = *cursor;
+    strncpy(cursor->name, consumer, BATTERY_FS_SYNC_NAME);
+    cursor->acked = seq;
+
+    char path[32];
+    build_sync_path(BATTERY_FS_SYNC_CURSORS, path, sizeof(path));
+    FIL *f;
+    FRESULT res = file_open(&f, path, FA_WRITE | FA_OPEN_ALWAYS);
+    if (res == FR_OK) {
+        res = write_at(f, 0, &g_fs_state.sync, sizeof(g_fs_state.sync));
+        if (file_close(f) != FR_OK) {
+            res = FR_DISK_ERR;
+        }
+    }
+    if (res != FR_OK) {
+        *cursor = previous;
+        ESP_LOGE(TAG, "Failed to store the mark of %s (FatFs error %d)", consumer, res);
+    }
+    xSemaphoreGive(g_fs_state.seq_lock);
+    io_leave();
+    return res == FR_OK ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t battery_fs_sync_cursor(const char *consumer, uint32_t *acked) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!sync_name_valid(consumer) || acked == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+    int slot = sync_find(consumer);
+    if (slot >= 0) {
+        *acked = g_fs_state.sync.cursor[slot].acked;
+    }
+    xSemaphoreGive(g_fs_state.seq_lock);
+    return slot >= 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// ============================================================================
+// Change Subscriptions
+// ============================================================================
+
+/**
+ * @brief Queue a committed append for the subscribers, with seq_lock held
+ *
+ * Never waits: with the dispatcher queue full the change is dropped for
+ * every subscriber. seq_lock keeps the queue in commit order.
+ */
+static void change_publish(const battery_fs_seq_entry_t *e, uint32_t last_memory_index) {
+    QueueHandle_t queue = __atomic_load_n(&g_fs_state.changes, __ATOMIC_ACQUIRE);
+    if (queue == NULL) {
+        return;
+    }
+
+    battery_fs_change_t change = {
+        .first_seq = e->first_seq,
+        .count = e->count,
+        .first_record = e->first_record,
+        .last_memory_index = last_memory_index,
+    };
+    memcpy(change.serial_number, e->serial, BATTERY_FS_SEQ_SERIAL);
+    if (xQueueSend(queue, &change, 0) != pdTRUE) {
+        __atomic_add_fetch(&g_fs_state.changes_dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Records committed after `handled_seq`, 0 while the log is unreadable
+ */
+static uint32_t seq_lag(uint32_t handled_seq) {
+    uint32_t next_seq = __atomic_load_n(&g_fs_state.next_seq, __ATOMIC_RELAXED);
+    return next_seq == 0 ? 0 : next_seq - 1 - handled_seq;
+}
+
+/**
+ * @brief Hand every queued change to the subscribers, a zero count stops
+ *
+ * sub_lock is released around each callback, so a callback may subscribe,
+ * unsubscribe or read stats. `delivering` makes battery_fs_unsubscribe()
+ * from another task wait for the callback. A slot freed and taken again
+ * meanwhile has a later since_seq, so it neither gets this change nor the
+ * counts.
+ */
+static void dispatch_task(void *arg) {
+    QueueHandle_t queue = arg;
+    battery_fs_change_t change;
+
+    while (xQueueReceive(queue, &change, portMAX_DELAY) == pdTRUE && change.count != 0) {
+        uint32_t last = change.first_seq + change.count - 1;
+        uint32_t lag = seq_lag(last);
+
+        xSemaphoreTake(g_fs_state.sub_lock, portMAX_DELAY);
+        for (int i = 0; i < BATTERY_FS_SUBSCRIBERS; i++) {
+            battery_fs_subscriber_t *sub = &g_fs_state.subs[i];
+            if (!sub->active || change.first_seq < sub->since_seq) {
+                continue;
+            }
+            bool delivered = true;
+            if (sub->cb != NULL) {
+                battery_fs_change_cb_t cb = sub->cb;
+                void *cb_arg = sub->arg;
+                g_fs_state.delivering = sub;
+                xSemaphoreGive(g_fs_state.sub_lock);
+                cb(&change, cb_arg);
+                xSemaphoreTake(g_fs_state.sub_lock, portMAX_DELAY);
+                g_fs_state.delivering = NULL;
+                if (!sub->active || change.first_seq < sub->since_seq) {
+                    continue;
+                }
+            } else {
+                delivered = xQueueSend(sub->queue, &change, 0) == pdTRUE;
+            }
+            if (delivered) {
+                sub->delivered++;
+            } else {
+                sub->dropped++;
+            }
+            sub->max_lag = lag > sub->max_lag ? lag : sub->max_lag;
+            sub->handled_seq = last;
+        }
+        xSemaphoreGive(g_fs_state.sub_lock);
+    }
+
+    xSemaphoreGive(g_fs_state.dispatch_done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Start the dispatcher unless running, with sub_lock held
+ */
+static esp_err_t dispatch_start(void) {
+    if (g_fs_state.changes != NULL) {
+        return ESP_OK;
+    }
+
+    QueueHandle_t queue = xQueueCreate(BATTERY_FS_CHANGE_QUEUE, sizeof(battery_fs_change_t));
+    g_fs_state.dispatch_done = xSemaphoreCreateBinary();
+    if (queue == NULL || g_fs_state.dispatch_done == NULL ||
+        xTaskCreate(dispatch_task, "fs_dispatch", BATTERY_FS_DISPATCH_STACK, queue,
+                    BATTERY_FS_DISPATCH_PRIORITY, &g_fs_state.dispatcher) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the change dispatcher");
+        if (queue != NULL) {
+            vQueueDelete(queue);
+        }
+        if (g_fs_state.dispatch_done != NULL) {
+            vSemaphoreDelete(g_fs_state.dispatch_done);
+            g_fs_state.dispatch_done = NULL;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+
+    __atomic_store_n(&g_fs_state.changes, queue, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+/**
+ * @brief Stop the dispatcher and drop every subscription, at deinit
+ */
+static void dispatch_stop(void) {
+    QueueHandle_t queue = g_fs_state.changes;
+    if (queue == NULL) {
+        return;
+    }
+
+    // Changes still queued are handed over first
+    __atomic_store_n(&g_fs_state.changes, NULL, __ATOMIC_RELEASE);
+    battery_fs_change_t stop = {0};
+    xQueueSend(queue, &stop, portMAX_DELAY);
+    xSemaphoreTake(g_fs_state.dispatch_done, portMAX_DELAY);
+
+    vQueueDelete(queue);
+    vSemaphoreDelete(g_fs_state.dispatch_done);
+    g_fs_state.dispatch_done = NULL;
+    g_fs_state.dispatcher = NULL;
+    memset(g_fs_state.subs, 0, sizeof(g_fs_state.subs));
+}
+
+static esp_err_t subscribe(battery_fs_change_cb_t cb, void *arg, QueueHandle_t queue, battery_fs_subscriber_t **sub) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (sub == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(g_fs_state.sub_lock, portMAX_DELAY);
+    esp_err_t ret = dispatch_start();
+    battery_fs_subscriber_t *s = NULL;
+    for (int i = 0; ret == ESP_OK && i < BATTERY_FS_SUBSCRIBERS && s == NULL; i++) {
+        s = g_fs_state.subs[i].active ? NULL : &g_fs_state.subs[i];
+    }
+    if (ret == ESP_OK && s == NULL) {
+        ret = ESP_ERR_NO_MEM;
+    }
+
+    if (ret == ESP_OK) {
+        // Changes committed from here on, whether queued yet or not
+        xSemaphoreTake(g_fs_state.seq_lock, portMAX_DELAY);
+        uint32_t next_seq = g_fs_state.next_seq;
+        uint32_t dropped = __atomic_load_n(&g_fs_state.changes_dropped, __ATOMIC_RELAXED);
+        xSemaphoreGive(g_fs_state.seq_lock);
+
+        *s = (battery_fs_subscriber_t){
+            .active = true,
+            .cb = cb,
+            .arg = arg,
+            .queue = queue,
+            .since_seq = next_seq,
+            .handled_seq = next_seq - 1,
+            .overflow_base = dropped,
+        };
+        *sub = s;
+    }
+    xSemaphoreGive(g_fs_state.sub_lock);
+    return ret;
+}
+
+esp_err_t battery_fs_subscribe(battery_fs_change_cb_t cb, void *arg, battery_fs_subscriber_t **sub) {
+    if (cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return subscribe(cb, arg, NULL, sub);
+}
+
+esp_err_t battery_fs_subscribe_queue(QueueHandle_t queue, battery_fs_subscriber_t **sub) {
+    if (queue == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return subscribe(NULL, NULL, queue, sub);
+}
+
+static bool subscriber_valid(const battery_fs_subscriber_t *sub) {
+    return sub >= &g_fs_state.subs[0] && sub < &g_fs_state.subs[BATTERY_FS_SUBSCRIBERS] && sub->active;
+}
+
+esp_err_t battery_fs_unsubscribe(battery_fs_subscriber_t *sub) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(g_fs_state.sub_lock, portMAX_DELAY);
+    // Its callback in progress finishes first, unless this is the callback
+    while (sub != NULL && g_fs_state.delivering == sub &&
+           xTaskGetCurrentTaskHandle() != g_fs_state.dispatcher) {
+        xSemaphoreGive(g_fs_state.sub_lock);
+        vTaskDelay(1);
+        xSemaphoreTake(g_fs_state.sub_lock, portMAX_DELAY);
+    }
+    bool valid = subscriber_valid(sub);
+    if (valid) {
+        memset(sub, 0, sizeof(*sub));
+    }
+    xSemaphoreGive(g_fs_state.sub_lock);
+    return valid ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t battery_fs_subscriber_stats(const battery_fs_subscriber_t *sub, battery_fs_subscriber_stats_t *stats) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!subscriber_valid(sub) || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Words written by the dispatcher alone, read without waiting for it
+    stats->delivered = sub->delivered;
+    stats->dropped = sub->dropped + (__atomic_load_n(&g_fs_state.changes_dropped, __ATOMIC_RELAXED) -
+                                     sub->overflow_base);
+    stats->lag = seq_lag(sub->handled_seq);
+    stats->max_lag = sub->max_lag;
+    return ESP_OK;
+}
+
+// ============================================================================
+// Data Write Functions
+// ============================================================================
+
+/**
+ * @brief Append the new records of a battery, with its writer lock held
+ *
+ * A data file is only recreated when its metadata is missing or unreadable,
+ * and readers cannot open such a battery, so this needs no reader exclusion.
+ *
+ * A suspension stops it between records. The metadata then covers the
+ * records that were written, so the next append of the same logs stores
+ * the rest.
+ */
+static esp_err_t append_records(const char *serial_number, const battery_log_t *logs, size_t log_count) {
+    ESP_LOGI(TAG, "Writing battery data for %s (%u logs)", serial_number, log_count);
+
+    // Step 1: Check if battery file exists
+    bool exists = battery_fs_exists(serial_number);
+
+    battery_log_t *logs_to_write = NULL;
+    size_t write_count = 0;
+    battery_metadata_t metadata = {0};
+    meta_file_t mf;
+    bool indexed = true;
+    bool free_logs = false;
+
+    if (exists) {
+        ESP_LOGI(TAG, "Battery %s exists, checking for new records...", serial_number);
+        
+        // Step 2: Read existing metadata
+        esp_err_t ret = read_meta_file(serial_number, &mf);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to read metadata, treating as new battery");
+            exists = false;
+        } else {
+            metadata = mf.meta;
+
+            // Step 3: Identify new records
+            battery_log_t *new_logs = malloc(log_count * sizeof(battery_log_t));
+            if (new_logs == NULL) {
+                ESP_LOGE(TAG, "Failed to allocate memory for new logs");
+                return ESP_ERR_NO_MEM;
+            }
+
+            ret = battery_fs_identify_new_records(&metadata, logs, log_count, new_logs, &write_count);
+            if (ret != ESP_OK) {
+                free(new_logs);
+                return ret;
             }
 
             if (write_count == 0) {
@@ -386,10 +2865,17 @@ esp_err_t battery_fs_write_data(const char *serial_number, const battery_log_t *
 
             logs_to_write = new_logs;
             free_logs = true;
+
+            // Written before the summary and flag index, or by
+            // battery_fs_write_metadata(): rebuilt once at the update
+            indexed = summary_current(&mf.summary, &metadata) && flag_header_current(&mf.flags, &metadata);
         }
     }
 
     if (!exists) {
+        summary_init(&mf.summary);
+        flag_header_init(&mf.flags);
+
         // New battery, write all logs
         ESP_LOGI(TAG, "New battery %s, writing all %u logs", serial_number, log_count);
         logs_to_write = (battery_log_t *)logs;
@@ -397,79 +2883,304 @@ esp_err_t battery_fs_write_data(const char *serial_number, const battery_log_t *
     }
 
     // Step 4: Write data to file
-    char filepath[128];
+    char filepath[64];
     build_data_path(serial_number, filepath, sizeof(filepath));
 
-    const char *mode = exists ? "ab" : "wb";  // Append if exists, write if new
-    FILE *f = fopen(filepath, mode);
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open file %s (errno: %d - %s)", 
-                 filepath, errno, strerror(errno));
+    BYTE mode = FA_WRITE | (exists ? FA_OPEN_APPEND : FA_CREATE_ALWAYS);  // Append if exists, write if new
+    FIL *f;
+    FRESULT res = file_open(&f, filepath, mode);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to open file %s (FatFs error %d)", filepath, res);
         if (free_logs) free(logs_to_write);
         return ESP_FAIL;
     }
 
+    // Where the first new record goes, for the sequence log
+    FSIZE_t first_offset = f_tell(f);
+    uint32_t first_record = exists ? metadata.record_count : 0;
+    uint32_t first_crc = calculate_data_hash(logs_to_write[0].data, logs_to_write[0].data_len);
+
     // Write each log entry
+    size_t stored = write_count;
     for (size_t i = 0; i < write_count; i++) {
-        // Write memory index
-        if (fwrite(&logs_to_write[i].memory_index, sizeof(uint32_t), 1, f) != 1) {
-            ESP_LOGE(TAG, "Failed to write memory index");
-            fclose(f);
-            if (free_logs) free(logs_to_write);
-            return ESP_FAIL;
+        UINT written;
+
+        if (g_fs_state.suspended) {
+            stored = i;
+            break;
         }
 
-        // Write data length
-        if (fwrite(&logs_to_write[i].data_len, sizeof(size_t), 1, f) != 1) {
-            ESP_LOGE(TAG, "Failed to write data length");
-            fclose(f);
+        // Record header: memory index + data length (fixed 32-bit so images are portable to 64-bit hosts)
+        battery_fs_record_header_t header = {
+            .memory_index = logs_to_write[i].memory_index,
+            .data_len = logs_to_write[i].data_len,
+        };
+        res = f_write(f, &header, sizeof(header), &written);
+        if (res != FR_OK || written != sizeof(header)) {
+            ESP_LOGE(TAG, "Failed to write record header");
+            file_close(f);
             if (free_logs) free(logs_to_write);
             return ESP_FAIL;
         }
 
         // Write binary data
-        if (fwrite(logs_to_write[i].data, 1, logs_to_write[i].data_len, f) != logs_to_write[i].data_len) {
+        res = f_write(f, logs_to_write[i].data, header.data_len, &written);
+        if (res != FR_OK || written != header.data_len) {
             ESP_LOGE(TAG, "Failed to write binary data");
-            fclose(f);
+            file_close(f);
             if (free_logs) free(logs_to_write);
             return ESP_FAIL;
         }
     }
 
-    fclose(f);
-    if (free_logs) free(logs_to_write);
+    res = file_close(f);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to close file %s (FatFs error %d)", filepath, res);
+        if (free_logs) free(logs_to_write);
+        return ESP_FAIL;
+    }
+    if (stored == 0) {
+        ESP_LOGW(TAG, "Suspended before writing to %s", serial_number);
+        if (free_logs) free(logs_to_write);
+        return ESP_ERR_INVALID_STATE;
+    }
+    __atomic_fetch_add(&g_fs_state.stats.records_written, stored, __ATOMIC_RELAXED);
 
-    ESP_LOGI(TAG, "✓ Wrote %u records to %s", write_count, serial_number);
+    ESP_LOGI(TAG, "✓ Wrote %u records to %s", stored, serial_number);
 
     // Step 5: Update metadata after successful write
-    // Find the highest memory_index and its corresponding data hash
-    uint32_t last_index = logs[0].memory_index;
-    const battery_log_t *last_log = &logs[0];
+    // Find the highest memory_index and its corresponding data hash, only
+    // among the records written when a suspension cut the append short
+    const battery_log_t *scan = stored < write_count ? logs_to_write : logs;
+    size_t scan_count = stored < write_count ? stored : log_count;
+    uint32_t last_index = scan[0].memory_index;
+    const battery_log_t *last_log = &scan[0];
     
-    for (size_t i = 0; i < log_count; i++) {
-        if (logs[i].memory_index > last_index) {
-            last_index = logs[i].memory_index;
-            last_log = &logs[i];
+    for (size_t i = 0; i < scan_count; i++) {
+        if (scan[i].memory_index > last_index) {
+            last_index = scan[i].memory_index;
+            last_log = &scan[i];
         }
     }
 
     metadata.last_memory_index = last_index;
     metadata.last_data_hash = calculate_data_hash(last_log->data, last_log->data_len);
-    metadata.record_count = exists ? (metadata.record_count + write_count) : write_count;
+    metadata.record_count = exists ? (metadata.record_count + stored) : stored;
     metadata.last_timestamp = time(NULL);
+    mf.meta = metadata;
     
     ESP_LOGI(TAG, "Updating metadata: index=%lu, hash=0x%08lX, records=%lu",
              (unsigned long)last_index, (unsigned long)metadata.last_data_hash,
              (unsigned long)metadata.record_count);
 
-    esp_err_t ret = battery_fs_write_metadata(serial_number, &metadata);
+    esp_err_t ret = write_meta_index(serial_number, &mf, indexed, logs_to_write, stored);
+    if (free_logs) free(logs_to_write);
     if (ret != ESP_OK) {
         ESP_LOGW(TAG, "Failed to update metadata (data was written successfully)");
+    } else {
+        seq_log_append(serial_number, first_record, first_offset, first_crc, stored, last_index);
+    }
+
+    if (stored < write_count) {
+        ESP_LOGW(TAG, "Suspended after %u of %u records for %s", stored, write_count, serial_number);
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t write_data(const char *serial_number, const battery_log_t *logs, size_t log_count) {
+    if (!g_fs_state.initialized) {
+        ESP_LOGE(TAG, "Not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (serial_number == NULL || logs == NULL || log_count == 0) {
+        ESP_LOGE(TAG, "Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Recheck once the writer lock is ours, the wait for it can be long
+    battery_lock_t *lock = battery_lock(serial_number);
+    xSemaphoreTake(lock->writer, portMAX_DELAY);
+    esp_err_t ret = g_fs_state.suspended ? ESP_ERR_INVALID_STATE
+                                         : append_records(serial_number, logs, log_count);
+    xSemaphoreGive(lock->writer);
+    io_leave();
+    return ret;
+}
+
+esp_err_t battery_fs_write_data(const char *serial_number, const battery_log_t *logs, size_t log_count) {
+    EVTRACE_BEGIN(EVTRACE_ID_FS_WRITE_DATA, log_count);
+    esp_err_t ret = write_data(serial_number, logs, log_count);
+    EVTRACE_END(EVTRACE_ID_FS_WRITE_DATA, ret);
+    return ret;
+}
+
+// ============================================================================
+// Data Read Functions
+// ============================================================================
+
+esp_err_t battery_fs_reader_open(const char *serial_number, battery_fs_reader_t **reader) {
+    if (!g_fs_state.initialized) {
+        ESP_LOGE(TAG, "Not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (serial_number == NULL || reader == NULL) {
+        ESP_LOGE(TAG, "Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    battery_fs_reader_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        io_leave();
+        return ESP_ERR_NO_MEM;
+    }
+    r->lock = battery_lock(serial_number);
+
+    // Count first: a delete cannot start between the snapshot and the open
+    reader_enter(r->lock);
+
+    battery_metadata_t metadata;
+    esp_err_t ret = battery_fs_read_metadata(serial_number, &metadata);
+    if (ret != ESP_OK) {
+        reader_leave(r->lock);
+        free(r);
+        io_leave();
+        return ret;
     }
+    r->count = metadata.record_count;
 
+    char filepath[64];
+    build_data_path(serial_number, filepath, sizeof(filepath));
+    FRESULT res = file_open(&r->file, filepath, FA_READ);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to open file %s (FatFs error %d)", filepath, res);
+        reader_leave(r->lock);
+        free(r);
+        io_leave();
+        return res == FR_NO_FILE ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+    }
+
+    *reader = r;
+    io_leave();
     return ESP_OK;
 }
 
+uint32_t battery_fs_reader_count(const battery_fs_reader_t *reader) {
+    return reader ? reader->count : 0;
+}
+
+static esp_err_t reader_next(battery_fs_reader_t *reader, battery_fs_record_header_t *header,
+                             uint8_t *data, size_t data_size) {
+    if (reader->next >= reader->count) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    UINT read = 0;
+    FRESULT res = f_read(reader->file, header, sizeof(*header), &read);
+    if (res != FR_OK || read != sizeof(*header)) {
+        ESP_LOGE(TAG, "Failed to read record header %lu", (unsigned long)reader->next);
+        return ESP_FAIL;
+    }
+
+    // Copy what fits, skip the rest so the next call stays aligned
+    FSIZE_t end = f_tell(reader->file) + header->data_len;
+    UINT copy = header->data_len < data_size ? header->data_len : data_size;
+    res = f_read(reader->file, data, copy, &read);
+    if (res == FR_OK && read == copy && copy < header->data_len) {
+        res = f_lseek(reader->file, end);
+    }
+    if (res != FR_OK || read != copy || f_tell(reader->file) != end) {
+        ESP_LOGE(TAG, "Failed to read record data %lu", (unsigned long)reader->next);
+        return ESP_FAIL;
+    }
+
+    reader->next++;
+    __atomic_fetch_add(&g_fs_state.stats.records_read, 1, __ATOMIC_RELAXED);
+    return copy < header->data_len ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+esp_err_t battery_fs_reader_next(battery_fs_reader_t *reader, battery_fs_record_header_t *header,
+                                 uint8_t *data, size_t data_size) {
+    if (reader == NULL || header == NULL || (data == NULL && data_size > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = reader_next(reader, header, data, data_size);
+    io_leave();
+    return ret;
+}
+
+esp_err_t battery_fs_reader_close(battery_fs_reader_t *reader) {
+    if (reader == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    FRESULT res = file_close(reader->file);
+    reader_leave(reader->lock);
+    free(reader);
+    return res == FR_OK ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t battery_fs_foreach(battery_fs_visit_cb_t cb, void *arg) {
+    if (!g_fs_state.initialized) {
+        ESP_LOGE(TAG, "Not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    FF_DIR *dir = malloc(sizeof(FF_DIR));
+    if (dir == NULL) {
+        io_leave();
+        return ESP_ERR_NO_MEM;
+    }
+
+    FRESULT res = f_opendir(dir, g_fs_state.drive);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to open directory %s (FatFs error %d)", g_fs_state.drive, res);
+        free(dir);
+        io_leave();
+        return ESP_FAIL;
+    }
+
+    // One visit per metadata file: a battery without one has no records
+    FILINFO entry;
+    while (!g_fs_state.suspended && f_readdir(dir, &entry) == FR_OK && entry.fname[0] != '\0') {
+        char *ext = strrchr(entry.fname, '.');
+        if (ext == NULL || strcmp(ext, ".met") != 0 || (entry.fattrib & AM_DIR)) {
+            continue;
+        }
+        *ext = '\0';
+        if (!cb(entry.fname, arg)) {
+            break;
+        }
+    }
+
+    f_closedir(dir);
+    free(dir);
+    io_leave();
+    return g_fs_state.suspended ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
 // ============================================================================
 // Delete Functions
 // ============================================================================
@@ -485,33 +3196,65 @@ esp_err_t battery_fs_delete_battery(const char *serial_number) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    char filepath[128];
-    char metapath[128];
+    char filepath[64];
+    char metapath[64];
+    char tlmpath[64];
     build_data_path(serial_number, filepath, sizeof(filepath));
     build_meta_path(serial_number, metapath, sizeof(metapath));
+    build_tlm_path(serial_number, tlmpath, sizeof(tlmpath));
+
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    battery_lock_t *lock = battery_lock(serial_number);
+    exclusive_enter(lock);
 
     bool data_deleted = false;
     bool meta_deleted = false;
+    bool tlm_deleted = false;
 
     // Delete data file
-    if (remove(filepath) == 0) {
+    FRESULT res = f_unlink(filepath);
+    if (res == FR_OK) {
         ESP_LOGI(TAG, "✓ Deleted data file: %s", serial_number);
         data_deleted = true;
-    } else if (errno != ENOENT) {
-        ESP_LOGE(TAG, "Failed to delete data file %s (errno: %d - %s)", 
-                 filepath, errno, strerror(errno));
+    } else if (res != FR_NO_FILE) {
+        ESP_LOGE(TAG, "Failed to delete data file %s (FatFs error %d)", filepath, res);
     }
 
     // Delete metadata file
-    if (remove(metapath) == 0) {
+    res = f_unlink(metapath);
+    if (res == FR_OK) {
         ESP_LOGI(TAG, "✓ Deleted metadata file: %s", serial_number);
         meta_deleted = true;
-    } else if (errno != ENOENT) {
-        ESP_LOGE(TAG, "Failed to delete metadata file %s (errno: %d - %s)", 
-                 metapath, errno, strerror(errno));
+    } else if (res != FR_NO_FILE) {
+        ESP_LOGE(TAG, "Failed to delete metadata file %s (FatFs error %d)", metapath, res);
+    }
+
+    // Telemetry file, only for batteries whose telemetry was logged
+    res = f_unlink(tlmpath);
+    if (res == FR_OK) {
+        ESP_LOGI(TAG, "✓ Deleted telemetry file: %s", serial_number);
+        tlm_deleted = true;
+    } else if (res != FR_NO_FILE) {
+        ESP_LOGE(TAG, "Failed to delete telemetry file %s (FatFs error %d)", tlmpath, res);
+    }
+
+    if (meta_deleted) {
+        xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+        if (g_fs_state.topk_building != NULL) {
+            topk_remove(g_fs_state.topk_building, serial_number);
+        }
+        if (topk_remove(&g_fs_state.topk, serial_number)) {
+            topk_store();
+        }
+        xSemaphoreGive(g_fs_state.topk_lock);
     }
 
-    if (!data_deleted && !meta_deleted) {
+    exclusive_leave(lock);
+    io_leave();
+
+    if (!data_deleted && !meta_deleted && !tlm_deleted) {
         ESP_LOGW(TAG, "Battery %s not found", serial_number);
         return ESP_ERR_NOT_FOUND;
     }
@@ -527,43 +3270,149 @@ esp_err_t battery_fs_delete_all(void) {
 
     ESP_LOGI(TAG, "Deleting all battery files from %s...", g_fs_state.mount_point);
 
-    DIR *dir = opendir(g_fs_state.mount_point);
+    if (!io_enter()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    FF_DIR *dir = malloc(sizeof(FF_DIR));
     if (dir == NULL) {
-        ESP_LOGE(TAG, "Failed to open directory %s (errno: %d - %s)", 
-                 g_fs_state.mount_point, errno, strerror(errno));
+        io_leave();
+        return ESP_ERR_NO_MEM;
+    }
+
+    FRESULT res = f_opendir(dir, g_fs_state.drive);
+    if (res != FR_OK) {
+        ESP_LOGE(TAG, "Failed to open directory %s (FatFs error %d)", g_fs_state.drive, res);
+        free(dir);
+        io_leave();
         return ESP_FAIL;
     }
 
-    struct dirent *entry;
+    FILINFO entry;
     size_t deleted_count = 0;
     size_t failed_count = 0;
 
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and .. directory entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+    // f_readdir() never returns "." or ".." for the root directory. A
+    // suspension may stop between the two files of a battery: data without
+    // metadata is rewritten from scratch, metadata without data has no records
+    while (!g_fs_state.suspended && f_readdir(dir, &entry) == FR_OK && entry.fname[0] != '\0') {
+        char filepath[64];
+        int len = snprintf(filepath, sizeof(filepath), "%s/%s", g_fs_state.drive, entry.fname);
+        if (len < 0 || (size_t)len >= sizeof(filepath)) {
+            ESP_LOGE(TAG, "Filepath too long: %s", entry.fname);
+            failed_count++;
             continue;
         }
 
-        char filepath[256];
-        int len = snprintf(filepath, sizeof(filepath), "%s/%s", g_fs_state.mount_point, entry->d_name);
-        if (len < 0 || (size_t)len >= sizeof(filepath)) {
-            ESP_LOGE(TAG, "Filepath too long: %s", entry->d_name);
-            failed_count++;
+        // Sequence numbers must not start over with the batteries
+        if (strcmp(entry.fname, BATTERY_FS_SEQ_LOG) == 0 || strcmp(entry.fname, BATTERY_FS_SYNC_CURSORS) == 0) {
             continue;
         }
 
-        if (remove(filepath) == 0) {
-            ESP_LOGI(TAG, "✓ Deleted: %s", entry->d_name);
+        // Files are named after their battery, the stem picks the lock
+        char *ext = strrchr(entry.fname, '.');
+        if (ext) {
+            *ext = '\0';
+        }
+        battery_lock_t *lock = battery_lock(entry.fname);
+        if (ext) {
+            *ext = '.';
+        }
+
+        exclusive_enter(lock);
+        res = f_unlink(filepath);
+        exclusive_leave(lock);
+        if (res == FR_OK) {
+            ESP_LOGI(TAG, "✓ Deleted: %s", entry.fname);
             deleted_count++;
         } else {
-            ESP_LOGE(TAG, "✗ Failed to delete: %s (errno: %d - %s)", 
-                     entry->d_name, errno, strerror(errno));
+            ESP_LOGE(TAG, "✗ Failed to delete: %s (FatFs error %d)", entry.fname, res);
             failed_count++;
         }
     }
 
-    closedir(dir);
+    f_closedir(dir);
+    free(dir);
+    io_leave();
+
+    // Nothing left to rank, unless a suspension or a failure left batteries.
+    // A rebuild running may have seen deleted batteries, its result goes.
+    xSemaphoreTake(g_fs_state.topk_lock, portMAX_DELAY);
+    __atomic_store_n(&g_fs_state.topk_abort, true, __ATOMIC_RELAXED);
+    bool left = g_fs_state.suspended || failed_count != 0;
+    topk_reset(&g_fs_state.topk, left ? INT32_MAX : INT32_MIN);
+    g_fs_state.topk_dirty = true;
+    if (!g_fs_state.suspended) {
+        topk_store();
+    }
+    xSemaphoreGive(g_fs_state.topk_lock);
 
     ESP_LOGI(TAG, "Delete complete: %u deleted, %u failed", deleted_count, failed_count);
+    if (g_fs_state.suspended) {
+        return ESP_ERR_INVALID_STATE;
+    }
     return (failed_count == 0) ? ESP_OK : ESP_FAIL;
 }
+
+// ============================================================================
+// Suspension
+// ============================================================================
+
+esp_err_t battery_fs_suspend(void) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    __atomic_store_n(&g_fs_state.suspended, true, __ATOMIC_SEQ_CST);
+    if (g_fs_state.backend->pause != NULL) {
+        g_fs_state.backend->pause(g_fs_state.backend_ctx, true);
+    }
+    EVTRACE_INSTANT(EVTRACE_ID_FS_SUSPEND, __atomic_load_n(&g_fs_state.active, __ATOMIC_SEQ_CST));
+    return ESP_OK;
+}
+
+esp_err_t battery_fs_wait_idle(uint32_t timeout_ms) {
+    if (!g_fs_state.initialized || !g_fs_state.suspended) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // A stale give from an earlier suspension only costs one more check
+    TickType_t start = xTaskGetTickCount();
+    TickType_t limit = pdMS_TO_TICKS(timeout_ms);
+    for (;;) {
+        bool calls = __atomic_load_n(&g_fs_state.active, __ATOMIC_SEQ_CST) != 0;
+        bool backend = g_fs_state.backend->busy != NULL && g_fs_state.backend->busy(g_fs_state.backend_ctx);
+        if (!calls && !backend) {
+            return ESP_OK;
+        }
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= limit) {
+            return ESP_ERR_TIMEOUT;
+        }
+        // Background work gives no signal, poll it every tick
+        xSemaphoreTake(g_fs_state.idle, calls ? limit - waited : 1);
+    }
+}
+
+esp_err_t battery_fs_resume(void) {
+    if (!g_fs_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    __atomic_store_n(&g_fs_state.suspended, false, __ATOMIC_SEQ_CST);
+    if (g_fs_state.backend->pause != NULL) {
+        g_fs_state.backend->pause(g_fs_state.backend_ctx, false);
+    }
+    return ESP_OK;
+}
+
+bool battery_fs_is_suspended(void) {
+    return g_fs_state.suspended;
+}
+
+battery_fs_flash_op_t battery_fs_flash_op(void) {
+    if (!g_fs_state.initialized || g_fs_state.backend->flash_op == NULL) {
+        return BATTERY_FS_FLASH_IDLE;
+    }
+    return g_fs_state.backend->flash_op(g_fs_state.backend_ctx);
+}
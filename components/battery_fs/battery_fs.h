@@ -4,23 +4,45 @@
  * 
  * This component manages battery data storage on SPI NAND Flash.
  * Each battery gets its own file based on serial number.
+ * 
+ * The FAT volume sits on a pluggable block backend selected at init:
+ * the managed spi_nand_flash component, the in-house spiflash driver,
+ * or a file-backed image on the linux target.
+ *
+ * All functions may be called from any task. Appends and deletes of one
+ * battery are serialized; readers take a snapshot of the record count and
+ * run concurrently with appends (see battery_fs_reader_open()).
  */
 
 #ifndef BATTERY_FS_H
 #define BATTERY_FS_H
 
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "battery_fs_format.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Block device backing the battery filesystem
+ */
+typedef enum {
+    BATTERY_FS_BACKEND_SPI_NAND = 0, ///< Managed spi_nand_flash component (Dhara FTL)
+    BATTERY_FS_BACKEND_SPIFLASH,     ///< In-house spiflash driver with battery_fs FTL (NAND image on linux)
+    BATTERY_FS_BACKEND_FILE,         ///< File-backed sector image (linux target)
+} battery_fs_backend_type_t;
+
 /**
  * @brief Battery filesystem configuration
  */
 typedef struct {
+    battery_fs_backend_type_t backend; ///< Block backend to mount the filesystem on
     int spi_host;           ///< SPI host (SPI2_HOST or SPI3_HOST)
     int pin_mosi;           ///< MOSI pin
     int pin_miso;           ///< MISO pin
@@ -31,6 +53,13 @@ typedef struct {
     uint32_t clock_speed_hz; ///< SPI clock speed in Hz
     const char *mount_point; ///< Filesystem mount point (e.g., "/nandflash")
     bool format_if_failed;   ///< Format filesystem if mount fails
+    const char *image_path;  ///< Image file (BATTERY_FS_BACKEND_FILE, BATTERY_FS_BACKEND_SPIFLASH on linux)
+    uint32_t image_size;     ///< Size of a newly created image in bytes, 0 for default (linux target)
+    uint32_t ftl_blocks;     ///< Erase blocks managed by the FTL, 0 for default (BATTERY_FS_BACKEND_SPIFLASH)
+    bool flash_realtime;     ///< Take the modeled device time of every flash operation (BATTERY_FS_BACKEND_SPIFLASH, linux target)
+    uint32_t page_cache_pages; ///< RAM cache in front of flash page reads, in pages, 0 = off (BATTERY_FS_BACKEND_SPIFLASH)
+    bool page_cache_psram;   ///< Allocate the page cache in PSRAM when available
+    uint32_t page_readahead; ///< Pages prefetched into the page cache on sequential reads, 0 = off, at most page_cache_pages / 2
 } battery_fs_config_t;
 
 /**
@@ -43,15 +72,47 @@ typedef struct {
 } battery_log_t;
 
 /**
- * @brief Battery metadata structure
- * Stores information about the last recorded log
+ * @brief Snapshot reader over the records of one battery
+ */
+typedef struct battery_fs_reader battery_fs_reader_t;
+
+/**
+ * @brief Called by battery_fs_foreach() per stored battery
+ *
+ * @return true to continue, false to stop
+ */
+typedef bool (*battery_fs_visit_cb_t)(const char *serial_number, void *arg);
+
+/**
+ * @brief I/O counters since init or battery_fs_reset_stats()
+ *
+ * The flash_* counters come from the block backend and include FTL
+ * relocation and spare area traffic; they stay 0 on backends that do not
+ * count device operations.
  */
 typedef struct {
-    uint32_t last_memory_index; ///< Last memory index written
-    uint32_t record_count;      ///< Total number of records
-    uint32_t last_timestamp;    ///< Last update timestamp (optional)
-    uint32_t last_data_hash;    ///< CRC32 hash of last record's data (for ring buffer detection)
-} battery_metadata_t;
+    uint32_t sector_size;           ///< Bytes per sector
+    uint64_t sectors_read;          ///< Sectors read through FatFs
+    uint64_t sectors_written;       ///< Sectors written through FatFs
+    uint32_t records_written;       ///< Records appended by battery_fs_write_data()
+    uint32_t records_read;          ///< Records returned by battery_fs_reader_next()
+    uint64_t flash_bytes_read;      ///< Bytes read from the flash device
+    uint64_t flash_bytes_programmed; ///< Bytes programmed into the flash device
+    uint32_t flash_blocks_erased;   ///< Erase blocks erased
+    uint32_t flash_cache_hits;      ///< Page reads served by the page cache
+    uint32_t flash_cache_misses;    ///< Page reads that missed it and went to the device
+    uint64_t flash_bytes_copied;    ///< Bytes copied out of the page cache into sector buffers
+} battery_fs_stats_t;
+
+/**
+ * @brief Flash operation in progress, see battery_fs_flash_op()
+ */
+typedef enum {
+    BATTERY_FS_FLASH_IDLE = 0,
+    BATTERY_FS_FLASH_READ,
+    BATTERY_FS_FLASH_PROGRAM,
+    BATTERY_FS_FLASH_ERASE,
+} battery_fs_flash_op_t;
 
 // ============================================================================
 // Core Functions
@@ -74,6 +135,21 @@ esp_err_t battery_fs_init(const battery_fs_config_t *config);
  */
 esp_err_t battery_fs_deinit(void);
 
+/**
+ * @brief Get the I/O counters
+ * 
+ * @param stats Output: counters
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t battery_fs_get_stats(battery_fs_stats_t *stats);
+
+/**
+ * @brief Zero the I/O counters
+ * 
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t battery_fs_reset_stats(void);
+
 // ============================================================================
 // Data Write Functions
 // ============================================================================
@@ -94,6 +170,59 @@ esp_err_t battery_fs_deinit(void);
  */
 esp_err_t battery_fs_write_data(const char *serial_number, const battery_log_t *logs, size_t log_count);
 
+// ============================================================================
+// Data Read Functions
+// ============================================================================
+
+/**
+ * @brief Open a battery for reading its records
+ * 
+ * The reader returns the records counted by the metadata at open time.
+ * Appends made while it is open are not seen and do not wait for it;
+ * battery_fs_delete_battery() and battery_fs_delete_all() wait until it is
+ * closed, so do not delete from a task holding a reader.
+ * 
+ * @param serial_number Battery serial number
+ * @param reader Output: reader, release with battery_fs_reader_close()
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the battery has no records
+ */
+esp_err_t battery_fs_reader_open(const char *serial_number, battery_fs_reader_t **reader);
+
+/**
+ * @brief Records in the reader's snapshot
+ */
+uint32_t battery_fs_reader_count(const battery_fs_reader_t *reader);
+
+/**
+ * @brief Read the next record, oldest first
+ * 
+ * @param reader Reader from battery_fs_reader_open()
+ * @param header Output: record header, data_len is the full record length
+ * @param data Buffer for the record data
+ * @param data_size Size of data; a longer record is truncated
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if truncated (the reader
+ *         still advances), ESP_ERR_NOT_FOUND past the last record
+ */
+esp_err_t battery_fs_reader_next(battery_fs_reader_t *reader, battery_fs_record_header_t *header,
+                                 uint8_t *data, size_t data_size);
+
+/**
+ * @brief Close a reader
+ * 
+ * @param reader Reader from battery_fs_reader_open()
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t battery_fs_reader_close(battery_fs_reader_t *reader);
+
+/**
+ * @brief Call cb with the serial number of every stored battery
+ * 
+ * @param cb Callback; may open readers and append, must not delete
+ * @param arg Passed to cb
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t battery_fs_foreach(battery_fs_visit_cb_t cb, void *arg);
+
 // ============================================================================
 // Metadata Functions
 // ============================================================================
@@ -115,15 +244,280 @@ bool battery_fs_exists(const char *serial_number);
  */
 esp_err_t battery_fs_read_metadata(const char *serial_number, battery_metadata_t *metadata);
 
+/**
+ * @brief Read the running summary of a battery
+ * 
+ * Appends keep the summary current and store it with the metadata, so this
+ * is one small read. A battery not appended to since summaries were added
+ * has none yet; its records are scanned instead.
+ * 
+ * @param serial_number Battery serial number
+ * @param summary Output: summary
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the battery has no records
+ */
+esp_err_t battery_fs_read_summary(const char *serial_number, battery_fs_summary_t *summary);
+
+/**
+ * @brief Called per run of records with a flag set, see battery_fs_flag_runs()
+ *
+ * @param first Number of the first record of the run, in reader order from 0
+ * @return true to continue, false to stop
+ */
+typedef bool (*battery_fs_flag_cb_t)(uint32_t first, uint32_t count, void *arg);
+
+/**
+ * @brief Count the records of a battery with each alarm or error flag set
+ *
+ * One small read from the flag index kept with the metadata, a battery
+ * whose index is not current yet is scanned (see battery_fs_flag_header_t).
+ *
+ * @param records Output: records covered, may be NULL
+ * @param set Output: records per battery_fs_flag_t
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when the battery has no records
+ */
+esp_err_t battery_fs_flag_counts(const char *serial_number, uint32_t *records, uint32_t set[BATTERY_FS_FLAGS]);
+
+/**
+ * @brief Call cb for every run of records with `flag` set, oldest first
+ *
+ * Reads the run-length index rather than the records, falling back to a
+ * scan like battery_fs_flag_counts(). Touching runs are reported as one.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when the battery has no records
+ */
+esp_err_t battery_fs_flag_runs(const char *serial_number, battery_fs_flag_t flag,
+                               battery_fs_flag_cb_t cb, void *arg);
+
 /**
  * @brief Write battery metadata
  * 
+ * A stored summary or flag index that no longer matches the record count
+ * is ignored until the next append rebuilds it.
+ * 
  * @param serial_number Battery serial number
  * @param metadata Pointer to metadata structure
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t battery_fs_write_metadata(const char *serial_number, const battery_metadata_t *metadata);
 
+// ============================================================================
+// Fleet Rankings
+// ============================================================================
+
+/**
+ * @brief One battery of a ranking, see battery_fs_topk()
+ */
+typedef struct {
+    char serial_number[BATTERY_FS_TOPK_SERIAL + 1];
+    int32_t value;                  ///< Metric value, see battery_fs_topk_metric_t
+} battery_fs_rank_t;
+
+/**
+ * @brief The batteries ranking highest on a fleet metric, highest first
+ *
+ * Appends keep BATTERY_FS_TOPK_CANDIDATES candidates per metric up to date
+ * in memory (see battery_fs_topk_file_t), so this copies and sorts them
+ * without reading any battery's files; a deleted or dropped battery's
+ * place goes to the next candidate. Only when fewer candidates than
+ * BATTERY_FS_TOPK are certain of their rank, after deletes or without
+ * stored rankings at mount, a rebuild from the metadata of every battery
+ * starts in the background, and this returns the certain ones meanwhile.
+ *
+ * @param ranks Output: BATTERY_FS_TOPK entries
+ * @param count Output: entries filled, fewer while few batteries qualify
+ *              or a rebuild runs
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t battery_fs_topk(battery_fs_topk_metric_t metric, battery_fs_rank_t ranks[BATTERY_FS_TOPK], size_t *count);
+
+// ============================================================================
+// Incremental Sync
+// ============================================================================
+
+/**
+ * @brief Called per record by battery_fs_sync_read(), in sequence order
+ *
+ * @param seq Global sequence number of the record
+ * @param data header->data_len bytes, valid during the call only
+ * @return true to continue, false to stop before the next record
+ */
+typedef bool (*battery_fs_sync_cb_t)(const char *serial_number, uint32_t seq,
+                                     const battery_fs_record_header_t *header, const uint8_t *data, void *arg);
+
+/**
+ * @brief Sequence number of the last committed record, 0 before the first
+ */
+uint32_t battery_fs_sync_last_seq(void);
+
+/**
+ * @brief Hand a consumer the records committed after its high-water mark
+ *
+ * Follows the sequence log (see battery_fs_seq_entry_t) from the entry
+ * holding the next sequence number, so only new records are read. The
+ * mark does not move: once the consumer has the records safely, it passes
+ * `last_seq` to battery_fs_sync_ack(). A consumer cut off before that is
+ * sent the same records again, one that acknowledged them never is.
+ * Records of deleted batteries are skipped, `last_seq` still covers them.
+ * A suspension stops the read between appends with ESP_ERR_INVALID_STATE,
+ * `last_seq` then covers the records handed over.
+ *
+ * @param consumer Consumer name, BATTERY_FS_SYNC_NAME bytes at most; one
+ *                 never acknowledged starts from the first record
+ * @param max_records Records to hand over at most, 0 = no limit
+ * @param last_seq Output: sequence number up to which the consumer is
+ *                 served, its mark when nothing is new
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE while suspended, error
+ *         code otherwise
+ */
+esp_err_t battery_fs_sync_read(const char *consumer, uint32_t max_records, battery_fs_sync_cb_t cb, void *arg,
+                               uint32_t *last_seq);
+
+/**
+ * @brief Store a consumer's high-water mark
+ *
+ * The first acknowledgement registers the consumer. A mark below the
+ * current one makes the next read send those records again.
+ *
+ * @param seq Last sequence number received, at most battery_fs_sync_last_seq()
+ * @return ESP_OK, ESP_ERR_NO_MEM when BATTERY_FS_SYNC_CONSUMERS are
+ *         registered already, error code otherwise
+ */
+esp_err_t battery_fs_sync_ack(const char *consumer, uint32_t seq);
+
+/**
+ * @brief High-water mark of a consumer
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND for a consumer never acknowledged
+ */
+esp_err_t battery_fs_sync_cursor(const char *consumer, uint32_t *acked);
+
+// ============================================================================
+// Change Subscriptions
+// ============================================================================
+
+#define BATTERY_FS_SUBSCRIBERS          8
+#define BATTERY_FS_CHANGE_QUEUE         32      ///< Commits waiting for the dispatcher
+#define BATTERY_FS_DISPATCH_PRIORITY    4       ///< Below the acquisition task
+#define BATTERY_FS_DISPATCH_STACK       3072
+
+/**
+ * @brief One committed append, as handed to subscribers
+ *
+ * The records are read with battery_fs_sync_read() or a reader; a gap
+ * in `first_seq` after the previous change means changes were dropped.
+ */
+typedef struct {
+    char serial_number[BATTERY_FS_SEQ_SERIAL + 1];
+    uint32_t first_seq;             ///< Sequence number of the first record
+    uint32_t count;                 ///< Records committed
+    uint32_t first_record;          ///< Record number of the first, reader order from 0
+    uint32_t last_memory_index;     ///< Memory index of the newest record
+} battery_fs_change_t;
+
+/**
+ * @brief Called by the dispatcher task for every change
+ *
+ * Runs without battery_fs locks held: it may call any battery_fs function
+ * but battery_fs_deinit(), battery_fs_unsubscribe() of its own
+ * subscription included.
+ */
+typedef void (*battery_fs_change_cb_t)(const battery_fs_change_t *change, void *arg);
+
+typedef struct {
+    uint32_t delivered;             ///< Changes handed over
+    uint32_t dropped;               ///< Changes lost: subscriber or dispatcher queue full
+    uint32_t lag;                   ///< Records committed since the last change handed over
+    uint32_t max_lag;               ///< Records committed ahead of a change when it was handed over, at most
+} battery_fs_subscriber_stats_t;
+
+typedef struct battery_fs_subscriber battery_fs_subscriber_t;
+
+/**
+ * @brief Have a callback run for every commit from now on
+ *
+ * Appends only queue their change, without waiting: a dispatcher task,
+ * started with the first subscription, hands it to the subscribers in
+ * commit order. A slow subscriber delays the others and, once
+ * BATTERY_FS_CHANGE_QUEUE changes wait, makes every subscriber drop
+ * changes, never the writer wait. Only appends given sequence numbers
+ * are published.
+ *
+ * @param sub Output: subscription handle
+ * @return ESP_OK, ESP_ERR_NO_MEM when BATTERY_FS_SUBSCRIBERS are taken or
+ *         the dispatcher cannot start, error code otherwise
+ */
+esp_err_t battery_fs_subscribe(battery_fs_change_cb_t cb, void *arg, battery_fs_subscriber_t **sub);
+
+/**
+ * @brief Have every change sent to a queue from now on
+ *
+ * Like battery_fs_subscribe(), without waiting for room in the queue: a
+ * change that does not fit counts as dropped.
+ *
+ * @param queue Queue of battery_fs_change_t items
+ */
+esp_err_t battery_fs_subscribe_queue(QueueHandle_t queue, battery_fs_subscriber_t **sub);
+
+/**
+ * @brief End a subscription
+ *
+ * Waits for its callback in progress, unless called from a callback.
+ */
+esp_err_t battery_fs_unsubscribe(battery_fs_subscriber_t *sub);
+
+esp_err_t battery_fs_subscriber_stats(const battery_fs_subscriber_t *sub, battery_fs_subscriber_stats_t *stats);
+
+// ============================================================================
+// Telemetry Functions
+// ============================================================================
+
+/**
+ * @brief One live telemetry sample, see battery_fs_tlm_append()
+ */
+typedef struct {
+    uint32_t time_s;                            ///< Wall clock, seconds
+    int16_t value[BATTERY_FS_TLM_CHANNELS];     ///< Per battery_fs_tlm_channel_t
+} battery_fs_tlm_sample_t;
+
+/**
+ * @brief Called per bucket by battery_fs_tlm_query(), oldest first
+ *
+ * @param period_s Resolution of this bucket: 1, 60 or 3600
+ * @return true to continue, false to stop
+ */
+typedef bool (*battery_fs_tlm_cb_t)(const battery_fs_tlm_bucket_t *bucket, uint32_t period_s, void *arg);
+
+/**
+ * @brief Fold live telemetry samples into the rollups of a battery
+ *
+ * Updates the 1 s, 1 min and 1 h buckets (see battery_fs_tlm_header_t):
+ * a few ring writes and one header write per call, whatever the count, so
+ * callers batch the samples of a few polls. Samples must come in time
+ * order; one older than the last stored second is dropped.
+ *
+ * @param samples Samples in ascending time
+ * @param count Number of samples
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE while suspended, error
+ *         code otherwise
+ */
+esp_err_t battery_fs_tlm_append(const char *serial_number, const battery_fs_tlm_sample_t *samples, size_t count);
+
+/**
+ * @brief Call cb for the telemetry buckets of a battery in [from_s, to_s]
+ *
+ * Reads the coarsest level whose period is at most `granularity_s` (raw
+ * seconds below a minute). Where that level has aged out, the older part
+ * of the range comes from the next coarser level that still has it, whole
+ * buckets only, so no sample is reported twice. Buckets still open are
+ * included, the latest samples show at every resolution. Only the ring
+ * entries in range are read.
+ *
+ * @param granularity_s Coarsest resolution the caller can use, seconds
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when no telemetry was logged
+ */
+esp_err_t battery_fs_tlm_query(const char *serial_number, uint32_t from_s, uint32_t to_s,
+                               uint32_t granularity_s, battery_fs_tlm_cb_t cb, void *arg);
+
 // ============================================================================
 // Helper Functions
 // ============================================================================
@@ -152,20 +546,75 @@ esp_err_t battery_fs_identify_new_records(const battery_metadata_t *metadata,
 // ============================================================================
 
 /**
- * @brief Delete all battery files (data and metadata)
+ * @brief Delete all battery files (data, metadata and telemetry)
  * 
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t battery_fs_delete_all(void);
 
 /**
- * @brief Delete specific battery data and metadata
+ * @brief Delete specific battery data, metadata and telemetry
  * 
  * @param serial_number Battery serial number
  * @return ESP_OK on success, ESP_ERR_NOT_FOUND if file doesn't exist
  */
 esp_err_t battery_fs_delete_battery(const char *serial_number);
 
+// ============================================================================
+// Suspension
+// ============================================================================
+
+/**
+ * @brief Stop storage work at the next consistent point
+ *
+ * Returns at once, safe to call from any task. Until battery_fs_resume():
+ *  - new appends, deletes and reader opens fail with ESP_ERR_INVALID_STATE
+ *  - a running append stops after its current record, closes the data
+ *    file and writes the metadata of the records that reached it, then
+ *    returns ESP_ERR_INVALID_STATE; appending the same logs again later
+ *    stores the rest
+ *  - battery_fs_reader_next() fails with ESP_ERR_INVALID_STATE, and
+ *    battery_fs_foreach() and battery_fs_delete_all() stop before the next
+ *    file
+ *
+ * A device operation already started, a block erase or the FTL garbage
+ * collection behind one sector write, always runs to completion. Background
+ * backend work, such as the FTL collector task, stops after its current
+ * step; battery_fs_wait_idle() also waits for that step.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t battery_fs_suspend(void);
+
+/**
+ * @brief Wait until no call is inside battery_fs after battery_fs_suspend()
+ *
+ * @param timeout_ms Longest wait
+ * @return ESP_OK once idle, ESP_ERR_TIMEOUT, ESP_ERR_INVALID_STATE if not
+ *         suspended
+ */
+esp_err_t battery_fs_wait_idle(uint32_t timeout_ms);
+
+/**
+ * @brief Accept storage work again
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t battery_fs_resume(void);
+
+/**
+ * @brief Whether battery_fs_suspend() is in effect
+ */
+bool battery_fs_is_suspended(void);
+
+/**
+ * @brief Flash operation the backend is running right now
+ *
+ * Lock free, for fault handlers and diagnostics; the answer may be stale by
+ * the time it returns. BATTERY_FS_FLASH_IDLE on backends that do not report it.
+ */
+battery_fs_flash_op_t battery_fs_flash_op(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,82 @@
+/**
+ * @file battery_fs_backend.h
+ * @brief Block device backends for the battery filesystem
+ * 
+ * A backend exposes a flat array of fixed-size sectors. battery_fs mounts
+ * FAT on top of it through the FatFs diskio layer, so the same filesystem
+ * code runs on every backend.
+ */
+
+#ifndef BATTERY_FS_BACKEND_H
+#define BATTERY_FS_BACKEND_H
+
+#include "sdkconfig.h"
+#include "battery_fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Block backend operations
+ */
+typedef struct {
+    const char *name;   ///< Backend name for logging
+
+    /**
+     * @brief Bring up the device and report its geometry
+     * 
+     * @param config Filesystem configuration
+     * @param ctx Output: backend context passed to all other operations
+     * @param sector_size Output: sector size in bytes
+     * @param sector_count Output: number of sectors
+     */
+    esp_err_t (*init)(const battery_fs_config_t *config, void **ctx,
+                      uint32_t *sector_size, uint32_t *sector_count);
+    esp_err_t (*deinit)(void *ctx);
+    esp_err_t (*read)(void *ctx, uint8_t *buffer, uint32_t sector, uint32_t count);
+    esp_err_t (*write)(void *ctx, const uint8_t *buffer, uint32_t sector, uint32_t count);
+    esp_err_t (*trim)(void *ctx, uint32_t sector, uint32_t count);
+    esp_err_t (*sync)(void *ctx);
+
+    /**
+     * @brief Optional: fill the flash_* counters of `stats`
+     */
+    esp_err_t (*get_stats)(void *ctx, battery_fs_stats_t *stats);
+
+    /**
+     * @brief Optional: zero the device counters
+     */
+    esp_err_t (*reset_stats)(void *ctx);
+
+    /**
+     * @brief Optional: device operation in progress, without taking locks
+     */
+    battery_fs_flash_op_t (*flash_op)(void *ctx);
+
+    /**
+     * @brief Optional: hold or restart background device work (GC, erases)
+     *
+     * Called by battery_fs_suspend() and battery_fs_resume(), possibly from
+     * a fault handler, so it must not wait. Work already started finishes.
+     */
+    void (*pause)(void *ctx, bool paused);
+
+    /**
+     * @brief Optional: background device work in progress, without taking locks
+     */
+    bool (*busy)(void *ctx);
+} battery_fs_backend_ops_t;
+
+extern const battery_fs_backend_ops_t battery_fs_backend_spiflash;
+#if !CONFIG_IDF_TARGET_LINUX
+extern const battery_fs_backend_ops_t battery_fs_backend_spi_nand;
+#else
+extern const battery_fs_backend_ops_t battery_fs_backend_file;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BATTERY_FS_BACKEND_H
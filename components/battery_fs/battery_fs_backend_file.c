@@ -0,0 +1,107 @@
+/**
+ * @file battery_fs_backend_file.c
+ * @brief battery_fs block backend on a file-backed sector image (linux target)
+ * 
+ * Sectors are stored back to back in a regular file. There are no NAND
+ * program/erase semantics here, which makes it the fastest backend for
+ * host-side benchmarks of the filesystem layer itself.
+ */
+
+#include "battery_fs_backend.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+static const char *TAG = "battery_fs_file";
+
+#define FILE_SECTOR_SIZE        2048                // Matches the NAND page size
+#define FILE_DEFAULT_IMAGE_SIZE (32 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+} file_backend_t;
+
+static esp_err_t file_init(const battery_fs_config_t *config, void **ctx,
+                           uint32_t *sector_size, uint32_t *sector_count) {
+    if (config->image_path == NULL) {
+        ESP_LOGE(TAG, "No image path configured");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    file_backend_t *be = calloc(1, sizeof(file_backend_t));
+    if (be == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    be->fd = open(config->image_path, O_RDWR | O_CREAT, 0644);
+    if (be->fd < 0) {
+        ESP_LOGE(TAG, "Failed to open image %s (errno: %d - %s)",
+                 config->image_path, errno, strerror(errno));
+        free(be);
+        return ESP_FAIL;
+    }
+
+    // Existing images keep their size, new ones are created at the configured size
+    struct stat st;
+    uint32_t size = config->image_size ? config->image_size : FILE_DEFAULT_IMAGE_SIZE;
+    if (fstat(be->fd, &st) == 0 && st.st_size >= FILE_SECTOR_SIZE) {
+        size = (uint32_t)st.st_size;
+    } else if (ftruncate(be->fd, size) != 0) {
+        ESP_LOGE(TAG, "Failed to size image (errno: %d - %s)", errno, strerror(errno));
+        close(be->fd);
+        free(be);
+        return ESP_FAIL;
+    }
+
+    *sector_size = FILE_SECTOR_SIZE;
+    *sector_count = size / FILE_SECTOR_SIZE;
+    *ctx = be;
+
+    ESP_LOGI(TAG, "Image %s: %lu sectors", config->image_path, (unsigned long)*sector_count);
+    return ESP_OK;
+}
+
+static esp_err_t file_deinit(void *ctx) {
+    file_backend_t *be = ctx;
+    close(be->fd);
+    free(be);
+    return ESP_OK;
+}
+
+static esp_err_t file_read(void *ctx, uint8_t *buffer, uint32_t sector, uint32_t count) {
+    file_backend_t *be = ctx;
+    size_t len = (size_t)count * FILE_SECTOR_SIZE;
+    ssize_t n = pread(be->fd, buffer, len, (off_t)sector * FILE_SECTOR_SIZE);
+    return (n == (ssize_t)len) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_write(void *ctx, const uint8_t *buffer, uint32_t sector, uint32_t count) {
+    file_backend_t *be = ctx;
+    size_t len = (size_t)count * FILE_SECTOR_SIZE;
+    ssize_t n = pwrite(be->fd, buffer, len, (off_t)sector * FILE_SECTOR_SIZE);
+    return (n == (ssize_t)len) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_trim(void *ctx, uint32_t sector, uint32_t count) {
+    // Nothing to reclaim in a flat image
+    return ESP_OK;
+}
+
+static esp_err_t file_sync(void *ctx) {
+    // pwrite() already hands data to the host OS; skipping fsync keeps benchmarks at host speed
+    return ESP_OK;
+}
+
+const battery_fs_backend_ops_t battery_fs_backend_file = {
+    .name = "file",
+    .init = file_init,
+    .deinit = file_deinit,
+    .read = file_read,
+    .write = file_write,
+    .trim = file_trim,
+    .sync = file_sync,
+};
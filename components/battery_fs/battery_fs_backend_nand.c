@@ -0,0 +1,149 @@
+/**
+ * @file battery_fs_backend_nand.c
+ * @brief battery_fs block backend on the managed spi_nand_flash component
+ */
+
+#include "battery_fs_backend.h"
+#include <stdlib.h>
+#include "esp_log.h"
+#include "spi_nand_flash.h"
+#include "driver/spi_master.h"
+
+static const char *TAG = "battery_fs_nand";
+
+typedef struct {
+    spi_nand_flash_device_t *flash_handle;
+    spi_device_handle_t spi_handle;
+    spi_host_device_t spi_host;
+} nand_backend_t;
+
+static esp_err_t nand_init(const battery_fs_config_t *config, void **ctx,
+                           uint32_t *sector_size, uint32_t *sector_count) {
+    nand_backend_t *be = calloc(1, sizeof(nand_backend_t));
+    if (be == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    be->spi_host = config->spi_host;
+
+    // Configure SPI bus
+    spi_bus_config_t bus_config = {
+        .mosi_io_num = config->pin_mosi,
+        .miso_io_num = config->pin_miso,
+        .sclk_io_num = config->pin_sclk,
+        .quadhd_io_num = config->pin_hd,
+        .quadwp_io_num = config->pin_wp,
+        .max_transfer_sz = 4096 * 2,
+    };
+
+    esp_err_t ret = spi_bus_initialize(be->spi_host, &bus_config, SPI_DMA_CH_AUTO);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize SPI bus: %s", esp_err_to_name(ret));
+        free(be);
+        return ret;
+    }
+
+    // Configure SPI device
+    spi_device_interface_config_t devcfg = {
+        .clock_speed_hz = config->clock_speed_hz,
+        .mode = 0,
+        .spics_io_num = config->pin_cs,
+        .queue_size = 10,
+        .flags = SPI_DEVICE_HALFDUPLEX,
+    };
+
+    ret = spi_bus_add_device(be->spi_host, &devcfg, &be->spi_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add SPI device: %s", esp_err_to_name(ret));
+        spi_bus_free(be->spi_host);
+        free(be);
+        return ret;
+    }
+
+    // Initialize NAND Flash
+    spi_nand_flash_config_t nand_config = {
+        .device_handle = be->spi_handle,
+        .io_mode = SPI_NAND_IO_MODE_SIO,
+        .flags = SPI_DEVICE_HALFDUPLEX,
+    };
+
+    ret = spi_nand_flash_init_device(&nand_config, &be->flash_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize NAND Flash: %s", esp_err_to_name(ret));
+        spi_bus_remove_device(be->spi_handle);
+        spi_bus_free(be->spi_host);
+        free(be);
+        return ret;
+    }
+
+    spi_nand_flash_get_sector_size(be->flash_handle, sector_size);
+    spi_nand_flash_get_capacity(be->flash_handle, sector_count);
+
+    *ctx = be;
+    return ESP_OK;
+}
+
+static esp_err_t nand_deinit(void *ctx) {
+    nand_backend_t *be = ctx;
+
+    spi_nand_flash_deinit_device(be->flash_handle);
+    spi_bus_remove_device(be->spi_handle);
+    spi_bus_free(be->spi_host);
+    free(be);
+
+    return ESP_OK;
+}
+
+static esp_err_t nand_read(void *ctx, uint8_t *buffer, uint32_t sector, uint32_t count) {
+    nand_backend_t *be = ctx;
+    uint32_t sector_size;
+    spi_nand_flash_get_sector_size(be->flash_handle, &sector_size);
+
+    for (uint32_t i = 0; i < count; i++) {
+        esp_err_t ret = spi_nand_flash_read_sector(be->flash_handle, buffer + i * sector_size, sector + i);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t nand_write(void *ctx, const uint8_t *buffer, uint32_t sector, uint32_t count) {
+    nand_backend_t *be = ctx;
+    uint32_t sector_size;
+    spi_nand_flash_get_sector_size(be->flash_handle, &sector_size);
+
+    for (uint32_t i = 0; i < count; i++) {
+        esp_err_t ret = spi_nand_flash_write_sector(be->flash_handle, buffer + i * sector_size, sector + i);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t nand_trim(void *ctx, uint32_t sector, uint32_t count) {
+    nand_backend_t *be = ctx;
+
+    for (uint32_t i = 0; i < count; i++) {
+        esp_err_t ret = spi_nand_flash_trim(be->flash_handle, sector + i);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t nand_sync(void *ctx) {
+    nand_backend_t *be = ctx;
+    return spi_nand_flash_sync(be->flash_handle);
+}
+
+const battery_fs_backend_ops_t battery_fs_backend_spi_nand = {
+    .name = "spi_nand_flash",
+    .init = nand_init,
+    .deinit = nand_deinit,
+    .read = nand_read,
+    .write = nand_write,
+    .trim = nand_trim,
+    .sync = nand_sync,
+};
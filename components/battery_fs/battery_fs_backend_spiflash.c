@@ -0,0 +1,722 @@
+/**
+ * @file battery_fs_backend_spiflash.c
+ * @brief battery_fs block backend on the in-house spiflash driver
+ *
+ * FAT needs rewritable sectors, NAND only offers program-once pages and
+ * whole-block erase. This file implements a small log-structured
+ * translation layer in between:
+ *  - one logical sector is one NAND page
+ *  - pages are programmed sequentially inside the active block
+ *  - every page carries its logical sector and a write sequence number in
+ *    the spare area, so the sector map is rebuilt by scanning at mount
+ *  - blocks with the fewest valid pages are garbage collected when the
+ *    free pool runs low
+ *
+ * On the linux target spiflash runs on a NAND image file, so this exact
+ * code path can be benchmarked on the host.
+ *
+ * All flash operations go through a spiflash_sched. FatFs traffic is
+ * foreground I/O: the backend cannot tell a writer's FAT lookup from an
+ * export's read, so both go first. Housekeeping runs in a GC task of its
+ * own as background I/O:
+ *  - it keeps one free block erased ahead, so writes never wait for an
+ *    erase
+ *  - below gc_low_water free blocks it collects, one page per hold of the
+ *    FTL lock, so a write waits at most one relocation for it
+ * A write only collects itself, as foreground I/O, when the free pool falls
+ * below FTL_MIN_FREE_BLOCKS because the GC task could not keep up.
+ */
+
+#include "battery_fs_backend.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "spiflash.h"
+#include "spiflash_sched.h"
+
+static const char *TAG = "battery_fs_spiflash";
+
+#define FTL_DEFAULT_BLOCKS      256         // 32MB region, 32KB sector map
+#define FTL_MIN_FREE_BLOCKS     2           // Below this a write collects itself
+#define FTL_TAG_MAGIC           BATTERY_FS_FTL_TAG_MAGIC
+#define FTL_TAG_OFFSET          BATTERY_FS_FTL_TAG_OFFSET
+#define FTL_UNMAPPED            0xFFFF
+#define FTL_NO_BLOCK            UINT32_MAX
+#define FTL_IO                  SPIFLASH_IO_FOREGROUND
+#define FTL_IO_GC               SPIFLASH_IO_BACKGROUND
+#define FTL_GC_MIN_GAIN         (SPIFLASH_PAGES_PER_BLOCK / 4) // Pages a background collection must free
+#define FTL_GC_STACK            3072
+#define FTL_GC_PRIORITY         1           // Just above idle
+
+typedef battery_fs_ftl_tag_t ftl_tag_t;   // Per-page tag stored in the spare area
+
+typedef enum {
+    FTL_BLOCK_FREE = 0, // No valid data, erased on allocation
+    FTL_BLOCK_USED,
+    FTL_BLOCK_BAD,
+    FTL_BLOCK_ERASED,   // Free and erased ahead by the GC task
+    FTL_BLOCK_ERASING,  // Being erased by the GC task, not counted free
+} ftl_block_state_t;
+
+typedef struct {
+    spiflash_handle_t *flash;
+    spiflash_sched_t *sched;
+    uint32_t first_block;       // First physical block of the region
+    uint32_t block_count;       // Blocks in the region
+    uint32_t sector_count;      // Logical sectors exposed to FAT
+    uint16_t *map;              // Logical sector -> region page
+    uint8_t *valid;             // Valid pages per block
+    uint8_t *state;             // ftl_block_state_t per block
+    uint32_t free_blocks;
+    uint32_t alloc_cursor;      // Round-robin allocation spreads wear
+    uint32_t active_block;
+    uint32_t next_page;         // Next page to program in the active block
+    uint32_t seq;
+    uint8_t *page_buf;          // Relocation buffer, used by ftl_collect_step() only
+    uint8_t *erased_page;       // All 0xFF, the data of a bad block marker page
+    SemaphoreHandle_t lock;     // FTL state, shared by FatFs calls and the GC task
+    TaskHandle_t gc_task;
+    SemaphoreHandle_t gc_done;  // Given by the GC task when it exits
+    bool gc_run;                // Cleared to stop the GC task
+    bool gc_paused;             // Set by battery_fs_suspend(), see spiflash_backend_pause()
+    bool gc_busy;               // GC task inside a unit of work
+    uint32_t gc_low_water;      // Free blocks the GC task collects up to
+    uint32_t gc_victim;         // Block being collected, FTL_NO_BLOCK when none
+    uint32_t gc_page;           // Next page of the victim to look at
+} ftl_t;
+
+// ============================================================================
+// Helper Functions
+// ============================================================================
+
+static inline uint32_t ftl_phys_page(const ftl_t *ftl, uint32_t region_page) {
+    return ftl->first_block * SPIFLASH_PAGES_PER_BLOCK + region_page;
+}
+
+static esp_err_t ftl_read_tag(ftl_t *ftl, spiflash_io_class_t cls, uint32_t region_page, uint8_t *bbm,
+                              ftl_tag_t *tag) {
+    uint8_t oob[FTL_TAG_OFFSET + sizeof(ftl_tag_t)];
+    esp_err_t ret = spiflash_sched_read_oob(ftl->sched, cls, ftl_phys_page(ftl, region_page),
+                                            oob, sizeof(oob));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (bbm != NULL) {
+        *bbm = oob[0];
+    }
+    memcpy(tag, oob + FTL_TAG_OFFSET, sizeof(ftl_tag_t));
+    return ESP_OK;
+}
+
+/**
+ * @brief Retire a block and write a bad block marker (best effort)
+ *
+ * Reached from ftl_program() in the middle of a GC relocation, so the
+ * marker page must not touch page_buf, which holds the sector being moved.
+ */
+static void ftl_mark_bad(ftl_t *ftl, uint32_t block) {
+    ESP_LOGW(TAG, "Retiring block %" PRIu32, ftl->first_block + block);
+
+    if (ftl->state[block] == FTL_BLOCK_FREE || ftl->state[block] == FTL_BLOCK_ERASED) {
+        ftl->free_blocks--;
+    }
+    ftl->state[block] = FTL_BLOCK_BAD;
+
+    uint8_t marker = 0x00;
+    spiflash_sched_write_page_oob(ftl->sched, FTL_IO, ftl_phys_page(ftl, block * SPIFLASH_PAGES_PER_BLOCK),
+                                  ftl->erased_page, &marker, 1);
+}
+
+static void ftl_gc_wake(ftl_t *ftl) {
+    if (ftl->gc_task != NULL) {
+        xTaskNotifyGive(ftl->gc_task);
+    }
+}
+
+/**
+ * @brief Next block in `state` from the allocation cursor on
+ */
+static uint32_t ftl_find_block(const ftl_t *ftl, ftl_block_state_t state) {
+    for (uint32_t i = 0; i < ftl->block_count; i++) {
+        uint32_t candidate = (ftl->alloc_cursor + i) % ftl->block_count;
+        if (ftl->state[candidate] == state) {
+            return candidate;
+        }
+    }
+    return FTL_NO_BLOCK;
+}
+
+/**
+ * @brief Take a free block, erase it unless erased ahead, make it active
+ */
+static esp_err_t ftl_open_block(ftl_t *ftl, spiflash_io_class_t cls) {
+    while (ftl->free_blocks > 0) {
+        uint32_t block = ftl_find_block(ftl, FTL_BLOCK_ERASED);
+        bool erased = block != FTL_NO_BLOCK;
+        if (!erased) {
+            block = ftl_find_block(ftl, FTL_BLOCK_FREE);
+        }
+        if (block == FTL_NO_BLOCK) {
+            break;
+        }
+        ftl->alloc_cursor = (block + 1) % ftl->block_count;
+
+        if (!erased && spiflash_sched_erase_block(ftl->sched, cls, ftl->first_block + block) != ESP_OK) {
+            ftl_mark_bad(ftl, block);
+            continue;
+        }
+
+        ftl->state[block] = FTL_BLOCK_USED;
+        ftl->valid[block] = 0;
+        ftl->free_blocks--;
+        ftl->active_block = block;
+        ftl->next_page = 0;
+        // Erase the next one ahead
+        ftl_gc_wake(ftl);
+        return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "No free blocks left");
+    return ESP_ERR_NO_MEM;
+}
+
+static void ftl_invalidate(ftl_t *ftl, uint32_t lsn) {
+    uint16_t old = ftl->map[lsn];
+    if (old != FTL_UNMAPPED) {
+        ftl->valid[old / SPIFLASH_PAGES_PER_BLOCK]--;
+        ftl->map[lsn] = FTL_UNMAPPED;
+    }
+}
+
+/**
+ * @brief Program a logical sector into the next page of the active block
+ */
+static esp_err_t ftl_program(ftl_t *ftl, spiflash_io_class_t cls, uint32_t lsn, const uint8_t *data) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (ftl->active_block == FTL_NO_BLOCK || ftl->next_page >= SPIFLASH_PAGES_PER_BLOCK) {
+            esp_err_t ret = ftl_open_block(ftl, cls);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+
+        uint32_t region_page = ftl->active_block * SPIFLASH_PAGES_PER_BLOCK + ftl->next_page;
+        uint8_t oob[FTL_TAG_OFFSET + sizeof(ftl_tag_t)];
+        ftl_tag_t tag = {
+            .magic = FTL_TAG_MAGIC,
+            .reserved = 0xFFFF,
+            .lsn = lsn,
+            .seq = ftl->seq + 1,
+        };
+        memset(oob, 0xFF, FTL_TAG_OFFSET);
+        memcpy(oob + FTL_TAG_OFFSET, &tag, sizeof(tag));
+
+        ftl->next_page++;
+        esp_err_t ret = spiflash_sched_write_page_oob(ftl->sched, cls, ftl_phys_page(ftl, region_page),
+                                                      data, oob, sizeof(oob));
+        if (ret != ESP_OK) {
+            // Close this block, its valid pages are moved out by a later GC
+            ESP_LOGW(TAG, "Program failed at page %" PRIu32 ", closing block", region_page);
+            ftl->next_page = SPIFLASH_PAGES_PER_BLOCK;
+            continue;
+        }
+
+        ftl->seq++;
+        ftl_invalidate(ftl, lsn);
+        ftl->map[lsn] = region_page;
+        ftl->valid[ftl->active_block]++;
+        return ESP_OK;
+    }
+
+    return ESP_FAIL;
+}
+
+/**
+ * @brief Used block with the fewest valid pages, at most `max_valid`
+ */
+static uint32_t ftl_pick_victim(const ftl_t *ftl, uint32_t max_valid) {
+    uint32_t victim = FTL_NO_BLOCK;
+    for (uint32_t b = 0; b < ftl->block_count; b++) {
+        if (ftl->state[b] != FTL_BLOCK_USED || b == ftl->active_block) {
+            continue;
+        }
+        if (victim == FTL_NO_BLOCK || ftl->valid[b] < ftl->valid[victim]) {
+            victim = b;
+        }
+    }
+    return victim != FTL_NO_BLOCK && ftl->valid[victim] <= max_valid ? victim : FTL_NO_BLOCK;
+}
+
+/**
+ * @brief Look at the next page of the GC victim, relocating it if valid
+ *
+ * Picks a victim first when none is being collected. One call does at
+ * most a tag read, a page read and a program, so callers can drop the FTL
+ * lock between calls; the writes in between only invalidate victim pages.
+ *
+ * @param max_valid Valid pages a new victim may have
+ * @param done Output: true once the victim is free
+ * @return ESP_ERR_NO_MEM when no block qualifies as victim
+ */
+static esp_err_t ftl_collect_step(ftl_t *ftl, spiflash_io_class_t cls, uint32_t max_valid, bool *done) {
+    *done = false;
+    if (ftl->gc_victim == FTL_NO_BLOCK) {
+        ftl->gc_victim = ftl_pick_victim(ftl, max_valid);
+        if (ftl->gc_victim == FTL_NO_BLOCK) {
+            return ESP_ERR_NO_MEM;
+        }
+        ftl->gc_page = 0;
+        ESP_LOGD(TAG, "GC block %" PRIu32 " (%u valid pages)", ftl->gc_victim, ftl->valid[ftl->gc_victim]);
+    }
+
+    uint32_t victim = ftl->gc_victim;
+    if (ftl->gc_page >= SPIFLASH_PAGES_PER_BLOCK || ftl->valid[victim] == 0) {
+        ftl->state[victim] = FTL_BLOCK_FREE;
+        ftl->free_blocks++;
+        ftl->gc_victim = FTL_NO_BLOCK;
+        *done = true;
+        return ESP_OK;
+    }
+
+    uint32_t region_page = victim * SPIFLASH_PAGES_PER_BLOCK + ftl->gc_page;
+    ftl_tag_t tag;
+    esp_err_t ret = ftl_read_tag(ftl, cls, region_page, NULL, &tag);
+    if (ret == ESP_OK && tag.magic == FTL_TAG_MAGIC && tag.lsn < ftl->sector_count &&
+        ftl->map[tag.lsn] == region_page) {
+        ret = spiflash_sched_read_page(ftl->sched, cls, ftl_phys_page(ftl, region_page), ftl->page_buf);
+        if (ret == ESP_OK) {
+            ret = ftl_program(ftl, cls, tag.lsn, ftl->page_buf);
+        }
+    }
+    if (ret != ESP_OK) {
+        // Start over with a fresh pick next time
+        ftl->gc_victim = FTL_NO_BLOCK;
+        return ret;
+    }
+
+    ftl->gc_page++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Reclaim the used block with the fewest valid pages
+ *
+ * Finishes the victim the GC task is working on, if any.
+ */
+static esp_err_t ftl_collect(ftl_t *ftl, spiflash_io_class_t cls) {
+    bool done = false;
+    esp_err_t ret = ESP_OK;
+    while (ret == ESP_OK && !done) {
+        ret = ftl_collect_step(ftl, cls, SPIFLASH_PAGES_PER_BLOCK - 1, &done);
+    }
+    return ret;
+}
+
+// ============================================================================
+// GC Task
+// ============================================================================
+
+/**
+ * @brief Erase a free block ahead and collect below the low-water mark
+ *
+ * Every unit of work takes the FTL lock on its own. The erase runs without
+ * it: the block is out of the free pool meanwhile, so writes take another.
+ * The task sleeps when there is nothing to do, or nothing worth collecting,
+ * until a write takes a block or finds the pool low.
+ *
+ * gc_busy is raised before gc_paused is checked, and the pauser stores
+ * gc_paused before reading gc_busy, so a waiter never misses a unit that
+ * started before the pause.
+ */
+static void ftl_gc_task(void *arg) {
+    ftl_t *ftl = arg;
+
+    while (__atomic_load_n(&ftl->gc_run, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&ftl->gc_busy, true, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ftl->gc_paused, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&ftl->gc_busy, false, __ATOMIC_SEQ_CST);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        xSemaphoreTake(ftl->lock, portMAX_DELAY);
+        bool idle = false;
+        uint32_t erase = FTL_NO_BLOCK;
+        if (ftl_find_block(ftl, FTL_BLOCK_ERASED) == FTL_NO_BLOCK &&
+            (erase = ftl_find_block(ftl, FTL_BLOCK_FREE)) != FTL_NO_BLOCK) {
+            ftl->state[erase] = FTL_BLOCK_ERASING;
+            ftl->free_blocks--;
+        } else if (ftl->free_blocks < ftl->gc_low_water) {
+            bool done;
+            esp_err_t ret = ftl_collect_step(ftl, FTL_IO_GC, SPIFLASH_PAGES_PER_BLOCK - FTL_GC_MIN_GAIN, &done);
+            if (ret != ESP_OK && ret != ESP_ERR_NO_MEM) {
+                ESP_LOGW(TAG, "Background GC failed: %s", esp_err_to_name(ret));
+            }
+            idle = ret != ESP_OK;
+        } else {
+            idle = true;
+        }
+        xSemaphoreGive(ftl->lock);
+
+        if (erase != FTL_NO_BLOCK) {
+            esp_err_t ret = spiflash_sched_erase_block(ftl->sched, FTL_IO_GC, ftl->first_block + erase);
+            xSemaphoreTake(ftl->lock, portMAX_DELAY);
+            if (ret == ESP_OK) {
+                ftl->state[erase] = FTL_BLOCK_ERASED;
+                ftl->free_blocks++;
+            } else {
+                ftl_mark_bad(ftl, erase);
+            }
+            xSemaphoreGive(ftl->lock);
+        }
+        __atomic_store_n(&ftl->gc_busy, false, __ATOMIC_SEQ_CST);
+        if (idle) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    xSemaphoreGive(ftl->gc_done);
+    vTaskDelete(NULL);
+}
+
+static void ftl_gc_stop(ftl_t *ftl) {
+    if (ftl->gc_task == NULL) {
+        return;
+    }
+    __atomic_store_n(&ftl->gc_run, false, __ATOMIC_RELEASE);
+    xTaskNotifyGive(ftl->gc_task);
+    xSemaphoreTake(ftl->gc_done, portMAX_DELAY);
+    ftl->gc_task = NULL;
+}
+
+/**
+ * @brief Rebuild the sector map from the spare area tags
+ */
+static esp_err_t ftl_scan(ftl_t *ftl) {
+    // Sequence of the mapped copy, only needed while resolving duplicates
+    uint32_t *map_seq = calloc(ftl->sector_count, sizeof(uint32_t));
+    if (map_seq == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ftl->free_blocks = 0;
+    for (uint32_t b = 0; b < ftl->block_count; b++) {
+        ftl_tag_t tag;
+        uint8_t bbm;
+        esp_err_t ret = ftl_read_tag(ftl, FTL_IO, b * SPIFLASH_PAGES_PER_BLOCK, &bbm, &tag);
+        if (ret != ESP_OK) {
+            free(map_seq);
+            return ret;
+        }
+
+        if (bbm != 0xFF) {
+            ftl->state[b] = FTL_BLOCK_BAD;
+            continue;
+        }
+        if (tag.magic != FTL_TAG_MAGIC) {
+            ftl->state[b] = FTL_BLOCK_FREE;
+            ftl->free_blocks++;
+            continue;
+        }
+
+        ftl->state[b] = FTL_BLOCK_USED;
+        for (uint32_t pg = 0; pg < SPIFLASH_PAGES_PER_BLOCK; pg++) {
+            uint32_t region_page = b * SPIFLASH_PAGES_PER_BLOCK + pg;
+            if (pg > 0) {
+                ret = ftl_read_tag(ftl, FTL_IO, region_page, NULL, &tag);
+                if (ret != ESP_OK) {
+                    free(map_seq);
+                    return ret;
+                }
+            }
+            if (tag.magic != FTL_TAG_MAGIC) {
+                break;  // Pages are programmed in order, the rest is erased
+            }
+            if (tag.seq > ftl->seq) {
+                ftl->seq = tag.seq;
+            }
+            if (tag.lsn < ftl->sector_count &&
+                (ftl->map[tag.lsn] == FTL_UNMAPPED || tag.seq > map_seq[tag.lsn])) {
+                ftl->map[tag.lsn] = region_page;
+                map_seq[tag.lsn] = tag.seq;
+            }
+        }
+    }
+    free(map_seq);
+
+    for (uint32_t lsn = 0; lsn < ftl->sector_count; lsn++) {
+        if (ftl->map[lsn] != FTL_UNMAPPED) {
+            ftl->valid[ftl->map[lsn] / SPIFLASH_PAGES_PER_BLOCK]++;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static void ftl_free(ftl_t *ftl) {
+    free(ftl->map);
+    free(ftl->valid);
+    free(ftl->state);
+    free(ftl->page_buf);
+    free(ftl->erased_page);
+    if (ftl->lock != NULL) {
+        vSemaphoreDelete(ftl->lock);
+    }
+    if (ftl->gc_done != NULL) {
+        vSemaphoreDelete(ftl->gc_done);
+    }
+    free(ftl);
+}
+
+// ============================================================================
+// Backend Operations
+// ============================================================================
+
+static esp_err_t spiflash_backend_deinit(void *ctx);
+
+static esp_err_t spiflash_backend_init(const battery_fs_config_t *config, void **ctx,
+                                       uint32_t *sector_size, uint32_t *sector_count) {
+    uint32_t blocks = config->ftl_blocks ? config->ftl_blocks : FTL_DEFAULT_BLOCKS;
+    // Region pages must stay below FTL_UNMAPPED to fit the 16-bit map
+    if (blocks * SPIFLASH_PAGES_PER_BLOCK > FTL_UNMAPPED || blocks <= FTL_MIN_FREE_BLOCKS + 2) {
+        ESP_LOGE(TAG, "Invalid FTL block count %" PRIu32, blocks);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ftl_t *ftl = calloc(1, sizeof(ftl_t));
+    if (ftl == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Reserve ~3% (at least 4 blocks) for garbage collection and bad blocks
+    uint32_t reserve = blocks / 32;
+    if (reserve < FTL_MIN_FREE_BLOCKS + 2) {
+        reserve = FTL_MIN_FREE_BLOCKS + 2;
+    }
+
+    ftl->first_block = 0;
+    ftl->block_count = blocks;
+    ftl->sector_count = (blocks - reserve) * SPIFLASH_PAGES_PER_BLOCK;
+    ftl->active_block = FTL_NO_BLOCK;
+    ftl->gc_victim = FTL_NO_BLOCK;
+    // Half the reserve, so collection gets ahead without churning a full volume
+    ftl->gc_low_water = reserve / 2 > FTL_MIN_FREE_BLOCKS ? reserve / 2 : FTL_MIN_FREE_BLOCKS + 1;
+    ftl->map = malloc(ftl->sector_count * sizeof(uint16_t));
+    ftl->valid = calloc(blocks, sizeof(uint8_t));
+    ftl->state = calloc(blocks, sizeof(uint8_t));
+    ftl->page_buf = malloc(SPIFLASH_PAGE_SIZE);
+    ftl->erased_page = malloc(SPIFLASH_PAGE_SIZE);
+    ftl->lock = xSemaphoreCreateMutex();
+    ftl->gc_done = xSemaphoreCreateBinary();
+    if (ftl->map == NULL || ftl->valid == NULL || ftl->state == NULL || ftl->page_buf == NULL ||
+        ftl->erased_page == NULL || ftl->lock == NULL || ftl->gc_done == NULL) {
+        ftl_free(ftl);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(ftl->map, 0xFF, ftl->sector_count * sizeof(uint16_t));
+    memset(ftl->erased_page, 0xFF, SPIFLASH_PAGE_SIZE);
+
+    spiflash_config_t flash_config = {
+        .host_id = config->spi_host,
+        .pin_mosi = config->pin_mosi,
+        .pin_miso = config->pin_miso,
+        .pin_sclk = config->pin_sclk,
+        .pin_cs = config->pin_cs,
+        .clock_speed_hz = config->clock_speed_hz,
+        .image_path = config->image_path,
+        .image_blocks = config->image_size / SPIFLASH_RAW_BLOCK_SIZE,
+        .model_realtime = config->flash_realtime,
+        .cache_pages = config->page_cache_pages,
+        .cache_psram = config->page_cache_psram,
+        .readahead_pages = config->page_readahead,
+    };
+
+    esp_err_t ret = spiflash_init(&flash_config, &ftl->flash);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize spiflash: %s", esp_err_to_name(ret));
+        ftl_free(ftl);
+        return ret;
+    }
+
+    ret = spiflash_sched_create(ftl->flash, NULL, &ftl->sched);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create I/O scheduler: %s", esp_err_to_name(ret));
+        spiflash_backend_deinit(ftl);
+        return ret;
+    }
+
+    if ((uint64_t)(ftl->first_block + blocks) * SPIFLASH_BLOCK_SIZE > ftl->flash->total_size) {
+        ESP_LOGE(TAG, "FTL region of %" PRIu32 " blocks exceeds flash size", blocks);
+        spiflash_backend_deinit(ftl);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ret = ftl_scan(ftl);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to scan flash: %s", esp_err_to_name(ret));
+        spiflash_backend_deinit(ftl);
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "FTL: %" PRIu32 " blocks, %" PRIu32 " sectors, %" PRIu32 " free blocks, seq %" PRIu32,
+             ftl->block_count, ftl->sector_count, ftl->free_blocks, ftl->seq);
+
+    ftl->gc_run = true;
+    if (xTaskCreate(ftl_gc_task, "ftl_gc", FTL_GC_STACK, ftl, FTL_GC_PRIORITY, &ftl->gc_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the GC task");
+        ftl->gc_task = NULL;
+        spiflash_backend_deinit(ftl);
+        return ESP_ERR_NO_MEM;
+    }
+
+    *sector_size = SPIFLASH_PAGE_SIZE;
+    *sector_count = ftl->sector_count;
+    *ctx = ftl;
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_deinit(void *ctx) {
+    ftl_t *ftl = ctx;
+    ftl_gc_stop(ftl);
+    spiflash_sched_delete(ftl->sched);
+    spiflash_deinit(ftl->flash);
+    ftl_free(ftl);
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_read(void *ctx, uint8_t *buffer, uint32_t sector, uint32_t count) {
+    ftl_t *ftl = ctx;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t *dst = buffer + i * SPIFLASH_PAGE_SIZE;
+        esp_err_t ret = ESP_OK;
+
+        // Held across the read, GC must not move and erase the page meanwhile
+        xSemaphoreTake(ftl->lock, portMAX_DELAY);
+        uint16_t region_page = ftl->map[sector + i];
+        if (region_page == FTL_UNMAPPED) {
+            memset(dst, 0xFF, SPIFLASH_PAGE_SIZE);  // Never written reads as erased
+        } else {
+            ret = spiflash_sched_read_page(ftl->sched, FTL_IO, ftl_phys_page(ftl, region_page), dst);
+        }
+        xSemaphoreGive(ftl->lock);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_write(void *ctx, const uint8_t *buffer, uint32_t sector, uint32_t count) {
+    ftl_t *ftl = ctx;
+
+    for (uint32_t i = 0; i < count; i++) {
+        xSemaphoreTake(ftl->lock, portMAX_DELAY);
+        // The GC task fell behind: collect here, before the active block
+        // fills up, so relocation always has room
+        esp_err_t ret = ESP_OK;
+        while (ret == ESP_OK && ftl->free_blocks < FTL_MIN_FREE_BLOCKS) {
+            ret = ftl_collect(ftl, FTL_IO);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Garbage collection failed: %s", esp_err_to_name(ret));
+            }
+        }
+        if (ret == ESP_OK) {
+            ret = ftl_program(ftl, FTL_IO, sector + i, buffer + i * SPIFLASH_PAGE_SIZE);
+        }
+        bool low = ftl->free_blocks < ftl->gc_low_water;
+        xSemaphoreGive(ftl->lock);
+
+        if (low) {
+            ftl_gc_wake(ftl);
+        }
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_trim(void *ctx, uint32_t sector, uint32_t count) {
+    ftl_t *ftl = ctx;
+
+    xSemaphoreTake(ftl->lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < count; i++) {
+        ftl_invalidate(ftl, sector + i);
+    }
+    xSemaphoreGive(ftl->lock);
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_sync(void *ctx) {
+    // Pages are programmed synchronously, nothing is buffered here
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_get_stats(void *ctx, battery_fs_stats_t *stats) {
+    ftl_t *ftl = ctx;
+    spiflash_stats_t flash;
+
+    esp_err_t ret = spiflash_get_stats(ftl->flash, &flash);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    stats->flash_bytes_read = flash.bytes_read;
+    stats->flash_bytes_programmed = flash.bytes_programmed;
+    stats->flash_blocks_erased = flash.blocks_erased;
+    stats->flash_cache_hits = flash.cache_hits;
+    stats->flash_cache_misses = flash.cache_misses;
+    stats->flash_bytes_copied = flash.bytes_copied;
+    return ESP_OK;
+}
+
+static esp_err_t spiflash_backend_reset_stats(void *ctx) {
+    ftl_t *ftl = ctx;
+    return spiflash_reset_stats(ftl->flash);
+}
+
+static battery_fs_flash_op_t spiflash_backend_flash_op(void *ctx) {
+    ftl_t *ftl = ctx;
+    switch (spiflash_current_op(ftl->flash)) {
+    case SPIFLASH_OP_READ:
+        return BATTERY_FS_FLASH_READ;
+    case SPIFLASH_OP_PROGRAM:
+        return BATTERY_FS_FLASH_PROGRAM;
+    case SPIFLASH_OP_ERASE:
+        return BATTERY_FS_FLASH_ERASE;
+    default:
+        return BATTERY_FS_FLASH_IDLE;
+    }
+}
+
+static void spiflash_backend_pause(void *ctx, bool paused) {
+    ftl_t *ftl = ctx;
+    __atomic_store_n(&ftl->gc_paused, paused, __ATOMIC_SEQ_CST);
+    if (!paused) {
+        ftl_gc_wake(ftl);
+    }
+}
+
+static bool spiflash_backend_busy(void *ctx) {
+    ftl_t *ftl = ctx;
+    return __atomic_load_n(&ftl->gc_busy, __ATOMIC_SEQ_CST);
+}
+
+const battery_fs_backend_ops_t battery_fs_backend_spiflash = {
+    .name = "spiflash",
+    .init = spiflash_backend_init,
+    .deinit = spiflash_backend_deinit,
+    .read = spiflash_backend_read,
+    .write = spiflash_backend_write,
+    .trim = spiflash_backend_trim,
+    .sync = spiflash_backend_sync,
+    .get_stats = spiflash_backend_get_stats,
+    .reset_stats = spiflash_backend_reset_stats,
+    .flash_op = spiflash_backend_flash_op,
+    .pause = spiflash_backend_pause,
+    .busy = spiflash_backend_busy,
+};
@@ -0,0 +1,345 @@
+/**
+ * @file battery_fs_format.h
+ * @brief On-media formats written by battery_fs
+ * 
+ * Everything battery_fs puts on flash is described here, free of ESP-IDF
+ * dependencies, so host tools (tools/analyzer) parse exactly what the
+ * firmware writes. All integers are little-endian.
+ * 
+ * Volume: FAT (8.3 names) on one of the block backends. With the spiflash
+ * backend each NAND page holds one sector and carries a battery_fs_ftl_tag_t
+ * in its spare area.
+ * 
+ * Files per battery, named after the battery ID:
+ *  - <ID>.bin: sequence of records, each a battery_fs_record_header_t
+ *              followed by data_len bytes (a BatmonMemory image)
+ *  - <ID>.met: one battery_metadata_t, a battery_fs_summary_t, a
+ *              battery_fs_flag_header_t and its battery_fs_flag_run_t
+ *              entries (all but the metadata missing from files written
+ *              before they existed)
+ *  - <ID>.tlm: live telemetry rollups, a battery_fs_tlm_header_t sector
+ *              then one ring of battery_fs_tlm_bucket_t per level (only
+ *              for batteries whose telemetry was logged)
+ *
+ * And per volume:
+ *  - FLEET.TOP: a battery_fs_topk_file_t, the batteries ranking highest
+ *               on each fleet metric
+ *  - SYNC.LOG:  battery_fs_seq_entry_t entries, the global sequence
+ *               numbers of every committed append
+ *  - SYNC.CUR:  a battery_fs_sync_file_t, the high-water mark of each
+ *               sync consumer
+ * The SYNC files outlive battery_fs_delete_all(), so sequence numbers
+ * never repeat on a volume.
+ */
+
+#ifndef BATTERY_FS_FORMAT_H
+#define BATTERY_FS_FORMAT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Record header in a .bin data file
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t memory_index;  ///< Memory index from battery
+    uint32_t data_len;      ///< Length of the record data that follows
+} battery_fs_record_header_t;
+
+/**
+ * @brief Battery metadata structure (.met file)
+ * Stores information about the last recorded log
+ */
+typedef struct {
+    uint32_t last_memory_index; ///< Last memory index written
+    uint32_t record_count;      ///< Total number of records
+    uint32_t last_timestamp;    ///< Last update timestamp (optional)
+    uint32_t last_data_hash;    ///< CRC32 hash of last record's data (for ring buffer detection)
+} battery_metadata_t;
+
+/**
+ * @brief Running summary of a battery's records (.met file, after the metadata)
+ *
+ * Updated from the BatmonMemory image of every appended record. Values are
+ * raw record fields: temperatures carry MEMORY_TEMP_OFFSET, currents are in
+ * A, charge in mAh. Records of another size count in `records` only. The
+ * summary is current when magic and size match and `records` equals the
+ * metadata record_count.
+ *
+ * Internal resistance is tracked per measurement condition: each IntRes
+ * sample goes to the bucket of its SOC and temperature interval, where
+ * the mean of its first BATTERY_FS_IR_BASELINE samples is the baseline and
+ * an exponential average (weight 1/BATTERY_FS_IR_SMOOTHING) the current
+ * level. The sample is the mean of the cell minimum and maximum. `soh` is
+ * the resistance-based state of health over the settled buckets, weighted
+ * by their samples: 100 % at the baseline, 0 % once resistance has grown
+ * to BATTERY_FS_SOH_EOL_PCT of it. The baseline is the oldest stored
+ * history, not necessarily a new pack.
+ */
+#define BATTERY_FS_SUMMARY_MAGIC    0x5342  ///< "BS"
+#define BATTERY_FS_SUMMARY_ALARMS   4       ///< triggeredAlarmCycle bits, in bit order
+#define BATTERY_FS_IR_SOC_BUCKETS   4       ///< IntRes SOC_interval values
+#define BATTERY_FS_IR_TEMP_BUCKETS  8       ///< IntRes temperature_interval values
+#define BATTERY_FS_IR_BUCKETS       (BATTERY_FS_IR_SOC_BUCKETS * BATTERY_FS_IR_TEMP_BUCKETS)
+#define BATTERY_FS_IR_BASELINE      8       ///< Samples averaged into a bucket baseline
+#define BATTERY_FS_IR_SETTLED       16      ///< Samples before a bucket counts for the SOH
+#define BATTERY_FS_IR_SMOOTHING     16      ///< Level averaging window, samples
+#define BATTERY_FS_IR_SCALE         256     ///< Stored resistances are in 1/256 mOhm
+#define BATTERY_FS_SOH_EOL_PCT      200     ///< Resistance growth at 0 % SOH, % of baseline
+#define BATTERY_FS_SOH_UNKNOWN      0xFF    ///< No settled bucket yet
+
+typedef enum {
+    BATTERY_FS_SUMMARY_MIN_SOC = 0, ///< minSOC
+    BATTERY_FS_SUMMARY_MAX_TEMP,    ///< maxTempCycle
+    BATTERY_FS_SUMMARY_MAX_CURRENT, ///< maxDrainedCurrentCycle
+    BATTERY_FS_SUMMARY_DISCHARGED,  ///< accumulatedDischarged
+    BATTERY_FS_SUMMARY_FIELDS
+} battery_fs_summary_field_id_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} battery_fs_summary_field_t;
+
+/**
+ * @brief Internal resistance of one condition bucket, bucket = soc * 8 + temp
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t samples;               ///< Samples folded in, saturates
+    uint16_t baseline;              ///< 1/BATTERY_FS_IR_SCALE mOhm
+    uint16_t level;                 ///< 1/BATTERY_FS_IR_SCALE mOhm
+    uint16_t first_cycle;           ///< battCycle of the first sample
+    uint16_t last_cycle;            ///< battCycle of the latest sample
+} battery_fs_ir_bucket_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                 ///< BATTERY_FS_SUMMARY_MAGIC
+    uint16_t size;                  ///< sizeof(battery_fs_summary_t)
+    uint32_t records;               ///< Records folded in
+    uint32_t decoded;               ///< Records decoded into the fields below
+    battery_fs_summary_field_t fields[BATTERY_FS_SUMMARY_FIELDS];
+    uint32_t alarms[BATTERY_FS_SUMMARY_ALARMS]; ///< Records with each alarm bit set
+    uint16_t latest_cycle;          ///< battCycle of the last record appended
+    uint8_t soh;                    ///< %, BATTERY_FS_SOH_UNKNOWN without a settled bucket
+    uint8_t reserved;
+    battery_fs_ir_bucket_t ir[BATTERY_FS_IR_BUCKETS];
+} battery_fs_summary_t;
+
+/**
+ * @brief Alarm and error flags indexed per record (.met file)
+ *
+ * Bit b of a record is set when:
+ *  - b < BATTERY_FS_SUMMARY_ALARMS: triggeredAlarmCycle.alarm bit b
+ *  - CC_ERROR, CC_TIME_ERROR: the bq_status bit
+ *  - CC_ERROR_COUNT: ccErrorCount differs from the previous record's
+ * Records that are not a BatmonMemory image have no flag set.
+ */
+typedef enum {
+    BATTERY_FS_FLAG_REMAINING_CAPACITY = 0,
+    BATTERY_FS_FLAG_CELL_IMBALANCE,
+    BATTERY_FS_FLAG_OVER_TEMP,
+    BATTERY_FS_FLAG_UNDER_TEMP,
+    BATTERY_FS_FLAG_CC_ERROR,
+    BATTERY_FS_FLAG_CC_TIME_ERROR,
+    BATTERY_FS_FLAG_CC_ERROR_COUNT,
+    BATTERY_FS_FLAGS
+} battery_fs_flag_t;
+
+/**
+ * @brief Run of consecutive records with one flag set (.met file, entry n
+ *        at sizeof(header, summary and flag header) + n * sizeof(run))
+ *
+ * Records are numbered in file order from 0, the order a reader returns
+ * them in. Runs of a flag are in ascending order and may touch each other;
+ * a run can reach past the header's `records`, the part beyond is not
+ * committed yet.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t first;                 ///< First record of the run
+    uint16_t count;
+    uint8_t flag;                   ///< battery_fs_flag_t
+    uint8_t reserved;
+} battery_fs_flag_run_t;
+
+/**
+ * @brief Flag index head (.met file, after the summary)
+ *
+ * Rewritten with the metadata after the runs it covers, so it commits an
+ * append. The index is current when magic and size match and `records`
+ * equals the metadata record_count.
+ */
+#define BATTERY_FS_FLAG_MAGIC       0x4946  ///< "FI"
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                 ///< BATTERY_FS_FLAG_MAGIC
+    uint16_t size;                  ///< sizeof(battery_fs_flag_header_t)
+    uint32_t records;               ///< Records indexed
+    uint32_t entries;               ///< Runs that follow
+    uint8_t cc_errors;              ///< ccErrorCount of the last record
+    uint8_t reserved[3];
+    uint32_t set[BATTERY_FS_FLAGS]; ///< Records with each flag set
+    uint32_t tail[BATTERY_FS_FLAGS]; ///< Last run of each flag, entry number + 1, 0 = none
+} battery_fs_flag_header_t;
+
+/**
+ * @brief Live telemetry rollups (.tlm file)
+ *
+ * Samples are folded into buckets of three resolutions. The open bucket of
+ * each level lives in the header; once a sample falls past it, it is
+ * stored in the level's ring and folded into the open bucket of the next
+ * level. Rings keep the latest buckets, oldest first from (head - count),
+ * so raw seconds age out long before the hourly rollups do. Buckets are
+ * in ascending start order within a ring; empty periods have no bucket.
+ *
+ * The header sector is rewritten after the ring entries it counts, so it
+ * commits an append. The rings follow the header in level order, each
+ * sized for its BATTERY_FS_TLM_*_BUCKETS entries.
+ */
+#define BATTERY_FS_TLM_MAGIC        0x4C54  ///< "TL"
+#define BATTERY_FS_TLM_RAW_BUCKETS  3600    ///< 1 s buckets kept, one hour
+#define BATTERY_FS_TLM_MINUTE_BUCKETS 1440  ///< 1 min buckets kept, one day
+#define BATTERY_FS_TLM_HOUR_BUCKETS 2160    ///< 1 h buckets kept, 90 days
+#define BATTERY_FS_TLM_HEADER_SIZE  512     ///< Bytes before the first ring
+
+typedef enum {
+    BATTERY_FS_TLM_RAW = 0,         ///< 1 s
+    BATTERY_FS_TLM_MINUTE,          ///< 60 s
+    BATTERY_FS_TLM_HOUR,            ///< 3600 s
+    BATTERY_FS_TLM_LEVELS
+} battery_fs_tlm_level_t;
+
+typedef enum {
+    BATTERY_FS_TLM_SOC = 0,         ///< %
+    BATTERY_FS_TLM_CURRENT,         ///< mA, positive while charging
+    BATTERY_FS_TLM_CHANNELS
+} battery_fs_tlm_channel_t;
+
+typedef struct __attribute__((packed)) {
+    int16_t min;
+    int16_t max;
+    int32_t sum;                    ///< Mean = sum / samples
+} battery_fs_tlm_stat_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t start_s;               ///< Bucket start, a multiple of its period
+    uint16_t samples;               ///< Samples folded in, saturates
+    uint16_t reserved;
+    battery_fs_tlm_stat_t channel[BATTERY_FS_TLM_CHANNELS];
+} battery_fs_tlm_bucket_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                 ///< BATTERY_FS_TLM_MAGIC
+    uint16_t size;                  ///< sizeof(battery_fs_tlm_header_t)
+    uint32_t head[BATTERY_FS_TLM_LEVELS];   ///< Next ring entry to write
+    uint32_t count[BATTERY_FS_TLM_LEVELS];  ///< Buckets stored per ring
+    battery_fs_tlm_bucket_t open[BATTERY_FS_TLM_LEVELS]; ///< Bucket being filled, samples 0 = none
+} battery_fs_tlm_header_t;
+
+/**
+ * @brief Fleet rankings (FLEET.TOP)
+ *
+ * Per metric, the BATTERY_FS_TOPK_CANDIDATES batteries with the highest
+ * value as a min-heap: entry 0 is the lowest of them. That is twice the
+ * ranks a query returns, so when a ranked battery is deleted or drops, a
+ * candidate takes its place without any .met file being read. `bound` is
+ * the highest value a battery outside the candidates can have, INT32_MIN
+ * when none is outside: every candidate at or above it holds its true
+ * rank. A candidate count below BATTERY_FS_TOPK above the bound needs a
+ * rebuild from the .met files of all batteries.
+ *
+ * Written at most once a minute by the appends that change a ranking,
+ * after deletes and rebuilds, and at deinit. `next_seq` is the first
+ * sequence number whose append it may lack: the sequence log names the
+ * batteries to enter again at mount.
+ */
+#define BATTERY_FS_TOPK_MAGIC       0x4B54  ///< "TK"
+#define BATTERY_FS_TOPK             10      ///< Batteries ranked per metric
+#define BATTERY_FS_TOPK_CANDIDATES  (2 * BATTERY_FS_TOPK)   ///< Batteries kept per metric
+#define BATTERY_FS_TOPK_SERIAL      8       ///< Serial number bytes, 8.3 stems, NUL padded
+
+typedef enum {
+    BATTERY_FS_TOPK_IR_GROWTH = 0,  ///< Internal resistance over baseline, permille
+    BATTERY_FS_TOPK_CC_ERRORS,      ///< Records with CC_ERROR set
+    BATTERY_FS_TOPK_ALARMS,         ///< Records with any alarm bit set, summed per bit
+    BATTERY_FS_TOPK_MAX_TEMP,       ///< Highest maxTempCycle, raw
+    BATTERY_FS_TOPK_METRICS
+} battery_fs_topk_metric_t;
+
+typedef struct __attribute__((packed)) {
+    char serial[BATTERY_FS_TOPK_SERIAL];
+    int32_t value;
+} battery_fs_topk_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                 ///< BATTERY_FS_TOPK_MAGIC
+    uint16_t size;                  ///< sizeof(battery_fs_topk_file_t)
+    uint32_t next_seq;              ///< Appends from this sequence number on may be missing, 0 = unknown
+    uint8_t count[BATTERY_FS_TOPK_METRICS]; ///< Entries used per metric
+    int32_t bound[BATTERY_FS_TOPK_METRICS]; ///< Highest value outside the entries
+    battery_fs_topk_entry_t entry[BATTERY_FS_TOPK_METRICS][BATTERY_FS_TOPK_CANDIDATES];
+} battery_fs_topk_file_t;
+
+/**
+ * @brief One committed append in the sequence log (SYNC.LOG)
+ *
+ * Records get consecutive global sequence numbers from 1 in commit order,
+ * an append's records from `first_seq` on. Entries are appended after the
+ * .met head commits the records, in ascending `first_seq`; a partial
+ * entry at the end of the file is ignored. `crc` tells the records apart
+ * from those of a battery deleted and stored again under the same name.
+ */
+#define BATTERY_FS_SEQ_SERIAL       8       ///< Serial number bytes, 8.3 stems, NUL padded
+
+typedef struct __attribute__((packed)) {
+    uint32_t first_seq;             ///< Sequence number of the first record
+    char serial[BATTERY_FS_SEQ_SERIAL];
+    uint32_t first_record;          ///< Its number in the battery, reader order from 0
+    uint32_t offset;                ///< Its byte offset in the .bin file
+    uint32_t crc;                   ///< CRC32 of its data, as last_data_hash
+    uint32_t count;                 ///< Records appended
+} battery_fs_seq_entry_t;
+
+/**
+ * @brief Sync consumer high-water marks (SYNC.CUR)
+ *
+ * A consumer has received every record up to `acked`; a sync read hands
+ * it the records after. Rewritten in one sector on every acknowledgement.
+ */
+#define BATTERY_FS_SYNC_MAGIC       0x5953  ///< "SY"
+#define BATTERY_FS_SYNC_CONSUMERS   8
+#define BATTERY_FS_SYNC_NAME        12      ///< Consumer name bytes, NUL padded
+
+typedef struct __attribute__((packed)) {
+    char name[BATTERY_FS_SYNC_NAME];    ///< Empty = free slot
+    uint32_t acked;                     ///< Last sequence number received
+} battery_fs_sync_cursor_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                 ///< BATTERY_FS_SYNC_MAGIC
+    uint16_t size;                  ///< sizeof(battery_fs_sync_file_t)
+    uint32_t reserved;
+    battery_fs_sync_cursor_t cursor[BATTERY_FS_SYNC_CONSUMERS];
+} battery_fs_sync_file_t;
+
+/**
+ * @brief Spare area tag of a page written by the spiflash backend FTL
+ */
+#define BATTERY_FS_FTL_TAG_MAGIC    0x4246  ///< "BF"
+#define BATTERY_FS_FTL_TAG_OFFSET   4       ///< Spare offset, skips the factory bad block marker
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;     ///< BATTERY_FS_FTL_TAG_MAGIC
+    uint16_t reserved;
+    uint32_t lsn;       ///< Logical sector number
+    uint32_t seq;       ///< Write sequence, the newest copy of a sector wins
+} battery_fs_ftl_tag_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BATTERY_FS_FORMAT_H
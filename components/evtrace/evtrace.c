@@ -0,0 +1,186 @@
+/**
+ * @file evtrace.c
+ * @brief Lock-free binary event tracer
+ */
+
+#include "evtrace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+static const char *TAG = "EVTRACE";
+
+#if CONFIG_EVTRACE_ENABLED
+
+#define EVTRACE_RING_MASK   (CONFIG_EVTRACE_EVENTS_PER_CORE - 1)
+
+_Static_assert((CONFIG_EVTRACE_EVENTS_PER_CORE & EVTRACE_RING_MASK) == 0,
+               "CONFIG_EVTRACE_EVENTS_PER_CORE must be a power of two");
+
+typedef struct {
+    uint32_t head;                      // Events ever claimed, slot = head & mask
+    evtrace_event_t events[CONFIG_EVTRACE_EVENTS_PER_CORE];
+} evtrace_ring_t;
+
+// One ring per core keeps the cores off each other's cache lines; the
+// atomic claim keeps a ring consistent when a task migrates mid-event.
+static evtrace_ring_t s_rings[portNUM_PROCESSORS];
+static volatile bool s_running;
+
+static inline uint32_t current_core(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    return 0;
+#else
+    return xPortGetCoreID();
+#endif
+}
+
+static inline uint32_t current_task(void) {
+#if !CONFIG_IDF_TARGET_LINUX
+    if (xPortInIsrContext()) {
+        return 0;
+    }
+#endif
+    return (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+}
+
+// ============================================================================
+// Recording
+// ============================================================================
+
+void evtrace_emit(uint16_t id, uint8_t type, uint32_t arg) {
+    if (!s_running) {
+        return;
+    }
+
+    uint32_t core = current_core();
+    evtrace_ring_t *ring = &s_rings[core];
+    uint32_t idx = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    evtrace_event_t *ev = &ring->events[idx & EVTRACE_RING_MASK];
+
+    ev->timestamp_us = (uint32_t)esp_timer_get_time();
+    ev->id = id;
+    ev->type = type;
+    ev->core = (uint8_t)core;
+    ev->task = current_task();
+    ev->arg = arg;
+}
+
+esp_err_t evtrace_start(void) {
+    s_running = false;
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        __atomic_store_n(&s_rings[c].head, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s_running = true;
+    ESP_LOGI(TAG, "Recording, %d events per core", CONFIG_EVTRACE_EVENTS_PER_CORE);
+    return ESP_OK;
+}
+
+void evtrace_stop(void) {
+    s_running = false;
+}
+
+bool evtrace_is_running(void) {
+    return s_running;
+}
+
+uint32_t evtrace_count(uint32_t *dropped) {
+    uint32_t held = 0, lost = 0;
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        uint32_t head = __atomic_load_n(&s_rings[c].head, __ATOMIC_RELAXED);
+        if (head > CONFIG_EVTRACE_EVENTS_PER_CORE) {
+            lost += head - CONFIG_EVTRACE_EVENTS_PER_CORE;
+            head = CONFIG_EVTRACE_EVENTS_PER_CORE;
+        }
+        held += head;
+    }
+    if (dropped) {
+        *dropped = lost;
+    }
+    return held;
+}
+
+// ============================================================================
+// Dump
+// ============================================================================
+
+static void dump_task_names(FILE *out) {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    // Some slack for tasks created while the snapshot is taken
+    UBaseType_t max = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *status = malloc(max * sizeof(TaskStatus_t));
+    if (status == NULL) {
+        ESP_LOGW(TAG, "No memory for task names");
+        return;
+    }
+
+    UBaseType_t n = uxTaskGetSystemState(status, max, NULL);
+    for (UBaseType_t i = 0; i < n; i++) {
+        fprintf(out, EVTRACE_LINE_PREFIX " T %" PRIx32 " %s\n",
+                (uint32_t)(uintptr_t)status[i].xHandle, status[i].pcTaskName);
+    }
+    free(status);
+#endif
+}
+
+void evtrace_dump(FILE *out) {
+    uint32_t dropped;
+    uint32_t count = evtrace_count(&dropped);
+
+    fprintf(out, EVTRACE_LINE_PREFIX " H %d %" PRIu32 " %" PRIu32 "\n",
+            EVTRACE_FORMAT_VERSION, count, dropped);
+
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        uint32_t head = __atomic_load_n(&s_rings[c].head, __ATOMIC_RELAXED);
+        uint32_t first = head > CONFIG_EVTRACE_EVENTS_PER_CORE ? head - CONFIG_EVTRACE_EVENTS_PER_CORE : 0;
+
+        for (uint32_t i = first; i < head; i++) {
+            // Byte copy: the format is the in-memory layout, little endian
+            uint8_t raw[sizeof(evtrace_event_t)];
+            memcpy(raw, &s_rings[c].events[i & EVTRACE_RING_MASK], sizeof(raw));
+
+            char hex[2 * sizeof(raw) + 1];
+            for (size_t b = 0; b < sizeof(raw); b++) {
+                snprintf(&hex[2 * b], 3, "%02x", raw[b]);
+            }
+            fprintf(out, EVTRACE_LINE_PREFIX " E %s\n", hex);
+        }
+    }
+
+    dump_task_names(out);
+    fflush(out);
+}
+
+#else
+
+void evtrace_emit(uint16_t id, uint8_t type, uint32_t arg) {
+}
+
+esp_err_t evtrace_start(void) {
+    ESP_LOGW(TAG, "Needs CONFIG_EVTRACE_ENABLED");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void evtrace_stop(void) {
+}
+
+bool evtrace_is_running(void) {
+    return false;
+}
+
+uint32_t evtrace_count(uint32_t *dropped) {
+    if (dropped) {
+        *dropped = 0;
+    }
+    return 0;
+}
+
+void evtrace_dump(FILE *out) {
+}
+
+#endif // CONFIG_EVTRACE_ENABLED
@@ -0,0 +1,86 @@
+/**
+ * @file evtrace.h
+ * @brief Lock-free binary event tracer
+ *
+ * Trace points record 16-byte begin/end/instant events with a microsecond
+ * timestamp and one 32-bit payload into a ring per core. Recording is off
+ * until evtrace_start(). Dumps are converted to Chrome trace JSON on the
+ * host with tools/evtrace.
+ *
+ * Writers never block and never disable interrupts: a slot is claimed
+ * with an atomic increment of the ring head, so trace points are safe in
+ * any task and in ISRs. A writer preempted between claiming and filling
+ * its slot can leave that one slot torn if the ring wraps onto it first;
+ * stop recording before dumping to get a consistent snapshot.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "evtrace_format.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_EVTRACE_ENABLED
+
+#define EVTRACE_BEGIN(id, arg)      evtrace_emit((id), EVTRACE_TYPE_BEGIN, (arg))
+#define EVTRACE_END(id, arg)        evtrace_emit((id), EVTRACE_TYPE_END, (arg))
+#define EVTRACE_INSTANT(id, arg)    evtrace_emit((id), EVTRACE_TYPE_INSTANT, (arg))
+
+#else
+
+// sizeof keeps variables computed only for the payload "used", unevaluated
+#define EVTRACE_BEGIN(id, arg)      do { (void)sizeof(arg); } while (0)
+#define EVTRACE_END(id, arg)        do { (void)sizeof(arg); } while (0)
+#define EVTRACE_INSTANT(id, arg)    do { (void)sizeof(arg); } while (0)
+
+#endif // CONFIG_EVTRACE_ENABLED
+
+/**
+ * @brief Record one event if recording is on
+ *
+ * Use the EVTRACE_* macros so trace points vanish with the tracer
+ * compiled out.
+ */
+void evtrace_emit(uint16_t id, uint8_t type, uint32_t arg);
+
+/**
+ * @brief Clear the rings and start recording
+ *
+ * @return ESP_OK, or ESP_ERR_NOT_SUPPORTED when compiled out
+ */
+esp_err_t evtrace_start(void);
+
+/**
+ * @brief Stop recording, keeping the recorded events
+ */
+void evtrace_stop(void);
+
+/**
+ * @brief Whether events are being recorded
+ */
+bool evtrace_is_running(void);
+
+/**
+ * @brief Events currently held, over all cores
+ *
+ * @param[out] dropped Events overwritten since the start, may be NULL
+ */
+uint32_t evtrace_count(uint32_t *dropped);
+
+/**
+ * @brief Print the recorded events in the format of evtrace_format.h
+ *
+ * @param out Stream to print to, e.g. stdout for the console
+ */
+void evtrace_dump(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file evtrace_format.h
+ * @brief Binary event layout and dump format of the event tracer
+ *
+ * Kept free of ESP-IDF dependencies so the host converter (tools/evtrace)
+ * can share it. A dump is a run of lines, possibly mixed with other log
+ * output:
+ *
+ *   EVTRACE H <version> <event_count> <dropped>
+ *   EVTRACE E <32 hex digits: one evtrace_event_t, little endian>
+ *   EVTRACE T <task id, hex> <name>
+ *
+ * H opens a dump, followed by the events of each core oldest first and
+ * then the names of the tasks that were alive at dump time. dropped is
+ * the number of events overwritten before the dump. The name is last
+ * because task names may contain spaces.
+ */
+
+#ifndef EVTRACE_FORMAT_H
+#define EVTRACE_FORMAT_H
+
+#include <stdint.h>
+
+#define EVTRACE_LINE_PREFIX     "EVTRACE"
+#define EVTRACE_FORMAT_VERSION  1
+#define EVTRACE_NAME_LEN        16      // configMAX_TASK_NAME_LEN
+
+/** Event types, the same letters as the Chrome trace "ph" field */
+#define EVTRACE_TYPE_BEGIN      'B'
+#define EVTRACE_TYPE_END        'E'
+#define EVTRACE_TYPE_INSTANT    'i'
+
+/**
+ * Trace points with the arg of their begin, then end event. Append only,
+ * the host converter names them by number.
+ */
+typedef enum {
+    EVTRACE_ID_SMBUS_POLL = 1,          ///< SMBUS_poll(), arg = 0, then packs attached
+    EVTRACE_ID_BATMON_GET_MEMORY,       ///< BATMON_getMemory(), arg = I2C address, then success
+    EVTRACE_ID_FS_WRITE_DATA,           ///< battery_fs_write_data(), arg = log count, then esp_err_t
+    EVTRACE_ID_FLASH_WAIT_READY,        ///< spiflash_wait_ready(), arg = timeout ms, then polls
+    EVTRACE_ID_BATMON_DOWNLOAD,         ///< Memory download of one pack, arg = slot, then esp_err_t
+    EVTRACE_ID_SYSTEM_STATE,            ///< Instant: system state change, arg = new system_state_t
+    EVTRACE_ID_FS_SUSPEND,              ///< Instant: battery_fs_suspend(), arg = calls in progress
+    EVTRACE_ID_COUNT
+} evtrace_id_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp_us;              ///< esp_timer time, low 32 bits
+    uint16_t id;                        ///< evtrace_id_t
+    uint8_t type;                       ///< EVTRACE_TYPE_*
+    uint8_t core;
+    uint32_t task;                      ///< Task handle, low 32 bits
+    uint32_t arg;
+} evtrace_event_t;
+
+_Static_assert(sizeof(evtrace_event_t) == 16, "evtrace_event_t must stay 16 bytes");
+
+static inline const char *evtrace_id_name(uint16_t id) {
+    switch (id) {
+    case EVTRACE_ID_SMBUS_POLL:         return "SMBUS_poll";
+    case EVTRACE_ID_BATMON_GET_MEMORY:  return "BATMON_getMemory";
+    case EVTRACE_ID_FS_WRITE_DATA:      return "battery_fs_write_data";
+    case EVTRACE_ID_FLASH_WAIT_READY:   return "spiflash_wait_ready";
+    case EVTRACE_ID_BATMON_DOWNLOAD:    return "download_battery_memory";
+    case EVTRACE_ID_SYSTEM_STATE:       return "system_state";
+    case EVTRACE_ID_FS_SUSPEND:         return "battery_fs_suspend";
+    default:                            return NULL;
+    }
+}
+
+#endif // EVTRACE_FORMAT_H
@@ -3,6 +3,35 @@
  * @brief SPI Flash Memory Driver for ESP-IDF
  * 
  * Supports SPI NAND flash chips (W25N, GD5F, etc.)
+ * 
+ * On the linux target the same API is backed by a memory-mapped image
+ * file (see spiflash_geometry.h for the layout), so everything above the
+ * driver runs unchanged at host speed. The time counters in
+ * spiflash_stats_t are then modeled from the configured clock and the
+ * chip's typical array times instead of measured.
+ *
+ * A handle can be shared between tasks. Every public call runs its whole
+ * command sequence (write enable, load, execute, status polls) under the
+ * handle's mutex, and on hardware holds the SPI bus for the sequence with
+ * spi_device_acquire_bus(), so sequences never interleave and the
+ * transactions inside skip per-transaction bus arbitration. Other devices
+ * on the same SPI host wait while a sequence runs, erases included.
+ *
+ * With cache_pages set, page reads go through a RAM cache of that many
+ * pages (CLOCK replacement). Programs and erases invalidate what they
+ * touch, spare area reads always go to the chip.
+ *
+ * With readahead_pages set as well, a run of consecutive page reads makes
+ * the driver read the pages ahead of it into the cache in one command
+ * sequence. On chips with a sequential cache read (31h/3Fh) the array read
+ * of each page then overlaps the transfer of the one before, so scans run
+ * at close to the bus rate. Without it (the W25N01GV) prefetching saves no
+ * bus time and reads past the end of every scan, so read-ahead stays off.
+ *
+ * spiflash_read_page() copies the page into the caller's buffer. With the
+ * cache, spiflash_borrow_page() lends the cached page itself instead: the
+ * chip transfers it by DMA into a cache slot and the caller parses it in
+ * place, then hands it back with spiflash_release_page().
  */
 
 #ifndef SPIFLASH_H
@@ -10,8 +39,15 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "driver/spi_master.h"
+#endif
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "spiflash_geometry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,20 +66,12 @@ extern "C" {
 #define SPIFLASH_CMD_READ_BBM           0xA5  // Read bad block markers
 #define SPIFLASH_CMD_BLOCK_ERASE        0xD8
 #define SPIFLASH_CMD_PAGE_READ          0x13  // Read from NAND to internal buffer
-#define SPIFLASH_CMD_PAGE_READ_CACHE    0x3F  // Cache read
+#define SPIFLASH_CMD_PAGE_READ_CACHE_SEQ 0x31 // Cache read: next page to the cache, load the one after
+#define SPIFLASH_CMD_PAGE_READ_CACHE    0x3F  // Cache read: last page to the cache, ends the sequence
 #define SPIFLASH_CMD_PROGRAM_LOAD       0x02  // Load data into program cache
 #define SPIFLASH_CMD_PROGRAM_EXECUTE    0x10  // Execute program from cache
 #define SPIFLASH_CMD_PROGRAM_LOAD_RND   0x84  // Random program load
 
-/**
- * @brief SPI NAND Flash memory parameters
- */
-#define SPIFLASH_PAGE_SIZE              2048
-#define SPIFLASH_OOB_SIZE               64
-#define SPIFLASH_PAGES_PER_BLOCK        64
-#define SPIFLASH_BLOCK_SIZE             (SPIFLASH_PAGE_SIZE * SPIFLASH_PAGES_PER_BLOCK)
-#define SPIFLASH_TOTAL_BLOCKS           1024  // 1GB chip
-
 /**
  * @brief Status register bits
  */
@@ -56,21 +84,84 @@ extern "C" {
  * @brief SPI Flash configuration structure
  */
 typedef struct {
+#if !CONFIG_IDF_TARGET_LINUX
     spi_host_device_t host_id;      // SPI host (SPI2_HOST or SPI3_HOST)
+#else
+    int host_id;                    // Unused on linux
+#endif
     int pin_mosi;                   // MOSI pin
     int pin_miso;                   // MISO pin
     int pin_sclk;                   // SCLK pin
     int pin_cs;                     // CS pin
-    int clock_speed_hz;             // SPI clock speed (Hz)
+    int clock_speed_hz;             // SPI clock speed (Hz), also the modeled clock on linux
+    int spi_mode;                   // SPI mode, 0 or 3 (the chip samples on the rising edge in both)
+    const char *image_path;         // NAND image file (linux target only)
+    uint32_t image_blocks;          // Blocks in a newly created image, 0 = full chip (linux target only)
+    bool model_realtime;            // Hold the handle for the modeled time of each call (linux target only)
+    uint32_t cache_pages;           // Page read cache size in pages, 0 = no cache
+    bool cache_psram;               // Allocate the page cache in PSRAM when available
+    uint32_t readahead_pages;       // Pages prefetched on sequential reads, 0 = none, at most cache_pages / 2 (cache read chips only)
+    bool model_cache_read;          // Emulate a chip with the 31h/3Fh cache read (linux target only)
 } spiflash_config_t;
 
+/**
+ * @brief Operation a handle is running, see spiflash_current_op()
+ */
+typedef enum {
+    SPIFLASH_OP_NONE = 0,
+    SPIFLASH_OP_READ,               // Page, spare area or register read
+    SPIFLASH_OP_PROGRAM,
+    SPIFLASH_OP_ERASE,
+} spiflash_op_t;
+
+/**
+ * @brief Operation counters, kept per handle
+ */
+typedef struct {
+    uint32_t pages_read;            // Page loads into the chip buffer (data or spare reads)
+    uint32_t pages_programmed;
+    uint32_t blocks_erased;
+    uint64_t bytes_read;            // Data and spare bytes transferred to the host
+    uint64_t bytes_programmed;      // Data and spare bytes loaded into the chip
+    uint64_t spi_us;                // Time in SPI transactions outside busy-waits
+    uint64_t busy_us;               // Time in spiflash_wait_ready(), status polls included
+    uint32_t busy_polls;            // Status register reads while waiting
+    uint32_t lock_waits;            // Calls that found the handle busy with another task
+    uint64_t lock_wait_us;          // Time those calls waited for it
+    uint32_t cache_hits;            // Page reads served from the page cache
+    uint32_t cache_misses;          // Page reads that went to the chip with the cache enabled
+    uint32_t cache_evictions;       // Cached pages replaced to make room
+    uint32_t readahead_pages;       // Pages prefetched into the cache
+    uint32_t readahead_used;        // Prefetched pages read before they were evicted
+    uint64_t bytes_copied;          // Page bytes copied by the CPU from the cache into read buffers
+    uint32_t pages_borrowed;        // Pages lent out by spiflash_borrow_page()
+} spiflash_stats_t;
+
 /**
  * @brief SPI NAND Flash device handle
  */
 typedef struct {
+#if !CONFIG_IDF_TARGET_LINUX
     spi_device_handle_t spi_handle;
+#else
+    int image_fd;                   // Backing image file
+    uint8_t *image;                 // Memory-mapped NAND array (SPIFLASH_RAW_PAGE_SIZE per page)
+    uint32_t total_blocks;          // Blocks present in the image
+    uint32_t program_violations;    // Programs over already programmed bytes
+    uint32_t clock_speed_hz;        // Clock the transfer times are modeled at
+    uint64_t model_spi_ns;          // Modeled times, reported in stats in us
+    uint64_t model_busy_ns;
+    bool model_realtime;            // Sleep out the modeled time before unlocking
+    int64_t model_lock_us;          // When the current call took the handle
+    uint64_t model_lock_ns;         // Modeled time charged before it
+#endif
+    SemaphoreHandle_t lock;         // Held for a whole command sequence
+    volatile spiflash_op_t op;      // Set while the lock is held
+    struct spiflash_cache *cache;   // Page read cache, NULL when disabled
+    bool cache_read;                // Chip has the 31h/3Fh sequential cache read
     uint8_t jedec_id[3];            // Manufacturer ID, Memory Type, Capacity
     uint32_t total_size;            // Total flash size in bytes (1GB = 1024 * 128KB blocks)
+    spiflash_stats_t stats;         // Completed operations since init or spiflash_reset_stats()
 } spiflash_handle_t;
 
 /**
@@ -110,6 +201,34 @@ esp_err_t spiflash_read_jedec_id(spiflash_handle_t *handle, uint8_t *id);
 esp_err_t spiflash_read_page(spiflash_handle_t *handle, uint32_t page_num, 
                              uint8_t *buffer);
 
+/**
+ * @brief Borrow a page from the page cache without copying it
+ * 
+ * The page is read into the cache first if needed, read-ahead included,
+ * as for spiflash_read_page(). Its slot stays pinned and unchanged until
+ * released: programming or erasing the page meanwhile leaves the borrowed
+ * data as it was, and later reads see the new contents. Release every
+ * borrow, a cache with every slot borrowed can read nothing more.
+ * 
+ * @param handle Device handle, opened with cache_pages set
+ * @param page_num Page number to read
+ * @param data Output: SPIFLASH_PAGE_SIZE bytes of page data, DMA-capable
+ *             and 64-byte aligned
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED without a page cache,
+ *         ESP_ERR_NO_MEM with every cache slot borrowed
+ */
+esp_err_t spiflash_borrow_page(spiflash_handle_t *handle, uint32_t page_num,
+                               const uint8_t **data);
+
+/**
+ * @brief Hand back a page from spiflash_borrow_page()
+ * 
+ * @param handle Device handle
+ * @param data Pointer returned by spiflash_borrow_page()
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if `data` is not borrowed
+ */
+esp_err_t spiflash_release_page(spiflash_handle_t *handle, const uint8_t *data);
+
 /**
  * @brief Write a page to flash
  * 
@@ -121,6 +240,31 @@ esp_err_t spiflash_read_page(spiflash_handle_t *handle, uint32_t page_num,
 esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num, 
                               const uint8_t *data);
 
+/**
+ * @brief Read the spare (OOB) area of a page
+ * 
+ * @param handle Device handle
+ * @param page_num Page number to read
+ * @param oob Buffer to store spare data
+ * @param len Number of spare bytes to read (max SPIFLASH_OOB_SIZE)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t spiflash_read_oob(spiflash_handle_t *handle, uint32_t page_num,
+                            uint8_t *oob, size_t len);
+
+/**
+ * @brief Write a page to flash together with its spare (OOB) area
+ * 
+ * @param handle Device handle
+ * @param page_num Page number to write to
+ * @param data Data to write (2048 bytes)
+ * @param oob Spare data written after the page data
+ * @param oob_len Number of spare bytes (max SPIFLASH_OOB_SIZE)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t spiflash_write_page_oob(spiflash_handle_t *handle, uint32_t page_num,
+                                  const uint8_t *data, const uint8_t *oob, size_t oob_len);
+
 /**
  * @brief Erase a 128KB block
  * 
@@ -148,6 +292,35 @@ esp_err_t spiflash_read_status(spiflash_handle_t *handle, uint8_t *status);
  */
 esp_err_t spiflash_wait_ready(spiflash_handle_t *handle, uint32_t timeout_ms);
 
+/**
+ * @brief Get the operation counters
+ * 
+ * @param handle Device handle
+ * @param stats Output: counters
+ * @return ESP_OK on success
+ */
+esp_err_t spiflash_get_stats(spiflash_handle_t *handle, spiflash_stats_t *stats);
+
+/**
+ * @brief Operation the handle is running right now
+ *
+ * Reads one field without the handle lock, so it can be called from a
+ * fault handler while another task is in the middle of an erase. The
+ * answer may be stale by the time it returns.
+ *
+ * @param handle Device handle
+ * @return SPIFLASH_OP_NONE when idle or handle is NULL
+ */
+spiflash_op_t spiflash_current_op(const spiflash_handle_t *handle);
+
+/**
+ * @brief Zero the operation counters
+ * 
+ * @param handle Device handle
+ * @return ESP_OK on success
+ */
+esp_err_t spiflash_reset_stats(spiflash_handle_t *handle);
+
 #ifdef __cplusplus
 }
 #endif
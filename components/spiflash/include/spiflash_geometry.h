@@ -0,0 +1,33 @@
+/**
+ * @file spiflash_geometry.h
+ * @brief SPI NAND geometry and raw image layout
+ * 
+ * Kept free of ESP-IDF dependencies so host tools can share it.
+ * 
+ * A raw image (linux backend, or a dump pulled from a field unit) stores
+ * every page as SPIFLASH_PAGE_SIZE data bytes followed by SPIFLASH_OOB_SIZE
+ * spare bytes, pages in ascending order with no header. The number of
+ * blocks follows from the file size.
+ */
+
+#ifndef SPIFLASH_GEOMETRY_H
+#define SPIFLASH_GEOMETRY_H
+
+/**
+ * @brief SPI NAND Flash memory parameters
+ */
+#define SPIFLASH_PAGE_SIZE              2048
+#define SPIFLASH_OOB_SIZE               64
+#define SPIFLASH_PAGES_PER_BLOCK        64
+#define SPIFLASH_BLOCK_SIZE             (SPIFLASH_PAGE_SIZE * SPIFLASH_PAGES_PER_BLOCK)
+#define SPIFLASH_TOTAL_BLOCKS           1024  // 1GB chip
+#define SPIFLASH_TOTAL_PAGES            (SPIFLASH_TOTAL_BLOCKS * SPIFLASH_PAGES_PER_BLOCK)
+
+/**
+ * @brief Raw image layout (data + spare per page)
+ */
+#define SPIFLASH_RAW_PAGE_SIZE          (SPIFLASH_PAGE_SIZE + SPIFLASH_OOB_SIZE)
+#define SPIFLASH_RAW_BLOCK_SIZE         (SPIFLASH_RAW_PAGE_SIZE * SPIFLASH_PAGES_PER_BLOCK)
+#define SPIFLASH_BAD_BLOCK_MARKER_OFFSET 0    // Spare byte checked on a block's first page
+
+#endif // SPIFLASH_GEOMETRY_H
@@ -0,0 +1,142 @@
+/**
+ * @file spiflash_sched.h
+ * @brief Priority-aware I/O scheduler in front of a spiflash handle
+ *
+ * The handle mutex serializes command sequences but serves waiters in no
+ * particular order, so a page program persisting a just-connected pack can
+ * queue behind a run of export reads or an erase. The scheduler admits
+ * one operation at a time and, when the device frees up, picks the next
+ * waiter by class:
+ *  - a waiter whose class deadline has passed goes first, the most overdue
+ *    one first, so lower classes are never starved
+ *  - otherwise the highest class, first come first served within a class
+ *
+ * Every operation is one unit: a page read, spare read, page program or
+ * block erase. Multi-page work goes through spiflash_sched_read_pages(),
+ * which queues again before every page, so a foreground request waits at
+ * most one page operation behind background work. A block erase cannot be
+ * split; erases below the foreground class are held back while foreground
+ * requests keep arriving (erase_holdoff_us), up to their own deadline.
+ *
+ * All users of a handle should go through its scheduler: direct spiflash
+ * calls still serialize on the handle, but bypass the ordering.
+ */
+
+#ifndef SPIFLASH_SCHED_H
+#define SPIFLASH_SCHED_H
+
+#include "spiflash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPIFLASH_SCHED_HIST_BUCKETS 24
+
+/**
+ * @brief Priority classes, highest first
+ */
+typedef enum {
+    SPIFLASH_IO_FOREGROUND = 0,     ///< Persisting acquired records
+    SPIFLASH_IO_NORMAL,             ///< Interactive reads: console, exports
+    SPIFLASH_IO_BACKGROUND,         ///< Housekeeping: garbage collection, scrubbing, pre-erase
+    SPIFLASH_IO_CLASSES
+} spiflash_io_class_t;
+
+typedef struct {
+    uint32_t deadline_us[SPIFLASH_IO_CLASSES]; ///< Queue wait after which a request overtakes higher classes, 0 = default
+    uint32_t erase_holdoff_us;      ///< Quiet time after a foreground request before a lower class erase starts, 0 = default
+} spiflash_sched_config_t;
+
+/**
+ * @brief Queueing counters of one class
+ *
+ * Queue wait runs from the request to the moment it gets the device.
+ * Histogram bucket b counts waits in [2^b, 2^(b+1)) us, bucket 0 also
+ * counts 0 and the last bucket everything above.
+ */
+typedef struct {
+    uint32_t ops;                   ///< Operations served
+    uint32_t queued;                ///< Operations that found the device busy
+    uint64_t wait_us;               ///< Total queue wait
+    uint32_t max_wait_us;
+    uint32_t late;                  ///< Served after their deadline
+    uint32_t promoted;              ///< Served ahead of a higher class waiter, being overdue
+    uint32_t holdoffs;              ///< Erases held back for foreground traffic
+    uint32_t hist[SPIFLASH_SCHED_HIST_BUCKETS];
+} spiflash_sched_class_stats_t;
+
+typedef struct {
+    spiflash_sched_class_stats_t cls[SPIFLASH_IO_CLASSES];
+} spiflash_sched_stats_t;
+
+typedef struct spiflash_sched spiflash_sched_t;
+
+/**
+ * @brief Create a scheduler for a handle
+ *
+ * @param flash Handle the operations run on, must outlive the scheduler
+ * @param config Deadlines, NULL for the defaults
+ * @param sched Output: scheduler
+ * @return ESP_OK on success, ESP_ERR_NO_MEM
+ */
+esp_err_t spiflash_sched_create(spiflash_handle_t *flash, const spiflash_sched_config_t *config,
+                                spiflash_sched_t **sched);
+
+/**
+ * @brief Delete a scheduler, no operation may be queued
+ */
+void spiflash_sched_delete(spiflash_sched_t *sched);
+
+/**
+ * @brief Scheduled spiflash_read_page()
+ */
+esp_err_t spiflash_sched_read_page(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                   uint32_t page_num, uint8_t *buffer);
+
+/**
+ * @brief Read consecutive pages, queueing separately for each page
+ *
+ * @param buffer Output: count * SPIFLASH_PAGE_SIZE bytes
+ */
+esp_err_t spiflash_sched_read_pages(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                    uint32_t first_page, uint32_t count, uint8_t *buffer);
+
+/**
+ * @brief Scheduled spiflash_read_oob()
+ */
+esp_err_t spiflash_sched_read_oob(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                  uint32_t page_num, uint8_t *oob, size_t len);
+
+/**
+ * @brief Scheduled spiflash_write_page_oob()
+ */
+esp_err_t spiflash_sched_write_page_oob(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                        uint32_t page_num, const uint8_t *data,
+                                        const uint8_t *oob, size_t oob_len);
+
+/**
+ * @brief Scheduled spiflash_erase_block()
+ */
+esp_err_t spiflash_sched_erase_block(spiflash_sched_t *sched, spiflash_io_class_t cls, uint32_t block_num);
+
+/**
+ * @brief Get the per-class queueing counters
+ */
+esp_err_t spiflash_sched_get_stats(spiflash_sched_t *sched, spiflash_sched_stats_t *stats);
+
+/**
+ * @brief Zero the per-class queueing counters
+ */
+esp_err_t spiflash_sched_reset_stats(spiflash_sched_t *sched);
+
+/**
+ * @brief Queue wait percentile of a class from its histogram (upper bucket bound)
+ */
+uint32_t spiflash_sched_wait_percentile(const spiflash_sched_class_stats_t *stats, unsigned pct);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPIFLASH_SCHED_H
@@ -4,7 +4,10 @@
  */
 
 #include "spiflash.h"
+#include "spiflash_cache.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "evtrace.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <string.h>
@@ -15,6 +18,58 @@ static const char *TAG = "SPIFLASH";
 
 #define SPIFLASH_TIMEOUT_MS         5000
 #define SPIFLASH_ERASE_TIMEOUT_MS   10000
+#define SPIFLASH_MFR_MICRON         0x2C    // MT29F: sequential cache read (31h/3Fh)
+
+// The *_locked functions run inside a command sequence: the caller holds
+// the handle lock and the bus, or owns the handle during init
+static esp_err_t spiflash_read_status_locked(spiflash_handle_t *handle, uint8_t *status);
+static esp_err_t spiflash_wait_ready_locked(spiflash_handle_t *handle, uint32_t timeout_ms);
+
+static inline bool spiflash_page_valid(const spiflash_handle_t *handle, uint32_t page_num) {
+    return page_num < handle->total_size / SPIFLASH_PAGE_SIZE;
+}
+
+// A wrapped row address would land on another block, refuse it up front
+static inline bool spiflash_block_valid(const spiflash_handle_t *handle, uint32_t block_num) {
+    return block_num < handle->total_size / SPIFLASH_BLOCK_SIZE;
+}
+
+/**
+ * @brief Run one SPI transaction and account its time
+ */
+static esp_err_t spiflash_transmit(spiflash_handle_t *handle, spi_transaction_t *trans) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = spi_device_polling_transmit(handle->spi_handle, trans);
+    handle->stats.spi_us += esp_timer_get_time() - start;
+    return ret;
+}
+
+/**
+ * @brief Take the handle and the SPI bus for one command sequence
+ */
+static esp_err_t spiflash_lock(spiflash_handle_t *handle, spiflash_op_t op) {
+    if (xSemaphoreTake(handle->lock, 0) != pdTRUE) {
+        int64_t start = esp_timer_get_time();
+        xSemaphoreTake(handle->lock, portMAX_DELAY);
+        handle->stats.lock_waits++;
+        handle->stats.lock_wait_us += esp_timer_get_time() - start;
+    }
+
+    // Transactions skip bus arbitration until the release
+    esp_err_t ret = spi_device_acquire_bus(handle->spi_handle, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(handle->lock);
+        return ret;
+    }
+    handle->op = op;
+    return ESP_OK;
+}
+
+static void spiflash_unlock(spiflash_handle_t *handle) {
+    handle->op = SPIFLASH_OP_NONE;
+    spi_device_release_bus(handle->spi_handle);
+    xSemaphoreGive(handle->lock);
+}
 
 /**
  * @brief Send a command with optional data
@@ -38,7 +93,7 @@ static esp_err_t spiflash_send_command(spiflash_handle_t *handle,
             .rx_buffer = rx_buf,
         };
         
-        esp_err_t ret = spi_device_polling_transmit(handle->spi_handle, &trans);
+        esp_err_t ret = spiflash_transmit(handle, &trans);
         free(tx_buf);
         
         if (ret == ESP_OK && rx_len > 0) {
@@ -54,7 +109,7 @@ static esp_err_t spiflash_send_command(spiflash_handle_t *handle,
             .tx_buffer = cmd_buf,
             .rx_buffer = NULL,
         };
-        return spi_device_polling_transmit(handle->spi_handle, &trans);
+        return spiflash_transmit(handle, &trans);
     }
     
     return ESP_ERR_INVALID_ARG;
@@ -107,7 +162,7 @@ static esp_err_t spiflash_write_status_register(spiflash_handle_t *handle, uint8
     }
     
     // Wait for write to complete
-    return spiflash_wait_ready(handle, SPIFLASH_TIMEOUT_MS);
+    return spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
 }
 
 /**
@@ -132,7 +187,7 @@ static esp_err_t spiflash_clear_block_protection(spiflash_handle_t *handle) {
  */
 static esp_err_t spiflash_verify_wel(spiflash_handle_t *handle) {
     uint8_t status;
-    esp_err_t ret = spiflash_read_status(handle, &status);
+    esp_err_t ret = spiflash_read_status_locked(handle, &status);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -146,11 +201,7 @@ static esp_err_t spiflash_verify_wel(spiflash_handle_t *handle) {
     return ESP_OK;
 }
 
-esp_err_t spiflash_read_status(spiflash_handle_t *handle, uint8_t *status) {
-    if (handle == NULL || status == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    
+static esp_err_t spiflash_read_status_locked(spiflash_handle_t *handle, uint8_t *status) {
     uint8_t cmd[2];
     uint8_t rx[1];
     cmd[0] = SPIFLASH_CMD_READ_STATUS;
@@ -164,32 +215,70 @@ esp_err_t spiflash_read_status(spiflash_handle_t *handle, uint8_t *status) {
     return ret;
 }
 
-esp_err_t spiflash_wait_ready(spiflash_handle_t *handle, uint32_t timeout_ms) {
-    if (handle == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    
+static esp_err_t spiflash_wait_ready_locked(spiflash_handle_t *handle, uint32_t timeout_ms) {
     uint32_t start = xTaskGetTickCount();
     uint8_t status;
+    esp_err_t ret;
+
+    // The status polls count as busy time, not as SPI transfer time
+    int64_t wait_start = esp_timer_get_time();
+    uint64_t spi_us = handle->stats.spi_us;
+    uint32_t polls = handle->stats.busy_polls;
+    EVTRACE_BEGIN(EVTRACE_ID_FLASH_WAIT_READY, timeout_ms);
     
     while (1) {
-        esp_err_t ret = spiflash_read_status(handle, &status);
+        ret = spiflash_read_status_locked(handle, &status);
+        handle->stats.busy_polls++;
         if (ret != ESP_OK) {
-            return ret;
+            break;
         }
         
         // Bit 0 is OIP (operation in progress)
         if ((status & SPIFLASH_STATUS_BUSY) == 0) {
-            return ESP_OK;
+            break;
         }
         
         if ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS > timeout_ms) {
             ESP_LOGE(TAG, "Timeout waiting for flash ready");
-            return ESP_ERR_TIMEOUT;
+            ret = ESP_ERR_TIMEOUT;
+            break;
         }
         
         vTaskDelay(pdMS_TO_TICKS(1));
     }
+
+    handle->stats.spi_us = spi_us;
+    handle->stats.busy_us += esp_timer_get_time() - wait_start;
+    EVTRACE_END(EVTRACE_ID_FLASH_WAIT_READY, handle->stats.busy_polls - polls);
+    return ret;
+}
+
+esp_err_t spiflash_read_status(spiflash_handle_t *handle, uint8_t *status) {
+    if (handle == NULL || status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_READ);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spiflash_read_status_locked(handle, status);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_wait_ready(spiflash_handle_t *handle, uint32_t timeout_ms) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_READ);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spiflash_wait_ready_locked(handle, timeout_ms);
+    spiflash_unlock(handle);
+    return ret;
 }
 
 esp_err_t spiflash_read_jedec_id(spiflash_handle_t *handle, uint8_t *id) {
@@ -212,7 +301,12 @@ esp_err_t spiflash_read_jedec_id(spiflash_handle_t *handle, uint8_t *id) {
         .rx_buffer = rx_buf,
     };
     
-    esp_err_t ret = spi_device_polling_transmit(handle->spi_handle, &trans);
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_READ);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spiflash_transmit(handle, &trans);
+    spiflash_unlock(handle);
     if (ret == ESP_OK) {
         // ID bytes are at rx_buf[1], rx_buf[2], rx_buf[3]
         id[0] = rx_buf[1];
@@ -223,19 +317,17 @@ esp_err_t spiflash_read_jedec_id(spiflash_handle_t *handle, uint8_t *id) {
     return ret;
 }
 
-esp_err_t spiflash_read_page(spiflash_handle_t *handle, uint32_t page_num, 
-                             uint8_t *buffer) {
-    if (handle == NULL || buffer == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    
+/**
+ * @brief Load a NAND page into the chip's internal data buffer
+ */
+static esp_err_t spiflash_load_page(spiflash_handle_t *handle, uint32_t page_num) {
     // Wait for flash to be ready
-    esp_err_t ret = spiflash_wait_ready(handle, SPIFLASH_TIMEOUT_MS);
+    esp_err_t ret = spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
     if (ret != ESP_OK) {
         return ret;
     }
     
-    // Step 1: Send PAGE READ command to load page into buffer
+    // Send PAGE READ command to load page into buffer
     uint8_t cmd[4];
     cmd[0] = SPIFLASH_CMD_PAGE_READ;
     cmd[1] = (page_num >> 16) & 0xFF;
@@ -249,45 +341,56 @@ esp_err_t spiflash_read_page(spiflash_handle_t *handle, uint32_t page_num,
     }
     
     // Wait for page to be loaded into internal buffer
-    ret = spiflash_wait_ready(handle, SPIFLASH_TIMEOUT_MS);
-    if (ret != ESP_OK) {
-        return ret;
-    }
-    
-    // Step 2: Read data from buffer (0x03 + 2-byte column address + 1 dummy byte, then read data)
-    uint8_t tx_buf[4] = {0x03, 0x00, 0x00, 0x00};
-    size_t rx_len = 4 + SPIFLASH_PAGE_SIZE;
-    uint8_t *rx_buf = malloc(rx_len);
-    if (!rx_buf) {
-        return ESP_ERR_NO_MEM;
+    ret = spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
+    if (ret == ESP_OK) {
+        handle->stats.pages_read++;
     }
+    return ret;
+}
 
-    spi_transaction_t trans = {
-        .length = rx_len * 8,
+/**
+ * @brief Read from the chip's internal data buffer starting at a column
+ *
+ * The data phase is its own transaction with CS held from the command on,
+ * so the page arrives by DMA straight in `buffer`.
+ */
+static esp_err_t spiflash_read_buffer(spiflash_handle_t *handle, uint16_t column,
+                                      uint8_t *buffer, size_t len) {
+    // 0x03 + 2-byte column address + 1 dummy byte, then read data
+    uint8_t tx_buf[4] = {0x03, (column >> 8) & 0xFF, column & 0xFF, 0x00};
+    spi_transaction_t cmd = {
+        .flags = SPI_TRANS_CS_KEEP_ACTIVE,
+        .length = sizeof(tx_buf) * 8,
         .tx_buffer = tx_buf,
-        .rx_buffer = rx_buf,
+    };
+    spi_transaction_t data = {
+        .length = len * 8,
+        .rx_buffer = buffer,
     };
 
-    ret = spi_device_polling_transmit(handle->spi_handle, &trans);
+    // The bus is held by spiflash_lock(), as CS_KEEP_ACTIVE requires
+    esp_err_t ret = spiflash_transmit(handle, &cmd);
     if (ret == ESP_OK) {
-        // Copy only the data portion (skip first 4 bytes: command + address + dummy)
-        memcpy(buffer, rx_buf + 4, SPIFLASH_PAGE_SIZE);
+        ret = spiflash_transmit(handle, &data);
+    }
+    if (ret == ESP_OK) {
+        handle->stats.bytes_read += len;
     } else {
         ESP_LOGE(TAG, "Page read data failed: %s", esp_err_to_name(ret));
     }
-
-    free(rx_buf);
     return ret;
 }
 
-esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num, 
-                              const uint8_t *data) {
-    if (handle == NULL || data == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    
+/**
+ * @brief Program a page, optionally followed by spare area bytes
+ */
+static esp_err_t spiflash_program(spiflash_handle_t *handle, uint32_t page_num,
+                                  const uint8_t *data, const uint8_t *oob, size_t oob_len) {
+    // Whatever happens below, the cached copy may no longer match the page
+    spiflash_cache_invalidate(handle->cache, page_num, 1);
+
     // Wait for flash to be ready
-    esp_err_t ret = spiflash_wait_ready(handle, SPIFLASH_TIMEOUT_MS);
+    esp_err_t ret = spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -305,8 +408,9 @@ esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num,
         return ret;
     }
     
-    // Step 2: Load program data into buffer (command 0x02 + 2 address bytes + data)
-    uint8_t *tx_buf = malloc(3 + SPIFLASH_PAGE_SIZE);
+    // Step 2: Load program data into buffer (command 0x02 + 2 address bytes + data + spare)
+    size_t load_len = 3 + SPIFLASH_PAGE_SIZE + oob_len;
+    uint8_t *tx_buf = malloc(load_len);
     if (tx_buf == NULL) {
         return ESP_ERR_NO_MEM;
     }
@@ -315,14 +419,17 @@ esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num,
     tx_buf[1] = 0x00;  // Column address high byte
     tx_buf[2] = 0x00;  // Column address low byte
     memcpy(tx_buf + 3, data, SPIFLASH_PAGE_SIZE);
+    if (oob_len > 0) {
+        memcpy(tx_buf + 3 + SPIFLASH_PAGE_SIZE, oob, oob_len);
+    }
     
     spi_transaction_t trans = {
-        .length = (3 + SPIFLASH_PAGE_SIZE) * 8,
+        .length = load_len * 8,
         .tx_buffer = tx_buf,
         .rx_buffer = NULL,
     };
     
-    ret = spi_device_polling_transmit(handle->spi_handle, &trans);
+    ret = spiflash_transmit(handle, &trans);
     free(tx_buf);
     
     if (ret != ESP_OK) {
@@ -345,7 +452,7 @@ esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num,
     }
     
     // Wait for program to complete (OIP bit will be 1 while programming)
-    ret = spiflash_wait_ready(handle, SPIFLASH_TIMEOUT_MS);
+    ret = spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Timeout waiting for program complete");
         return ret;
@@ -353,7 +460,7 @@ esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num,
     
     // Check for program failure
     uint8_t status;
-    ret = spiflash_read_status(handle, &status);
+    ret = spiflash_read_status_locked(handle, &status);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -363,17 +470,255 @@ esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num,
         return ESP_FAIL;
     }
     
-    ESP_LOGI(TAG, "Wrote page %" PRIu32, page_num);
+    handle->stats.pages_programmed++;
+    handle->stats.bytes_programmed += SPIFLASH_PAGE_SIZE + oob_len;
+
+    // Page writes are on the battery_fs path, keep them out of the INFO log
+    ESP_LOGD(TAG, "Wrote page %" PRIu32, page_num);
     return spiflash_write_disable(handle);
 }
 
-esp_err_t spiflash_erase_block(spiflash_handle_t *handle, uint32_t block_num) {
-    if (handle == NULL) {
+/**
+ * @brief Read `count` pages of one block from `first_page` on
+ *
+ * Without a cache the page goes to `buffer`, and count is 1. With one every
+ * page goes to a cache slot: the first is returned pinned in `*first` when
+ * asked for, the others are prefetched. With cache read the run is one
+ * sequence: PAGE READ for the first page, then per page 31h (3Fh for the
+ * last) and a buffer read, which transfers that page while the array loads
+ * the next.
+ *
+ * @return Result for the first page; later pages are best effort
+ */
+static esp_err_t spiflash_read_run(spiflash_handle_t *handle, uint32_t first_page, uint32_t count,
+                                   uint8_t *buffer, const uint8_t **first) {
+    uint32_t last_page = handle->total_size / SPIFLASH_PAGE_SIZE;
+    if (first_page + count > last_page) {
+        count = first_page < last_page ? last_page - first_page : 0;
+    }
+    if (count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bool cache_read = handle->cache_read && count > 1;
+
+    esp_err_t ret = ESP_OK;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page_num = first_page + i;
+        bool demand = i == 0 && first != NULL;
+        uint8_t *dst = buffer;
+        if (handle->cache != NULL) {
+            dst = spiflash_cache_claim(handle->cache, page_num, !demand, &handle->stats);
+            if (dst == NULL) {
+                // Every slot is borrowed
+                return i == 0 ? ESP_ERR_NO_MEM : ESP_OK;
+            }
+        }
+
+        if (i == 0 || !cache_read) {
+            ret = spiflash_load_page(handle, page_num);
+        }
+        if (ret == ESP_OK && cache_read) {
+            uint8_t cmd = i + 1 < count ? SPIFLASH_CMD_PAGE_READ_CACHE_SEQ : SPIFLASH_CMD_PAGE_READ_CACHE;
+            ret = spiflash_send_command(handle, &cmd, 1, NULL, 0);
+            if (ret == ESP_OK) {
+                ret = spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
+            }
+            if (ret == ESP_OK && i + 1 < count) {
+                handle->stats.pages_read++;  // The array is loading the next page
+            }
+        }
+        if (ret == ESP_OK) {
+            ret = spiflash_read_buffer(handle, 0, dst, SPIFLASH_PAGE_SIZE);
+        }
+
+        if (ret != ESP_OK && handle->cache != NULL) {
+            spiflash_cache_invalidate(handle->cache, page_num, 1);
+            spiflash_cache_unpin(handle->cache, dst);
+        }
+        if (ret != ESP_OK) {
+            return i == 0 ? ret : ESP_OK;
+        }
+        if (demand) {
+            *first = dst;
+        } else if (handle->cache != NULL) {
+            spiflash_cache_unpin(handle->cache, dst);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Prefetch the pages of a read-ahead window not cached yet
+ *
+ * A second scan over cached pages then stays off the chip, and a window
+ * partly cached reads only its gaps, one run each.
+ */
+static void spiflash_prefetch(spiflash_handle_t *handle, uint32_t first_page, uint32_t count) {
+    uint32_t end = first_page + count;
+    while (first_page < end) {
+        uint32_t run = spiflash_cache_uncached_run(handle->cache, &first_page, end - first_page);
+        if (run == 0 || spiflash_read_run(handle, first_page, run, NULL, NULL) != ESP_OK) {
+            return;
+        }
+        first_page += run;
+    }
+}
+
+/**
+ * @brief Read a page with the handle locked, copied to `buffer` or borrowed
+ *
+ * Exactly one of `buffer` and `borrowed` is given; borrowing needs the cache.
+ */
+static esp_err_t spiflash_read_locked(spiflash_handle_t *handle, uint32_t page_num, uint8_t *buffer,
+                                      const uint8_t **borrowed) {
+    if (handle->cache == NULL) {
+        return spiflash_read_run(handle, page_num, 1, buffer, NULL);
+    }
+
+    uint32_t ahead_first = 0;
+    uint32_t ahead = spiflash_cache_readahead(handle->cache, page_num, &ahead_first);
+    esp_err_t ret = ESP_OK;
+    const uint8_t *page = spiflash_cache_pin(handle->cache, page_num, &handle->stats);
+    if (page == NULL) {
+        // The missed page starts the run when the window follows it,
+        // up to the first page of the window already cached
+        uint32_t count = 1;
+        if (ahead > 0 && ahead_first == page_num + 1 && ahead_first % SPIFLASH_PAGES_PER_BLOCK != 0) {
+            uint32_t next = ahead_first;
+            uint32_t run = spiflash_cache_uncached_run(handle->cache, &next, ahead);
+            if (next == ahead_first) {
+                count += run;
+                ahead_first += run;
+                ahead -= run;
+            }
+        }
+        ret = spiflash_read_run(handle, page_num, count, NULL, &page);
+    }
+    if (ret == ESP_OK && ahead > 0) {
+        spiflash_prefetch(handle, ahead_first, ahead);
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (borrowed != NULL) {
+        *borrowed = page;
+        handle->stats.pages_borrowed++;
+    } else {
+        memcpy(buffer, page, SPIFLASH_PAGE_SIZE);
+        handle->stats.bytes_copied += SPIFLASH_PAGE_SIZE;
+        spiflash_cache_unpin(handle->cache, page);
+    }
+    return ESP_OK;
+}
+
+esp_err_t spiflash_read_page(spiflash_handle_t *handle, uint32_t page_num, 
+                             uint8_t *buffer) {
+    if (handle == NULL || buffer == NULL || !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_READ);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    
+    ret = spiflash_read_locked(handle, page_num, buffer, NULL);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_borrow_page(spiflash_handle_t *handle, uint32_t page_num,
+                               const uint8_t **data) {
+    if (handle == NULL || data == NULL || !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->cache == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_READ);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = spiflash_read_locked(handle, page_num, NULL, data);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_release_page(spiflash_handle_t *handle, const uint8_t *data) {
+    if (handle == NULL || data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // No bus access, the handle lock alone guards the cache
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    esp_err_t ret = spiflash_cache_unpin(handle->cache, data);
+    xSemaphoreGive(handle->lock);
+    return ret;
+}
+
+esp_err_t spiflash_read_oob(spiflash_handle_t *handle, uint32_t page_num,
+                            uint8_t *oob, size_t len) {
+    if (handle == NULL || oob == NULL || len == 0 || len > SPIFLASH_OOB_SIZE ||
+        !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_READ);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    
+    ret = spiflash_load_page(handle, page_num);
+    if (ret == ESP_OK) {
+        // Spare area starts right after the page data
+        ret = spiflash_read_buffer(handle, SPIFLASH_PAGE_SIZE, oob, len);
+    }
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num, 
+                              const uint8_t *data) {
+    if (handle == NULL || data == NULL || !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_PROGRAM);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spiflash_program(handle, page_num, data, NULL, 0);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_write_page_oob(spiflash_handle_t *handle, uint32_t page_num,
+                                  const uint8_t *data, const uint8_t *oob, size_t oob_len) {
+    if (handle == NULL || data == NULL || (oob == NULL && oob_len > 0) ||
+        oob_len > SPIFLASH_OOB_SIZE || !spiflash_page_valid(handle, page_num)) {
         return ESP_ERR_INVALID_ARG;
     }
     
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_PROGRAM);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spiflash_program(handle, page_num, data, oob, oob_len);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+/**
+ * @brief Erase a block: write enable, erase, wait, fail check
+ */
+static esp_err_t spiflash_erase(spiflash_handle_t *handle, uint32_t block_num) {
+    spiflash_cache_invalidate(handle->cache, block_num * SPIFLASH_PAGES_PER_BLOCK, SPIFLASH_PAGES_PER_BLOCK);
+
     // Wait for flash to be ready
-    esp_err_t ret = spiflash_wait_ready(handle, SPIFLASH_TIMEOUT_MS);
+    esp_err_t ret = spiflash_wait_ready_locked(handle, SPIFLASH_TIMEOUT_MS);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -408,14 +753,14 @@ esp_err_t spiflash_erase_block(spiflash_handle_t *handle, uint32_t block_num) {
     }
     
     // Wait for erase to complete
-    ret = spiflash_wait_ready(handle, SPIFLASH_ERASE_TIMEOUT_MS);
+    ret = spiflash_wait_ready_locked(handle, SPIFLASH_ERASE_TIMEOUT_MS);
     if (ret != ESP_OK) {
         return ret;
     }
     
     // Check for erase failure
     uint8_t status;
-    ret = spiflash_read_status(handle, &status);
+    ret = spiflash_read_status_locked(handle, &status);
     if (ret != ESP_OK) {
         return ret;
     }
@@ -425,12 +770,28 @@ esp_err_t spiflash_erase_block(spiflash_handle_t *handle, uint32_t block_num) {
         return ESP_FAIL;
     }
     
+    handle->stats.blocks_erased++;
     ESP_LOGI(TAG, "Erased block %" PRIu32, block_num);
     return spiflash_write_disable(handle);
 }
 
+esp_err_t spiflash_erase_block(spiflash_handle_t *handle, uint32_t block_num) {
+    if (handle == NULL || !spiflash_block_valid(handle, block_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = spiflash_lock(handle, SPIFLASH_OP_ERASE);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spiflash_erase(handle, block_num);
+    spiflash_unlock(handle);
+    return ret;
+}
+
 esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **handle) {
-    if (config == NULL || handle == NULL) {
+    if (config == NULL || handle == NULL ||
+        (config->spi_mode != 0 && config->spi_mode != 3)) {
         return ESP_ERR_INVALID_ARG;
     }
     
@@ -442,6 +803,12 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
     }
     
     memset(*handle, 0, sizeof(spiflash_handle_t));
+    (*handle)->lock = xSemaphoreCreateMutex();
+    if ((*handle)->lock == NULL) {
+        free(*handle);
+        *handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
     (*handle)->total_size = SPIFLASH_TOTAL_BLOCKS * SPIFLASH_BLOCK_SIZE;  // 1GB
     
     // Configure SPI bus
@@ -457,6 +824,7 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
     esp_err_t ret = spi_bus_initialize(config->host_id, &bus_cfg, SPI_DMA_CH_AUTO);
     if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
         ESP_LOGE(TAG, "SPI bus init failed: %s", esp_err_to_name(ret));
+        vSemaphoreDelete((*handle)->lock);
         free(*handle);
         *handle = NULL;
         return ret;
@@ -467,7 +835,7 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
         .command_bits = 0,
         .address_bits = 0,
         .dummy_bits = 0,
-        .mode = 0,  // SPI mode 0 (CPOL=0, CPHA=0)
+        .mode = config->spi_mode,  // 0 (CPOL=0, CPHA=0) or 3 (CPOL=1, CPHA=1)
         .clock_speed_hz = config->clock_speed_hz,
         .spics_io_num = config->pin_cs,
         .queue_size = 7,
@@ -478,6 +846,7 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "SPI device add failed: %s", esp_err_to_name(ret));
         spi_bus_free(config->host_id);
+        vSemaphoreDelete((*handle)->lock);
         free(*handle);
         *handle = NULL;
         return ret;
@@ -489,6 +858,7 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
         ESP_LOGE(TAG, "Reset failed: %s", esp_err_to_name(ret));
         spi_bus_remove_device((*handle)->spi_handle);
         spi_bus_free(config->host_id);
+        vSemaphoreDelete((*handle)->lock);
         free(*handle);
         *handle = NULL;
         return ret;
@@ -502,6 +872,7 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
         ESP_LOGE(TAG, "Failed to clear block protection");
         spi_bus_remove_device((*handle)->spi_handle);
         spi_bus_free(config->host_id);
+        vSemaphoreDelete((*handle)->lock);
         free(*handle);
         *handle = NULL;
         return ret;
@@ -513,11 +884,29 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
         ESP_LOGE(TAG, "Failed to read JEDEC ID");
         spi_bus_remove_device((*handle)->spi_handle);
         spi_bus_free(config->host_id);
+        vSemaphoreDelete((*handle)->lock);
         free(*handle);
         *handle = NULL;
         return ret;
     }
     
+    (*handle)->cache_read = (*handle)->jedec_id[0] == SPIFLASH_MFR_MICRON;
+    if (config->cache_pages > 0) {
+        uint32_t readahead = (*handle)->cache_read ? config->readahead_pages : 0;
+        if (readahead != config->readahead_pages) {
+            ESP_LOGI(TAG, "No cache read on this chip, read-ahead off");
+        }
+        ret = spiflash_cache_create(config->cache_pages, readahead, config->cache_psram, &(*handle)->cache);
+        if (ret != ESP_OK) {
+            spi_bus_remove_device((*handle)->spi_handle);
+            spi_bus_free(config->host_id);
+            vSemaphoreDelete((*handle)->lock);
+            free(*handle);
+            *handle = NULL;
+            return ret;
+        }
+    }
+
     ESP_LOGI(TAG, "SPI NAND Flash initialized");
     ESP_LOGI(TAG, "JEDEC ID: %02X %02X %02X", 
              (*handle)->jedec_id[0], (*handle)->jedec_id[1], (*handle)->jedec_id[2]);
@@ -535,7 +924,35 @@ esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **han
 esp_err_t spiflash_deinit(spiflash_handle_t *handle) {
     if (handle != NULL) {
         spi_bus_remove_device(handle->spi_handle);
+        spiflash_cache_delete(handle->cache);
+        vSemaphoreDelete(handle->lock);
         free(handle);
     }
     return ESP_OK;
 }
+
+esp_err_t spiflash_get_stats(spiflash_handle_t *handle, spiflash_stats_t *stats) {
+    if (handle == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    *stats = handle->stats;
+    xSemaphoreGive(handle->lock);
+    return ESP_OK;
+}
+
+spiflash_op_t spiflash_current_op(const spiflash_handle_t *handle) {
+    return handle ? handle->op : SPIFLASH_OP_NONE;
+}
+
+esp_err_t spiflash_reset_stats(spiflash_handle_t *handle) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    memset(&handle->stats, 0, sizeof(handle->stats));
+    xSemaphoreGive(handle->lock);
+    return ESP_OK;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file spiflash_cache.c
+ * @brief Page read cache shared by the spiflash drivers
+ */
+
+#include "spiflash_cache.h"
+#include "esp_log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+static const char *TAG = "SPIFLASH_CACHE";
+
+#define CACHE_FREE      UINT32_MAX  // Page number of an empty slot
+#define CACHE_NONE      0xFFFF      // End of a hash chain
+
+typedef struct {
+    uint32_t page_num;              // CACHE_FREE when empty
+    uint16_t next;                  // Next slot in the same hash chain
+    uint16_t refs;                  // Pins held: borrowers and fills in flight
+    bool referenced;                // Hit since the hand last passed
+    bool prefetched;                // Read ahead and not hit yet
+} cache_slot_t;
+
+struct spiflash_cache {
+    uint32_t pages;
+    uint32_t mask;                  // Hash buckets - 1
+    uint32_t hand;                  // CLOCK hand, next eviction candidate
+    uint8_t *data;                  // pages * SPIFLASH_PAGE_SIZE
+    cache_slot_t *slots;
+    uint16_t *buckets;              // First slot of each chain
+    uint32_t readahead;             // Read-ahead window in pages, 0 = off
+    uint32_t seq_next;              // Page that continues the current run
+    uint32_t seq_run;               // Consecutive page reads in the run
+    uint32_t ra_end;                // End of the pages prefetched for the run
+};
+
+// ============================================================================
+// Helper Functions
+// ============================================================================
+
+static uint8_t *cache_alloc_data(size_t size, bool psram) {
+#if CONFIG_IDF_TARGET_LINUX
+    return malloc(size);
+#else
+    // Pages are transferred straight into the slots, so the buffer must be DMA-capable
+    uint8_t *data = NULL;
+    if (psram) {
+        data = heap_caps_aligned_alloc(SPIFLASH_CACHE_ALIGN, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA);
+        if (data == NULL) {
+            ESP_LOGW(TAG, "No DMA-capable PSRAM for the page cache, using internal RAM");
+        }
+    }
+    if (data == NULL) {
+        data = heap_caps_aligned_alloc(SPIFLASH_CACHE_ALIGN, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    }
+    return data;
+#endif
+}
+
+static void cache_free_data(uint8_t *data) {
+#if CONFIG_IDF_TARGET_LINUX
+    free(data);
+#else
+    heap_caps_free(data);
+#endif
+}
+
+static inline uint16_t *cache_bucket(spiflash_cache_t *cache, uint32_t page_num) {
+    // Pages are read in runs, consecutive numbers land in consecutive buckets
+    return &cache->buckets[page_num & cache->mask];
+}
+
+static uint16_t cache_find(spiflash_cache_t *cache, uint32_t page_num) {
+    uint16_t s = *cache_bucket(cache, page_num);
+    while (s != CACHE_NONE && cache->slots[s].page_num != page_num) {
+        s = cache->slots[s].next;
+    }
+    return s;
+}
+
+/**
+ * @brief Unlink a used slot from its chain and mark it empty
+ *
+ * A pinned slot keeps its data and stays out of reach of claims until the
+ * last unpin.
+ */
+static void cache_drop(spiflash_cache_t *cache, uint16_t slot) {
+    uint16_t *link = cache_bucket(cache, cache->slots[slot].page_num);
+    while (*link != slot) {
+        link = &cache->slots[*link].next;
+    }
+    *link = cache->slots[slot].next;
+    cache->slots[slot].page_num = CACHE_FREE;
+    cache->slots[slot].referenced = false;
+    cache->slots[slot].prefetched = false;
+}
+
+// ============================================================================
+// Cache Operations
+// ============================================================================
+
+esp_err_t spiflash_cache_create(uint32_t pages, uint32_t readahead, bool psram, spiflash_cache_t **cache) {
+    // A larger window would evict its own pages before they are read
+    if (cache == NULL || pages == 0 || pages > SPIFLASH_CACHE_MAX_PAGES || readahead > pages / 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t buckets = 1;
+    while (buckets < pages) {
+        buckets <<= 1;
+    }
+
+    spiflash_cache_t *c = calloc(1, sizeof(spiflash_cache_t));
+    if (c == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    c->pages = pages;
+    c->mask = buckets - 1;
+    c->readahead = readahead;
+    c->slots = malloc(pages * sizeof(cache_slot_t));
+    c->buckets = malloc(buckets * sizeof(uint16_t));
+    c->data = cache_alloc_data((size_t)pages * SPIFLASH_PAGE_SIZE, psram);
+    if (c->slots == NULL || c->buckets == NULL || c->data == NULL) {
+        ESP_LOGE(TAG, "No memory for a %" PRIu32 " page cache", pages);
+        spiflash_cache_delete(c);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint32_t i = 0; i < pages; i++) {
+        c->slots[i] = (cache_slot_t){ .page_num = CACHE_FREE, .next = CACHE_NONE };
+    }
+    memset(c->buckets, 0xFF, buckets * sizeof(uint16_t));
+
+    ESP_LOGI(TAG, "Page cache: %" PRIu32 " pages (%" PRIu32 " KB), read-ahead %" PRIu32 " pages",
+             pages, pages * SPIFLASH_PAGE_SIZE / 1024, readahead);
+    *cache = c;
+    return ESP_OK;
+}
+
+void spiflash_cache_delete(spiflash_cache_t *cache) {
+    if (cache != NULL) {
+        cache_free_data(cache->data);
+        free(cache->slots);
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+const uint8_t *spiflash_cache_pin(spiflash_cache_t *cache, uint32_t page_num, spiflash_stats_t *stats) {
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    uint16_t s = cache_find(cache, page_num);
+    if (s == CACHE_NONE) {
+        stats->cache_misses++;
+        return NULL;
+    }
+
+    cache->slots[s].refs++;
+    cache->slots[s].referenced = true;
+    if (cache->slots[s].prefetched) {
+        cache->slots[s].prefetched = false;
+        stats->readahead_used++;
+    }
+    stats->cache_hits++;
+    return cache->data + (size_t)s * SPIFLASH_PAGE_SIZE;
+}
+
+esp_err_t spiflash_cache_unpin(spiflash_cache_t *cache, const uint8_t *data) {
+    if (cache == NULL || data < cache->data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t offset = data - cache->data;
+    size_t s = offset / SPIFLASH_PAGE_SIZE;
+    if (offset % SPIFLASH_PAGE_SIZE != 0 || s >= cache->pages || cache->slots[s].refs == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cache->slots[s].refs--;
+    return ESP_OK;
+}
+
+uint8_t *spiflash_cache_claim(spiflash_cache_t *cache, uint32_t page_num, bool prefetched,
+                              spiflash_stats_t *stats) {
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    uint16_t s = cache_find(cache, page_num);
+    if (s != CACHE_NONE && cache->slots[s].refs > 0) {
+        // Borrowed: the borrower keeps what it has, the new read goes elsewhere
+        cache_drop(cache, s);
+        s = CACHE_NONE;
+    }
+    if (s == CACHE_NONE) {
+        // Second chance: referenced slots lose the bit and are passed over,
+        // pinned ones are skipped; two turns without a victim means all pinned
+        for (uint32_t n = 0;; n++) {
+            if (n == 2 * cache->pages) {
+                return NULL;
+            }
+            cache_slot_t *slot = &cache->slots[cache->hand];
+            s = cache->hand;
+            cache->hand = (cache->hand + 1) % cache->pages;
+            if (slot->refs > 0) {
+                continue;
+            }
+            if (!slot->referenced) {
+                break;
+            }
+            slot->referenced = false;
+        }
+
+        if (cache->slots[s].page_num != CACHE_FREE) {
+            cache_drop(cache, s);
+            stats->cache_evictions++;
+        }
+        uint16_t *bucket = cache_bucket(cache, page_num);
+        cache->slots[s].page_num = page_num;
+        cache->slots[s].next = *bucket;
+        *bucket = s;
+    }
+
+    // A prefetched page survives one pass of the hand, to be read before it goes
+    cache->slots[s].refs = 1;
+    cache->slots[s].prefetched = prefetched;
+    if (prefetched) {
+        cache->slots[s].referenced = true;
+        stats->readahead_pages++;
+    }
+    return cache->data + (size_t)s * SPIFLASH_PAGE_SIZE;
+}
+
+uint32_t spiflash_cache_readahead(spiflash_cache_t *cache, uint32_t page_num, uint32_t *first) {
+    if (cache == NULL || cache->readahead == 0) {
+        return 0;
+    }
+
+    if (page_num != cache->seq_next) {
+        cache->seq_run = 0;
+        cache->ra_end = 0;
+    }
+    cache->seq_run++;
+    cache->seq_next = page_num + 1;
+    if (cache->seq_run < SPIFLASH_READAHEAD_TRIGGER) {
+        return 0;
+    }
+
+    // Top the window up once half of it has been consumed
+    uint32_t start = cache->ra_end > page_num + 1 ? cache->ra_end : page_num + 1;
+    if (start - (page_num + 1) > cache->readahead / 2) {
+        return 0;
+    }
+    uint32_t end = page_num + 1 + cache->readahead;
+    uint32_t block_end = (start / SPIFLASH_PAGES_PER_BLOCK + 1) * SPIFLASH_PAGES_PER_BLOCK;
+    if (end > block_end) {
+        end = block_end;
+    }
+
+    cache->ra_end = end;
+    *first = start;
+    return end - start;
+}
+
+uint32_t spiflash_cache_uncached_run(spiflash_cache_t *cache, uint32_t *first, uint32_t count) {
+    uint32_t end = *first + count;
+    if (cache == NULL) {
+        return count;
+    }
+
+    while (*first < end && cache_find(cache, *first) != CACHE_NONE) {
+        (*first)++;
+    }
+    uint32_t last = *first;
+    while (last < end && cache_find(cache, last) == CACHE_NONE) {
+        last++;
+    }
+    return last - *first;
+}
+
+void spiflash_cache_invalidate(spiflash_cache_t *cache, uint32_t first_page, uint32_t count) {
+    if (cache == NULL) {
+        return;
+    }
+
+    for (uint32_t p = first_page; p < first_page + count; p++) {
+        uint16_t s = cache_find(cache, p);
+        if (s != CACHE_NONE) {
+            cache_drop(cache, s);
+        }
+    }
+}
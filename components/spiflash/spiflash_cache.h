@@ -0,0 +1,107 @@
+/**
+ * @file spiflash_cache.h
+ * @brief Page read cache shared by the spiflash drivers (private)
+ *
+ * A fixed number of page slots in one buffer, found through a chained hash
+ * on the page number and replaced in CLOCK order: every hit sets the slot's
+ * referenced bit, and the hand looking for a victim clears set bits and
+ * takes the first slot found clear. Programs and erases invalidate the
+ * pages they touch before reaching the chip, so a cached page never
+ * outlives its flash contents.
+ *
+ * Slots are pinned while a page is lent out by spiflash_borrow_page() or
+ * being filled from the chip. The hand passes pinned slots over, and
+ * invalidating a pinned page only unlinks it: the holder keeps the data it
+ * has until the last unpin frees the slot.
+ *
+ * The cache also runs the read-ahead detector: reads of consecutive pages
+ * form a run, and once a run is SPIFLASH_READAHEAD_TRIGGER reads long the
+ * driver is told to prefetch the pages ahead of it, topping the window up
+ * whenever half of it has been consumed.
+ *
+ * The cache has no lock of its own, every call is made with the handle
+ * lock held. A NULL cache is valid everywhere and caches nothing.
+ */
+
+#ifndef SPIFLASH_CACHE_H
+#define SPIFLASH_CACHE_H
+
+#include "spiflash.h"
+
+#define SPIFLASH_CACHE_MAX_PAGES    4096    // 8MB, slot indices stay 16-bit
+#define SPIFLASH_READAHEAD_TRIGGER  2       // Consecutive page reads that start read-ahead
+#define SPIFLASH_CACHE_ALIGN        64      // Slot alignment, a cache line for PSRAM DMA
+
+typedef struct spiflash_cache spiflash_cache_t;
+
+/**
+ * @brief Allocate a cache of `pages` slots
+ *
+ * @param readahead Read-ahead window in pages, 0 = off, at most pages / 2
+ * @param psram Put the page buffer in PSRAM, falls back to internal RAM;
+ *              either way it is DMA-capable
+ */
+esp_err_t spiflash_cache_create(uint32_t pages, uint32_t readahead, bool psram, spiflash_cache_t **cache);
+
+void spiflash_cache_delete(spiflash_cache_t *cache);
+
+/**
+ * @brief Pin a cached page
+ *
+ * Counts a hit or, with the cache enabled, a miss in `stats`.
+ *
+ * @return Page data, valid until spiflash_cache_unpin(); NULL when the
+ *         page must be read from the chip
+ */
+const uint8_t *spiflash_cache_pin(spiflash_cache_t *cache, uint32_t page_num, spiflash_stats_t *stats);
+
+/**
+ * @brief Drop one pin on the slot holding `data`
+ *
+ * @return ESP_ERR_INVALID_ARG unless `data` is a pinned slot
+ */
+esp_err_t spiflash_cache_unpin(spiflash_cache_t *cache, const uint8_t *data);
+
+/**
+ * @brief Take the slot for a page about to be read from the chip
+ *
+ * Evicts the CLOCK victim if the page is not cached yet. The slot comes
+ * pinned: the caller fills the SPIFLASH_PAGE_SIZE bytes, or invalidates
+ * the page if the read fails, then unpins it.
+ *
+ * @param prefetched Read ahead of the caller, counted in readahead_used
+ *                   when a read hits it
+ * @return Slot data, NULL without a cache or with every slot pinned
+ */
+uint8_t *spiflash_cache_claim(spiflash_cache_t *cache, uint32_t page_num, bool prefetched,
+                              spiflash_stats_t *stats);
+
+/**
+ * @brief Feed a page read to the read-ahead detector
+ *
+ * Call once per page read or borrow, before looking the page up. The
+ * pages returned are taken as prefetched, and never cross a block.
+ *
+ * @param first Output: first page to prefetch
+ * @return Pages to prefetch from `first` on, 0 for none
+ */
+uint32_t spiflash_cache_readahead(spiflash_cache_t *cache, uint32_t page_num, uint32_t *first);
+
+/**
+ * @brief Find the next pages of a window that must come from the chip
+ *
+ * Moves `*first` past the pages at the start of the window that are
+ * cached already.
+ *
+ * @param first In: first page of the window, out: first uncached page
+ * @param count Pages in the window from the original `*first`
+ * @return Uncached pages from the new `*first` on, 0 when all are cached
+ */
+uint32_t spiflash_cache_uncached_run(spiflash_cache_t *cache, uint32_t *first, uint32_t count);
+
+/**
+ * @brief Drop `count` pages from `first_page` on, cached or not
+ */
+void spiflash_cache_invalidate(spiflash_cache_t *cache, uint32_t first_page, uint32_t count);
+
+#endif // SPIFLASH_CACHE_H
@@ -0,0 +1,557 @@
+/**
+ * @file spiflash_linux.c
+ * @brief SPI NAND Flash driver backed by a memory-mapped image (linux target)
+ *
+ * Implements the spiflash API on a raw image file laid out as described in
+ * spiflash_geometry.h. NAND semantics are kept: programming can only clear
+ * bits, and only a block erase sets them back to 1. Operations complete
+ * immediately, so the status register never reports busy.
+ *
+ * Each operation is charged the time the real driver would spend on it:
+ * the bytes it moves over the bus at the configured clock, and the chip's
+ * typical array time as busy-wait. By default nothing is slept and the
+ * time only shows up in spiflash_stats_t; with model_realtime each call
+ * keeps the handle until its modeled time has passed, so contention
+ * between tasks plays out at device speed.
+ *
+ * With model_cache_read the image behaves like a chip with the 31h/3Fh
+ * sequential cache read, so read-ahead runs are charged as one pipelined
+ * sequence instead of page by page.
+ *
+ * Calls serialize on the handle mutex like on hardware, so tasks sharing
+ * a handle see the same contention (without the bus).
+ */
+
+#include "spiflash.h"
+#include "spiflash_cache.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *TAG = "SPIFLASH";
+
+// W25N01GV typical array times (ECC enabled)
+#define SPIFLASH_MODEL_READ_NS      60000       // tRD
+#define SPIFLASH_MODEL_PROGRAM_NS   250000      // tPP
+#define SPIFLASH_MODEL_ERASE_NS     2000000     // tBE
+#define SPIFLASH_MODEL_CACHE_BUSY_NS 3000       // tRCBSY, data to cache register (MT29F)
+#define SPIFLASH_MODEL_CLOCK_HZ     40000000    // When the config leaves it 0
+
+// Bytes spiflash.c moves per command, see its transaction layout
+#define SPIFLASH_MODEL_STATUS_BYTES 3           // 05h, register, value
+#define SPIFLASH_MODEL_CMD_BYTES    4           // Opcode and 3 address bytes
+#define SPIFLASH_MODEL_READ_HDR     4           // 03h, column, dummy
+
+static inline uint64_t spiflash_model_bytes_ns(spiflash_handle_t *handle, size_t bytes) {
+    return (uint64_t)bytes * 8 * 1000000000ull / handle->clock_speed_hz;
+}
+
+/**
+ * @brief Charge a wait for the chip: one status poll plus the array time
+ */
+static void spiflash_model_wait(spiflash_handle_t *handle, uint64_t array_ns) {
+    handle->model_busy_ns += array_ns + spiflash_model_bytes_ns(handle, SPIFLASH_MODEL_STATUS_BYTES);
+    handle->stats.busy_polls++;
+}
+
+/**
+ * @brief Charge a page load and the read of `len` buffer bytes
+ */
+static void spiflash_model_read(spiflash_handle_t *handle, size_t len) {
+    spiflash_model_wait(handle, 0);
+    handle->model_spi_ns += spiflash_model_bytes_ns(handle, SPIFLASH_MODEL_CMD_BYTES);
+    spiflash_model_wait(handle, SPIFLASH_MODEL_READ_NS);
+    handle->model_spi_ns += spiflash_model_bytes_ns(handle, SPIFLASH_MODEL_READ_HDR + len);
+}
+
+/**
+ * @brief Charge page `i` of a cache read run
+ *
+ * The run starts with a PAGE READ of its first page. Every page then takes
+ * a 31h (3Fh for the last), the cache busy time and the buffer read; the
+ * array read of the following page runs during that transfer, so only what
+ * is left of tRD is waited for at the next command.
+ */
+static void spiflash_model_cache_read(spiflash_handle_t *handle, uint32_t i) {
+    uint64_t transfer_ns = spiflash_model_bytes_ns(handle, SPIFLASH_MODEL_READ_HDR + SPIFLASH_PAGE_SIZE);
+    uint64_t array_ns = 0;
+    if (i == 0) {
+        spiflash_model_wait(handle, 0);
+        handle->model_spi_ns += spiflash_model_bytes_ns(handle, SPIFLASH_MODEL_CMD_BYTES);
+        spiflash_model_wait(handle, SPIFLASH_MODEL_READ_NS);
+    } else if (SPIFLASH_MODEL_READ_NS > transfer_ns) {
+        array_ns = SPIFLASH_MODEL_READ_NS - transfer_ns;
+    }
+    handle->model_spi_ns += spiflash_model_bytes_ns(handle, 1);
+    spiflash_model_wait(handle, array_ns + SPIFLASH_MODEL_CACHE_BUSY_NS);
+    handle->model_spi_ns += transfer_ns;
+}
+
+/**
+ * @brief Charge a program or erase: write enable, WEL check, `load` bytes
+ * of data, execute, wait, fail check, write disable
+ */
+static void spiflash_model_modify(spiflash_handle_t *handle, size_t load, uint64_t array_ns) {
+    spiflash_model_wait(handle, 0);
+    handle->model_spi_ns += spiflash_model_bytes_ns(handle, 1 + SPIFLASH_MODEL_STATUS_BYTES + load +
+                                                    SPIFLASH_MODEL_CMD_BYTES);
+    spiflash_model_wait(handle, array_ns);
+    handle->model_spi_ns += spiflash_model_bytes_ns(handle, SPIFLASH_MODEL_STATUS_BYTES + 1);
+}
+
+/**
+ * @brief Take the handle for one operation
+ */
+static void spiflash_lock(spiflash_handle_t *handle, spiflash_op_t op) {
+    if (xSemaphoreTake(handle->lock, 0) != pdTRUE) {
+        int64_t start = esp_timer_get_time();
+        xSemaphoreTake(handle->lock, portMAX_DELAY);
+        handle->stats.lock_waits++;
+        handle->stats.lock_wait_us += esp_timer_get_time() - start;
+    }
+    if (handle->model_realtime) {
+        handle->model_lock_us = esp_timer_get_time();
+        handle->model_lock_ns = handle->model_spi_ns + handle->model_busy_ns;
+    }
+    handle->op = op;
+}
+
+static void spiflash_unlock(spiflash_handle_t *handle) {
+    if (handle->model_realtime) {
+        uint64_t charged_ns = handle->model_spi_ns + handle->model_busy_ns - handle->model_lock_ns;
+        int64_t left_us = handle->model_lock_us + (int64_t)(charged_ns / 1000) - esp_timer_get_time();
+        if (left_us > 0) {
+            usleep(left_us);
+        }
+    }
+    handle->op = SPIFLASH_OP_NONE;
+    xSemaphoreGive(handle->lock);
+}
+
+static inline uint8_t *spiflash_raw_page(spiflash_handle_t *handle, uint32_t page_num) {
+    return handle->image + (size_t)page_num * SPIFLASH_RAW_PAGE_SIZE;
+}
+
+static inline bool spiflash_page_valid(spiflash_handle_t *handle, uint32_t page_num) {
+    return page_num < handle->total_blocks * SPIFLASH_PAGES_PER_BLOCK;
+}
+
+/**
+ * @brief Program bytes the way NAND does: 1 -> 0 only
+ *
+ * 0xFF source bytes leave the cell untouched. Anything else landing on a
+ * byte that is already programmed is a re-program the chip does not allow.
+ */
+static void spiflash_program_bytes(uint8_t *dst, const uint8_t *src, size_t len, bool *violation) {
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] != 0xFF && dst[i] != 0xFF) {
+            *violation = true;
+        }
+        dst[i] &= src[i];
+    }
+}
+
+esp_err_t spiflash_read_status(spiflash_handle_t *handle, uint8_t *status) {
+    if (handle == NULL || status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *status = 0;  // Never busy, never failed
+    return ESP_OK;
+}
+
+esp_err_t spiflash_wait_ready(spiflash_handle_t *handle, uint32_t timeout_ms) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t spiflash_read_jedec_id(spiflash_handle_t *handle, uint8_t *id) {
+    if (handle == NULL || id == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(id, handle->jedec_id, sizeof(handle->jedec_id));
+    return ESP_OK;
+}
+
+/**
+ * @brief Read `count` pages of one block from `first_page` on
+ *
+ * Without a cache the page goes to `buffer`, with one to pinned cache
+ * slots, the first returned in `*first` when asked for. Same contract as
+ * the hardware driver; the copy out of the image stands for the DMA
+ * transfer and is not counted in bytes_copied.
+ */
+static esp_err_t spiflash_read_run(spiflash_handle_t *handle, uint32_t first_page, uint32_t count,
+                                   uint8_t *buffer, const uint8_t **first) {
+    uint32_t last_page = handle->total_blocks * SPIFLASH_PAGES_PER_BLOCK;
+    if (first_page + count > last_page) {
+        count = first_page < last_page ? last_page - first_page : 0;
+    }
+    if (count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bool cache_read = handle->cache_read && count > 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page_num = first_page + i;
+        bool demand = i == 0 && first != NULL;
+        uint8_t *dst = buffer;
+        if (handle->cache != NULL) {
+            dst = spiflash_cache_claim(handle->cache, page_num, !demand, &handle->stats);
+            if (dst == NULL) {
+                // Every slot is borrowed
+                return i == 0 ? ESP_ERR_NO_MEM : ESP_OK;
+            }
+        }
+        memcpy(dst, spiflash_raw_page(handle, page_num), SPIFLASH_PAGE_SIZE);
+        if (demand) {
+            *first = dst;
+        } else if (handle->cache != NULL) {
+            spiflash_cache_unpin(handle->cache, dst);
+        }
+
+        if (cache_read) {
+            spiflash_model_cache_read(handle, i);
+        } else {
+            spiflash_model_read(handle, SPIFLASH_PAGE_SIZE);
+        }
+        handle->stats.pages_read++;
+        handle->stats.bytes_read += SPIFLASH_PAGE_SIZE;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Prefetch the pages of a read-ahead window not cached yet
+ *
+ * A second scan over cached pages then stays off the chip, and a window
+ * partly cached reads only its gaps, one run each.
+ */
+static void spiflash_prefetch(spiflash_handle_t *handle, uint32_t first_page, uint32_t count) {
+    uint32_t end = first_page + count;
+    while (first_page < end) {
+        uint32_t run = spiflash_cache_uncached_run(handle->cache, &first_page, end - first_page);
+        if (run == 0 || spiflash_read_run(handle, first_page, run, NULL, NULL) != ESP_OK) {
+            return;
+        }
+        first_page += run;
+    }
+}
+
+/**
+ * @brief Read a page with the handle locked, copied to `buffer` or borrowed
+ */
+static esp_err_t spiflash_read_locked(spiflash_handle_t *handle, uint32_t page_num, uint8_t *buffer,
+                                      const uint8_t **borrowed) {
+    if (handle->cache == NULL) {
+        return spiflash_read_run(handle, page_num, 1, buffer, NULL);
+    }
+
+    uint32_t ahead_first = 0;
+    uint32_t ahead = spiflash_cache_readahead(handle->cache, page_num, &ahead_first);
+    esp_err_t ret = ESP_OK;
+    const uint8_t *page = spiflash_cache_pin(handle->cache, page_num, &handle->stats);
+    if (page == NULL) {
+        // The missed page starts the run when the window follows it,
+        // up to the first page of the window already cached
+        uint32_t count = 1;
+        if (ahead > 0 && ahead_first == page_num + 1 && ahead_first % SPIFLASH_PAGES_PER_BLOCK != 0) {
+            uint32_t next = ahead_first;
+            uint32_t run = spiflash_cache_uncached_run(handle->cache, &next, ahead);
+            if (next == ahead_first) {
+                count += run;
+                ahead_first += run;
+                ahead -= run;
+            }
+        }
+        ret = spiflash_read_run(handle, page_num, count, NULL, &page);
+    }
+    if (ret == ESP_OK && ahead > 0) {
+        spiflash_prefetch(handle, ahead_first, ahead);
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (borrowed != NULL) {
+        *borrowed = page;
+        handle->stats.pages_borrowed++;
+    } else {
+        memcpy(buffer, page, SPIFLASH_PAGE_SIZE);
+        handle->stats.bytes_copied += SPIFLASH_PAGE_SIZE;
+        spiflash_cache_unpin(handle->cache, page);
+    }
+    return ESP_OK;
+}
+
+esp_err_t spiflash_read_page(spiflash_handle_t *handle, uint32_t page_num,
+                             uint8_t *buffer) {
+    if (handle == NULL || buffer == NULL || !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_READ);
+    esp_err_t ret = spiflash_read_locked(handle, page_num, buffer, NULL);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_borrow_page(spiflash_handle_t *handle, uint32_t page_num,
+                               const uint8_t **data) {
+    if (handle == NULL || data == NULL || !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->cache == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_READ);
+    esp_err_t ret = spiflash_read_locked(handle, page_num, NULL, data);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_release_page(spiflash_handle_t *handle, const uint8_t *data) {
+    if (handle == NULL || data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_NONE);
+    esp_err_t ret = spiflash_cache_unpin(handle->cache, data);
+    spiflash_unlock(handle);
+    return ret;
+}
+
+esp_err_t spiflash_read_oob(spiflash_handle_t *handle, uint32_t page_num,
+                            uint8_t *oob, size_t len) {
+    if (handle == NULL || oob == NULL || len == 0 || len > SPIFLASH_OOB_SIZE ||
+        !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_READ);
+    memcpy(oob, spiflash_raw_page(handle, page_num) + SPIFLASH_PAGE_SIZE, len);
+    spiflash_model_read(handle, len);
+    handle->stats.pages_read++;
+    handle->stats.bytes_read += len;
+    spiflash_unlock(handle);
+    return ESP_OK;
+}
+
+esp_err_t spiflash_write_page_oob(spiflash_handle_t *handle, uint32_t page_num,
+                                  const uint8_t *data, const uint8_t *oob, size_t oob_len) {
+    if (handle == NULL || data == NULL || (oob == NULL && oob_len > 0) ||
+        oob_len > SPIFLASH_OOB_SIZE || !spiflash_page_valid(handle, page_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_PROGRAM);
+    spiflash_cache_invalidate(handle->cache, page_num, 1);
+    uint8_t *raw = spiflash_raw_page(handle, page_num);
+    bool violation = false;
+    spiflash_program_bytes(raw, data, SPIFLASH_PAGE_SIZE, &violation);
+    if (oob_len > 0) {
+        spiflash_program_bytes(raw + SPIFLASH_PAGE_SIZE, oob, oob_len, &violation);
+    }
+
+    if (violation) {
+        // Real silicon corrupts the page here; flag it so FTL bugs surface on host
+        handle->program_violations++;
+        ESP_LOGW(TAG, "Page %" PRIu32 " programmed without erase", page_num);
+    }
+
+    spiflash_model_modify(handle, 3 + SPIFLASH_PAGE_SIZE + oob_len, SPIFLASH_MODEL_PROGRAM_NS);
+    handle->stats.pages_programmed++;
+    handle->stats.bytes_programmed += SPIFLASH_PAGE_SIZE + oob_len;
+    spiflash_unlock(handle);
+
+    ESP_LOGD(TAG, "Wrote page %" PRIu32, page_num);
+    return ESP_OK;
+}
+
+esp_err_t spiflash_write_page(spiflash_handle_t *handle, uint32_t page_num,
+                              const uint8_t *data) {
+    return spiflash_write_page_oob(handle, page_num, data, NULL, 0);
+}
+
+esp_err_t spiflash_erase_block(spiflash_handle_t *handle, uint32_t block_num) {
+    if (handle == NULL || block_num >= handle->total_blocks) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_ERASE);
+    spiflash_cache_invalidate(handle->cache, block_num * SPIFLASH_PAGES_PER_BLOCK, SPIFLASH_PAGES_PER_BLOCK);
+    memset(spiflash_raw_page(handle, block_num * SPIFLASH_PAGES_PER_BLOCK), 0xFF,
+           SPIFLASH_RAW_BLOCK_SIZE);
+    spiflash_model_modify(handle, 0, SPIFLASH_MODEL_ERASE_NS);
+    handle->stats.blocks_erased++;
+    spiflash_unlock(handle);
+
+    ESP_LOGD(TAG, "Erased block %" PRIu32, block_num);
+    return ESP_OK;
+}
+
+esp_err_t spiflash_init(const spiflash_config_t *config, spiflash_handle_t **handle) {
+    if (config == NULL || handle == NULL || config->image_path == NULL ||
+        (config->spi_mode != 0 && config->spi_mode != 3)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *handle = (spiflash_handle_t *)calloc(1, sizeof(spiflash_handle_t));
+    if (*handle == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for handle");
+        return ESP_ERR_NO_MEM;
+    }
+    spiflash_handle_t *h = *handle;
+
+    h->lock = xSemaphoreCreateMutex();
+    if (h->lock == NULL) {
+        free(h);
+        *handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    h->image_fd = open(config->image_path, O_RDWR | O_CREAT, 0644);
+    if (h->image_fd < 0) {
+        ESP_LOGE(TAG, "Failed to open image %s (errno: %d - %s)",
+                 config->image_path, errno, strerror(errno));
+        vSemaphoreDelete(h->lock);
+        free(h);
+        *handle = NULL;
+        return ESP_FAIL;
+    }
+
+    struct stat st;
+    if (fstat(h->image_fd, &st) != 0) {
+        close(h->image_fd);
+        vSemaphoreDelete(h->lock);
+        free(h);
+        *handle = NULL;
+        return ESP_FAIL;
+    }
+
+    // An empty file becomes a freshly erased chip
+    bool created = (st.st_size == 0);
+    size_t size = st.st_size;
+    if (created) {
+        uint32_t blocks = config->image_blocks ? config->image_blocks : SPIFLASH_TOTAL_BLOCKS;
+        size = (size_t)blocks * SPIFLASH_RAW_BLOCK_SIZE;
+        if (ftruncate(h->image_fd, size) != 0) {
+            ESP_LOGE(TAG, "Failed to size image (errno: %d - %s)", errno, strerror(errno));
+            close(h->image_fd);
+            vSemaphoreDelete(h->lock);
+            free(h);
+            *handle = NULL;
+            return ESP_FAIL;
+        }
+    }
+
+    h->total_blocks = size / SPIFLASH_RAW_BLOCK_SIZE;
+    if (h->total_blocks == 0 || size % SPIFLASH_RAW_BLOCK_SIZE != 0) {
+        ESP_LOGE(TAG, "Image %s is not a whole number of %d byte blocks",
+                 config->image_path, SPIFLASH_RAW_BLOCK_SIZE);
+        close(h->image_fd);
+        vSemaphoreDelete(h->lock);
+        free(h);
+        *handle = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    h->image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, h->image_fd, 0);
+    if (h->image == MAP_FAILED) {
+        ESP_LOGE(TAG, "Failed to map image (errno: %d - %s)", errno, strerror(errno));
+        close(h->image_fd);
+        vSemaphoreDelete(h->lock);
+        free(h);
+        *handle = NULL;
+        return ESP_FAIL;
+    }
+
+    if (created) {
+        memset(h->image, 0xFF, size);
+    }
+
+    // Report the W25N01GV we emulate
+    h->jedec_id[0] = 0xEF;
+    h->jedec_id[1] = 0xAA;
+    h->jedec_id[2] = 0x21;
+    h->total_size = h->total_blocks * SPIFLASH_BLOCK_SIZE;
+    h->clock_speed_hz = config->clock_speed_hz > 0 ? config->clock_speed_hz : SPIFLASH_MODEL_CLOCK_HZ;
+    h->model_realtime = config->model_realtime;
+    h->cache_read = config->model_cache_read;
+
+    if (config->cache_pages > 0) {
+        uint32_t readahead = h->cache_read ? config->readahead_pages : 0;
+        if (readahead != config->readahead_pages) {
+            ESP_LOGI(TAG, "No cache read modeled, read-ahead off");
+        }
+        esp_err_t ret = spiflash_cache_create(config->cache_pages, readahead, config->cache_psram, &h->cache);
+        if (ret != ESP_OK) {
+            munmap(h->image, size);
+            close(h->image_fd);
+            vSemaphoreDelete(h->lock);
+            free(h);
+            *handle = NULL;
+            return ret;
+        }
+    }
+
+    ESP_LOGI(TAG, "SPI NAND image %s: %" PRIu32 " blocks%s", config->image_path,
+             h->total_blocks, created ? " (created)" : "");
+    return ESP_OK;
+}
+
+esp_err_t spiflash_deinit(spiflash_handle_t *handle) {
+    if (handle != NULL) {
+        size_t size = (size_t)handle->total_blocks * SPIFLASH_RAW_BLOCK_SIZE;
+        msync(handle->image, size, MS_SYNC);
+        munmap(handle->image, size);
+        close(handle->image_fd);
+        spiflash_cache_delete(handle->cache);
+        vSemaphoreDelete(handle->lock);
+        free(handle);
+    }
+    return ESP_OK;
+}
+
+esp_err_t spiflash_get_stats(spiflash_handle_t *handle, spiflash_stats_t *stats) {
+    if (handle == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_NONE);
+    *stats = handle->stats;
+    stats->spi_us = handle->model_spi_ns / 1000;
+    stats->busy_us = handle->model_busy_ns / 1000;
+    spiflash_unlock(handle);
+    return ESP_OK;
+}
+
+spiflash_op_t spiflash_current_op(const spiflash_handle_t *handle) {
+    return handle ? handle->op : SPIFLASH_OP_NONE;
+}
+
+esp_err_t spiflash_reset_stats(spiflash_handle_t *handle) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_lock(handle, SPIFLASH_OP_NONE);
+    memset(&handle->stats, 0, sizeof(handle->stats));
+    handle->model_spi_ns = 0;
+    handle->model_busy_ns = 0;
+    handle->model_lock_ns = 0;
+    spiflash_unlock(handle);
+    return ESP_OK;
+}
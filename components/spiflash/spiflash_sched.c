@@ -0,0 +1,320 @@
+/**
+ * @file spiflash_sched.c
+ * @brief Priority-aware I/O scheduler in front of a spiflash handle
+ *
+ * Admission is a hand-off: the task leaving the device picks the next
+ * waiter, marks it granted and wakes it with a task notification, so the
+ * device never looks idle while someone is queued. Waiters live on their
+ * own stack, one FIFO per class.
+ */
+
+#include "spiflash_sched.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "SPIFLASH_SCHED";
+
+// Defaults: a foreground request is overdue after a few page programs,
+// background work after half a second of being passed over
+static const uint32_t s_default_deadline_us[SPIFLASH_IO_CLASSES] = { 2000, 50000, 500000 };
+#define SCHED_DEFAULT_ERASE_HOLDOFF_US  20000
+
+typedef struct sched_waiter {
+    struct sched_waiter *next;
+    TaskHandle_t task;
+    int64_t queued_us;
+    int64_t deadline_us;
+    volatile bool granted;
+} sched_waiter_t;
+
+struct spiflash_sched {
+    spiflash_handle_t *flash;
+    SemaphoreHandle_t guard;            // Protects everything below
+    bool busy;                          // An operation holds the device
+    sched_waiter_t *head[SPIFLASH_IO_CLASSES];
+    sched_waiter_t *tail[SPIFLASH_IO_CLASSES];
+    uint32_t deadline_us[SPIFLASH_IO_CLASSES];
+    uint32_t erase_holdoff_us;
+    int64_t last_foreground_us;
+    spiflash_sched_stats_t stats;
+};
+
+// ============================================================================
+// Admission
+// ============================================================================
+
+static void record_grant(spiflash_sched_t *s, spiflash_io_class_t cls, uint32_t wait_us,
+                         bool queued, bool late, bool promoted) {
+    spiflash_sched_class_stats_t *st = &s->stats.cls[cls];
+    st->ops++;
+    st->queued += queued;
+    st->late += late;
+    st->promoted += promoted;
+    st->wait_us += wait_us;
+    if (wait_us > st->max_wait_us) {
+        st->max_wait_us = wait_us;
+    }
+    int b = wait_us ? 31 - __builtin_clz(wait_us) : 0;
+    st->hist[b < SPIFLASH_SCHED_HIST_BUCKETS ? b : SPIFLASH_SCHED_HIST_BUCKETS - 1]++;
+}
+
+/**
+ * @brief Wait for the device
+ */
+static void sched_enter(spiflash_sched_t *s, spiflash_io_class_t cls) {
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(s->guard, portMAX_DELAY);
+    if (cls == SPIFLASH_IO_FOREGROUND) {
+        s->last_foreground_us = now;
+    }
+    if (!s->busy) {
+        // Nobody queued either: the leaving task hands over directly
+        s->busy = true;
+        record_grant(s, cls, 0, false, false, false);
+        xSemaphoreGive(s->guard);
+        return;
+    }
+
+    sched_waiter_t w = {
+        .task = xTaskGetCurrentTaskHandle(),
+        .queued_us = now,
+        .deadline_us = now + s->deadline_us[cls],
+    };
+    if (s->tail[cls]) {
+        s->tail[cls]->next = &w;
+    } else {
+        s->head[cls] = &w;
+    }
+    s->tail[cls] = &w;
+    xSemaphoreGive(s->guard);
+
+    // A notification left over from an earlier grant only costs a recheck
+    while (!w.granted) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+/**
+ * @brief Release the device to the next waiter
+ */
+static void sched_leave(spiflash_sched_t *s) {
+    xSemaphoreTake(s->guard, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+
+    // Most overdue head first, then the highest class
+    int next = -1;
+    for (int c = 0; c < SPIFLASH_IO_CLASSES; c++) {
+        sched_waiter_t *w = s->head[c];
+        if (w && w->deadline_us <= now && (next < 0 || w->deadline_us < s->head[next]->deadline_us)) {
+            next = c;
+        }
+    }
+    bool promoted = false;
+    if (next >= 0) {
+        for (int c = 0; c < next && !promoted; c++) {
+            promoted = s->head[c] != NULL;
+        }
+    } else {
+        for (int c = 0; c < SPIFLASH_IO_CLASSES && next < 0; c++) {
+            if (s->head[c]) {
+                next = c;
+            }
+        }
+    }
+
+    if (next < 0) {
+        s->busy = false;
+        xSemaphoreGive(s->guard);
+        return;
+    }
+
+    sched_waiter_t *w = s->head[next];
+    s->head[next] = w->next;
+    if (s->head[next] == NULL) {
+        s->tail[next] = NULL;
+    }
+    record_grant(s, next, (uint32_t)(now - w->queued_us), true, now > w->deadline_us, promoted);
+
+    // The waiter's frame is gone once it sees granted, read it first
+    TaskHandle_t task = w->task;
+    w->granted = true;
+    xSemaphoreGive(s->guard);
+    xTaskNotifyGive(task);
+}
+
+/**
+ * @brief Hold a lower class erase back while foreground requests keep coming
+ */
+static void erase_holdoff(spiflash_sched_t *s, spiflash_io_class_t cls) {
+    if (cls == SPIFLASH_IO_FOREGROUND) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool held = false;
+    while (true) {
+        xSemaphoreTake(s->guard, portMAX_DELAY);
+        int64_t quiet_at = s->last_foreground_us + s->erase_holdoff_us;
+        xSemaphoreGive(s->guard);
+        int64_t now = esp_timer_get_time();
+        if (now >= quiet_at || now - start >= s->deadline_us[cls]) {
+            break;
+        }
+        held = true;
+        TickType_t ticks = pdMS_TO_TICKS((quiet_at - now + 999) / 1000);
+        vTaskDelay(ticks > 0 ? ticks : 1);
+    }
+
+    if (held) {
+        xSemaphoreTake(s->guard, portMAX_DELAY);
+        s->stats.cls[cls].holdoffs++;
+        xSemaphoreGive(s->guard);
+    }
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+esp_err_t spiflash_sched_create(spiflash_handle_t *flash, const spiflash_sched_config_t *config,
+                                spiflash_sched_t **sched) {
+    if (flash == NULL || sched == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spiflash_sched_t *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s->guard = xSemaphoreCreateMutex();
+    if (s->guard == NULL) {
+        free(s);
+        return ESP_ERR_NO_MEM;
+    }
+
+    s->flash = flash;
+    for (int c = 0; c < SPIFLASH_IO_CLASSES; c++) {
+        uint32_t d = config ? config->deadline_us[c] : 0;
+        s->deadline_us[c] = d ? d : s_default_deadline_us[c];
+    }
+    s->erase_holdoff_us = config && config->erase_holdoff_us ? config->erase_holdoff_us
+                                                             : SCHED_DEFAULT_ERASE_HOLDOFF_US;
+    s->last_foreground_us = INT64_MIN / 2;
+
+    ESP_LOGI(TAG, "Deadlines %lu/%lu/%lu us, erase holdoff %lu us",
+             (unsigned long)s->deadline_us[0], (unsigned long)s->deadline_us[1],
+             (unsigned long)s->deadline_us[2], (unsigned long)s->erase_holdoff_us);
+    *sched = s;
+    return ESP_OK;
+}
+
+void spiflash_sched_delete(spiflash_sched_t *sched) {
+    if (sched != NULL) {
+        vSemaphoreDelete(sched->guard);
+        free(sched);
+    }
+}
+
+esp_err_t spiflash_sched_read_page(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                   uint32_t page_num, uint8_t *buffer) {
+    if (sched == NULL || cls >= SPIFLASH_IO_CLASSES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sched_enter(sched, cls);
+    esp_err_t ret = spiflash_read_page(sched->flash, page_num, buffer);
+    sched_leave(sched);
+    return ret;
+}
+
+esp_err_t spiflash_sched_read_pages(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                    uint32_t first_page, uint32_t count, uint8_t *buffer) {
+    if (sched == NULL || cls >= SPIFLASH_IO_CLASSES || buffer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        esp_err_t ret = spiflash_sched_read_page(sched, cls, first_page + i,
+                                                 buffer + (size_t)i * SPIFLASH_PAGE_SIZE);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t spiflash_sched_read_oob(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                  uint32_t page_num, uint8_t *oob, size_t len) {
+    if (sched == NULL || cls >= SPIFLASH_IO_CLASSES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sched_enter(sched, cls);
+    esp_err_t ret = spiflash_read_oob(sched->flash, page_num, oob, len);
+    sched_leave(sched);
+    return ret;
+}
+
+esp_err_t spiflash_sched_write_page_oob(spiflash_sched_t *sched, spiflash_io_class_t cls,
+                                        uint32_t page_num, const uint8_t *data,
+                                        const uint8_t *oob, size_t oob_len) {
+    if (sched == NULL || cls >= SPIFLASH_IO_CLASSES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sched_enter(sched, cls);
+    esp_err_t ret = spiflash_write_page_oob(sched->flash, page_num, data, oob, oob_len);
+    sched_leave(sched);
+    return ret;
+}
+
+esp_err_t spiflash_sched_erase_block(spiflash_sched_t *sched, spiflash_io_class_t cls, uint32_t block_num) {
+    if (sched == NULL || cls >= SPIFLASH_IO_CLASSES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    erase_holdoff(sched, cls);
+    sched_enter(sched, cls);
+    esp_err_t ret = spiflash_erase_block(sched->flash, block_num);
+    sched_leave(sched);
+    return ret;
+}
+
+esp_err_t spiflash_sched_get_stats(spiflash_sched_t *sched, spiflash_sched_stats_t *stats) {
+    if (sched == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(sched->guard, portMAX_DELAY);
+    *stats = sched->stats;
+    xSemaphoreGive(sched->guard);
+    return ESP_OK;
+}
+
+esp_err_t spiflash_sched_reset_stats(spiflash_sched_t *sched) {
+    if (sched == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(sched->guard, portMAX_DELAY);
+    memset(&sched->stats, 0, sizeof(sched->stats));
+    xSemaphoreGive(sched->guard);
+    return ESP_OK;
+}
+
+uint32_t spiflash_sched_wait_percentile(const spiflash_sched_class_stats_t *stats, unsigned pct) {
+    uint32_t rank = ((uint64_t)stats->ops * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < SPIFLASH_SCHED_HIST_BUCKETS; b++) {
+        seen += stats->hist[b];
+        if (seen >= rank && seen > 0) {
+            uint32_t upper = (b == SPIFLASH_SCHED_HIST_BUCKETS - 1) ? stats->max_wait_us : (2u << b) - 1;
+            return upper < stats->max_wait_us ? upper : stats->max_wait_us;
+        }
+    }
+    return 0;
+}
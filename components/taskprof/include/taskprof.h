@@ -0,0 +1,77 @@
+/**
+ * @file taskprof.h
+ * @brief Periodic per-task CPU and stack profiling
+ *
+ * A low priority task samples the FreeRTOS run-time stats and the stack
+ * high-water mark of every task each CONFIG_TASKPROF_PERIOD_MS and keeps
+ * the last CONFIG_TASKPROF_RING_SAMPLES samples. Dump them with
+ * taskprof_dump() and summarize the log with the host tool in
+ * tools/taskprof.
+ *
+ * Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "taskprof_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TASKPROF_TASK_PRIORITY  1
+#define TASKPROF_TASK_STACK     3072
+
+/**
+ * @brief One task in a sample
+ */
+typedef struct {
+    char name[TASKPROF_NAME_LEN];
+    uint8_t priority;               ///< Current priority
+    int8_t core;                    ///< Affinity, -1 for none
+    uint16_t cpu_permille;          ///< Share of one core over the sample interval
+    uint32_t stack_free;            ///< Lowest free stack so far, bytes
+} taskprof_task_t;
+
+/**
+ * @brief All tasks at one point in time
+ */
+typedef struct {
+    uint32_t seq;                   ///< Increments with every sample
+    int64_t timestamp_us;
+    uint32_t interval_us;           ///< Time covered by cpu_permille
+    uint16_t task_count;            ///< Entries in tasks
+    uint16_t untracked;             ///< Tasks that did not fit in tasks
+    taskprof_task_t tasks[CONFIG_TASKPROF_MAX_TASKS];
+} taskprof_sample_t;
+
+/**
+ * @brief Start the sampling task
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if already running,
+ *         ESP_ERR_NOT_SUPPORTED without FreeRTOS run-time stats
+ */
+esp_err_t taskprof_start(void);
+
+/**
+ * @brief Copy the recorded samples, oldest first
+ *
+ * @param out Output array
+ * @param max Capacity of out
+ * @return Number of samples copied
+ */
+size_t taskprof_get_samples(taskprof_sample_t *out, size_t max);
+
+/**
+ * @brief Print the recorded samples to stdout in the taskprof_format.h format
+ */
+void taskprof_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,25 @@
+/**
+ * @file taskprof_format.h
+ * @brief Text format of dumped task profiler samples
+ *
+ * Kept free of ESP-IDF dependencies so the host pretty printer
+ * (tools/taskprof) can share it. A dump is a run of lines, possibly mixed
+ * with other log output:
+ *
+ *   TASKPROF S <seq> <timestamp_us> <interval_us> <task_count> <untracked>
+ *   TASKPROF T <seq> <core> <priority> <cpu_permille> <stack_free> <name>
+ *
+ * One S line opens a sample, followed by one T line per task. core is -1
+ * for tasks without affinity. cpu_permille is the share of one core over
+ * the interval, so the tasks of a sample add up to 1000 per core.
+ * stack_free is the lowest amount of free stack the task ever had, in
+ * bytes. The name is last because task names may contain spaces.
+ */
+
+#ifndef TASKPROF_FORMAT_H
+#define TASKPROF_FORMAT_H
+
+#define TASKPROF_LINE_PREFIX    "TASKPROF"
+#define TASKPROF_NAME_LEN       16      // configMAX_TASK_NAME_LEN
+
+#endif // TASKPROF_FORMAT_H
@@ -0,0 +1,229 @@
+/**
+ * @file taskprof.c
+ * @brief Per-task CPU and stack sampler
+ */
+
+#include "taskprof.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+static const char *TAG = "TASKPROF";
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+// uxTaskGetSystemState() fails when there are more tasks than status slots
+#define TASKPROF_STATUS_SLACK   8
+
+// Run-time counter of a task at the previous sample
+typedef struct {
+    TaskHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE runtime;
+} prev_runtime_t;
+
+static taskprof_sample_t s_ring[CONFIG_TASKPROF_RING_SAMPLES];
+static size_t s_ring_head;          // Next slot to write
+static size_t s_ring_count;
+static SemaphoreHandle_t s_ring_lock;
+static TaskHandle_t s_task;
+
+static TaskStatus_t s_status[CONFIG_TASKPROF_MAX_TASKS + TASKPROF_STATUS_SLACK];
+static prev_runtime_t s_prev[CONFIG_TASKPROF_MAX_TASKS + TASKPROF_STATUS_SLACK];
+static size_t s_prev_count;
+static configRUN_TIME_COUNTER_TYPE s_prev_total;
+static int64_t s_prev_us;
+static uint32_t s_seq;
+
+// ============================================================================
+// Sampling
+// ============================================================================
+
+static configRUN_TIME_COUNTER_TYPE prev_runtime(TaskHandle_t handle, configRUN_TIME_COUNTER_TYPE now) {
+    for (size_t i = 0; i < s_prev_count; i++) {
+        if (s_prev[i].handle == handle) {
+            return s_prev[i].runtime;
+        }
+    }
+    return now;     // New task: no CPU time to attribute yet
+}
+
+static void take_sample(taskprof_sample_t *sample) {
+    configRUN_TIME_COUNTER_TYPE total;
+    UBaseType_t n = uxTaskGetSystemState(s_status, sizeof(s_status) / sizeof(s_status[0]), &total);
+    int64_t now = esp_timer_get_time();
+
+    if (n == 0) {
+        // Too many tasks to snapshot, keep the baseline for the next sample
+        sample->seq = s_seq++;
+        sample->timestamp_us = now;
+        sample->interval_us = 0;
+        sample->task_count = 0;
+        sample->untracked = uxTaskGetNumberOfTasks();
+        return;
+    }
+
+    // Unsigned differences survive a 32-bit counter wrap
+    configRUN_TIME_COUNTER_TYPE total_delta = total - s_prev_total;
+
+    sample->seq = s_seq++;
+    sample->timestamp_us = now;
+    sample->interval_us = s_prev_us ? (uint32_t)(now - s_prev_us) : 0;
+    sample->task_count = 0;
+    sample->untracked = 0;
+
+    for (UBaseType_t i = 0; i < n; i++) {
+        const TaskStatus_t *st = &s_status[i];
+        if (sample->task_count == CONFIG_TASKPROF_MAX_TASKS) {
+            sample->untracked++;
+            continue;
+        }
+
+        taskprof_task_t *t = &sample->tasks[sample->task_count++];
+        configRUN_TIME_COUNTER_TYPE delta = st->ulRunTimeCounter - prev_runtime(st->xHandle, st->ulRunTimeCounter);
+        strncpy(t->name, st->pcTaskName, sizeof(t->name) - 1);
+        t->name[sizeof(t->name) - 1] = '\0';
+        t->priority = st->uxCurrentPriority;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        t->core = st->xCoreID == tskNO_AFFINITY ? -1 : (int8_t)st->xCoreID;
+#else
+        t->core = -1;
+#endif
+        t->cpu_permille = total_delta ? (uint16_t)((uint64_t)delta * 1000 / total_delta) : 0;
+        t->stack_free = st->usStackHighWaterMark;   // Bytes on ESP-IDF
+    }
+
+    // Tasks that ended since the last sample drop out of s_prev here
+    for (UBaseType_t i = 0; i < n; i++) {
+        s_prev[i].handle = s_status[i].xHandle;
+        s_prev[i].runtime = s_status[i].ulRunTimeCounter;
+    }
+    s_prev_count = n;
+    s_prev_total = total;
+    s_prev_us = now;
+}
+
+static void taskprof_task(void *arg) {
+    TickType_t last_wake = xTaskGetTickCount();
+    taskprof_sample_t sample;
+
+    // First sample only sets the baseline for CPU use
+    take_sample(&sample);
+
+    while (1) {
+        xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_TASKPROF_PERIOD_MS));
+        take_sample(&sample);
+
+        xSemaphoreTake(s_ring_lock, portMAX_DELAY);
+        s_ring[s_ring_head] = sample;
+        s_ring_head = (s_ring_head + 1) % CONFIG_TASKPROF_RING_SAMPLES;
+        if (s_ring_count < CONFIG_TASKPROF_RING_SAMPLES) {
+            s_ring_count++;
+        }
+        xSemaphoreGive(s_ring_lock);
+    }
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+esp_err_t taskprof_start(void) {
+    if (s_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_ring_lock = xSemaphoreCreateMutex();
+    if (s_ring_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(taskprof_task, "taskprof", TASKPROF_TASK_STACK, NULL,
+                    TASKPROF_TASK_PRIORITY, &s_task) != pdPASS) {
+        vSemaphoreDelete(s_ring_lock);
+        s_ring_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Sampling every %d ms, keeping %d samples",
+             CONFIG_TASKPROF_PERIOD_MS, CONFIG_TASKPROF_RING_SAMPLES);
+    return ESP_OK;
+}
+
+/**
+ * @brief Copy the sample `age` places behind the newest one
+ */
+static bool get_sample(size_t age, taskprof_sample_t *out) {
+    bool found = false;
+
+    xSemaphoreTake(s_ring_lock, portMAX_DELAY);
+    if (age < s_ring_count) {
+        size_t slot = (s_ring_head + CONFIG_TASKPROF_RING_SAMPLES - 1 - age) % CONFIG_TASKPROF_RING_SAMPLES;
+        *out = s_ring[slot];
+        found = true;
+    }
+    xSemaphoreGive(s_ring_lock);
+    return found;
+}
+
+size_t taskprof_get_samples(taskprof_sample_t *out, size_t max) {
+    if (s_ring_lock == NULL || out == NULL) {
+        return 0;
+    }
+
+    // The `max` most recent samples, oldest first
+    xSemaphoreTake(s_ring_lock, portMAX_DELAY);
+    size_t count = s_ring_count < max ? s_ring_count : max;
+    xSemaphoreGive(s_ring_lock);
+
+    size_t copied = 0;
+    while (copied < count && get_sample(count - 1 - copied, &out[copied])) {
+        copied++;
+    }
+    return copied;
+}
+
+void taskprof_dump(void) {
+    if (s_ring_lock == NULL) {
+        return;
+    }
+
+    // One sample at a time keeps the caller's stack small. New samples
+    // shift the ages, the sequence numbers let the host tool sort it out.
+    taskprof_sample_t sample;
+    for (size_t age = CONFIG_TASKPROF_RING_SAMPLES; age-- > 0; ) {
+        if (!get_sample(age, &sample)) {
+            continue;
+        }
+
+        printf(TASKPROF_LINE_PREFIX " S %" PRIu32 " %lld %" PRIu32 " %u %u\n",
+               sample.seq, (long long)sample.timestamp_us, sample.interval_us,
+               sample.task_count, sample.untracked);
+        for (size_t i = 0; i < sample.task_count; i++) {
+            const taskprof_task_t *t = &sample.tasks[i];
+            printf(TASKPROF_LINE_PREFIX " T %" PRIu32 " %d %u %u %" PRIu32 " %s\n",
+                   sample.seq, t->core, t->priority, t->cpu_permille, t->stack_free, t->name);
+        }
+    }
+}
+
+#else
+
+esp_err_t taskprof_start(void) {
+    ESP_LOGW(TAG, "Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t taskprof_get_samples(taskprof_sample_t *out, size_t max) {
+    return 0;
+}
+
+void taskprof_dump(void) {
+}
+
+#endif // CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
@@ -0,0 +1,791 @@
+/**
+ * @file Console.c
+ * @brief esp_console commands over the acquisition and storage counters
+ *
+ * Commands:
+ *  - stats [reset]          battery_fs and flash I/O counters
+ *  - hist [reset]           poll, connect-to-persist and write latency
+ *  - packs                  per-slot acquisition counters
+ *  - mem                    heap and task stack high-water marks
+ *  - taskprof [dump]        per-task CPU and stack samples (tools/taskprof)
+ *  - trace start|stop|dump  event trace (tools/evtrace)
+ *  - records [pack]         stored packs, or a scan of one pack's records
+ *  - flags [flag [pack]]    packs with alarm or error flags, or flagged records
+ *  - tlm <pack> [min] [s]   live telemetry rollups of the last minutes
+ *  - top <metric>           packs ranking highest on a fleet metric
+ *  - sync <consumer> [n]    records stored since a consumer's mark
+ *  - sync <consumer> ack <seq>
+ *                           move a consumer's mark
+ *  - state [fault|estop|clear]
+ *                           system state, or inject a fault or clear one
+ *  - bench decode|meta [n]  on-demand micro-benchmarks
+ *  - poll [class] [ms]      per-slot poll periods (idle packs without class)
+ *  - flush [ms]             flush deadline for downloaded records
+ *  - log <tag|*> <level>    log level
+ */
+
+#include "Console.h"
+#include "DataAcquisition.h"
+#include "BATMON_decode.h"
+#include "batmon_fixtures.h"
+#include "battery_fs.h"
+#include "taskprof.h"
+#include "evtrace.h"
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+static const char *TAG = "CONSOLE";
+
+#define BENCH_DECODE_RECORDS    256
+#define BENCH_DEFAULT_ROUNDS    100
+
+// Tasks whose stack high-water mark `mem` reports
+static const char *const s_tasks[] = { "SMBUS_update", "system_state", "main", "console_repl", "IDLE0", "IDLE1" };
+
+// `flags` names, in battery_fs_flag_t order
+static const char *const s_flag_names[BATTERY_FS_FLAGS] = {
+    "capacity", "imbalance", "hot", "cold", "cc", "cc_time", "cc_count",
+};
+
+typedef struct {
+    int flag;                       // -1 = any
+    uint32_t packs;
+} flag_filter_t;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static bool arg_is(int argc, char **argv, int i, const char *value) {
+    return argc > i && strcmp(argv[i], value) == 0;
+}
+
+static void print_histogram(const char *name, const acq_histogram_t *hist) {
+    // Copy first, the SMBUS_update task keeps adding samples
+    acq_histogram_t h = *hist;
+    printf("%-9s n=%-7" PRIu32 " mean=%-8" PRIu64 " p50<=%-8" PRIu32 " p99<=%-8" PRIu32 " max=%" PRIu32 " us\n",
+           name, h.count, h.count ? h.sum_us / h.count : 0,
+           acq_histogram_percentile(&h, 50), acq_histogram_percentile(&h, 99), h.max_us);
+    for (int b = 0; b < ACQ_HIST_BUCKETS; b++) {
+        if (h.buckets[b]) {
+            printf("          [%8" PRIu32 ", %8" PRIu32 ") %" PRIu32 "\n",
+                   b ? 1u << b : 0, 2u << b, h.buckets[b]);
+        }
+    }
+}
+
+// ============================================================================
+// Commands
+// ============================================================================
+
+static int cmd_stats(int argc, char **argv) {
+    if (arg_is(argc, argv, 1, "reset")) {
+        return battery_fs_reset_stats() == ESP_OK ? 0 : 1;
+    }
+
+    battery_fs_stats_t st;
+    if (battery_fs_get_stats(&st) != ESP_OK) {
+        printf("Filesystem not available\n");
+        return 1;
+    }
+    printf("records written   %" PRIu32 "\n", st.records_written);
+    printf("sectors read      %" PRIu64 " (%" PRIu32 " B)\n", st.sectors_read, st.sector_size);
+    printf("sectors written   %" PRIu64 "\n", st.sectors_written);
+    printf("flash read        %" PRIu64 " B\n", st.flash_bytes_read);
+    printf("flash programmed  %" PRIu64 " B\n", st.flash_bytes_programmed);
+    printf("blocks erased     %" PRIu32 "\n", st.flash_blocks_erased);
+    if (st.flash_cache_hits + st.flash_cache_misses) {
+        printf("page cache        %" PRIu32 " hits, %" PRIu32 " misses\n", st.flash_cache_hits,
+               st.flash_cache_misses);
+    }
+    if (st.records_written) {
+        printf("flash B/record    %" PRIu64 "\n", st.flash_bytes_programmed / st.records_written);
+    }
+    if (st.records_read) {
+        printf("records read      %" PRIu32 ", %" PRIu64 " B copied/record\n", st.records_read,
+               st.flash_bytes_copied / st.records_read);
+    }
+    return 0;
+}
+
+static int cmd_hist(int argc, char **argv) {
+    if (arg_is(argc, argv, 1, "reset")) {
+        acq_stats_reset();
+        return 0;
+    }
+
+    print_histogram("poll", &acq_stats.poll);
+    print_histogram("persist", &acq_stats.persist);
+    print_histogram("fs_write", &acq_stats.fs_write);
+    print_histogram("fault", &acq_stats.fault_response);
+    print_histogram("quiesce", &acq_stats.fault_quiesce);
+    return 0;
+}
+
+static int cmd_packs(int argc, char **argv) {
+    int64_t now = esp_timer_get_time();
+
+    printf("slot addr pack      conn  connects discon  records rd_err sv_err  age_s  persist_ms"
+           " class      soc     mA    polls  soh\n");
+    for (int i = 0; i < NO_BATMON; i++) {
+        battery_state_t st = battery_state[i];
+        printf("%4d 0x%02X %-9s %-5s %8" PRIu32 " %6" PRIu32 " %8" PRIu32 " %6" PRIu32 " %6" PRIu32,
+               i, st.address ? st.address : BATMON_addresses[i], st.pack_id[0] ? st.pack_id : "-",
+               st.is_connected ? "yes" : "no", st.connects, st.disconnects,
+               st.records_read, st.read_errors, st.save_errors);
+        if (st.connected_us) {
+            printf(" %6lld", (long long)((now - st.connected_us) / 1000000));
+        } else {
+            printf(" %6s", "-");
+        }
+        if (st.persisted_us) {
+            printf(" %11lld", (long long)((st.persisted_us - st.connected_us) / 1000));
+        } else {
+            printf(" %11s", "-");
+        }
+        printf(" %-9s %4u %6d %8" PRIu32, SMBUS_slot_class_name(st.poll_class),
+               (unsigned)st.soc, st.current_ma, st.polls);
+        if (st.connects && st.soh != BATTERY_FS_SOH_UNKNOWN) {
+            printf(" %3u%%\n", st.soh);
+        } else {
+            printf(" %4s\n", "-");
+        }
+    }
+    return 0;
+}
+
+static int cmd_mem(int argc, char **argv) {
+    printf("heap 8bit     free %u  min %u  largest %u\n",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    printf("heap internal free %u  min %u\n",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+
+    for (size_t i = 0; i < sizeof(s_tasks) / sizeof(s_tasks[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(s_tasks[i]);
+        if (task != NULL) {
+            // Bytes on ESP-IDF
+            printf("stack %-13s min free %u\n", s_tasks[i], (unsigned)uxTaskGetStackHighWaterMark(task));
+        }
+    }
+    return 0;
+}
+
+static int cmd_taskprof(int argc, char **argv) {
+    if (arg_is(argc, argv, 1, "dump")) {
+        taskprof_dump();
+        return 0;
+    }
+
+    taskprof_sample_t *sample = malloc(sizeof(*sample));
+    if (sample == NULL || taskprof_get_samples(sample, 1) == 0) {
+        printf("No samples yet\n");
+        free(sample);
+        return 1;
+    }
+
+    printf("sample %" PRIu32 " over %" PRIu32 " ms\n", sample->seq, sample->interval_us / 1000);
+    printf("%-16s %4s %4s %6s %10s\n", "task", "core", "prio", "cpu", "stack_min");
+    for (size_t i = 0; i < sample->task_count; i++) {
+        const taskprof_task_t *t = &sample->tasks[i];
+        printf("%-16s %4d %4u %5.1f%% %10" PRIu32 "\n",
+               t->name, t->core, t->priority, t->cpu_permille / 10.0, t->stack_free);
+    }
+    free(sample);
+    return 0;
+}
+
+static int cmd_trace(int argc, char **argv) {
+    if (arg_is(argc, argv, 1, "start")) {
+        return evtrace_start() == ESP_OK ? 0 : 1;
+    }
+    if (arg_is(argc, argv, 1, "stop")) {
+        evtrace_stop();
+    } else if (arg_is(argc, argv, 1, "dump")) {
+        // A consistent snapshot needs the writers stopped
+        evtrace_stop();
+        evtrace_dump(stdout);
+        return 0;
+    } else if (argc > 1) {
+        printf("Usage: trace [start|stop|dump]\n");
+        return 1;
+    }
+
+    uint32_t dropped;
+    uint32_t count = evtrace_count(&dropped);
+    printf("%s, %" PRIu32 " events held, %" PRIu32 " overwritten\n",
+           evtrace_is_running() ? "recording" : "stopped", count, dropped);
+    return 0;
+}
+
+/**
+ * @brief Resistance SOH and the condition bucket that grew most
+ */
+static void print_ir(const battery_fs_summary_t *sum) {
+    int worst = -1;
+    uint32_t worst_pct = 0;
+    for (int b = 0; b < BATTERY_FS_IR_BUCKETS; b++) {
+        const battery_fs_ir_bucket_t *ir = &sum->ir[b];
+        if (ir->samples < BATTERY_FS_IR_SETTLED || ir->baseline == 0) {
+            continue;
+        }
+        uint32_t pct = (uint32_t)ir->level * 100 / ir->baseline;
+        if (worst < 0 || pct > worst_pct) {
+            worst = b;
+            worst_pct = pct;
+        }
+    }
+    if (worst < 0) {
+        printf("%12s SOH unknown, no settled IR bucket\n", "");
+        return;
+    }
+
+    const battery_fs_ir_bucket_t *ir = &sum->ir[worst];
+    printf("%12s SOH %u%%, IR up most at soc %d temp %d: %.2f -> %.2f mOhm (%" PRIu32 "%%) over cycles %u..%u\n",
+           "", sum->soh, worst / BATTERY_FS_IR_TEMP_BUCKETS, worst % BATTERY_FS_IR_TEMP_BUCKETS,
+           (double)ir->baseline / BATTERY_FS_IR_SCALE, (double)ir->level / BATTERY_FS_IR_SCALE,
+           worst_pct, ir->first_cycle, ir->last_cycle);
+}
+
+static bool print_pack(const char *serial_number, void *arg) {
+    battery_metadata_t meta;
+    if (battery_fs_read_metadata(serial_number, &meta) != ESP_OK) {
+        return true;
+    }
+    printf("%-12s %8" PRIu32 " records, last index %" PRIu32 "\n",
+           serial_number, meta.record_count, meta.last_memory_index);
+
+    battery_fs_summary_t sum;
+    if (battery_fs_read_summary(serial_number, &sum) == ESP_OK && sum.decoded > 0) {
+        const battery_fs_summary_field_t *f = sum.fields;
+        printf("%12s cycle %u, min SOC %" PRIu32 "%%, max temp %d°C, max current %" PRIu32 " A, "
+               "discharged %" PRIu64 " mAh, alarms capacity %" PRIu32 " imbalance %" PRIu32
+               " hot %" PRIu32 " cold %" PRIu32 "\n",
+               "", sum.latest_cycle, f[BATTERY_FS_SUMMARY_MIN_SOC].min,
+               (int)f[BATTERY_FS_SUMMARY_MAX_TEMP].max + MEMORY_TEMP_OFFSET,
+               f[BATTERY_FS_SUMMARY_MAX_CURRENT].max, f[BATTERY_FS_SUMMARY_DISCHARGED].sum,
+               sum.alarms[0], sum.alarms[1], sum.alarms[2], sum.alarms[3]);
+        print_ir(&sum);
+    }
+    return true;
+}
+
+/**
+ * @brief List stored packs, or read all records of one
+ *
+ * The scan reads a snapshot while acquisition keeps appending.
+ */
+static int cmd_records(int argc, char **argv) {
+    if (argc < 2) {
+        return battery_fs_foreach(print_pack, NULL) == ESP_OK ? 0 : 1;
+    }
+
+    battery_fs_reader_t *reader;
+    esp_err_t ret = battery_fs_reader_open(argv[1], &reader);
+    if (ret != ESP_OK) {
+        printf("%s: %s\n", argv[1], esp_err_to_name(ret));
+        return 1;
+    }
+
+    BatmonMemory record;
+    battery_fs_record_header_t hdr;
+    uint32_t records = 0, first = 0, last = 0;
+    uint64_t bytes = 0;
+    int64_t start = esp_timer_get_time();
+    while ((ret = battery_fs_reader_next(reader, &hdr, (uint8_t *)&record, sizeof(record))) == ESP_OK ||
+           ret == ESP_ERR_INVALID_SIZE) {
+        if (records++ == 0) {
+            first = hdr.memory_index;
+        }
+        last = hdr.memory_index;
+        bytes += hdr.data_len;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    uint32_t expected = battery_fs_reader_count(reader);
+    battery_fs_reader_close(reader);
+
+    printf("%s: %" PRIu32 "/%" PRIu32 " records, index %" PRIu32 "..%" PRIu32 ", %" PRIu64 " bytes in %lld us%s\n",
+           argv[1], records, expected, first, last, bytes, (long long)elapsed,
+           ret == ESP_ERR_NOT_FOUND ? "" : " (read error)");
+    return ret == ESP_ERR_NOT_FOUND ? 0 : 1;
+}
+
+static bool print_flag_pack(const char *serial_number, void *arg) {
+    flag_filter_t *filter = arg;
+    uint32_t records, set[BATTERY_FS_FLAGS];
+    if (battery_fs_flag_counts(serial_number, &records, set) != ESP_OK) {
+        return true;
+    }
+
+    bool any = false;
+    for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+        any |= set[f] > 0 && (filter->flag < 0 || filter->flag == f);
+    }
+    if (!any) {
+        return true;
+    }
+    filter->packs++;
+    printf("%-12s %8" PRIu32 " records", serial_number, records);
+    for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+        if (set[f] > 0 && (filter->flag < 0 || filter->flag == f)) {
+            printf(", %s %" PRIu32, s_flag_names[f], set[f]);
+        }
+    }
+    printf("\n");
+    return true;
+}
+
+static bool print_flag_run(uint32_t first, uint32_t count, void *arg) {
+    printf("  records %" PRIu32 "..%" PRIu32 "\n", first, first + count - 1);
+    return true;
+}
+
+/**
+ * @brief Packs with alarm or error flags, or the flagged records of one pack
+ *
+ * Answered from the per-pack flag index, without reading records.
+ */
+static int cmd_flags(int argc, char **argv) {
+    flag_filter_t filter = { .flag = -1 };
+    if (argc > 1) {
+        for (int f = 0; f < BATTERY_FS_FLAGS && filter.flag < 0; f++) {
+            if (strcmp(argv[1], s_flag_names[f]) == 0) {
+                filter.flag = f;
+            }
+        }
+        if (filter.flag < 0) {
+            printf("Unknown flag %s:", argv[1]);
+            for (int f = 0; f < BATTERY_FS_FLAGS; f++) {
+                printf(" %s", s_flag_names[f]);
+            }
+            printf("\n");
+            return 1;
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = argc > 2 ? battery_fs_flag_runs(argv[2], filter.flag, print_flag_run, NULL)
+                             : battery_fs_foreach(print_flag_pack, &filter);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    if (argc > 2) {
+        printf("%s %s in %lld us\n", argv[2], argv[1], (long long)elapsed);
+    } else {
+        printf("%" PRIu32 " packs in %lld us\n", filter.packs, (long long)elapsed);
+    }
+    return 0;
+}
+
+#define TLM_DEFAULT_MINUTES 10
+#define TLM_DEFAULT_ROWS    20          // Resolution picked for about this many rows
+
+typedef struct {
+    uint32_t now;                   // Reference for the bucket ages
+    uint32_t buckets;
+} tlm_print_t;
+
+static bool print_tlm_bucket(const battery_fs_tlm_bucket_t *b, uint32_t period_s, void *arg) {
+    tlm_print_t *p = arg;
+    p->buckets++;
+    const battery_fs_tlm_stat_t *soc = &b->channel[BATTERY_FS_TLM_SOC];
+    const battery_fs_tlm_stat_t *cur = &b->channel[BATTERY_FS_TLM_CURRENT];
+    printf("%7" PRIu32 " s ago %4" PRIu32 " s %5u  soc %3d/%3" PRId32 "/%3d %%  current %6d/%6" PRId32 "/%6d mA\n",
+           p->now - b->start_s, period_s, b->samples, soc->min, soc->sum / b->samples, soc->max,
+           cur->min, cur->sum / b->samples, cur->max);
+    return true;
+}
+
+/**
+ * @brief Telemetry rollups of a pack over the last minutes, min/mean/max
+ *
+ * battery_fs picks the resolution from the step, coarser where the finer
+ * buckets have aged out.
+ */
+static int cmd_tlm(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: tlm <pack> [minutes] [step_s]\n");
+        return 1;
+    }
+    int minutes = argc > 2 ? atoi(argv[2]) : TLM_DEFAULT_MINUTES;
+    if (minutes <= 0) {
+        printf("Invalid minutes\n");
+        return 1;
+    }
+    uint32_t step = argc > 3 ? (uint32_t)atoi(argv[3]) : (uint32_t)minutes * 60 / TLM_DEFAULT_ROWS;
+
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t from = now > (uint32_t)minutes * 60 ? now - (uint32_t)minutes * 60 : 0;
+    tlm_print_t print = { .now = now };
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = battery_fs_tlm_query(argv[1], from, now, step, print_tlm_bucket, &print);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (ret != ESP_OK) {
+        printf("%s: %s\n", argv[1], esp_err_to_name(ret));
+        return 1;
+    }
+    printf("%s: %" PRIu32 " buckets in %lld us\n", argv[1], print.buckets, (long long)elapsed);
+    return 0;
+}
+
+static const char *const s_topk_names[BATTERY_FS_TOPK_METRICS] = { "ir", "cc", "alarms", "temp" };
+
+/**
+ * @brief Packs ranking highest on a fleet metric
+ *
+ * Answered from the rankings battery_fs keeps in memory, without reading
+ * any pack's files.
+ */
+static int cmd_top(int argc, char **argv) {
+    int metric = -1;
+    for (int m = 0; argc > 1 && m < BATTERY_FS_TOPK_METRICS && metric < 0; m++) {
+        if (strcmp(argv[1], s_topk_names[m]) == 0) {
+            metric = m;
+        }
+    }
+    if (metric < 0) {
+        printf("Usage: top");
+        for (int m = 0; m < BATTERY_FS_TOPK_METRICS; m++) {
+            printf("%s%s", m == 0 ? " " : "|", s_topk_names[m]);
+        }
+        printf("\n");
+        return 1;
+    }
+
+    battery_fs_rank_t ranks[BATTERY_FS_TOPK];
+    size_t count;
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = battery_fs_topk(metric, ranks, &count);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int32_t v = ranks[i].value;
+        printf("%2u. %-12s ", (unsigned)i + 1, ranks[i].serial_number);
+        switch (metric) {
+        case BATTERY_FS_TOPK_IR_GROWTH:
+            printf("IR %+.1f %% over baseline\n", v / 10.0);
+            break;
+        case BATTERY_FS_TOPK_MAX_TEMP:
+            printf("max temp %" PRId32 " C\n", v + MEMORY_TEMP_OFFSET);
+            break;
+        default:
+            printf("%" PRId32 " records\n", v);
+            break;
+        }
+    }
+    printf("%u packs in %lld us\n", (unsigned)count, (long long)elapsed);
+    return 0;
+}
+
+#define SYNC_DEFAULT_RECORDS 20
+
+static bool print_sync_record(const char *serial_number, uint32_t seq, const battery_fs_record_header_t *header,
+                              const uint8_t *data, void *arg) {
+    printf("%8" PRIu32 " %-12s index %" PRIu32 " (%" PRIu32 " bytes)\n", seq, serial_number, header->memory_index,
+           header->data_len);
+    return true;
+}
+
+static int cmd_sync(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: sync <consumer> [records] | sync <consumer> ack <seq>\n");
+        return 1;
+    }
+
+    esp_err_t ret;
+    if (arg_is(argc, argv, 2, "ack")) {
+        if (argc < 4) {
+            printf("Usage: sync <consumer> ack <seq>\n");
+            return 1;
+        }
+        ret = battery_fs_sync_ack(argv[1], (uint32_t)strtoul(argv[3], NULL, 10));
+        if (ret != ESP_OK) {
+            printf("%s\n", esp_err_to_name(ret));
+            return 1;
+        }
+        printf("%s acknowledged up to %s\n", argv[1], argv[3]);
+        return 0;
+    }
+
+    uint32_t max = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : SYNC_DEFAULT_RECORDS;
+    uint32_t acked = 0, last = 0;
+    battery_fs_sync_cursor(argv[1], &acked);
+    ret = battery_fs_sync_read(argv[1], max, print_sync_record, NULL, &last);
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    printf("%s: mark %" PRIu32 ", served to %" PRIu32 " of %" PRIu32 "\n", argv[1], acked, last,
+           battery_fs_sync_last_seq());
+    if (last != acked) {
+        printf("Acknowledge with: sync %s ack %" PRIu32 "\n", argv[1], last);
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode synthetic records into columns, CPU only
+ */
+static int bench_decode(int rounds) {
+    BatmonMemory *records = malloc(BENCH_DECODE_RECORDS * sizeof(BatmonMemory));
+    void *col_buf = malloc(BATMON_memColumnsSize(BENCH_DECODE_RECORDS));
+    if (records == NULL || col_buf == NULL) {
+        printf("Out of memory\n");
+        free(records);
+        free(col_buf);
+        return 1;
+    }
+
+    batmon_synth_t synth;
+    batmon_synth_init(&synth, NULL, 0);
+    batmon_synth_fill(&synth, records, BENCH_DECODE_RECORDS);
+
+    batmon_mem_columns_t cols;
+    BATMON_memColumnsBind(&cols, col_buf, BENCH_DECODE_RECORDS);
+
+    int64_t start = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++) {
+        BATMON_decodeMemoryBatch(records, sizeof(BatmonMemory), BENCH_DECODE_RECORDS, &cols, 0);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    // Wall time: acquisition preempts this task whenever it runs
+    printf("decode: %d x %d records in %lld us, %.1f ns/record\n", rounds, BENCH_DECODE_RECORDS,
+           (long long)elapsed, elapsed * 1000.0 / ((double)rounds * BENCH_DECODE_RECORDS));
+
+    free(records);
+    free(col_buf);
+    return 0;
+}
+
+/**
+ * @brief Read the metadata of every known pack
+ *
+ * FatFs serializes these reads with the writes of SMBUS_update. Files are
+ * read one at a time with a yield in between, so a write waits for one
+ * read at most.
+ */
+static int bench_meta(int rounds) {
+    battery_metadata_t meta;
+    uint32_t reads = 0, max_us = 0;
+    int64_t total_us = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < NO_BATMON; i++) {
+            char pack_id[sizeof(battery_state[i].pack_id)];
+            memcpy(pack_id, battery_state[i].pack_id, sizeof(pack_id));
+            pack_id[sizeof(pack_id) - 1] = '\0';
+            if (pack_id[0] == '\0') {
+                continue;
+            }
+
+            int64_t start = esp_timer_get_time();
+            esp_err_t ret = battery_fs_read_metadata(pack_id, &meta);
+            int64_t us = esp_timer_get_time() - start;
+            if (ret != ESP_OK) {
+                continue;
+            }
+            reads++;
+            total_us += us;
+            if (us > max_us) {
+                max_us = us;
+            }
+            vTaskDelay(1);
+        }
+    }
+
+    if (reads == 0) {
+        printf("No stored packs\n");
+        return 1;
+    }
+    printf("meta: %" PRIu32 " reads, mean %lld us, max %" PRIu32 " us\n",
+           reads, (long long)(total_us / reads), max_us);
+    return 0;
+}
+
+static int cmd_bench(int argc, char **argv) {
+    int rounds = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_ROUNDS;
+    if (rounds <= 0) {
+        rounds = BENCH_DEFAULT_ROUNDS;
+    }
+
+    if (arg_is(argc, argv, 1, "decode")) {
+        return bench_decode(rounds);
+    }
+    if (arg_is(argc, argv, 1, "meta")) {
+        return bench_meta(rounds);
+    }
+    printf("Usage: bench decode|meta [rounds]\n");
+    return 1;
+}
+
+static int cmd_state(int argc, char **argv) {
+    if (argc > 1) {
+        system_state_t to;
+        if (arg_is(argc, argv, 1, "fault")) {
+            to = SYS_FAULT;
+        } else if (arg_is(argc, argv, 1, "estop")) {
+            to = SYS_ESTOP;
+        } else if (arg_is(argc, argv, 1, "clear")) {
+            to = SYS_IDLE;
+        } else {
+            printf("Usage: state [fault|estop|clear]\n");
+            return 1;
+        }
+        if (!system_state_request(to)) {
+            printf("%s -> %s not allowed\n", system_state_name(system_state_get()), system_state_name(to));
+            return 1;
+        }
+    }
+    printf("state %s, storage %s\n", system_state_name(system_state_get()),
+           battery_fs_is_suspended() ? "suspended" : "running");
+    return 0;
+}
+
+static int cmd_poll(int argc, char **argv) {
+    smbus_poll_rates_t rates;
+    SMBUS_get_poll_rates(&rates);
+
+    if (argc > 1) {
+        // A bare period sets idle packs, as before per-slot rates
+        uint32_t *field = &rates.idle_ms;
+        const char *value = argv[1];
+        if (argc > 2) {
+            value = argv[2];
+            if (strcmp(argv[1], "cv") == 0) {
+                field = &rates.charge_cv_ms;
+            } else if (strcmp(argv[1], "charging") == 0) {
+                field = &rates.charging_ms;
+            } else if (strcmp(argv[1], "empty_min") == 0) {
+                field = &rates.empty_min_ms;
+            } else if (strcmp(argv[1], "empty_max") == 0) {
+                field = &rates.empty_max_ms;
+            } else if (strcmp(argv[1], "idle") != 0) {
+                printf("Usage: poll [cv|charging|idle|empty_min|empty_max] [ms]\n");
+                return 1;
+            }
+        }
+        int ms = atoi(value);
+        if (ms <= 0) {
+            printf("Period must be > 0 ms\n");
+            return 1;
+        }
+        *field = ms;
+        if (SMBUS_set_poll_rates(&rates) != ESP_OK) {
+            printf("empty_max must be >= empty_min\n");
+            return 1;
+        }
+    }
+    printf("poll cv %" PRIu32 " ms (charging at %u%%+), charging %" PRIu32 " ms, idle %" PRIu32
+           " ms, empty %" PRIu32 "..%" PRIu32 " ms\n",
+           rates.charge_cv_ms, (unsigned)rates.cv_soc, rates.charging_ms, rates.idle_ms,
+           rates.empty_min_ms, rates.empty_max_ms);
+    return 0;
+}
+
+static int cmd_flush(int argc, char **argv) {
+    if (argc > 1) {
+        int ms = atoi(argv[1]);
+        if (ms < 0) {
+            printf("Deadline must be >= 0 ms\n");
+            return 1;
+        }
+        SMBUS_set_flush_deadline(ms);
+    }
+    printf("flush deadline %" PRIu32 " ms\n", SMBUS_get_flush_deadline());
+    return 0;
+}
+
+static int cmd_log(int argc, char **argv) {
+    static const char *const levels[] = { "none", "error", "warn", "info", "debug", "verbose" };
+
+    if (argc != 3) {
+        printf("Usage: log <tag|*> none|error|warn|info|debug|verbose\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strcmp(argv[2], levels[i]) == 0) {
+            esp_log_level_set(argv[1], (esp_log_level_t)i);
+            return 0;
+        }
+    }
+    printf("Unknown level %s\n", argv[2]);
+    return 1;
+}
+
+// ============================================================================
+// REPL
+// ============================================================================
+
+static const esp_console_cmd_t s_commands[] = {
+    { .command = "stats", .help = "Storage I/O counters", .hint = "[reset]", .func = cmd_stats },
+    { .command = "hist", .help = "Acquisition latency histograms", .hint = "[reset]", .func = cmd_hist },
+    { .command = "packs", .help = "Per-slot acquisition counters", .func = cmd_packs },
+    { .command = "mem", .help = "Heap and task stack high-water marks", .func = cmd_mem },
+    { .command = "taskprof", .help = "Task CPU and stack samples", .hint = "[dump]", .func = cmd_taskprof },
+    { .command = "trace", .help = "Record or dump the event trace", .hint = "[start|stop|dump]", .func = cmd_trace },
+    { .command = "records", .help = "List stored packs or scan one", .hint = "[pack]", .func = cmd_records },
+    { .command = "flags", .help = "Packs with alarm or error flags, or flagged records of one", .hint = "[flag [pack]]", .func = cmd_flags },
+    { .command = "tlm", .help = "Live telemetry rollups of a pack, min/mean/max", .hint = "<pack> [minutes] [step_s]", .func = cmd_tlm },
+    { .command = "top", .help = "Packs ranking highest on a fleet metric", .hint = "ir|cc|alarms|temp", .func = cmd_top },
+    { .command = "sync", .help = "Records stored since a consumer's mark, or move the mark", .hint = "<consumer> [records] | <consumer> ack <seq>", .func = cmd_sync },
+    { .command = "bench", .help = "Run a micro-benchmark", .hint = "decode|meta [rounds]", .func = cmd_bench },
+    { .command = "state", .help = "System state, inject or clear a fault", .hint = "[fault|estop|clear]", .func = cmd_state },
+    { .command = "poll", .help = "Get or set the per-slot SMBus poll periods", .hint = "[cv|charging|idle|empty_min|empty_max] [ms]", .func = cmd_poll },
+    { .command = "flush", .help = "Get or set the flush deadline (0 = store at once)", .hint = "[ms]", .func = cmd_flush },
+    { .command = "log", .help = "Set a log level", .hint = "<tag|*> <level>", .func = cmd_log },
+};
+
+esp_err_t console_start(void) {
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "batmon>";
+    repl_config.task_priority = CONSOLE_TASK_PRIORITY;
+    repl_config.task_stack_size = CONSOLE_TASK_STACK;
+
+    esp_err_t ret;
+#if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
+    esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ret = esp_console_new_repl_uart(&hw_config, &repl_config, &repl);
+#elif CONFIG_ESP_CONSOLE_USB_CDC
+    esp_console_dev_usb_cdc_config_t hw_config = ESP_CONSOLE_DEV_CDC_CONFIG_DEFAULT();
+    ret = esp_console_new_repl_usb_cdc(&hw_config, &repl_config, &repl);
+#elif CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
+    esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+    ret = esp_console_new_repl_usb_serial_jtag(&hw_config, &repl_config, &repl);
+#else
+    ret = ESP_ERR_NOT_SUPPORTED;
+#endif
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create REPL: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    esp_console_register_help_command();
+    for (size_t i = 0; i < sizeof(s_commands) / sizeof(s_commands[0]); i++) {
+        ret = esp_console_cmd_register(&s_commands[i]);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register %s: %s", s_commands[i].command, esp_err_to_name(ret));
+            return ret;
+        }
+    }
+
+    return esp_console_start_repl(repl);
+}
@@ -3,14 +3,19 @@
 #include "battery_fs.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
+#include "evtrace.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 
 #define TAG "DATA_ACQ"
 
+#if !CONFIG_BATMON_SIMULATED
 // GPIO pins for I2C
 typedef struct {
     gpio_num_t sda;
@@ -21,6 +26,7 @@ static const i2c_pins_t smbus_pins = {
     .sda = GPIO_NUM_21,
     .scl = GPIO_NUM_18,
 };
+#endif
 
 // BATMON addresses
 const uint8_t BATMON_addresses[NO_BATMON] = {
@@ -31,12 +37,312 @@ const uint8_t BATMON_addresses[NO_BATMON] = {
 i2c_master_bus_handle_t SMBus_handle;
 batmon_handle_t BATMON_handle[NO_BATMON];
 battery_state_t battery_state[NO_BATMON] = {0};
+acq_stats_t acq_stats;
+
+// Tuning, see SMBUS_set_poll_rates() and SMBUS_set_flush_deadline()
+static smbus_poll_rates_t s_rates = {
+    .charge_cv_ms = 100,
+    .charging_ms = 500,
+    .idle_ms = 1000,
+    .empty_min_ms = 250,
+    .empty_max_ms = 1000,
+    .cv_soc = 80,
+    .charge_ma = 50,
+};
+static volatile uint32_t s_flush_deadline_ms = 0;
+
+// Per-slot schedule, see SMBUS_poll_due()
+static int64_t s_due_us[NO_BATMON];
+static uint32_t s_empty_ms[NO_BATMON];      // Current period of an empty slot
+static uint8_t s_queue[NO_BATMON];          // Slots by due time, earliest first
+static bool s_schedule_ready;
+
+// System state, see system_state_request()
+#define SYSTEM_STATE_TASK_PRIORITY  10      // Above SMBUS_update and the console
+#define SYSTEM_STATE_TASK_STACK     3072
+#define SYSTEM_QUIESCE_TIMEOUT_MS   2000    // Longest wait for storage to stop
+#define SOH_DEGRADED_PCT            60      // Warn below this resistance-based SOH
+#define TLM_BATCH                   16      // Telemetry samples per slot stored at once
+
+static volatile system_state_t s_system_state = SYS_IDLE;
+static volatile int64_t s_fault_us;                 // When the last fault was raised
+static volatile battery_fs_flash_op_t s_fault_flash_op; // What the flash was doing then
+static TaskHandle_t s_state_task;
+
+// Downloaded pack memory waiting for its flush deadline
+typedef struct {
+    BatmonMemory *records;      // Records followed by their log entries, NULL when empty
+    size_t count;
+    int64_t due_us;
+    char pack_id[16];
+} pending_write_t;
+
+static pending_write_t s_pending[NO_BATMON];
+
+// Live telemetry of a slot waiting to be stored, see flush_pending()
+typedef struct {
+    battery_fs_tlm_sample_t samples[TLM_BATCH];
+    size_t count;
+    char pack_id[16];
+} pending_tlm_t;
+
+static pending_tlm_t s_tlm[NO_BATMON];
+
+static void histogram_add(acq_histogram_t *hist, int64_t us)
+{
+    uint32_t v = us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+    int bucket = v ? 31 - __builtin_clz(v) : 0;
+    if (bucket >= ACQ_HIST_BUCKETS) {
+        bucket = ACQ_HIST_BUCKETS - 1;
+    }
+    hist->buckets[bucket]++;
+    hist->sum_us += v;
+    if (v > hist->max_us) {
+        hist->max_us = v;
+    }
+    hist->count++;
+}
+
+/**
+ * @brief Upper bound of the bucket holding the pct-th percentile
+ */
+uint32_t acq_histogram_percentile(const acq_histogram_t *hist, unsigned pct)
+{
+    uint32_t rank = ((uint64_t)hist->count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < ACQ_HIST_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= rank && seen > 0) {
+            uint32_t upper = (b == ACQ_HIST_BUCKETS - 1) ? hist->max_us : (2u << b) - 1;
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return 0;
+}
+
+void acq_stats_reset(void)
+{
+    memset(&acq_stats, 0, sizeof(acq_stats));
+}
+
+/**
+ * @brief Set the poll period of slots holding an idle pack
+ */
+void SMBUS_set_poll_period(uint32_t ms)
+{
+    s_rates.idle_ms = ms > 0 ? ms : 1;
+}
+
+uint32_t SMBUS_get_poll_period(void)
+{
+    return s_rates.idle_ms;
+}
+
+/**
+ * @brief Set the per-class poll periods
+ *
+ * A slot picks up new periods when it is next polled. The fields are
+ * copied one by one, a poll running meanwhile may mix old and new ones.
+ */
+esp_err_t SMBUS_set_poll_rates(const smbus_poll_rates_t *rates)
+{
+    if (rates == NULL || rates->charge_cv_ms == 0 || rates->charging_ms == 0 || rates->idle_ms == 0 ||
+        rates->empty_min_ms == 0 || rates->empty_max_ms < rates->empty_min_ms) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_rates = *rates;
+    return ESP_OK;
+}
+
+void SMBUS_get_poll_rates(smbus_poll_rates_t *rates)
+{
+    *rates = s_rates;
+}
+
+/**
+ * @brief Let downloaded records wait up to `ms` before they are stored
+ *
+ * 0 stores them in the poll that downloaded them. Otherwise the write runs
+ * at the end of the first poll past the deadline, after every slot has been
+ * serviced, so a burst of connections is read out before storage work.
+ */
+void SMBUS_set_flush_deadline(uint32_t ms)
+{
+    s_flush_deadline_ms = ms;
+}
+
+uint32_t SMBUS_get_flush_deadline(void)
+{
+    return s_flush_deadline_ms;
+}
+
+// ============================================================================
+// System state
+// ============================================================================
+
+static bool is_fault(system_state_t state)
+{
+    return state == SYS_FAULT || state == SYS_ESTOP;
+}
+
+static bool transition_allowed(system_state_t from, system_state_t to)
+{
+    switch (to) {
+    case SYS_ESTOP:
+        return from != SYS_ESTOP;
+    case SYS_FAULT:
+        return !is_fault(from);
+    case SYS_CHARGING:
+        return from == SYS_IDLE;
+    case SYS_IDLE:
+        return from != SYS_IDLE;
+    default:
+        return false;
+    }
+}
+
+const char *system_state_name(system_state_t state)
+{
+    switch (state) {
+    case SYS_IDLE:      return "IDLE";
+    case SYS_CHARGING:  return "CHARGING";
+    case SYS_FAULT:     return "FAULT";
+    case SYS_ESTOP:     return "ESTOP";
+    default:            return "?";
+    }
+}
+
+system_state_t system_state_get(void)
+{
+    return s_system_state;
+}
+
+/**
+ * @brief Change state and gate storage, from a task or an ISR
+ *
+ * Only flags change here, nothing waits: battery_fs_suspend() makes storage
+ * stop at its next record boundary, the state task waits for that. When a
+ * clear races a new fault the storage gate is re-checked against the state
+ * that won.
+ */
+static bool state_request(system_state_t to, bool from_isr, BaseType_t *woken)
+{
+    int64_t now = esp_timer_get_time();
+    system_state_t from = __atomic_load_n(&s_system_state, __ATOMIC_SEQ_CST);
+    do {
+        if (!transition_allowed(from, to)) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&s_system_state, &from, to, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    EVTRACE_INSTANT(EVTRACE_ID_SYSTEM_STATE, to);
+
+    if (is_fault(to)) {
+        s_fault_us = now;
+        s_fault_flash_op = battery_fs_flash_op();
+        battery_fs_suspend();
+    } else if (is_fault(from)) {
+        battery_fs_resume();
+        if (is_fault(s_system_state)) {
+            battery_fs_suspend();
+        }
+    }
+
+    if (s_state_task != NULL) {
+        if (from_isr) {
+            vTaskNotifyGiveFromISR(s_state_task, woken);
+        } else {
+            xTaskNotifyGive(s_state_task);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Request a state change
+ *
+ * Entering SYS_FAULT or SYS_ESTOP suspends storage before returning, so no
+ * new flash work starts, and wakes the state task, which waits for the
+ * work in progress to stop and records both latencies in acq_stats.
+ * Returns false if the transition is not allowed from the current state.
+ */
+bool system_state_request(system_state_t state)
+{
+    return state_request(state, false, NULL);
+}
+
+bool system_state_request_from_isr(system_state_t state, BaseType_t *higher_priority_task_woken)
+{
+    return state_request(state, true, higher_priority_task_woken);
+}
+
+/**
+ * @brief Acts on state changes above every storage user's priority
+ *
+ * Response time is the raise to this task running, which no storage call
+ * can hold up. Quiesce time adds the rest of the storage call in progress:
+ * at most one record, the metadata update and the flash operations behind
+ * them, a block erase included.
+ */
+static void system_state_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        system_state_t state = s_system_state;
+        if (!is_fault(state)) {
+            ESP_LOGI(TAG, "System state %s, storage resumed", system_state_name(state));
+            continue;
+        }
+
+        int64_t raised = s_fault_us;
+        histogram_add(&acq_stats.fault_response, esp_timer_get_time() - raised);
+
+        esp_err_t ret = battery_fs_wait_idle(SYSTEM_QUIESCE_TIMEOUT_MS);
+        int64_t quiesced = esp_timer_get_time();
+        if (ret == ESP_OK) {
+            histogram_add(&acq_stats.fault_quiesce, quiesced - raised);
+        }
+
+        // Log only once storage is measured, the UART is slow
+        static const char *const flash_ops[] = { "idle", "reading", "programming", "erasing" };
+        if (ret == ESP_ERR_TIMEOUT) {
+            ESP_LOGE(TAG, "System state %s: storage still busy after %d ms",
+                     system_state_name(state), SYSTEM_QUIESCE_TIMEOUT_MS);
+        } else {
+            ESP_LOGE(TAG, "System state %s: storage stopped in %lld us (flash was %s)",
+                     system_state_name(state), (long long)(quiesced - raised),
+                     flash_ops[s_fault_flash_op]);
+        }
+    }
+}
+
+/**
+ * @brief Start the task handling system state changes
+ */
+esp_err_t system_state_start(void)
+{
+    if (s_state_task != NULL) {
+        return ESP_OK;
+    }
+    if (xTaskCreate(system_state_task, "system_state", SYSTEM_STATE_TASK_STACK, NULL,
+                    SYSTEM_STATE_TASK_PRIORITY, &s_state_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the system state task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
 
 /**
  * @brief Initialize I2C bus
  */
 esp_err_t init_i2c_bus(void)
 {
+#if CONFIG_BATMON_SIMULATED
+    // Simulated BATMON devices answer without a bus
+    SMBus_handle = NULL;
+    ESP_LOGI(TAG, "SMBus simulated (CONFIG_BATMON_SIMULATED)");
+    return ESP_OK;
+#else
     i2c_master_bus_config_t SMBus_cfg = {
         .i2c_port = 1,
         .sda_io_num = smbus_pins.sda,
@@ -55,6 +361,7 @@ esp_err_t init_i2c_bus(void)
     }
     
     return ESP_OK;
+#endif
 }
 
 /**
@@ -150,102 +457,473 @@ void get_battery_log(int batmon_index)
     ESP_LOGI(TAG, "  Logged Without Sleep: %d", batmem.data.log.LOGGED_WITHOUT_SLEEP);
 }
 
+/**
+ * @brief Store the pending download of slot i
+ */
+static esp_err_t persist_pending(int i)
+{
+    pending_write_t *pending = &s_pending[i];
+    battery_log_t *logs = (battery_log_t *)(pending->records + pending->count);
+
+    // Write to flash (automatically handles new/existing files)
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = battery_fs_write_data(pending->pack_id, logs, pending->count);
+    int64_t now = esp_timer_get_time();
+    histogram_add(&acq_stats.fs_write, now - start);
+
+    if (ret == ESP_ERR_INVALID_STATE && battery_fs_is_suspended()) {
+        // Suspended for a fault: keep the download, whatever part of it was
+        // stored is skipped when it is written again
+        ESP_LOGW(TAG, "Storage suspended, keeping %s for later", pending->pack_id);
+        return ret;
+    }
+
+    if (ret == ESP_OK) {
+        // A later connection of the same slot may already be in flight
+        bool current = strcmp(battery_state[i].pack_id, pending->pack_id) == 0;
+        if (current) {
+            battery_state[i].persisted_us = now;
+            histogram_add(&acq_stats.persist, now - battery_state[i].connected_us);
+        }
+        ESP_LOGI(TAG, "✓ Battery log saved to flash: %s (%u records, last index #%u)",
+                 pending->pack_id, (unsigned)pending->count, logs[pending->count - 1].memory_index);
+
+        // The append updated the pack's SOH estimate, one small read
+        battery_fs_summary_t summary;
+        if (battery_fs_read_summary(pending->pack_id, &summary) == ESP_OK &&
+            summary.soh != BATTERY_FS_SOH_UNKNOWN) {
+            if (current) {
+                battery_state[i].soh = summary.soh;
+            }
+            if (summary.soh < SOH_DEGRADED_PCT) {
+                ESP_LOGW(TAG, "Pack %s degraded: SOH %u%% from internal resistance",
+                         pending->pack_id, summary.soh);
+            }
+        }
+    } else {
+        battery_state[i].save_errors++;
+        ESP_LOGE(TAG, "✗ Failed to save battery log to flash: %s", esp_err_to_name(ret));
+    }
+
+    free(pending->records);
+    pending->records = NULL;
+    return ret;
+}
+
+/**
+ * @brief Store the telemetry batch of slot i
+ */
+static void persist_telemetry(int i)
+{
+    pending_tlm_t *tlm = &s_tlm[i];
+    esp_err_t ret = battery_fs_tlm_append(tlm->pack_id, tlm->samples, tlm->count);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        // Suspended, or no storage at all: keep the batch, later samples
+        // are dropped once it is full
+        return;
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store telemetry of %s: %s", tlm->pack_id, esp_err_to_name(ret));
+    }
+    tlm->count = 0;
+}
+
+/**
+ * @brief Add the telemetry of the last poll of slot i to its batch
+ */
+static void record_telemetry(int i)
+{
+    pending_tlm_t *tlm = &s_tlm[i];
+    if (tlm->count != 0 && strcmp(tlm->pack_id, battery_state[i].pack_id) != 0) {
+        // Swapped between two polls, the batch belongs to the previous pack
+        persist_telemetry(i);
+        tlm->count = 0;
+    }
+    if (tlm->count == TLM_BATCH) {
+        return;
+    }
+
+    snprintf(tlm->pack_id, sizeof(tlm->pack_id), "%s", battery_state[i].pack_id);
+    battery_fs_tlm_sample_t *s = &tlm->samples[tlm->count++];
+    s->time_s = (uint32_t)time(NULL);
+    s->value[BATTERY_FS_TLM_SOC] = (int16_t)battery_state[i].soc;
+    s->value[BATTERY_FS_TLM_CURRENT] = battery_state[i].current_ma;
+}
+
+/**
+ * @brief Store pending downloads past their deadline, and telemetry
+ *        batches that are full or whose pack left
+ */
+static void flush_pending(void)
+{
+    if (battery_fs_is_suspended()) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < NO_BATMON; i++) {
+        if (s_pending[i].records != NULL && now >= s_pending[i].due_us) {
+            persist_pending(i);
+        }
+        if (s_tlm[i].count == TLM_BATCH || (s_tlm[i].count != 0 && !battery_state[i].is_connected)) {
+            persist_telemetry(i);
+        }
+    }
+}
+
+/**
+ * @brief Download the whole pack memory and store it
+ *
+ * SMBUS_RESET_BATMEM (BATMON_getMemoryInfo) rewinds the pack's record
+ * reader, then every BATMON_getMemory call returns the next record.
+ * battery_fs_write_data() keeps only the records it has not stored yet.
+ * The write happens now or at the flush deadline.
+ */
+static esp_err_t download_battery_memory(int i, const char *filename)
+{
+    BATMON_Mem_Info mem_info;
+    esp_err_t ret = BATMON_getMemoryInfo(&BATMON_handle[i], &mem_info);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get memory info: %s", esp_err_to_name(ret));
+        battery_state[i].read_errors++;
+        return ret;
+    }
+
+    size_t total = mem_info.data.totalMemoryRecords;
+    if (total == 0) {
+        ESP_LOGI(TAG, "Battery memory is empty");
+        return ESP_OK;
+    }
+
+    // Records followed by their log entries, one allocation off the task stack
+    BatmonMemory *records = malloc(total * (sizeof(BatmonMemory) + sizeof(battery_log_t)));
+    if (records == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %u records", (unsigned)total);
+        battery_state[i].read_errors++;
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t count = 0;
+    while (count < total && BATMON_getMemory(&BATMON_handle[i], &records[count], &mem_info)) {
+        count++;
+    }
+    battery_state[i].records_read += count;
+
+    if (count < total) {
+        // Keep what was read, the rest is picked up on the next connection
+        ESP_LOGE(TAG, "Failed to read battery memory (record %u of %u)", (unsigned)count, (unsigned)total);
+        battery_state[i].read_errors++;
+        if (count == 0) {
+            free(records);
+            return ESP_FAIL;
+        }
+    }
+
+    // Log entries go right after the records that were read, where
+    // persist_pending() looks for them
+    battery_log_t *logs = (battery_log_t *)(records + count);
+    for (size_t r = 0; r < count; r++) {
+        logs[r] = (battery_log_t){
+            .memory_index = records[r].data.memoryIndex,
+            .data = records[r].bytedata,
+            .data_len = sizeof(BatmonMemory),
+        };
+    }
+
+    // The slot was reconnected before its previous download was stored
+    if (s_pending[i].records != NULL) {
+        persist_pending(i);
+    }
+    if (s_pending[i].records != NULL) {
+        // Still suspended, the newer download takes the slot
+        ESP_LOGW(TAG, "Dropping the unstored download of %s", s_pending[i].pack_id);
+        battery_state[i].save_errors++;
+        free(s_pending[i].records);
+        s_pending[i].records = NULL;
+    }
+
+    pending_write_t *pending = &s_pending[i];
+    pending->records = records;
+    pending->count = count;
+    pending->due_us = esp_timer_get_time() + (int64_t)s_flush_deadline_ms * 1000;
+    snprintf(pending->pack_id, sizeof(pending->pack_id), "%s", filename);
+
+    return s_flush_deadline_ms == 0 ? persist_pending(i) : ESP_OK;
+}
+
+/**
+ * @brief Identify a newly connected pack and store its memory
+ */
+static void handle_connect(int i, uint16_t soc)
+{
+    ESP_LOGI(TAG, "\n========== BATMON %d (0x%02X) CONNECTED ==========", i, BATMON_addresses[i]);
+    ESP_LOGI(TAG, "SOC: %d%%", soc);
+
+    // Get battery serial number (full 128-bit UID)
+    uint16_t sn[8];
+    char serial_full[40];
+    if (BATMON_getSN(&BATMON_handle[i], sn)) {
+        // Format full serial number as hex string for logging
+        snprintf(serial_full, sizeof(serial_full), 
+                 "%04X%04X%04X%04X%04X%04X%04X%04X",
+                 sn[0], sn[1], sn[2], sn[3], sn[4], sn[5], sn[6], sn[7]);
+        ESP_LOGI(TAG, "Battery Serial (128-bit): %s", serial_full);
+    } else {
+        ESP_LOGW(TAG, "Failed to read battery serial number");
+        serial_full[0] = '\0';
+    }
+
+    // Get battery hash (16-bit) for shorter filename
+    uint16_t hash;
+    char filename[16];
+    esp_err_t ret = BATMON_getHash(&BATMON_handle[i], &hash);
+    if (ret == ESP_OK) {
+        snprintf(filename, sizeof(filename), "BAT_%04X", hash);
+        ESP_LOGI(TAG, "Battery ID (hash): %s", filename);
+    } else {
+        // Fallback to address-based filename
+        snprintf(filename, sizeof(filename), "BAT_%02X", BATMON_addresses[i]);
+        ESP_LOGW(TAG, "Failed to read hash, using address as ID: %s", filename);
+    }
+    snprintf(battery_state[i].pack_id, sizeof(battery_state[i].pack_id), "%s", filename);
+
+    EVTRACE_BEGIN(EVTRACE_ID_BATMON_DOWNLOAD, i);
+    esp_err_t dl = download_battery_memory(i, filename);
+    EVTRACE_END(EVTRACE_ID_BATMON_DOWNLOAD, dl);
+
+    // The hex dump re-reads the first record, only worth it when debugging
+    if (esp_log_level_get(TAG) >= ESP_LOG_DEBUG) {
+        get_battery_log(i);
+    }
+}
+
+// ============================================================================
+// Slot scheduling
+// ============================================================================
+
+const char *SMBUS_slot_class_name(slot_class_t cls)
+{
+    static const char *const names[] = { "empty", "idle", "charging", "charge_cv" };
+    return cls <= SLOT_CHARGE_CV ? names[cls] : "?";
+}
+
+static slot_class_t classify_slot(const battery_state_t *st)
+{
+    if (!st->is_connected) {
+        return SLOT_EMPTY;
+    }
+    if (st->current_ma <= s_rates.charge_ma) {
+        return SLOT_IDLE;
+    }
+    return st->soc >= s_rates.cv_soc ? SLOT_CHARGE_CV : SLOT_CHARGING;
+}
+
+/**
+ * @brief Make every slot due at now_us, empty slots start over at empty_min_ms
+ */
+void SMBUS_schedule_reset(int64_t now_us)
+{
+    for (int i = 0; i < NO_BATMON; i++) {
+        s_queue[i] = i;
+        s_due_us[i] = now_us;
+        s_empty_ms[i] = 0;
+    }
+    s_schedule_ready = true;
+}
+
+/**
+ * @brief Move slot i to its place in the deadline queue
+ */
+static void schedule_slot(int i, int64_t due_us)
+{
+    int pos = 0;
+    while (s_queue[pos] != i) {
+        pos++;
+    }
+    memmove(&s_queue[pos], &s_queue[pos + 1], NO_BATMON - 1 - pos);
+
+    // Behind every slot due no later, so equal deadlines go round-robin
+    s_due_us[i] = due_us;
+    int at = NO_BATMON - 1;
+    while (at > 0 && s_due_us[s_queue[at - 1]] > due_us) {
+        s_queue[at] = s_queue[at - 1];
+        at--;
+    }
+    s_queue[at] = i;
+}
+
+/**
+ * @brief Schedule the next poll of slot i from what it holds now
+ */
+static void reschedule_slot(int i, slot_class_t prev, int64_t now_us)
+{
+    slot_class_t cls = classify_slot(&battery_state[i]);
+    uint32_t ms;
+    switch (cls) {
+    case SLOT_CHARGE_CV:
+        ms = s_rates.charge_cv_ms;
+        break;
+    case SLOT_CHARGING:
+        ms = s_rates.charging_ms;
+        break;
+    case SLOT_IDLE:
+        ms = s_rates.idle_ms;
+        break;
+    default:
+        // A pack is most likely to arrive right after one left, back off
+        // while the slot stays empty
+        ms = (prev == SLOT_EMPTY && s_empty_ms[i]) ? s_empty_ms[i] * 2 : s_rates.empty_min_ms;
+        if (ms < s_rates.empty_min_ms) {
+            ms = s_rates.empty_min_ms;
+        }
+        if (ms > s_rates.empty_max_ms) {
+            ms = s_rates.empty_max_ms;
+        }
+        s_empty_ms[i] = ms;
+        break;
+    }
+
+    if (cls != prev) {
+        ESP_LOGD(TAG, "BATMON %d: %s -> %s", i, SMBUS_slot_class_name(prev), SMBUS_slot_class_name(cls));
+    }
+    battery_state[i].poll_class = cls;
+    schedule_slot(i, now_us + (int64_t)ms * 1000);
+}
+
+/**
+ * @brief Poll slot i: presence, live telemetry, connection changes
+ */
+static void poll_slot(int i, int64_t now_us)
+{
+    slot_class_t prev = battery_state[i].poll_class;
+    battery_state[i].polls++;
+
+    // Check if battery is connected by trying to read SOC
+    uint16_t soc;
+    esp_err_t ret = BATMON_getSOC(&BATMON_handle[i], &soc);
+    bool currently_connected = (ret == ESP_OK);
+
+    // The current tells a charging pack from an idle one
+    int16_t current = 0;
+    if (currently_connected && BATMON_getCur(&BATMON_handle[i], &current) != ESP_OK) {
+        current = battery_state[i].current_ma;
+    }
+    battery_state[i].soc = currently_connected ? soc : 0;
+    battery_state[i].current_ma = current;
+
+    // Detect new connection or reconnection
+    if (currently_connected && !battery_state[i].is_connected)
+    {
+        battery_state[i].is_connected = true;
+        battery_state[i].connects++;
+        battery_state[i].connected_us = esp_timer_get_time();
+        battery_state[i].persisted_us = 0;
+        battery_state[i].soh = BATTERY_FS_SOH_UNKNOWN;
+        handle_connect(i, soc);
+    }
+    else if (!currently_connected && battery_state[i].is_connected)
+    {
+        // Battery disconnected
+        ESP_LOGW(TAG, "BATMON %d (0x%02X) DISCONNECTED", i, BATMON_addresses[i]);
+        battery_state[i].is_connected = false;
+        battery_state[i].disconnects++;
+    }
+    // If still connected, do nothing (don't print again)
+
+    if (currently_connected) {
+        record_telemetry(i);
+    }
+    reschedule_slot(i, prev, now_us);
+}
+
+static uint32_t attached_slots(void)
+{
+    uint32_t attached = 0;
+    for (int i = 0; i < NO_BATMON; i++) {
+        attached += battery_state[i].is_connected;
+    }
+    return attached;
+}
+
+/**
+ * @brief One pass over all slots
+ * Detects connections and disconnections and stores the memory of newly
+ * connected packs
+ */
+void SMBUS_poll(void)
+{
+    int64_t start = esp_timer_get_time();
+    EVTRACE_BEGIN(EVTRACE_ID_SMBUS_POLL, 0);
+
+    if (!s_schedule_ready) {
+        SMBUS_schedule_reset(start);
+    }
+    for (int i = 0; i < NO_BATMON; i++) {
+        poll_slot(i, start);
+    }
+
+    flush_pending();
+    EVTRACE_END(EVTRACE_ID_SMBUS_POLL, attached_slots());
+    histogram_add(&acq_stats.poll, esp_timer_get_time() - start);
+}
+
+/**
+ * @brief Poll the slots due at now_us
+ *
+ * Every slot has its own period from what it holds (smbus_poll_rates_t):
+ * fast while a pack charges near the CV transition, slower while it
+ * charges or idles, backing off while the slot is empty. Slots wait in a
+ * queue ordered by due time, so a pass only talks to those whose time has
+ * come. Pending downloads are flushed at the end of a pass, as in
+ * SMBUS_poll().
+ *
+ * @return Time the next slot is due
+ */
+int64_t SMBUS_poll_due(int64_t now_us)
+{
+    if (!s_schedule_ready) {
+        SMBUS_schedule_reset(now_us);
+    }
+    if (s_due_us[s_queue[0]] > now_us) {
+        return s_due_us[s_queue[0]];
+    }
+
+    int64_t start = esp_timer_get_time();
+    EVTRACE_BEGIN(EVTRACE_ID_SMBUS_POLL, 0);
+
+    // A polled slot is due again at least a millisecond later
+    while (s_due_us[s_queue[0]] <= now_us) {
+        poll_slot(s_queue[0], now_us);
+    }
+
+    flush_pending();
+    EVTRACE_END(EVTRACE_ID_SMBUS_POLL, attached_slots());
+    histogram_add(&acq_stats.poll, esp_timer_get_time() - start);
+    return s_due_us[s_queue[0]];
+}
+
 /**
  * @brief Continuous SMBUS update task
- * Monitors battery connections and reads logs when newly connected
+ * Monitors battery connections and reads logs when newly connected, each
+ * slot at the rate its pack state calls for (SMBUS_poll_due())
  */
 void SMBUS_update(void *arg)
 {
     ESP_LOGI(TAG, "SMBUS_update task started");
-    const TickType_t xFrequency = pdMS_TO_TICKS(1000); // Update every 1 second
-    TickType_t xLastWakeTime = xTaskGetTickCount();
     
     while (1)
     {
-        xTaskDelayUntil(&xLastWakeTime, xFrequency);
-        
-        for (int i = 0; i < NO_BATMON; i++)
-        {
-            // Check if battery is connected by trying to read SOC
-            uint16_t soc;
-            esp_err_t ret = BATMON_getSOC(&BATMON_handle[i], &soc);
-            bool currently_connected = (ret == ESP_OK);
-            
-            // Detect new connection or reconnection
-            if (currently_connected && !battery_state[i].is_connected)
-            {
-                // Battery just connected or reconnected
-                ESP_LOGI(TAG, "\n========== BATMON %d (0x%02X) CONNECTED ==========", i, BATMON_addresses[i]);
-                ESP_LOGI(TAG, "SOC: %d%%", soc);
-                
-                // Get battery serial number (full 128-bit UID)
-                uint16_t sn[8];
-                char serial_full[40];
-                if (BATMON_getSN(&BATMON_handle[i], sn)) {
-                    // Format full serial number as hex string for logging
-                    snprintf(serial_full, sizeof(serial_full), 
-                             "%04X%04X%04X%04X%04X%04X%04X%04X",
-                             sn[0], sn[1], sn[2], sn[3], sn[4], sn[5], sn[6], sn[7]);
-                    ESP_LOGI(TAG, "Battery Serial (128-bit): %s", serial_full);
-                } else {
-                    ESP_LOGW(TAG, "Failed to read battery serial number");
-                    serial_full[0] = '\0';
-                }
-                
-                // Get battery hash (16-bit) for shorter filename
-                uint16_t hash;
-                char filename[16];
-                esp_err_t ret = BATMON_getHash(&BATMON_handle[i], &hash);
-                if (ret == ESP_OK) {
-                    snprintf(filename, sizeof(filename), "BAT_%04X", hash);
-                    ESP_LOGI(TAG, "Battery ID (hash): %s", filename);
-                } else {
-                    // Fallback to address-based filename
-                    snprintf(filename, sizeof(filename), "BAT_%02X", BATMON_addresses[i]);
-                    ESP_LOGW(TAG, "Failed to read hash, using address as ID: %s", filename);
-                }
-                
-                // Get battery memory log
-                BATMON_Mem_Info mem_info;
-                BatmonMemory batmem;
-                
-                ret = BATMON_getMemoryInfo(&BATMON_handle[i], &mem_info);
-                if (ret == ESP_OK) {
-                    bool success = BATMON_getMemory(&BATMON_handle[i], &batmem, &mem_info);
-                    if (success) {
-                        // Prepare battery log for writing
-                        battery_log_t log = {
-                            .memory_index = batmem.data.memoryIndex,
-                            .data = (uint8_t *)&batmem,
-                            .data_len = sizeof(BatmonMemory)
-                        };
-                        
-                        // Write to flash (automatically handles new/existing files)
-                        ret = battery_fs_write_data(filename, &log, 1);
-                        if (ret == ESP_OK) {
-                            ESP_LOGI(TAG, "✓ Battery log saved to flash: %s (index #%lu)", 
-                                     filename, (unsigned long)batmem.data.memoryIndex);
-                        } else {
-                            ESP_LOGE(TAG, "✗ Failed to save battery log to flash: %s", esp_err_to_name(ret));
-                        }
-                    } else {
-                        ESP_LOGE(TAG, "Failed to read battery memory");
-                    }
-                } else {
-                    ESP_LOGE(TAG, "Failed to get memory info: %s", esp_err_to_name(ret));
-                }
-                
-                // Print the log for debugging
-                get_battery_log(i);
-                battery_state[i].is_connected = true;
-            }
-            else if (!currently_connected && battery_state[i].is_connected)
-            {
-                // Battery disconnected
-                ESP_LOGW(TAG, "BATMON %d (0x%02X) DISCONNECTED", i, BATMON_addresses[i]);
-                battery_state[i].is_connected = false;
-            }
-            // If still connected, do nothing (don't print again)
+        // An E-stop leaves the bus alone until it is cleared
+        int64_t now = esp_timer_get_time();
+        int64_t next_us = now + (int64_t)s_rates.idle_ms * 1000;
+        if (s_system_state != SYS_ESTOP) {
+            next_us = SMBUS_poll_due(now);
         }
+
+        // Sleep until the next slot is due; waking a tick early only costs
+        // a pass with nothing to do
+        int64_t wait_ms = (next_us - esp_timer_get_time()) / 1000;
+        TickType_t ticks = wait_ms > 0 ? pdMS_TO_TICKS(wait_ms) : 0;
+        vTaskDelay(ticks > 0 ? ticks : 1);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,22 @@
+/**
+ * @file Console.h
+ * @brief Serial console for stats, micro-benchmarks and runtime tuning
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+// Below SMBUS_update (5), so commands only run when acquisition is idle
+#define CONSOLE_TASK_PRIORITY   1
+#define CONSOLE_TASK_STACK      4096
+
+/**
+ * @brief Register the commands and start the REPL task
+ *
+ * Commands read the acquisition and storage counters without taking locks
+ * and never call into the SMBus, so they cannot stall SMBUS_update.
+ *
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t console_start(void);
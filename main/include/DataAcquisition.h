@@ -5,35 +5,116 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
-#include "driver/i2c_master.h"
 #include "BATMON.h"
+#include "freertos/FreeRTOS.h"
 
 #define NO_DBR 4
 #define NO_BATMON 9
 
+// System state, see system_state_request(). A fault is entered from any
+// state and only escalates (FAULT to ESTOP); leaving one goes to SYS_IDLE
 typedef enum {
     SYS_IDLE,
     SYS_CHARGING,
-    SYS_FAULT,
-    SYS_ESTOP
+    SYS_FAULT,                  // Storage suspended, slots still polled
+    SYS_ESTOP                   // Storage suspended, SMBus left alone
 } system_state_t;
 
+// What a slot holds, sets how often it is polled (smbus_poll_rates_t)
+typedef enum {
+    SLOT_EMPTY,
+    SLOT_IDLE,                  // Pack present, not charging
+    SLOT_CHARGING,
+    SLOT_CHARGE_CV,             // Charging near or past the CC/CV transition
+} slot_class_t;
+
 // Battery state tracking
 typedef struct {
     bool is_connected;
     uint8_t address;
+    // Acquisition counters
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t records_read;      // Records downloaded from the pack
+    uint32_t read_errors;       // Failed or partial memory downloads
+    uint32_t save_errors;       // Failed battery_fs writes
+    int64_t connected_us;       // esp_timer time the last connection was detected
+    int64_t persisted_us;       // esp_timer time its memory reached battery_fs, 0 until then
+    uint8_t soh;                // Stored SOH estimate after the last save, BATTERY_FS_SOH_UNKNOWN
+    char pack_id[16];           // battery_fs name of the current or last pack
+    // Live telemetry of the last poll and the resulting poll class
+    uint16_t soc;               // %
+    int16_t current_ma;         // Positive while charging
+    slot_class_t poll_class;
+    uint32_t polls;             // Times the slot was polled
 } battery_state_t;
 
+// Per-slot poll periods by slot class. An empty slot is polled
+// empty_min_ms after it empties, then the period doubles up to empty_max_ms
+typedef struct {
+    uint32_t charge_cv_ms;
+    uint32_t charging_ms;
+    uint32_t idle_ms;
+    uint32_t empty_min_ms;
+    uint32_t empty_max_ms;
+    uint16_t cv_soc;            // SOC (%) from which a charging pack is near CV
+    int16_t charge_ma;          // Current above which a pack is charging
+} smbus_poll_rates_t;
+
+#define ACQ_HIST_BUCKETS 24
+
+// Latency histogram: bucket b counts samples in [2^b, 2^(b+1)) us,
+// bucket 0 also counts 0 and the last bucket everything above
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[ACQ_HIST_BUCKETS];
+} acq_histogram_t;
+
+// Acquisition timing, updated by the SMBUS_update task and read without
+// locking (a reader can see a sample half added)
+typedef struct {
+    acq_histogram_t poll;       // One SMBUS_poll() pass
+    acq_histogram_t persist;    // Connection detected to memory stored
+    acq_histogram_t fs_write;   // battery_fs_write_data() calls
+    acq_histogram_t fault_response; // Fault raised to the state task handling it
+    acq_histogram_t fault_quiesce;  // Fault raised to no storage call in progress
+} acq_stats_t;
+
 // Global variables
 extern i2c_master_bus_handle_t SMBus_handle;
 extern batmon_handle_t BATMON_handle[NO_BATMON];
 extern battery_state_t battery_state[NO_BATMON];
 extern const uint8_t BATMON_addresses[NO_BATMON];
+extern acq_stats_t acq_stats;
 
 // function prototypes
 esp_err_t init_i2c_bus(void);
 void init_batmon_devices(void);
 void get_battery_log(int batmon_index);
+void SMBUS_poll(void);
+int64_t SMBUS_poll_due(int64_t now_us);
+void SMBUS_schedule_reset(int64_t now_us);
+const char *SMBUS_slot_class_name(slot_class_t cls);
 void SMBUS_update(void *arg);
 
+// Runtime tuning, safe to call from any task
+void SMBUS_set_poll_period(uint32_t ms);
+uint32_t SMBUS_get_poll_period(void);
+esp_err_t SMBUS_set_poll_rates(const smbus_poll_rates_t *rates);
+void SMBUS_get_poll_rates(smbus_poll_rates_t *rates);
+void SMBUS_set_flush_deadline(uint32_t ms);
+uint32_t SMBUS_get_flush_deadline(void);
+
+// System state machine, the requests are safe to call from any task
+esp_err_t system_state_start(void);
+system_state_t system_state_get(void);
+const char *system_state_name(system_state_t state);
+bool system_state_request(system_state_t state);
+bool system_state_request_from_isr(system_state_t state, BaseType_t *higher_priority_task_woken);
+
+void acq_stats_reset(void);
+uint32_t acq_histogram_percentile(const acq_histogram_t *hist, unsigned pct);
+
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "driver/spi_common.h"
 #include "battery_fs.h"
 #include "DataAcquisition.h"
+#include "Console.h"
+#include "taskprof.h"
 
 static const char *TAG = "MAIN";
 
@@ -29,6 +31,11 @@ void app_main(void) {
 
     ESP_LOGI(TAG, "=== Battery Monitoring System Starting ===");
 
+    // Faults must be handled whatever else fails to come up
+    if (system_state_start() != ESP_OK) {
+        ESP_LOGE(TAG, "System state task not started, faults will not be handled");
+    }
+
     // ========================================
     // Step 1: Initialize I2C Bus and BATMON
     // ========================================
@@ -53,6 +60,7 @@ void app_main(void) {
     // ========================================
     ESP_LOGI(TAG, "Initializing battery filesystem...");
     battery_fs_config_t fs_config = {
+        .backend = BATTERY_FS_BACKEND_SPIFLASH,
         .spi_host = SPI_HOST,
         .pin_mosi = PIN_MOSI,
         .pin_miso = PIN_MISO,
@@ -90,13 +98,18 @@ void app_main(void) {
     ESP_LOGI(TAG, "\n=== System Running ===");
     ESP_LOGI(TAG, "BATMON Monitoring: %s", ret == ESP_OK ? "ACTIVE" : "INACTIVE");
     ESP_LOGI(TAG, "Filesystem: %s", filesystem_available ? "AVAILABLE" : "NOT AVAILABLE");
+
+    // CPU and stack high-water of every task, dumped with "taskprof dump"
+    if (taskprof_start() != ESP_OK) {
+        ESP_LOGW(TAG, "Task profiler not available");
+    }
+
+    // Stats, health checks and tuning are on the console (type "help")
+    if (console_start() != ESP_OK) {
+        ESP_LOGW(TAG, "Console not available");
+    }
     
     while (1) {
         vTaskDelay(pdMS_TO_TICKS(5000));
-        
-        // Periodic status update every 5 seconds
-        if (filesystem_available) {
-            // Could add filesystem health checks here
-        }
     }
 }
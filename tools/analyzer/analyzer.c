@@ -0,0 +1,753 @@
+/**
+ * @file analyzer.c
+ * @brief Offline analyzer for battery_fs flash dumps
+ *
+ * Reconstructs the battery_fs volume from a dump, pulls every battery's
+ * .bin/.met pair out of the FAT, decodes the BatmonMemory records in
+ * parallel and reports per-pack summaries.
+ *
+ *   analyzer [options] <dump>
+ *     -j <n>        Worker threads (default: online CPUs)
+ *     -l <layout>   Force the dump layout (nand-ftl, sectors)
+ *     -s <file>     Write per-pack summaries as CSV
+ *     -c <file>     Write every decoded record as CSV
+ *     -C <dir>      Write decoded records as raw little-endian columns
+ *     -q            Do not print the summary table
+ *     -v            Print phase timings to stderr
+ */
+
+#include "analyzer.h"
+#include "battery_fs_format.h"
+#include "BATMON_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DECODE_CHUNK            4096        // Records per work item
+
+// ============================================================================
+// Parallel for
+// ============================================================================
+
+typedef struct {
+    void (*fn)(void *ctx, size_t item);
+    void *ctx;
+    size_t items;
+    size_t next;
+} parallel_t;
+
+static void *parallel_worker(void *arg) {
+    parallel_t *p = arg;
+    size_t item;
+    while ((item = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->items) {
+        p->fn(p->ctx, item);
+    }
+    return NULL;
+}
+
+/** @brief Run fn(ctx, 0..items-1) on up to `threads` threads, items handed out dynamically */
+static void parallel_for(int threads, size_t items, void (*fn)(void *, size_t), void *ctx) {
+    parallel_t p = { fn, ctx, items, 0 };
+    if ((size_t)threads > items) {
+        threads = items;
+    }
+    if (threads <= 1) {
+        parallel_worker(&p);
+        return;
+    }
+
+    pthread_t tids[threads];
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&tids[t], NULL, parallel_worker, &p);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ============================================================================
+// Packs and file parsers
+// ============================================================================
+
+#define PARSER_BIN  0
+#define PARSER_MET  1
+#define PARSER_COUNT 2
+
+typedef struct {
+    char id[9];                 ///< Battery ID, the file stem
+    const fat_entry_t *files[PARSER_COUNT];
+
+    uint8_t *bin_data;          ///< Kept, records point into it
+    const BatmonMemory **recs; ///< Records inside bin_data
+    uint32_t *rec_index;        ///< memory_index from each record header
+    size_t rec_count;
+    size_t skipped;             ///< Records of another type or size
+    bool truncated;             ///< .bin ends inside a record
+
+    battery_metadata_t meta;
+    bool has_meta;
+
+    size_t first;               ///< First row in the decoded columns
+} pack_t;
+
+/**
+ * @brief Parser for one battery_fs file type
+ *
+ * Files are matched by extension; a new on-flash file format gets its own
+ * entry here. parse() takes ownership of data.
+ */
+typedef struct {
+    const char *ext;
+    void (*parse)(pack_t *pack, uint8_t *data, size_t len);
+} file_parser_t;
+
+static void parse_bin(pack_t *pack, uint8_t *data, size_t len) {
+    pack->bin_data = data;
+
+    // First pass counts so the record arrays are sized once
+    size_t count = 0, off = 0;
+    battery_fs_record_header_t hdr;
+    while (off + sizeof(hdr) <= len) {
+        memcpy(&hdr, data + off, sizeof(hdr));
+        if (hdr.data_len > len - off - sizeof(hdr)) {
+            break;
+        }
+        count += hdr.data_len == sizeof(BatmonMemory);
+        off += sizeof(hdr) + hdr.data_len;
+    }
+
+    pack->recs = malloc((count ? count : 1) * sizeof(*pack->recs));
+    pack->rec_index = malloc((count ? count : 1) * sizeof(*pack->rec_index));
+
+    off = 0;
+    while (off + sizeof(hdr) <= len) {
+        memcpy(&hdr, data + off, sizeof(hdr));
+        if (hdr.data_len > len - off - sizeof(hdr)) {
+            pack->truncated = true;
+            break;
+        }
+        if (hdr.data_len == sizeof(BatmonMemory)) {
+            pack->recs[pack->rec_count] = (const BatmonMemory *)(data + off + sizeof(hdr));
+            pack->rec_index[pack->rec_count] = hdr.memory_index;
+            pack->rec_count++;
+        } else {
+            pack->skipped++;
+        }
+        off += sizeof(hdr) + hdr.data_len;
+    }
+    if (off < len && !pack->truncated) {
+        pack->truncated = true;
+    }
+}
+
+static void parse_met(pack_t *pack, uint8_t *data, size_t len) {
+    if (len >= sizeof(pack->meta)) {
+        memcpy(&pack->meta, data, sizeof(pack->meta));
+        pack->has_meta = true;
+    }
+    free(data);
+}
+
+static const file_parser_t s_parsers[PARSER_COUNT] = {
+    [PARSER_BIN] = { "BIN", parse_bin },
+    [PARSER_MET] = { "MET", parse_met },
+};
+
+typedef struct {
+    const fat_t *fat;
+    pack_t *packs;
+} load_ctx_t;
+
+static void load_pack(void *arg, size_t i) {
+    load_ctx_t *ctx = arg;
+    pack_t *pack = &ctx->packs[i];
+
+    for (size_t p = 0; p < PARSER_COUNT; p++) {
+        if (pack->files[p] == NULL) {
+            continue;
+        }
+        size_t len;
+        uint8_t *data = fat_read_file(ctx->fat, pack->files[p], &len);
+        if (data) {
+            s_parsers[p].parse(pack, data, len);
+        }
+    }
+}
+
+/** @brief Group root directory files into packs by stem */
+static pack_t *collect_packs(const fat_entry_t *files, size_t file_count, size_t *pack_count) {
+    pack_t *packs = calloc(file_count ? file_count : 1, sizeof(pack_t));
+    size_t n = 0;
+
+    for (size_t f = 0; f < file_count; f++) {
+        const char *dot = strchr(files[f].name, '.');
+        if (dot == NULL || dot - files[f].name > 8) {
+            continue;
+        }
+        size_t stem = dot - files[f].name;
+
+        size_t p;
+        for (p = 0; p < PARSER_COUNT && strcmp(dot + 1, s_parsers[p].ext) != 0; p++) {
+        }
+        if (p == PARSER_COUNT) {
+            continue;
+        }
+
+        size_t i;
+        for (i = 0; i < n; i++) {
+            if (strlen(packs[i].id) == stem && strncmp(packs[i].id, files[f].name, stem) == 0) {
+                break;
+            }
+        }
+        if (i == n) {
+            memcpy(packs[n].id, files[f].name, stem);
+            packs[n].id[stem] = '\0';
+            n++;
+        }
+        packs[i].files[p] = &files[f];
+    }
+
+    *pack_count = n;
+    return packs;
+}
+
+// ============================================================================
+// Decoded columns
+// ============================================================================
+
+typedef struct {
+    uint32_t *pack;             ///< Index into the pack table
+    uint32_t *record_index;     ///< memory_index from the record header
+    batmon_mem_columns_t mem;
+    void *mem_buf;
+} columns_t;
+
+/** @brief A column as seen by the writers */
+typedef struct {
+    const char *name;
+    batmon_col_type_t type;
+    const void *data;
+} out_column_t;
+
+#define OUT_COLUMNS_MAX 64
+
+static const char *const s_col_suffix[] = { "u8", "u16", "u32", "f32" };
+
+static int columns_alloc(columns_t *cols, size_t rows) {
+    memset(cols, 0, sizeof(*cols));
+    size_t n = rows ? rows : 1;
+    cols->pack = malloc(n * sizeof(uint32_t));
+    cols->record_index = malloc(n * sizeof(uint32_t));
+    cols->mem_buf = aligned_alloc(64, (BATMON_memColumnsSize(n) + 63) & ~(size_t)63);
+    if (cols->pack == NULL || cols->record_index == NULL || cols->mem_buf == NULL) {
+        return -1;
+    }
+    BATMON_memColumnsBind(&cols->mem, cols->mem_buf, n);
+    return 0;
+}
+
+static void columns_free(columns_t *cols) {
+    free(cols->pack);
+    free(cols->record_index);
+    free(cols->mem_buf);
+}
+
+/** @brief Output column list: pack, record_index, then every decoded field */
+static size_t columns_list(const columns_t *cols, out_column_t *out) {
+    size_t n = 0;
+    out[n++] = (out_column_t){ "pack", BATMON_COL_U32, cols->pack };
+    out[n++] = (out_column_t){ "record_index", BATMON_COL_U32, cols->record_index };
+    for (size_t c = 0; c < BATMON_memColumnCount; c++) {
+        const batmon_col_desc_t *d = &BATMON_memColumns[c];
+        out[n++] = (out_column_t){ d->name, d->type, BATMON_memColumn(&cols->mem, d) };
+    }
+    return n;
+}
+
+typedef struct {
+    const pack_t *packs;
+    size_t pack_count;
+    size_t rows;
+    columns_t *cols;
+} decode_ctx_t;
+
+static void decode_chunk(void *arg, size_t chunk) {
+    decode_ctx_t *ctx = arg;
+    size_t row = chunk * DECODE_CHUNK;
+    size_t end = row + DECODE_CHUNK < ctx->rows ? row + DECODE_CHUNK : ctx->rows;
+    const size_t stride = sizeof(battery_fs_record_header_t) + sizeof(BatmonMemory);
+
+    // Find the pack holding the first row, packs are laid out in order
+    size_t lo = 0, hi = ctx->pack_count;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (ctx->packs[mid].first <= row) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (size_t p = lo; row < end; p++) {
+        const pack_t *pack = &ctx->packs[p];
+        size_t r = row - pack->first;
+        while (r < pack->rec_count && row < end) {
+            // Batch over runs of back-to-back records, which is all of them
+            // unless the file holds records of other sizes
+            size_t run = 1;
+            while (r + run < pack->rec_count && row + run < end &&
+                   (const uint8_t *)pack->recs[r + run] == (const uint8_t *)pack->recs[r] + run * stride) {
+                run++;
+            }
+
+            BATMON_decodeMemoryBatch(pack->recs[r], stride, run, &ctx->cols->mem, row);
+            for (size_t i = 0; i < run; i++) {
+                ctx->cols->pack[row + i] = p;
+                ctx->cols->record_index[row + i] = pack->rec_index[r + i];
+            }
+            r += run;
+            row += run;
+        }
+    }
+}
+
+// ============================================================================
+// Summaries
+// ============================================================================
+
+typedef struct {
+    size_t records;
+    uint32_t first_index;
+    uint32_t last_index;
+    uint16_t cycle;
+    uint8_t min_soc;
+    float max_temp_c;
+    uint16_t max_current_a;
+    uint64_t charged_mah;
+    uint64_t discharged_mah;
+    size_t alarm_records;
+    size_t cc_error_records;
+    uint32_t last_seen_s;
+} summary_t;
+
+typedef struct {
+    const pack_t *packs;
+    const columns_t *cols;
+    summary_t *out;
+} summary_ctx_t;
+
+static void summarize_pack(void *arg, size_t p) {
+    summary_ctx_t *ctx = arg;
+    const pack_t *pack = &ctx->packs[p];
+    const columns_t *c = ctx->cols;
+    summary_t s = { .records = pack->rec_count, .min_soc = UINT8_MAX, .max_temp_c = -1000.0f };
+
+    if (pack->rec_count) {
+        s.first_index = pack->rec_index[0];
+        s.last_index = pack->rec_index[pack->rec_count - 1];
+    }
+
+    for (size_t r = pack->first; r < pack->first + pack->rec_count; r++) {
+        s.cycle = c->mem.cycle[r] > s.cycle ? c->mem.cycle[r] : s.cycle;
+        s.min_soc = c->mem.min_soc[r] < s.min_soc ? c->mem.min_soc[r] : s.min_soc;
+        s.max_temp_c = c->mem.max_temp_c[r] > s.max_temp_c ? c->mem.max_temp_c[r] : s.max_temp_c;
+        s.max_current_a = c->mem.max_current_a[r] > s.max_current_a ? c->mem.max_current_a[r] : s.max_current_a;
+        s.charged_mah += c->mem.charged_mah[r];
+        s.discharged_mah += c->mem.discharged_mah[r];
+        s.alarm_records += c->mem.alarms[r] != 0;
+        s.cc_error_records += c->mem.cc_error[r] || c->mem.cc_time_error[r];
+        s.last_seen_s = c->mem.gps_end_s[r] > s.last_seen_s ? c->mem.gps_end_s[r] : s.last_seen_s;
+    }
+
+    ctx->out[p] = s;
+}
+
+static void format_gps_time(uint32_t gps_s, char *buf, size_t len) {
+    if (gps_s == 0) {
+        snprintf(buf, len, "-");
+        return;
+    }
+    // The pack clock is set to UTC, only the epoch differs
+    time_t t = (time_t)BATMON_GPS_EPOCH_UNIX + gps_s;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+static const char *pack_notes(const pack_t *pack) {
+    if (pack->files[PARSER_BIN] == NULL) {
+        return "no .bin";
+    }
+    if (pack->bin_data == NULL) {
+        return "unreadable .bin";
+    }
+    if (pack->truncated) {
+        return "truncated";
+    }
+    if (!pack->has_meta) {
+        return "no .met";
+    }
+    if (pack->meta.record_count != pack->rec_count + pack->skipped) {
+        return "count mismatch";
+    }
+    return "";
+}
+
+static void print_summaries(FILE *f, const pack_t *packs, const summary_t *s, size_t n) {
+    fprintf(f, "%-8s %8s %7s %7s %6s %5s %8s %6s %10s %10s %6s %6s %-20s %s\n",
+            "pack", "records", "first", "last", "cycle", "soc", "max_t_c", "max_a",
+            "chg_mah", "dsg_mah", "alarm", "cc_err", "last_seen", "notes");
+    for (size_t p = 0; p < n; p++) {
+        char when[32];
+        format_gps_time(s[p].last_seen_s, when, sizeof(when));
+        fprintf(f, "%-8s %8zu %7u %7u %6u %5u %8.2f %6u %10llu %10llu %6zu %6zu %-20s %s\n",
+                packs[p].id, s[p].records, s[p].first_index, s[p].last_index, s[p].cycle,
+                s[p].records ? s[p].min_soc : 0, s[p].records ? s[p].max_temp_c : 0.0f,
+                s[p].max_current_a, (unsigned long long)s[p].charged_mah,
+                (unsigned long long)s[p].discharged_mah, s[p].alarm_records,
+                s[p].cc_error_records, when, pack_notes(&packs[p]));
+    }
+}
+
+static int write_summary_csv(const char *path, const pack_t *packs, const summary_t *s, size_t n) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "pack,records,skipped,meta_records,first_index,last_index,cycle,min_soc,max_temp_c,"
+               "max_current_a,charged_mah,discharged_mah,alarm_records,cc_error_records,last_seen,notes\n");
+    for (size_t p = 0; p < n; p++) {
+        char when[32];
+        format_gps_time(s[p].last_seen_s, when, sizeof(when));
+        fprintf(f, "%s,%zu,%zu,%u,%u,%u,%u,%u,%.2f,%u,%llu,%llu,%zu,%zu,%s,%s\n",
+                packs[p].id, s[p].records, packs[p].skipped,
+                packs[p].has_meta ? packs[p].meta.record_count : 0,
+                s[p].first_index, s[p].last_index, s[p].cycle,
+                s[p].records ? s[p].min_soc : 0, s[p].records ? s[p].max_temp_c : 0.0f,
+                s[p].max_current_a, (unsigned long long)s[p].charged_mah,
+                (unsigned long long)s[p].discharged_mah, s[p].alarm_records,
+                s[p].cc_error_records, when, pack_notes(&packs[p]));
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// ============================================================================
+// Record output
+// ============================================================================
+
+typedef struct {
+    const pack_t *packs;
+    const columns_t *cols;
+    out_column_t columns[OUT_COLUMNS_MAX];
+    size_t column_count;
+    size_t rows;
+    char **text;                ///< Formatted CSV per chunk
+    size_t *text_len;
+} csv_ctx_t;
+
+static char *fmt_u32(char *p, uint32_t v) {
+    char tmp[10];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+/** @brief Two decimals, enough for the 1 K resolution of the stored temperatures */
+static char *fmt_fixed2(char *p, float v) {
+    int32_t c = lrintf(v * 100.0f);
+    if (c < 0) {
+        *p++ = '-';
+        c = -c;
+    }
+    p = fmt_u32(p, c / 100);
+    *p++ = '.';
+    *p++ = '0' + (c / 10) % 10;
+    *p++ = '0' + c % 10;
+    return p;
+}
+
+static void format_csv_chunk(void *arg, size_t chunk) {
+    csv_ctx_t *ctx = arg;
+    size_t first = chunk * DECODE_CHUNK;
+    size_t end = first + DECODE_CHUNK < ctx->rows ? first + DECODE_CHUNK : ctx->rows;
+
+    // snprintf dominates the whole run on large dumps, format by hand
+    char *buf = malloc((end - first) * (ctx->column_count * 12 + sizeof(ctx->packs->id)) + 1);
+    char *p = buf;
+
+    for (size_t r = first; r < end; r++) {
+        const char *id = ctx->packs[ctx->cols->pack[r]].id;
+        while (*id) {
+            *p++ = *id++;
+        }
+        // Column 0 is the pack index, printed as its ID above
+        for (size_t c = 1; c < ctx->column_count; c++) {
+            const void *col = ctx->columns[c].data;
+            *p++ = ',';
+            switch (ctx->columns[c].type) {
+            case BATMON_COL_U8:
+                p = fmt_u32(p, ((const uint8_t *)col)[r]);
+                break;
+            case BATMON_COL_U16:
+                p = fmt_u32(p, ((const uint16_t *)col)[r]);
+                break;
+            case BATMON_COL_U32:
+                p = fmt_u32(p, ((const uint32_t *)col)[r]);
+                break;
+            case BATMON_COL_F32:
+                p = fmt_fixed2(p, ((const float *)col)[r]);
+                break;
+            }
+        }
+        *p++ = '\n';
+    }
+
+    ctx->text[chunk] = buf;
+    ctx->text_len[chunk] = p - buf;
+}
+
+static int write_records_csv(const char *path, const pack_t *packs, const columns_t *cols,
+                             size_t rows, int threads) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Chunks are formatted in parallel and written in order
+    size_t chunks = (rows + DECODE_CHUNK - 1) / DECODE_CHUNK;
+    csv_ctx_t ctx = {
+        .packs = packs,
+        .cols = cols,
+        .rows = rows,
+        .text = calloc(chunks ? chunks : 1, sizeof(char *)),
+        .text_len = calloc(chunks ? chunks : 1, sizeof(size_t)),
+    };
+    ctx.column_count = columns_list(cols, ctx.columns);
+
+    for (size_t c = 0; c < ctx.column_count; c++) {
+        fprintf(f, "%s%s", c ? "," : "", ctx.columns[c].name);
+    }
+    fputc('\n', f);
+    parallel_for(threads, chunks, format_csv_chunk, &ctx);
+
+    int ret = 0;
+    for (size_t i = 0; i < chunks; i++) {
+        if (ret == 0 && fwrite(ctx.text[i], 1, ctx.text_len[i], f) != ctx.text_len[i]) {
+            fprintf(stderr, "%s: write failed\n", path);
+            ret = -1;
+        }
+        free(ctx.text[i]);
+    }
+    free(ctx.text);
+    free(ctx.text_len);
+
+    if (fclose(f) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Write one raw little-endian file per column, plus the pack names
+ *
+ * <dir>/<column>.<u8|u16|u32|f32> holds one value per record; the pack
+ * column indexes the lines of <dir>/packs.txt.
+ */
+static int write_columns(const char *dir, const pack_t *packs, size_t pack_count,
+                         const columns_t *cols, size_t rows) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    out_column_t columns[OUT_COLUMNS_MAX];
+    size_t column_count = columns_list(cols, columns);
+
+    char path[512];
+    for (size_t c = 0; c < column_count; c++) {
+        snprintf(path, sizeof(path), "%s/%s.%s", dir, columns[c].name, s_col_suffix[columns[c].type]);
+        FILE *f = fopen(path, "wb");
+        if (f == NULL) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        size_t size = BATMON_colTypeSize(columns[c].type);
+        bool ok = rows == 0 || fwrite(columns[c].data, size, rows, f) == rows;
+        if (fclose(f) != 0 || !ok) {
+            fprintf(stderr, "%s: write failed\n", path);
+            return -1;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/packs.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    for (size_t p = 0; p < pack_count; p++) {
+        fprintf(f, "%s\n", packs[p].id);
+    }
+    fclose(f);
+    return 0;
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: analyzer [-j threads] [-l layout] [-s summary.csv] [-c records.csv]\n"
+            "                [-C columns_dir] [-q] [-v] <dump>\n");
+}
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *layout = NULL, *summary_csv = NULL, *records_csv = NULL, *columns_dir = NULL;
+    bool quiet = false, verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:l:s:c:C:qv")) != -1) {
+        switch (opt) {
+        case 'j': threads = atoi(optarg); break;
+        case 'l': layout = optarg; break;
+        case 's': summary_csv = optarg; break;
+        case 'c': records_csv = optarg; break;
+        case 'C': columns_dir = optarg; break;
+        case 'q': quiet = true; break;
+        case 'v': verbose = true; break;
+        default: usage(); return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return 2;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    const char *path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s: %s\n", path, fd < 0 ? strerror(errno) : "empty or unreadable");
+        return 1;
+    }
+    const uint8_t *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    double t0 = now_s();
+
+    volume_t vol;
+    if (volume_open(&vol, base, st.st_size, layout, threads) != 0) {
+        return 1;
+    }
+    double t_volume = now_s();
+
+    fat_t fat;
+    fat_entry_t *files = NULL;
+    size_t file_count = 0;
+    if (fat_open(&fat, &vol) != 0 || fat_list_root(&fat, &files, &file_count) != 0) {
+        volume_close(&vol);
+        return 1;
+    }
+
+    size_t pack_count;
+    pack_t *packs = collect_packs(files, file_count, &pack_count);
+    load_ctx_t load = { &fat, packs };
+    parallel_for(threads, pack_count, load_pack, &load);
+    double t_load = now_s();
+
+    size_t rows = 0;
+    for (size_t p = 0; p < pack_count; p++) {
+        packs[p].first = rows;
+        rows += packs[p].rec_count;
+    }
+
+    columns_t cols;
+    if (columns_alloc(&cols, rows) != 0) {
+        fprintf(stderr, "out of memory for %zu records\n", rows);
+        return 1;
+    }
+    decode_ctx_t decode = { packs, pack_count, rows, &cols };
+    parallel_for(threads, (rows + DECODE_CHUNK - 1) / DECODE_CHUNK, decode_chunk, &decode);
+    double t_decode = now_s();
+
+    summary_t *summaries = calloc(pack_count ? pack_count : 1, sizeof(summary_t));
+    summary_ctx_t summary = { packs, &cols, summaries };
+    parallel_for(threads, pack_count, summarize_pack, &summary);
+    double t_summary = now_s();
+
+    int ret = 0;
+    if (!quiet) {
+        printf("%s: %s layout, %u/%u sectors mapped, FAT%d, %zu packs, %zu records\n",
+               path, vol.layout, vol.mapped_sectors, vol.sector_count, fat.type, pack_count, rows);
+        print_summaries(stdout, packs, summaries, pack_count);
+    }
+    if (summary_csv && write_summary_csv(summary_csv, packs, summaries, pack_count) != 0) {
+        ret = 1;
+    }
+    if (records_csv && write_records_csv(records_csv, packs, &cols, rows, threads) != 0) {
+        ret = 1;
+    }
+    if (columns_dir && write_columns(columns_dir, packs, pack_count, &cols, rows) != 0) {
+        ret = 1;
+    }
+    double t_output = now_s();
+
+    if (verbose) {
+        double mb = st.st_size / 1048576.0;
+        fprintf(stderr, "threads %d, dump %.1f MB\n", threads, mb);
+        fprintf(stderr, "  volume   %8.3f s\n", t_volume - t0);
+        fprintf(stderr, "  files    %8.3f s\n", t_load - t_volume);
+        fprintf(stderr, "  decode   %8.3f s  (%.1f M records/s)\n", t_decode - t_load,
+                rows / ((t_decode - t_load) * 1e6 + 1e-9));
+        fprintf(stderr, "  summary  %8.3f s\n", t_summary - t_decode);
+        fprintf(stderr, "  output   %8.3f s\n", t_output - t_summary);
+        fprintf(stderr, "  total    %8.3f s  (%.0f MB/s)\n", t_output - t0, mb / (t_output - t0));
+    }
+
+    for (size_t p = 0; p < pack_count; p++) {
+        free(packs[p].bin_data);
+        free(packs[p].recs);
+        free(packs[p].rec_index);
+    }
+    free(packs);
+    free(summaries);
+    free(files);
+    columns_free(&cols);
+    volume_close(&vol);
+    munmap((void *)base, st.st_size);
+    return ret;
+}
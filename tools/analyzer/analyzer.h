@@ -0,0 +1,93 @@
+/**
+ * @file analyzer.h
+ * @brief Offline analyzer for battery_fs flash dumps
+ */
+
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// ============================================================================
+// Volume: a flat array of sectors reconstructed from a dump
+// ============================================================================
+
+typedef struct volume volume_t;
+
+struct volume {
+    const char *layout;         ///< Name of the layout that produced this volume
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t mapped_sectors;    ///< Sectors backed by data (the rest read as erased)
+
+    /** @brief Sector contents, never NULL (unmapped sectors read as erased) */
+    const uint8_t *(*sector)(const volume_t *vol, uint32_t lsn);
+
+    const uint8_t *base;        ///< Mapped dump
+    size_t size;
+    void *priv;                 ///< Layout private state
+};
+
+/**
+ * @brief A dump layout the analyzer knows how to turn into a volume
+ *
+ * New on-flash layouts are supported by adding an entry to the table in
+ * volume.c; probe() must be cheap and side-effect free.
+ */
+typedef struct {
+    const char *name;
+    bool (*probe)(const uint8_t *base, size_t size);
+    int (*open)(volume_t *vol, const uint8_t *base, size_t size, int threads);
+    void (*close)(volume_t *vol);
+} layout_t;
+
+/**
+ * @brief Detect the layout of a dump and reconstruct its volume
+ *
+ * @param force_layout Layout name to use instead of probing, or NULL
+ * @return 0 on success
+ */
+int volume_open(volume_t *vol, const uint8_t *base, size_t size, const char *force_layout, int threads);
+void volume_close(volume_t *vol);
+
+// ============================================================================
+// FAT: read-only access to the battery_fs root directory
+// ============================================================================
+
+typedef struct {
+    char name[13];              ///< 8.3 name, e.g. "BAT_1A2B.BIN"
+    uint32_t first_cluster;
+    uint32_t size;
+} fat_entry_t;
+
+typedef struct {
+    const volume_t *vol;
+    int type;                   ///< 12, 16 or 32
+    uint32_t part_start;        ///< Sector of the boot record (0 for super-floppy)
+    uint32_t sector_size;
+    uint32_t cluster_sectors;
+    uint32_t fat_start;
+    uint32_t root_start;        ///< FAT12/16 fixed root directory
+    uint32_t root_entries;
+    uint32_t root_cluster;      ///< FAT32 root directory
+    uint32_t data_start;
+    uint32_t cluster_count;
+} fat_t;
+
+int fat_open(fat_t *fat, const volume_t *vol);
+
+/**
+ * @brief List regular files in the root directory
+ * @param entries Output: malloc'd array, free() when done
+ */
+int fat_list_root(const fat_t *fat, fat_entry_t **entries, size_t *count);
+
+/**
+ * @brief Read a whole file into a malloc'd buffer
+ * @return Buffer or NULL on a broken cluster chain
+ */
+uint8_t *fat_read_file(const fat_t *fat, const fat_entry_t *entry, size_t *len);
+
+#endif // ANALYZER_H
@@ -0,0 +1,493 @@
+/**
+ * @file volume.c
+ * @brief Dump layouts and a read-only FAT reader for the analyzer
+ *
+ * A dump is first turned into a volume (a flat array of sectors) by one of
+ * the layouts below, then the FAT on it is walked to find the battery files.
+ *
+ * Layouts:
+ *  - nand-ftl: raw SPI NAND image (data + spare per page) written by the
+ *              battery_fs spiflash backend; the sector map is rebuilt from
+ *              the spare area tags, newest sequence number wins
+ *  - sectors:  plain sector image (file backend, or a volume already
+ *              extracted from the chip)
+ */
+
+#include "analyzer.h"
+#include "spiflash_geometry.h"
+#include "battery_fs_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// ============================================================================
+// Layout: raw NAND with battery_fs FTL
+// ============================================================================
+
+/*
+ * The map holds (seq << 17 | page) per logical sector so the scan threads
+ * can resolve duplicates with an atomic max; 0 means unmapped (sequence
+ * numbers start at 1).
+ */
+#define FTL_PAGE_BITS   17
+#define FTL_PAGE_MASK   ((1u << FTL_PAGE_BITS) - 1)
+#define FTL_MAX_SECTORS 0x10000     // The firmware map is 16-bit
+
+typedef struct {
+    uint64_t *map;
+    uint32_t blocks;
+    uint8_t erased[SPIFLASH_PAGE_SIZE];
+} ftl_volume_t;
+
+typedef struct {
+    const uint8_t *base;
+    ftl_volume_t *ftl;
+    uint32_t first_block;
+    uint32_t last_block;
+    uint32_t max_lsn;
+    uint32_t pages;
+    uint32_t bad_blocks;
+} ftl_scan_job_t;
+
+static inline const uint8_t *raw_page(const uint8_t *base, uint32_t page) {
+    return base + (size_t)page * SPIFLASH_RAW_PAGE_SIZE;
+}
+
+static bool ftl_read_tag(const uint8_t *base, uint32_t page, battery_fs_ftl_tag_t *tag) {
+    memcpy(tag, raw_page(base, page) + SPIFLASH_PAGE_SIZE + BATTERY_FS_FTL_TAG_OFFSET, sizeof(*tag));
+    return tag->magic == BATTERY_FS_FTL_TAG_MAGIC && tag->lsn < FTL_MAX_SECTORS && tag->seq != 0;
+}
+
+static bool ftl_probe(const uint8_t *base, size_t size) {
+    if (size == 0 || size % SPIFLASH_RAW_BLOCK_SIZE != 0) {
+        return false;
+    }
+
+    // The first allocated block is not necessarily block 0; look a little further
+    uint32_t blocks = size / SPIFLASH_RAW_BLOCK_SIZE;
+    for (uint32_t b = 0; b < blocks && b < 64; b++) {
+        battery_fs_ftl_tag_t tag;
+        if (ftl_read_tag(base, b * SPIFLASH_PAGES_PER_BLOCK, &tag)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *ftl_scan_worker(void *arg) {
+    ftl_scan_job_t *job = arg;
+
+    for (uint32_t b = job->first_block; b < job->last_block; b++) {
+        uint32_t first = b * SPIFLASH_PAGES_PER_BLOCK;
+        if (raw_page(job->base, first)[SPIFLASH_PAGE_SIZE + SPIFLASH_BAD_BLOCK_MARKER_OFFSET] != 0xFF) {
+            job->bad_blocks++;
+            continue;
+        }
+
+        // Pages are programmed in order, the first untagged page ends the block
+        for (uint32_t pg = 0; pg < SPIFLASH_PAGES_PER_BLOCK; pg++) {
+            battery_fs_ftl_tag_t tag;
+            if (!ftl_read_tag(job->base, first + pg, &tag)) {
+                break;
+            }
+            job->pages++;
+            if (tag.lsn > job->max_lsn) {
+                job->max_lsn = tag.lsn;
+            }
+
+            uint64_t key = ((uint64_t)tag.seq << FTL_PAGE_BITS) | (first + pg);
+            uint64_t cur = __atomic_load_n(&job->ftl->map[tag.lsn], __ATOMIC_RELAXED);
+            while (key > cur &&
+                   !__atomic_compare_exchange_n(&job->ftl->map[tag.lsn], &cur, key, true,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+        }
+    }
+    return NULL;
+}
+
+static const uint8_t *ftl_sector(const volume_t *vol, uint32_t lsn) {
+    const ftl_volume_t *ftl = vol->priv;
+    if (lsn >= FTL_MAX_SECTORS || ftl->map[lsn] == 0) {
+        return ftl->erased;
+    }
+    return raw_page(vol->base, ftl->map[lsn] & FTL_PAGE_MASK);
+}
+
+static int ftl_open(volume_t *vol, const uint8_t *base, size_t size, int threads) {
+    ftl_volume_t *ftl = calloc(1, sizeof(ftl_volume_t));
+    if (ftl == NULL || (ftl->map = calloc(FTL_MAX_SECTORS, sizeof(uint64_t))) == NULL) {
+        free(ftl);
+        return -1;
+    }
+    memset(ftl->erased, 0xFF, sizeof(ftl->erased));
+    ftl->blocks = size / SPIFLASH_RAW_BLOCK_SIZE;
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if ((uint32_t)threads > ftl->blocks) {
+        threads = ftl->blocks;
+    }
+
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    ftl_scan_job_t *jobs = calloc(threads, sizeof(ftl_scan_job_t));
+    if (tids == NULL || jobs == NULL) {
+        free(tids);
+        free(jobs);
+        free(ftl->map);
+        free(ftl);
+        return -1;
+    }
+
+    uint32_t per_thread = (ftl->blocks + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        jobs[t].base = base;
+        jobs[t].ftl = ftl;
+        jobs[t].first_block = t * per_thread;
+        jobs[t].last_block = jobs[t].first_block + per_thread;
+        if (jobs[t].last_block > ftl->blocks) {
+            jobs[t].last_block = ftl->blocks;
+        }
+        pthread_create(&tids[t], NULL, ftl_scan_worker, &jobs[t]);
+    }
+
+    uint32_t max_lsn = 0, pages = 0, bad_blocks = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        if (jobs[t].max_lsn > max_lsn) {
+            max_lsn = jobs[t].max_lsn;
+        }
+        pages += jobs[t].pages;
+        bad_blocks += jobs[t].bad_blocks;
+    }
+    free(tids);
+    free(jobs);
+
+    uint32_t mapped = 0;
+    for (uint32_t lsn = 0; lsn <= max_lsn; lsn++) {
+        mapped += ftl->map[lsn] != 0;
+    }
+
+    vol->sector_size = SPIFLASH_PAGE_SIZE;
+    vol->sector_count = pages ? max_lsn + 1 : 0;
+    vol->mapped_sectors = mapped;
+    vol->sector = ftl_sector;
+    vol->priv = ftl;
+
+    if (bad_blocks) {
+        fprintf(stderr, "nand-ftl: %u bad blocks skipped\n", bad_blocks);
+    }
+    return 0;
+}
+
+static void ftl_close(volume_t *vol) {
+    ftl_volume_t *ftl = vol->priv;
+    free(ftl->map);
+    free(ftl);
+}
+
+// ============================================================================
+// Layout: plain sector image
+// ============================================================================
+
+static uint16_t rd16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool sectors_probe(const uint8_t *base, size_t size) {
+    // Boot record (or MBR) signature at the end of the first 512 bytes
+    return size >= 512 && size % 512 == 0 && base[510] == 0x55 && base[511] == 0xAA;
+}
+
+static const uint8_t *sectors_sector(const volume_t *vol, uint32_t lsn) {
+    return vol->base + (size_t)lsn * vol->sector_size;
+}
+
+static int sectors_open(volume_t *vol, const uint8_t *base, size_t size, int threads) {
+    (void)threads;
+
+    // Take the sector size from the boot record when there is one
+    uint32_t ss = rd16(base + 11);
+    if (ss < 512 || ss > 4096 || (ss & (ss - 1)) || size % ss) {
+        ss = SPIFLASH_PAGE_SIZE;
+    }
+
+    vol->sector_size = ss;
+    vol->sector_count = size / ss;
+    vol->mapped_sectors = vol->sector_count;
+    vol->sector = sectors_sector;
+    return 0;
+}
+
+static void sectors_close(volume_t *vol) {
+    (void)vol;
+}
+
+// ============================================================================
+// Layout registry
+// ============================================================================
+
+static const layout_t s_layouts[] = {
+    { "nand-ftl", ftl_probe,     ftl_open,     ftl_close },
+    { "sectors",  sectors_probe, sectors_open, sectors_close },
+};
+
+#define LAYOUT_COUNT (sizeof(s_layouts) / sizeof(s_layouts[0]))
+
+int volume_open(volume_t *vol, const uint8_t *base, size_t size, const char *force_layout, int threads) {
+    memset(vol, 0, sizeof(*vol));
+    vol->base = base;
+    vol->size = size;
+
+    for (size_t i = 0; i < LAYOUT_COUNT; i++) {
+        const layout_t *l = &s_layouts[i];
+        if (force_layout ? strcmp(force_layout, l->name) != 0 : !l->probe(base, size)) {
+            continue;
+        }
+        vol->layout = l->name;
+        return l->open(vol, base, size, threads);
+    }
+
+    if (force_layout) {
+        fprintf(stderr, "unknown layout '%s'\n", force_layout);
+    } else {
+        fprintf(stderr, "unrecognized dump layout\n");
+    }
+    return -1;
+}
+
+void volume_close(volume_t *vol) {
+    for (size_t i = 0; i < LAYOUT_COUNT; i++) {
+        if (vol->layout && strcmp(vol->layout, s_layouts[i].name) == 0) {
+            s_layouts[i].close(vol);
+        }
+    }
+    vol->layout = NULL;
+}
+
+// ============================================================================
+// FAT
+// ============================================================================
+
+#define DIR_ENTRY_SIZE  32
+#define ATTR_VOLUME_ID  0x08
+#define ATTR_DIRECTORY  0x10
+#define ATTR_LFN        0x0F
+
+/**
+ * @brief Read bytes at a volume offset relative to the FAT boot record
+ *
+ * Sectors of a reconstructed volume are not contiguous, so everything goes
+ * through here rather than pointer arithmetic.
+ */
+static void fat_read(const fat_t *fat, uint64_t offset, void *buf, size_t len) {
+    const volume_t *vol = fat->vol;
+    uint8_t *dst = buf;
+    offset += (uint64_t)fat->part_start * vol->sector_size;
+
+    while (len > 0) {
+        uint32_t lsn = offset / vol->sector_size;
+        uint32_t off = offset % vol->sector_size;
+        size_t n = vol->sector_size - off;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(dst, vol->sector(vol, lsn) + off, n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+static bool fat_parse_bpb(fat_t *fat, const uint8_t *bs) {
+    uint32_t ss = rd16(bs + 11);
+    uint32_t spc = bs[13];
+    uint32_t reserved = rd16(bs + 14);
+    uint32_t nfats = bs[16];
+    uint32_t root_entries = rd16(bs + 17);
+    uint32_t total = rd16(bs + 19) ? rd16(bs + 19) : rd32(bs + 32);
+    uint32_t fat_size = rd16(bs + 22) ? rd16(bs + 22) : rd32(bs + 36);
+
+    if (bs[510] != 0x55 || bs[511] != 0xAA || ss != fat->vol->sector_size ||
+        spc == 0 || (spc & (spc - 1)) || reserved == 0 || nfats == 0 || fat_size == 0) {
+        return false;
+    }
+
+    uint32_t root_sectors = (root_entries * DIR_ENTRY_SIZE + ss - 1) / ss;
+    fat->sector_size = ss;
+    fat->cluster_sectors = spc;
+    fat->fat_start = reserved;
+    fat->root_start = reserved + nfats * fat_size;
+    fat->root_entries = root_entries;
+    fat->data_start = fat->root_start + root_sectors;
+    if (total <= fat->data_start) {
+        return false;
+    }
+    fat->cluster_count = (total - fat->data_start) / spc;
+
+    // Type follows from the cluster count alone, as in the FAT specification
+    if (fat->cluster_count < 4085) {
+        fat->type = 12;
+    } else if (fat->cluster_count < 65525) {
+        fat->type = 16;
+    } else {
+        fat->type = 32;
+        fat->root_cluster = rd32(bs + 44);
+    }
+    return true;
+}
+
+int fat_open(fat_t *fat, const volume_t *vol) {
+    memset(fat, 0, sizeof(*fat));
+    fat->vol = vol;
+    if (vol->sector_count == 0) {
+        return -1;
+    }
+
+    uint8_t bs[512];
+    memcpy(bs, vol->sector(vol, 0), sizeof(bs));
+    if (fat_parse_bpb(fat, bs)) {
+        return 0;
+    }
+
+    // Partitioned volume: follow the first MBR entry
+    uint32_t start = rd32(bs + 446 + 8);
+    if (bs[510] == 0x55 && bs[511] == 0xAA && bs[446 + 4] != 0 && start < vol->sector_count) {
+        memcpy(bs, vol->sector(vol, start), sizeof(bs));
+        fat->part_start = start;
+        if (fat_parse_bpb(fat, bs)) {
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "no FAT file system found\n");
+    return -1;
+}
+
+static uint32_t fat_next(const fat_t *fat, uint32_t cluster) {
+    uint64_t base = (uint64_t)fat->fat_start * fat->sector_size;
+    uint8_t b[4] = {0};
+
+    switch (fat->type) {
+    case 12:
+        fat_read(fat, base + cluster + cluster / 2, b, 2);
+        return (cluster & 1) ? rd16(b) >> 4 : rd16(b) & 0xFFF;
+    case 16:
+        fat_read(fat, base + cluster * 2, b, 2);
+        return rd16(b);
+    default:
+        fat_read(fat, base + cluster * 4, b, 4);
+        return rd32(b) & 0x0FFFFFFF;
+    }
+}
+
+static bool fat_valid_cluster(const fat_t *fat, uint32_t cluster) {
+    return cluster >= 2 && cluster < fat->cluster_count + 2;
+}
+
+static uint64_t fat_cluster_offset(const fat_t *fat, uint32_t cluster) {
+    return ((uint64_t)fat->data_start + (uint64_t)(cluster - 2) * fat->cluster_sectors) * fat->sector_size;
+}
+
+static void fat_format_name(const uint8_t *e, char *out) {
+    int n = 0;
+    for (int i = 0; i < 8 && e[i] != ' '; i++) {
+        out[n++] = e[i];
+    }
+    if (e[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && e[i] != ' '; i++) {
+            out[n++] = e[i];
+        }
+    }
+    out[n] = '\0';
+}
+
+/** @return false at the end-of-directory marker */
+static bool fat_add_entry(const fat_t *fat, const uint8_t *e, fat_entry_t **list, size_t *count, size_t *cap) {
+    if (e[0] == 0x00) {
+        return false;
+    }
+    if (e[0] == 0xE5 || e[11] == ATTR_LFN || (e[11] & (ATTR_VOLUME_ID | ATTR_DIRECTORY))) {
+        return true;
+    }
+
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *list = realloc(*list, *cap * sizeof(fat_entry_t));
+    }
+    fat_entry_t *out = &(*list)[(*count)++];
+    fat_format_name(e, out->name);
+    out->first_cluster = rd16(e + 26) | (fat->type == 32 ? (uint32_t)rd16(e + 20) << 16 : 0);
+    out->size = rd32(e + 28);
+    return true;
+}
+
+int fat_list_root(const fat_t *fat, fat_entry_t **entries, size_t *count) {
+    fat_entry_t *list = NULL;
+    size_t n = 0, cap = 0;
+    uint8_t e[DIR_ENTRY_SIZE];
+
+    if (fat->type != 32) {
+        uint64_t base = (uint64_t)fat->root_start * fat->sector_size;
+        for (uint32_t i = 0; i < fat->root_entries; i++) {
+            fat_read(fat, base + (uint64_t)i * DIR_ENTRY_SIZE, e, sizeof(e));
+            if (!fat_add_entry(fat, e, &list, &n, &cap)) {
+                break;
+            }
+        }
+    } else {
+        uint32_t cluster_bytes = fat->cluster_sectors * fat->sector_size;
+        bool done = false;
+        for (uint32_t c = fat->root_cluster, hops = 0;
+             !done && fat_valid_cluster(fat, c) && hops < fat->cluster_count;
+             c = fat_next(fat, c), hops++) {
+            for (uint32_t off = 0; off < cluster_bytes; off += DIR_ENTRY_SIZE) {
+                fat_read(fat, fat_cluster_offset(fat, c) + off, e, sizeof(e));
+                if (!fat_add_entry(fat, e, &list, &n, &cap)) {
+                    done = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    *entries = list;
+    *count = n;
+    return 0;
+}
+
+uint8_t *fat_read_file(const fat_t *fat, const fat_entry_t *entry, size_t *len) {
+    uint8_t *buf = malloc(entry->size ? entry->size : 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    uint32_t cluster_bytes = fat->cluster_sectors * fat->sector_size;
+    uint32_t c = entry->first_cluster;
+    size_t done = 0;
+    while (done < entry->size) {
+        if (!fat_valid_cluster(fat, c)) {
+            fprintf(stderr, "%s: broken cluster chain at %zu of %u bytes\n",
+                    entry->name, done, entry->size);
+            free(buf);
+            return NULL;
+        }
+        size_t n = entry->size - done;
+        if (n > cluster_bytes) {
+            n = cluster_bytes;
+        }
+        fat_read(fat, fat_cluster_offset(fat, c), buf + done, n);
+        done += n;
+        c = fat_next(fat, c);
+    }
+
+    *len = done;
+    return buf;
+}
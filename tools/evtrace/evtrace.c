@@ -0,0 +1,307 @@
+/**
+ * @file evtrace.c
+ * @brief Convert event tracer dumps from a serial log to Chrome trace JSON
+ *
+ * Reads logs containing `trace dump` console output (see evtrace_format.h),
+ * ignores everything else, and writes a trace for chrome://tracing or
+ * https://ui.perfetto.dev. Each task is a thread, events keep their core
+ * and payload as args. When a log holds several dumps the last one wins.
+ *
+ *   evtrace [-o out.json] [log ...]   Read the logs (stdin if none)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include "evtrace_format.h"
+
+#define MAX_CORES   8
+
+typedef struct {
+    evtrace_event_t ev;
+    uint64_t ts_us;             // Unwrapped, relative to the first event
+    size_t order;               // Position in the dump, breaks timestamp ties
+} event_t;
+
+typedef struct {
+    uint32_t id;
+    char name[EVTRACE_NAME_LEN + 1];
+} task_name_t;
+
+static event_t *s_events;
+static size_t s_event_count, s_event_cap;
+static task_name_t *s_names;
+static size_t s_name_count, s_name_cap;
+static uint32_t s_dropped;
+static bool s_have_dump;
+
+static void *grow(void *array, size_t *cap, size_t elem) {
+    *cap = *cap ? *cap * 2 : 256;
+    void *p = realloc(array, *cap * elem);
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool parse_event(const char *hex, evtrace_event_t *ev) {
+    uint8_t raw[sizeof(evtrace_event_t)];
+    for (size_t b = 0; b < sizeof(raw); b++) {
+        int hi = hex_digit(hex[2 * b]);
+        int lo = hi < 0 ? -1 : hex_digit(hex[2 * b + 1]);
+        if (lo < 0) {
+            return false;
+        }
+        raw[b] = (uint8_t)(hi << 4 | lo);
+    }
+
+    // Little endian on the wire, decode field by field for any host
+    ev->timestamp_us = raw[0] | raw[1] << 8 | raw[2] << 16 | (uint32_t)raw[3] << 24;
+    ev->id = (uint16_t)(raw[4] | raw[5] << 8);
+    ev->type = raw[6];
+    ev->core = raw[7];
+    ev->task = raw[8] | raw[9] << 8 | raw[10] << 16 | (uint32_t)raw[11] << 24;
+    ev->arg = raw[12] | raw[13] << 8 | raw[14] << 16 | (uint32_t)raw[15] << 24;
+    return true;
+}
+
+// ============================================================================
+// Parsing
+// ============================================================================
+
+static void parse_stream(FILE *f) {
+    char line[512];
+
+    while (fgets(line, sizeof(line), f)) {
+        char *p = strstr(line, EVTRACE_LINE_PREFIX " ");
+        if (p == NULL) {
+            continue;
+        }
+        p += strlen(EVTRACE_LINE_PREFIX) + 1;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (p[0] == 'H') {
+            unsigned version, count, dropped;
+            if (sscanf(p, "H %u %u %u", &version, &count, &dropped) != 3) {
+                continue;
+            }
+            if (version != EVTRACE_FORMAT_VERSION) {
+                fprintf(stderr, "skipping dump of format version %u\n", version);
+                s_have_dump = false;
+                continue;
+            }
+            // A new dump replaces the previous one
+            s_event_count = 0;
+            s_name_count = 0;
+            s_dropped = dropped;
+            s_have_dump = true;
+        } else if (p[0] == 'E' && s_have_dump) {
+            evtrace_event_t ev;
+            if (strlen(p) < 2 + 2 * sizeof(ev) || !parse_event(p + 2, &ev) || ev.core >= MAX_CORES) {
+                continue;
+            }
+            if (s_event_count == s_event_cap) {
+                s_events = grow(s_events, &s_event_cap, sizeof(*s_events));
+            }
+            s_events[s_event_count] = (event_t){ .ev = ev, .order = s_event_count };
+            s_event_count++;
+        } else if (p[0] == 'T' && s_have_dump) {
+            unsigned id;
+            int name_at = 0;
+            if (sscanf(p, "T %x %n", &id, &name_at) != 1 || name_at == 0) {
+                continue;
+            }
+            if (s_name_count == s_name_cap) {
+                s_names = grow(s_names, &s_name_cap, sizeof(*s_names));
+            }
+            task_name_t *t = &s_names[s_name_count++];
+            t->id = id;
+            snprintf(t->name, sizeof(t->name), "%s", p + name_at);
+        }
+    }
+}
+
+/**
+ * @brief Extend the 32-bit timestamps, per core in recording order
+ *
+ * Events of a core are dumped in the order they claimed their slot, which
+ * is time order up to preemption between the claim and the timestamp, so
+ * each event is taken as the nearest time to the one before it. The first
+ * event of a core is placed near the last event of the previous core.
+ */
+static void unwrap_timestamps(void) {
+    uint64_t last[MAX_CORES];
+    bool seen[MAX_CORES] = {false};
+    uint64_t prev = (uint64_t)1 << 32;  // Headroom for steps back
+    uint64_t first = UINT64_MAX;
+
+    for (size_t i = 0; i < s_event_count; i++) {
+        event_t *e = &s_events[i];
+        unsigned c = e->ev.core;
+        uint64_t ref = seen[c] ? last[c] : prev;
+        int32_t delta = (int32_t)(e->ev.timestamp_us - (uint32_t)ref);
+
+        e->ts_us = ref + delta;
+        last[c] = prev = e->ts_us;
+        seen[c] = true;
+        if (e->ts_us < first) {
+            first = e->ts_us;
+        }
+    }
+
+    for (size_t i = 0; i < s_event_count; i++) {
+        s_events[i].ts_us -= first;
+    }
+}
+
+static int cmp_time(const void *a, const void *b) {
+    const event_t *x = a, *y = b;
+    if (x->ts_us != y->ts_us) {
+        return (x->ts_us > y->ts_us) - (x->ts_us < y->ts_us);
+    }
+    // A begin and end in the same microsecond must stay in order
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// ============================================================================
+// Output
+// ============================================================================
+
+static const char *task_name(uint32_t id) {
+    if (id == 0) {
+        return "ISR";
+    }
+    for (size_t i = 0; i < s_name_count; i++) {
+        if (s_names[i].id == id) {
+            return s_names[i].name;
+        }
+    }
+    return NULL;
+}
+
+static void write_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+        }
+        if ((unsigned char)*s >= 0x20) {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void write_trace(FILE *out) {
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%" PRIu32 "},\"traceEvents\":[\n", s_dropped);
+
+    uint32_t *named = NULL;
+    size_t named_count = 0, named_cap = 0;
+    bool comma = false;
+    for (size_t i = 0; i < s_event_count; i++) {
+        const evtrace_event_t *ev = &s_events[i].ev;
+
+        // One thread name per task, at its first event
+        bool first_of_task = true;
+        for (size_t j = 0; j < named_count && first_of_task; j++) {
+            first_of_task = named[j] != ev->task;
+        }
+        if (first_of_task) {
+            if (named_count == named_cap) {
+                named = grow(named, &named_cap, sizeof(*named));
+            }
+            named[named_count++] = ev->task;
+            const char *name = task_name(ev->task);
+            fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%" PRIu32 ",\"args\":{\"name\":",
+                    comma ? ",\n" : "", ev->task);
+            if (name) {
+                write_string(out, name);
+            } else {
+                fprintf(out, "\"task %08" PRIx32 "\"", ev->task);
+            }
+            fprintf(out, "}}");
+            comma = true;
+        }
+
+        const char *name = evtrace_id_name(ev->id);
+        fprintf(out, ",\n{\"ph\":\"%c\",\"cat\":\"evtrace\",\"name\":", ev->type);
+        if (name) {
+            write_string(out, name);
+        } else {
+            fprintf(out, "\"id %u\"", ev->id);
+        }
+        fprintf(out, ",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":%" PRIu32 "%s,\"args\":{\"arg\":%" PRIu32 ",\"core\":%u}}",
+                s_events[i].ts_us, ev->task, ev->type == EVTRACE_TYPE_INSTANT ? ",\"s\":\"t\"" : "",
+                ev->arg, ev->core);
+    }
+    fprintf(out, "\n]}\n");
+    free(named);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: evtrace [-o out.json] [log ...]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (i == argc) {
+        parse_stream(stdin);
+    }
+    for (; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        parse_stream(f);
+        fclose(f);
+    }
+
+    if (s_event_count == 0) {
+        fprintf(stderr, "no " EVTRACE_LINE_PREFIX " events found\n");
+        return 1;
+    }
+
+    unwrap_timestamps();
+    // chrome://tracing sorts too, this just keeps the file readable
+    qsort(s_events, s_event_count, sizeof(*s_events), cmp_time);
+
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (out == NULL) {
+            perror(out_path);
+            return 1;
+        }
+    }
+    write_trace(out);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%zu events, %zu task names, %" PRIu32 " overwritten\n",
+            s_event_count, s_name_count, s_dropped);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file flashimg.c
+ * @brief Create, inspect and diff raw SPI NAND images
+ *
+ * Works on the image layout of spiflash_geometry.h: the files used by the
+ * linux spiflash backend and raw dumps pulled from field units.
+ *
+ *   flashimg create <image> [blocks]     Create an erased image
+ *   flashimg info <image> [-v]           Summarize block usage (-v: block map)
+ *   flashimg page <image> <page>         Hex dump one page with its spare area
+ *   flashimg diff <a> <b> [-v]           Compare two images page by page
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "spiflash_geometry.h"
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    uint32_t blocks;
+} image_t;
+
+static int image_open(const char *path, image_t *img) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % SPIFLASH_RAW_BLOCK_SIZE != 0) {
+        fprintf(stderr, "%s: not a whole number of %d byte blocks\n", path, SPIFLASH_RAW_BLOCK_SIZE);
+        close(fd);
+        return -1;
+    }
+
+    img->size = st.st_size;
+    img->blocks = img->size / SPIFLASH_RAW_BLOCK_SIZE;
+    img->data = mmap(NULL, img->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img->data == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    madvise((void *)img->data, img->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+static void image_close(image_t *img) {
+    munmap((void *)img->data, img->size);
+}
+
+static inline const uint8_t *raw_page(const image_t *img, uint32_t page) {
+    return img->data + (size_t)page * SPIFLASH_RAW_PAGE_SIZE;
+}
+
+static bool is_erased(const uint8_t *p, size_t len) {
+    // Word-wise check, raw pages are 8-byte aligned in the mapping
+    const uint64_t *w = (const uint64_t *)p;
+    for (size_t i = 0; i < len / 8; i++) {
+        if (w[i] != UINT64_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// Commands
+// ============================================================================
+
+static int cmd_create(int argc, char **argv) {
+    if (argc < 1) {
+        fprintf(stderr, "usage: flashimg create <image> [blocks]\n");
+        return 2;
+    }
+
+    uint32_t blocks = argc > 1 ? strtoul(argv[1], NULL, 0) : SPIFLASH_TOTAL_BLOCKS;
+    if (blocks == 0 || blocks > SPIFLASH_TOTAL_BLOCKS) {
+        fprintf(stderr, "blocks must be 1..%d\n", SPIFLASH_TOTAL_BLOCKS);
+        return 2;
+    }
+
+    FILE *f = fopen(argv[0], "wb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
+    static uint8_t erased[SPIFLASH_RAW_BLOCK_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (uint32_t b = 0; b < blocks; b++) {
+        if (fwrite(erased, sizeof(erased), 1, f) != 1) {
+            fprintf(stderr, "%s: write failed\n", argv[0]);
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+
+    printf("Created %s: %u blocks, %zu bytes\n", argv[0], blocks,
+           (size_t)blocks * SPIFLASH_RAW_BLOCK_SIZE);
+    return 0;
+}
+
+static int cmd_info(int argc, char **argv) {
+    if (argc < 1) {
+        fprintf(stderr, "usage: flashimg info <image> [-v]\n");
+        return 2;
+    }
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    image_t img;
+    if (image_open(argv[0], &img) != 0) {
+        return 1;
+    }
+
+    uint32_t erased_blocks = 0, bad_blocks = 0, full_blocks = 0, partial_blocks = 0;
+    uint64_t programmed_pages = 0;
+
+    if (verbose) {
+        printf("Block map ('.' erased, '+' partial, '#' full, 'B' bad), 64 blocks per line:\n");
+    }
+
+    for (uint32_t b = 0; b < img.blocks; b++) {
+        uint32_t first = b * SPIFLASH_PAGES_PER_BLOCK;
+        char c;
+
+        if (raw_page(&img, first)[SPIFLASH_PAGE_SIZE + SPIFLASH_BAD_BLOCK_MARKER_OFFSET] != 0xFF) {
+            bad_blocks++;
+            c = 'B';
+        } else {
+            uint32_t used = 0;
+            for (uint32_t p = 0; p < SPIFLASH_PAGES_PER_BLOCK; p++) {
+                if (!is_erased(raw_page(&img, first + p), SPIFLASH_RAW_PAGE_SIZE)) {
+                    used++;
+                }
+            }
+            programmed_pages += used;
+            if (used == 0) {
+                erased_blocks++;
+                c = '.';
+            } else if (used == SPIFLASH_PAGES_PER_BLOCK) {
+                full_blocks++;
+                c = '#';
+            } else {
+                partial_blocks++;
+                c = '+';
+            }
+        }
+
+        if (verbose) {
+            if (b % 64 == 0) {
+                printf("%5u ", b);
+            }
+            putchar(c);
+            if (b % 64 == 63 || b == img.blocks - 1) {
+                putchar('\n');
+            }
+        }
+    }
+
+    printf("Image:            %s\n", argv[0]);
+    printf("Blocks:           %u (%u pages, %zu bytes)\n", img.blocks,
+           img.blocks * SPIFLASH_PAGES_PER_BLOCK, img.size);
+    printf("Erased blocks:    %u\n", erased_blocks);
+    printf("Partial blocks:   %u\n", partial_blocks);
+    printf("Full blocks:      %u\n", full_blocks);
+    printf("Bad blocks:       %u\n", bad_blocks);
+    printf("Programmed pages: %llu\n", (unsigned long long)programmed_pages);
+
+    image_close(&img);
+    return 0;
+}
+
+static void hexdump(const uint8_t *p, size_t len, size_t base) {
+    for (size_t i = 0; i < len; i += 16) {
+        printf("%04zX: ", base + i);
+        for (size_t j = 0; j < 16 && i + j < len; j++) {
+            printf("%02X ", p[i + j]);
+        }
+        printf(" ");
+        for (size_t j = 0; j < 16 && i + j < len; j++) {
+            putchar(p[i + j] >= 32 && p[i + j] <= 126 ? p[i + j] : '.');
+        }
+        putchar('\n');
+    }
+}
+
+static int cmd_page(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: flashimg page <image> <page>\n");
+        return 2;
+    }
+
+    image_t img;
+    if (image_open(argv[0], &img) != 0) {
+        return 1;
+    }
+
+    uint32_t page = strtoul(argv[1], NULL, 0);
+    if (page >= img.blocks * SPIFLASH_PAGES_PER_BLOCK) {
+        fprintf(stderr, "page %u out of range\n", page);
+        image_close(&img);
+        return 2;
+    }
+
+    const uint8_t *raw = raw_page(&img, page);
+    printf("Page %u (block %u, page %u in block)\n", page,
+           page / SPIFLASH_PAGES_PER_BLOCK, page % SPIFLASH_PAGES_PER_BLOCK);
+    if (is_erased(raw, SPIFLASH_RAW_PAGE_SIZE)) {
+        printf("(erased)\n");
+    } else {
+        printf("Data:\n");
+        hexdump(raw, SPIFLASH_PAGE_SIZE, 0);
+        printf("Spare:\n");
+        hexdump(raw + SPIFLASH_PAGE_SIZE, SPIFLASH_OOB_SIZE, SPIFLASH_PAGE_SIZE);
+    }
+
+    image_close(&img);
+    return 0;
+}
+
+static int cmd_diff(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: flashimg diff <a> <b> [-v]\n");
+        return 2;
+    }
+    bool verbose = argc > 2 && strcmp(argv[2], "-v") == 0;
+
+    image_t a, b;
+    if (image_open(argv[0], &a) != 0) {
+        return 1;
+    }
+    if (image_open(argv[1], &b) != 0) {
+        image_close(&a);
+        return 1;
+    }
+
+    if (a.blocks != b.blocks) {
+        printf("Block count differs: %u vs %u, comparing common range\n", a.blocks, b.blocks);
+    }
+    uint32_t pages = (a.blocks < b.blocks ? a.blocks : b.blocks) * SPIFLASH_PAGES_PER_BLOCK;
+
+    uint64_t data_diffs = 0, oob_diffs = 0;
+    uint32_t blocks_touched = 0, last_block = UINT32_MAX;
+
+    for (uint32_t p = 0; p < pages; p++) {
+        const uint8_t *pa = raw_page(&a, p);
+        const uint8_t *pb = raw_page(&b, p);
+        if (memcmp(pa, pb, SPIFLASH_RAW_PAGE_SIZE) == 0) {
+            continue;
+        }
+
+        bool data = memcmp(pa, pb, SPIFLASH_PAGE_SIZE) != 0;
+        bool oob = memcmp(pa + SPIFLASH_PAGE_SIZE, pb + SPIFLASH_PAGE_SIZE, SPIFLASH_OOB_SIZE) != 0;
+        data_diffs += data;
+        oob_diffs += oob;
+
+        if (p / SPIFLASH_PAGES_PER_BLOCK != last_block) {
+            last_block = p / SPIFLASH_PAGES_PER_BLOCK;
+            blocks_touched++;
+        }
+
+        if (verbose) {
+            size_t first = 0;
+            while (pa[first] == pb[first]) {
+                first++;
+            }
+            printf("page %6u (block %4u): %s%s first difference at byte %zu\n", p,
+                   p / SPIFLASH_PAGES_PER_BLOCK, data ? "data " : "", oob ? "spare " : "", first);
+        }
+    }
+
+    printf("Pages compared:       %u\n", pages);
+    printf("Pages differing data: %llu\n", (unsigned long long)data_diffs);
+    printf("Pages differing spare: %llu\n", (unsigned long long)oob_diffs);
+    printf("Blocks touched:       %u\n", blocks_touched);
+
+    image_close(&a);
+    image_close(&b);
+    return (data_diffs || oob_diffs || a.blocks != b.blocks) ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: flashimg <create|info|page|diff> ...\n");
+        return 2;
+    }
+
+    if (strcmp(argv[1], "create") == 0) {
+        return cmd_create(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "info") == 0) {
+        return cmd_info(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "page") == 0) {
+        return cmd_page(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "diff") == 0) {
+        return cmd_diff(argc - 2, argv + 2);
+    }
+
+    fprintf(stderr, "unknown command: %s\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file taskprof.c
+ * @brief Summarize task profiler dumps from a serial log
+ *
+ * Reads logs containing `taskprof` console dumps (see taskprof_format.h),
+ * ignores everything else, and prints per-task CPU use and stack headroom.
+ * Samples dumped more than once are counted once.
+ *
+ *   taskprof [-t] [-m margin] [log ...]   Read the logs (stdin if none)
+ *
+ *   -t         Also print a CPU timeline, one row per sample
+ *   -m margin  Stack bytes to keep free when suggesting a size (default 512)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "taskprof_format.h"
+
+#define DEFAULT_MARGIN  512
+#define TIMELINE_TASKS  8       // Busiest tasks shown in the timeline
+
+typedef struct {
+    char name[TASKPROF_NAME_LEN + 1];
+    int core;
+    unsigned priority;
+    uint32_t samples;
+    uint64_t cpu_sum;           // permille
+    unsigned cpu_max;
+    uint32_t stack_min;
+} task_stat_t;
+
+typedef struct {
+    uint32_t seq;
+    int64_t timestamp_us;
+    uint32_t interval_us;
+    unsigned untracked;
+} sample_t;
+
+typedef struct {
+    uint32_t seq;
+    size_t task;                // Index into tasks
+    unsigned cpu;
+} entry_t;
+
+static task_stat_t *s_tasks;
+static size_t s_task_count, s_task_cap;
+static sample_t *s_samples;
+static size_t s_sample_count, s_sample_cap;
+static entry_t *s_entries;
+static size_t s_entry_count, s_entry_cap;
+
+static void *grow(void *array, size_t *cap, size_t elem) {
+    *cap = *cap ? *cap * 2 : 64;
+    void *p = realloc(array, *cap * elem);
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static bool sample_seen(uint32_t seq) {
+    for (size_t i = 0; i < s_sample_count; i++) {
+        if (s_samples[i].seq == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t task_index(const char *name) {
+    for (size_t i = 0; i < s_task_count; i++) {
+        if (strcmp(s_tasks[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (s_task_count == s_task_cap) {
+        s_tasks = grow(s_tasks, &s_task_cap, sizeof(*s_tasks));
+    }
+    task_stat_t *t = &s_tasks[s_task_count];
+    memset(t, 0, sizeof(*t));
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->stack_min = UINT32_MAX;
+    return s_task_count++;
+}
+
+// ============================================================================
+// Parsing
+// ============================================================================
+
+static void parse_stream(FILE *f) {
+    char line[512];
+    bool skipping = true;       // Inside a sample that was already read
+
+    while (fgets(line, sizeof(line), f)) {
+        char *p = strstr(line, TASKPROF_LINE_PREFIX " ");
+        if (p == NULL) {
+            continue;
+        }
+        p += strlen(TASKPROF_LINE_PREFIX) + 1;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        unsigned seq;
+        if (p[0] == 'S') {
+            sample_t s;
+            long long ts;
+            unsigned count;
+            if (sscanf(p, "S %u %lld %u %u %u", &seq, &ts, &s.interval_us, &count, &s.untracked) != 5) {
+                skipping = true;
+                continue;
+            }
+            skipping = sample_seen(seq);
+            if (skipping) {
+                continue;
+            }
+            s.seq = seq;
+            s.timestamp_us = ts;
+            if (s_sample_count == s_sample_cap) {
+                s_samples = grow(s_samples, &s_sample_cap, sizeof(*s_samples));
+            }
+            s_samples[s_sample_count++] = s;
+        } else if (p[0] == 'T' && !skipping) {
+            int core, name_at = 0;
+            unsigned priority, cpu, stack_free;
+            if (sscanf(p, "T %u %d %u %u %u %n", &seq, &core, &priority, &cpu, &stack_free, &name_at) != 5 ||
+                name_at == 0 || seq != s_samples[s_sample_count - 1].seq) {
+                continue;
+            }
+
+            size_t idx = task_index(p + name_at);
+            task_stat_t *t = &s_tasks[idx];
+            t->core = core;
+            t->priority = priority;
+            t->samples++;
+            if (s_samples[s_sample_count - 1].interval_us) {
+                t->cpu_sum += cpu;
+                if (cpu > t->cpu_max) {
+                    t->cpu_max = cpu;
+                }
+            }
+            if (stack_free < t->stack_min) {
+                t->stack_min = stack_free;
+            }
+
+            if (s_entry_count == s_entry_cap) {
+                s_entries = grow(s_entries, &s_entry_cap, sizeof(*s_entries));
+            }
+            s_entries[s_entry_count++] = (entry_t){ .seq = seq, .task = idx, .cpu = cpu };
+        }
+    }
+}
+
+// ============================================================================
+// Report
+// ============================================================================
+
+static uint32_t s_timed_samples;    // Samples with a CPU interval
+
+static double cpu_avg(const task_stat_t *t) {
+    return s_timed_samples ? t->cpu_sum / 10.0 / s_timed_samples : 0;
+}
+
+static int cmp_cpu_desc(const void *a, const void *b) {
+    double x = cpu_avg(&s_tasks[*(const size_t *)a]);
+    double y = cpu_avg(&s_tasks[*(const size_t *)b]);
+    return (x < y) - (x > y);
+}
+
+static int cmp_sample_seq(const void *a, const void *b) {
+    uint32_t x = ((const sample_t *)a)->seq, y = ((const sample_t *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+static void print_timeline(const size_t *order) {
+    size_t shown = s_task_count < TIMELINE_TASKS ? s_task_count : TIMELINE_TASKS;
+
+    printf("\n%8s %9s", "seq", "time_s");
+    for (size_t k = 0; k < shown; k++) {
+        printf(" %12.12s", s_tasks[order[k]].name);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < s_sample_count; i++) {
+        const sample_t *s = &s_samples[i];
+        if (s->interval_us == 0) {
+            continue;
+        }
+        printf("%8u %9.1f", s->seq, s->timestamp_us / 1e6);
+        for (size_t k = 0; k < shown; k++) {
+            const entry_t *hit = NULL;
+            for (size_t e = 0; e < s_entry_count && hit == NULL; e++) {
+                if (s_entries[e].seq == s->seq && s_entries[e].task == order[k]) {
+                    hit = &s_entries[e];
+                }
+            }
+            if (hit) {
+                printf(" %11.1f%%", hit->cpu / 10.0);
+            } else {
+                printf(" %12s", "-");
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void report(uint32_t margin, bool timeline) {
+    if (s_sample_count == 0) {
+        fprintf(stderr, "no " TASKPROF_LINE_PREFIX " samples found\n");
+        return;
+    }
+
+    qsort(s_samples, s_sample_count, sizeof(*s_samples), cmp_sample_seq);
+    unsigned untracked = 0;
+    for (size_t i = 0; i < s_sample_count; i++) {
+        if (s_samples[i].interval_us) {
+            s_timed_samples++;
+        }
+        if (s_samples[i].untracked > untracked) {
+            untracked = s_samples[i].untracked;
+        }
+    }
+
+    const sample_t *first = &s_samples[0], *last = &s_samples[s_sample_count - 1];
+    printf("%zu samples (seq %u..%u), %.1f s\n", s_sample_count, first->seq, last->seq,
+           (last->timestamp_us - first->timestamp_us) / 1e6);
+    if (untracked) {
+        printf("up to %u tasks per sample not recorded (raise CONFIG_TASKPROF_MAX_TASKS)\n", untracked);
+    }
+
+    size_t *order = malloc(s_task_count * sizeof(size_t));
+    if (order == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < s_task_count; i++) {
+        order[i] = i;
+    }
+    qsort(order, s_task_count, sizeof(size_t), cmp_cpu_desc);
+
+    // CPU is per core, so the column adds up to 100% per core
+    printf("\n%-16s %4s %4s %8s %8s %10s %12s\n",
+           "task", "core", "prio", "cpu_avg", "cpu_max", "stack_min", "can_shrink");
+    for (size_t k = 0; k < s_task_count; k++) {
+        const task_stat_t *t = &s_tasks[order[k]];
+        printf("%-16s %4d %4u %7.1f%% %7.1f%% %10u ",
+               t->name, t->core, t->priority, cpu_avg(t), t->cpu_max / 10.0, t->stack_min);
+        if (t->stack_min > margin) {
+            printf("%12u\n", t->stack_min - margin);
+        } else {
+            printf("%12s\n", t->stack_min < margin / 2 ? "GROW" : "-");
+        }
+    }
+
+    if (timeline) {
+        print_timeline(order);
+    }
+    free(order);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: taskprof [-t] [-m margin] [log ...]\n");
+}
+
+int main(int argc, char **argv) {
+    bool timeline = false;
+    uint32_t margin = DEFAULT_MARGIN;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            timeline = true;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            margin = strtoul(argv[++i], NULL, 0);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (i == argc) {
+        parse_stream(stdin);
+    }
+    for (; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        parse_stream(f);
+        fclose(f);
+    }
+
+    report(margin, timeline);
+    return s_sample_count ? 0 : 1;
+}